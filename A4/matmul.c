@@ -0,0 +1,1004 @@
+/**
+ * Description: libmatmul, the multiply kernels and the plans that run them (see matmul.h).
+ * The kernels are picked at run time from the CPU features (AVX-512, AVX2, SSE4.1, or the scalar reference), the
+ * vectorized ones are compiled for their instruction set with the target attribute.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <float.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define x86Kernels 1
+#endif
+
+#include "matmul.h"
+#include "task_pool.h"
+
+#define arenaAlign 64   //every buffer of the arena starts on a cache line
+#define realElements (elementType == typeFloat || elementType == typeDouble)
+
+/**
+ * This function returns how many panels of width columns are needed to cover size columns.
+ * Input parameters: size, width
+ * Returns: the number of panels
+**/
+static int panelCount(int size, int width){
+    return (size + width - 1) / width;
+}
+
+/**
+ * This function packs W into panels of width consecutive columns, so that the kernels read W contiguously.
+ * Panel p holds columns p*width..p*width+width-1 of every row k, row after row; the last panel is padded with 0s.
+ * With width 1 the packed matrix is the transpose of W.
+ * Input parameters: size, width, matrixW, packed (to store in, panelCount(size, width) * width * size elements)
+ * Returns: nothing, packed holds the panels of W
+**/
+static void packMatrix(int size, int width, const wElement *matrixW, wElement *packed){
+    for(int p = 0; p < panelCount(size, width); p++){
+        wElement *panel = packed + (size_t)p * size * width;
+        for(int k = 0; k < size; k++){
+            for(int c = 0; c < width; c++){
+                int j = p * width + c;
+                panel[k * width + c] = j < size ? matrixW[(size_t)k * size + j] : 0;
+            }
+        }
+    }
+}
+
+/**
+ * This function multiplies a band of rows of A by W using a cache-blocked scalar kernel. It is the reference the
+ * vectorized kernels are checked against.
+ * The rows, columns and dot products are split into tiles that fit in the L1/L2 caches, and W is read through its
+ * packed transpose (panels of width 1) so the innermost loop walks both operands contiguously. The sums are
+ * wrapElement, so an integer result that overflows wraps around (as in the vector kernels and the Strassen recursion)
+ * instead of being undefined.
+ * Assumption: matrices are size x size, are not empty, and packedW was built by packMatrix with width 1.
+ * Input parameters: size, rowStart, rowEnd (exclusive), matrixA, packedW, result matrix, tiles
+ * Returns: rows rowStart..rowEnd-1 of result hold A*W
+**/
+static void scalarCalculation(int size, int rowStart, int rowEnd, element matrixA[size][size], const wElement *packedW,
+                              element result[size][size], const struct matmulTiles *tiles){
+    int tileRows = tiles->rows, tileCols = tiles->cols, tileDepth = tiles->depth;
+
+    for (int i = rowStart; i < rowEnd; i++) {
+        memset(result[i], 0, size * sizeof(element));
+    }
+
+    // Multiplying matrixA and matrixW one tile at a time and storing in array result.
+    for (int ii = rowStart; ii < rowEnd; ii += tileRows) {
+        int iEnd = ii + tileRows < rowEnd ? ii + tileRows : rowEnd;
+        for (int kk = 0; kk < size; kk += tileDepth) {
+            int kEnd = kk + tileDepth < size ? kk + tileDepth : size;
+            for (int jj = 0; jj < size; jj += tileCols) {
+                int jEnd = jj + tileCols < size ? jj + tileCols : size;
+                for (int i = ii; i < iEnd; i++) {
+                    for (int j = jj; j < jEnd; j++) {
+                        const wElement *column = packedW + (size_t)j * size;
+                        wrapElement sum = 0;
+                        for (int k = kk; k < kEnd; k++) {
+                            sum += (wrapElement)matrixA[i][k] * (wrapElement)column[k];
+                        }
+                        result[i][j] = (element)((wrapElement)result[i][j] + sum);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * This function is the row function of the scalar kernel for the sparse kernels (see rowFunction in matrix_sparse.h):
+ * it adds value * (a row of W) to a row of the result.
+ * Input parameters: sum (row of the result), value, wRow, columns (of a sparse row, or NULL for a dense row), count
+ * Returns: nothing, sum holds the new row
+**/
+static void scalarAddRow(element *restrict sum, element value, const wElement *restrict wRow, const int *columns,
+                         int count){
+    if (columns != NULL) {
+        for (int q = 0; q < count; q++) {
+            sum[columns[q]] = (element)((wrapElement)sum[columns[q]] + (wrapElement)value * (wrapElement)wRow[q]);
+        }
+        return;
+    }
+    for (int j = 0; j < count; j++) {
+        sum[j] = (element)((wrapElement)sum[j] + (wrapElement)value * (wrapElement)wRow[j]);
+    }
+}
+
+#ifdef x86Kernels
+/**
+ * This macro defines a vectorized kernel for one instruction set. It uses the same tiles as scalarCalculation, but
+ * W is packed into panels as wide as a vector register: A[i][k] is broadcast and multiplied with row k of the
+ * panel, and four rows of A share every load of W.
+ * Input parameters: name, isa (compiler target), vector type, width, and the intrinsics of that instruction set to
+ * load a row of a panel (widening narrow Ws), store, broadcast, zero, multiply and add elements
+ * Returns: defines void name(size, rowStart, rowEnd, matrixA, packedW, result, tiles)
+**/
+#define defineVectorKernel(name, isa, vec, width, loadW, store, set1, zero, mul, add)                          \
+__attribute__((target(isa)))                                                                                   \
+static void name(int size, int rowStart, int rowEnd, element matrixA[size][size], const wElement *packedW,     \
+                 element result[size][size], const struct matmulTiles *tiles){                                 \
+    int tileRows = tiles->rows, tileDepth = tiles->depth;                                                      \
+    for (int i = rowStart; i < rowEnd; i++) {                                                                  \
+        memset(result[i], 0, size * sizeof(element));                                                          \
+    }                                                                                                          \
+    int panels = panelCount(size, width);                                                                      \
+    for (int ii = rowStart; ii < rowEnd; ii += tileRows) {                                                     \
+        int iEnd = ii + tileRows < rowEnd ? ii + tileRows : rowEnd;                                            \
+        for (int kk = 0; kk < size; kk += tileDepth) {                                                         \
+            int kEnd = kk + tileDepth < size ? kk + tileDepth : size;                                          \
+            for (int p = 0; p < panels; p++) {                                                                 \
+                const wElement *panel = packedW + (size_t)p * size * width;                                    \
+                int j = p * width;                                                                             \
+                int valid = size - j < width ? size - j : width;                                               \
+                int i = ii;                                                                                    \
+                /* four rows at a time share each row of the panel */                                          \
+                for (; i + 4 <= iEnd; i += 4) {                                                                \
+                    vec acc0 = zero(), acc1 = zero(), acc2 = zero(), acc3 = zero();                            \
+                    for (int k = kk; k < kEnd; k++) {                                                          \
+                        vec w = loadW((const void *)(panel + k * width));                                      \
+                        acc0 = add(acc0, mul(set1(matrixA[i][k]), w));                                         \
+                        acc1 = add(acc1, mul(set1(matrixA[i + 1][k]), w));                                     \
+                        acc2 = add(acc2, mul(set1(matrixA[i + 2][k]), w));                                     \
+                        acc3 = add(acc3, mul(set1(matrixA[i + 3][k]), w));                                     \
+                    }                                                                                          \
+                    wrapElement sums[4][width];                                                                \
+                    store((void *)sums[0], acc0);                                                              \
+                    store((void *)sums[1], acc1);                                                              \
+                    store((void *)sums[2], acc2);                                                              \
+                    store((void *)sums[3], acc3);                                                              \
+                    for (int r = 0; r < 4; r++) {                                                              \
+                        for (int c = 0; c < valid; c++) {                                                      \
+                            wrapElement cell = (wrapElement)result[i + r][j + c] + sums[r][c];                 \
+                            result[i + r][j + c] = (element)cell;                                              \
+                        }                                                                                      \
+                    }                                                                                          \
+                }                                                                                              \
+                /* leftover rows one at a time */                                                              \
+                for (; i < iEnd; i++) {                                                                        \
+                    vec acc = zero();                                                                          \
+                    for (int k = kk; k < kEnd; k++) {                                                          \
+                        acc = add(acc, mul(set1(matrixA[i][k]), loadW((const void *)(panel + k * width))));    \
+                    }                                                                                          \
+                    wrapElement sums[width];                                                                   \
+                    store((void *)sums, acc);                                                                  \
+                    for (int c = 0; c < valid; c++) {                                                          \
+                        result[i][j + c] = (element)((wrapElement)result[i][j + c] + sums[c]);                 \
+                    }                                                                                          \
+                }                                                                                              \
+            }                                                                                                  \
+        }                                                                                                      \
+    }                                                                                                          \
+}
+
+/**
+ * This macro defines the row function of a vectorized kernel for the sparse kernels (see scalarAddRow), compiled for
+ * the same instruction set, so its products and sums are rounded like the kernel's.
+ * Input parameters: name, isa (compiler target), vector type, width, and the intrinsics of that instruction set to
+ * load elements, load Ws (widening narrow Ws), store, broadcast, multiply and add elements
+ * Returns: defines void name(sum, value, wRow, columns, count)
+**/
+#define defineVectorAddRow(name, isa, vec, width, load, loadW, store, set1, mul, add)                          \
+__attribute__((target(isa)))                                                                                   \
+static void name(element *restrict sum, element value, const wElement *restrict wRow, const int *columns,      \
+                 int count){                                                                                   \
+    if (columns != NULL) {                                                                                     \
+        for (int q = 0; q < count; q++) {                                                                      \
+            wrapElement product = (wrapElement)value * (wrapElement)wRow[q];                                   \
+            sum[columns[q]] = (element)((wrapElement)sum[columns[q]] + product);                               \
+        }                                                                                                      \
+        return;                                                                                                \
+    }                                                                                                          \
+    vec scale = set1(value);                                                                                   \
+    int j = 0;                                                                                                 \
+    for (; j + width <= count; j += width) {                                                                   \
+        vec w = loadW((const void *)(wRow + j));                                                               \
+        store((void *)(sum + j), add(load((const void *)(sum + j)), mul(scale, w)));                           \
+    }                                                                                                          \
+    for (; j < count; j++) {                                                                                   \
+        sum[j] = (element)((wrapElement)sum[j] + (wrapElement)value * (wrapElement)wRow[j]);                   \
+    }                                                                                                          \
+}
+
+#if narrowW
+/**
+ * These functions load a row of a panel of narrow Ws and widen it to int32, for the vector kernels.
+ * Input parameters: address of the row
+ * Returns: the row in a vector register
+**/
+__attribute__((target("sse4.1"))) static inline __m128i loadWideW128(const void *row){
+#if wElementType == typeInt8
+    int32_t bytes;
+    memcpy(&bytes, row, sizeof(bytes));
+    return _mm_cvtepi8_epi32(_mm_cvtsi32_si128(bytes));
+#else
+    return _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)row));
+#endif
+}
+
+__attribute__((target("avx2"))) static inline __m256i loadWideW256(const void *row){
+#if wElementType == typeInt8
+    return _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)row));
+#else
+    return _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)row));
+#endif
+}
+
+__attribute__((target("avx512f"))) static inline __m512i loadWideW512(const void *row){
+#if wElementType == typeInt8
+    return _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)row));
+#else
+    return _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)row));
+#endif
+}
+#define loadW128 loadWideW128
+#define loadW256 loadWideW256
+#define loadW512 loadWideW512
+#else
+#define loadW128 _mm_loadu_si128
+#define loadW256 _mm256_loadu_si256
+#define loadW512 _mm512_loadu_si512
+#endif
+
+//the kernels of the element type; int64 has no vector multiply before AVX-512DQ and uses the scalar kernel
+#if elementType == typeInt32
+defineVectorKernel(sse41Calculation, "sse4.1", __m128i, 4, loadW128, _mm_storeu_si128, _mm_set1_epi32,
+                   _mm_setzero_si128, _mm_mullo_epi32, _mm_add_epi32)
+defineVectorKernel(avx2Calculation, "avx2", __m256i, 8, loadW256, _mm256_storeu_si256, _mm256_set1_epi32,
+                   _mm256_setzero_si256, _mm256_mullo_epi32, _mm256_add_epi32)
+defineVectorKernel(avx512Calculation, "avx512f", __m512i, 16, loadW512, _mm512_storeu_si512,
+                   _mm512_set1_epi32, _mm512_setzero_si512, _mm512_mullo_epi32, _mm512_add_epi32)
+defineVectorAddRow(sse41AddRow, "sse4.1", __m128i, 4, _mm_loadu_si128, loadW128, _mm_storeu_si128, _mm_set1_epi32,
+                   _mm_mullo_epi32, _mm_add_epi32)
+defineVectorAddRow(avx2AddRow, "avx2", __m256i, 8, _mm256_loadu_si256, loadW256, _mm256_storeu_si256,
+                   _mm256_set1_epi32, _mm256_mullo_epi32, _mm256_add_epi32)
+defineVectorAddRow(avx512AddRow, "avx512f", __m512i, 16, _mm512_loadu_si512, loadW512, _mm512_storeu_si512,
+                   _mm512_set1_epi32, _mm512_mullo_epi32, _mm512_add_epi32)
+#define vectorWidths 4, 8, 16
+#elif elementType == typeFloat
+defineVectorKernel(sse41Calculation, "sse4.1", __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_set1_ps,
+                   _mm_setzero_ps, _mm_mul_ps, _mm_add_ps)
+defineVectorKernel(avx2Calculation, "avx2", __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps,
+                   _mm256_setzero_ps, _mm256_mul_ps, _mm256_add_ps)
+defineVectorKernel(avx512Calculation, "avx512f", __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_set1_ps,
+                   _mm512_setzero_ps, _mm512_mul_ps, _mm512_add_ps)
+defineVectorAddRow(sse41AddRow, "sse4.1", __m128, 4, _mm_loadu_ps, _mm_loadu_ps, _mm_storeu_ps, _mm_set1_ps,
+                   _mm_mul_ps, _mm_add_ps)
+defineVectorAddRow(avx2AddRow, "avx2", __m256, 8, _mm256_loadu_ps, _mm256_loadu_ps, _mm256_storeu_ps,
+                   _mm256_set1_ps, _mm256_mul_ps, _mm256_add_ps)
+defineVectorAddRow(avx512AddRow, "avx512f", __m512, 16, _mm512_loadu_ps, _mm512_loadu_ps, _mm512_storeu_ps,
+                   _mm512_set1_ps, _mm512_mul_ps, _mm512_add_ps)
+#define vectorWidths 4, 8, 16
+#elif elementType == typeDouble
+defineVectorKernel(sse41Calculation, "sse4.1", __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd,
+                   _mm_setzero_pd, _mm_mul_pd, _mm_add_pd)
+defineVectorKernel(avx2Calculation, "avx2", __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+                   _mm256_setzero_pd, _mm256_mul_pd, _mm256_add_pd)
+defineVectorKernel(avx512Calculation, "avx512f", __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_set1_pd,
+                   _mm512_setzero_pd, _mm512_mul_pd, _mm512_add_pd)
+defineVectorAddRow(sse41AddRow, "sse4.1", __m128d, 2, _mm_loadu_pd, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd,
+                   _mm_mul_pd, _mm_add_pd)
+defineVectorAddRow(avx2AddRow, "avx2", __m256d, 4, _mm256_loadu_pd, _mm256_loadu_pd, _mm256_storeu_pd,
+                   _mm256_set1_pd, _mm256_mul_pd, _mm256_add_pd)
+defineVectorAddRow(avx512AddRow, "avx512f", __m512d, 8, _mm512_loadu_pd, _mm512_loadu_pd, _mm512_storeu_pd,
+                   _mm512_set1_pd, _mm512_mul_pd, _mm512_add_pd)
+#define vectorWidths 2, 4, 8
+#endif
+#endif
+
+/**
+ * The multiply kernels, from the fastest to the scalar reference. width is the panel width packMatrix has to use,
+ * addRow the row function of the kernel for the sparse kernels.
+ */
+#ifdef vectorWidths
+static const int widths[] = {vectorWidths};
+#define vectorWidth(level) widths[level]
+#endif
+static const struct matmulKernel kernels[] = {
+#ifdef vectorWidths
+    {"avx512", "avx512f", vectorWidth(2), avx512Calculation, avx512AddRow},
+    {"avx2", "avx2", vectorWidth(1), avx2Calculation, avx2AddRow},
+    {"sse4.1", "sse4.1", vectorWidth(0), sse41Calculation, sse41AddRow},
+#endif
+    {"scalar", NULL, 1, scalarCalculation, scalarAddRow},
+};
+#define kernelCount (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+/**
+ * This function checks if the CPU supports the instruction set of a kernel.
+ * Input parameters: kernel
+ * Returns: true if the kernel can run on this CPU
+**/
+static bool kernelSupported(const struct matmulKernel *kernel){
+    if(kernel->feature == NULL){
+        return true;
+    }
+#ifdef x86Kernels
+    __builtin_cpu_init();
+    if(strcmp(kernel->feature, "avx512f") == 0){
+        return __builtin_cpu_supports("avx512f");
+    }
+    if(strcmp(kernel->feature, "avx2") == 0){
+        return __builtin_cpu_supports("avx2");
+    }
+    if(strcmp(kernel->feature, "sse4.1") == 0){
+        return __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    return false;
+}
+
+/**
+ * This function finds a multiply kernel by name, or the fastest one this CPU supports.
+ * Input parameters: name (scalar, sse4.1, avx2 or avx512), or NULL
+ * Returns: the kernel, or NULL if there is no kernel of that name for the element type or this CPU does not support
+ * it
+**/
+const struct matmulKernel *matmulFindKernel(const char *name){
+    for(int i = 0; i < kernelCount; i++){
+        if((name == NULL || strcmp(kernels[i].name, name) == 0) && kernelSupported(&kernels[i])){
+            return &kernels[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * The memory of a plan as it is laid out: the buffers are taken one after the other, each on a cache line. With no
+ * base the buffers are only counted, to know how big the arena has to be.
+ */
+struct arena {
+    char *base;
+    size_t used;
+};
+
+/**
+ * This function takes the next buffer of an arena.
+ * Input parameters: arena, bytes
+ * Returns: the buffer, or NULL when the arena is only counted
+**/
+static void *arenaTake(struct arena *arena, size_t bytes){
+    size_t offset = (arena->used + arenaAlign - 1) / arenaAlign * arenaAlign;
+    arena->used = offset + bytes;
+    return arena->base != NULL ? arena->base + offset : NULL;
+}
+
+/**
+ * What the threads of multiplyRows share: the operands, and the rows of each task.
+ */
+struct multiplyTasks {
+    int size;
+    int rowStart;
+    int rowEnd;
+    int rowsPerTask;
+    element *matrixA;
+    const wElement *packedW;
+    element *result;
+    const struct matmulKernel *kernel;
+    const struct matmulTiles *tiles;
+};
+
+/**
+ * This function returns how many rows a task of the threads of a plan gets: the block rows of the plan if it has
+ * some, otherwise blocks of its tile rows, smaller when there would not be a few blocks per thread to balance.
+ * Input parameters: plan, rows
+ * Returns: the rows per task
+**/
+static int taskRows(const struct matmulPlan *plan, int rows){
+    if(plan->blockRows > 0){
+        return plan->blockRows;
+    }
+    int threads = plan->threads;
+    int rowsPerTask = plan->tiles.rows;
+    if(rows < plan->tiles.rows * threads * 4){
+        rowsPerTask = (rows + threads * 4 - 1) / (threads * 4);
+        rowsPerTask = rowsPerTask < 4 ? 4 : (rowsPerTask + 3) / 4 * 4;
+    }
+    return rowsPerTask;
+}
+
+/**
+ * This function runs tasks on the threads of a plan, or on threads started for them if it could not keep any.
+ * Input parameters: plan, taskCount, run, context
+ * Returns: nothing
+**/
+static void planTasks(const struct matmulPlan *plan, int taskCount, taskFunction run, void *context){
+    if(plan->workers != NULL){
+        runTasksOn(plan->workers, taskCount, run, context);
+    }else{
+        runTasks(plan->threads, taskCount, run, context, plan->placement);
+    }
+}
+
+/**
+ * This function computes one task of multiplyRows, a block of rows of the result.
+ * Input parameters: context (struct multiplyTasks), task, thread
+ * Returns: nothing, the rows of the task hold A*W
+**/
+static void multiplyTask(void *context, int task, int thread){
+    const struct multiplyTasks *tasks = context;
+    int size = tasks->size;
+    int rowStart = tasks->rowStart + task * tasks->rowsPerTask;
+    int rowEnd = rowStart + tasks->rowsPerTask < tasks->rowEnd ? rowStart + tasks->rowsPerTask : tasks->rowEnd;
+    (void)thread;
+    tasks->kernel->run(size, rowStart, rowEnd, (element (*)[size])tasks->matrixA, tasks->packedW,
+                       (element (*)[size])tasks->result, tasks->tiles);
+}
+
+/**
+ * This function computes rows rowStart..rowEnd-1 of result = A*W with the kernel of the plan, by its threads if it
+ * has more than one: the rows are split into blocks that the threads take from work-stealing deques (see
+ * task_pool.c).
+ * Input parameters: plan, size (of the matrices, the leaf size in the Strassen recursion), matrixA, packedW (packed
+ * for the kernel), result, rowStart, rowEnd (exclusive)
+ * Returns: nothing, the rows of result hold A*W
+**/
+static void multiplyRows(const struct matmulPlan *plan, int size, const element *matrixA, const wElement *packedW,
+                         element *result, int rowStart, int rowEnd){
+    int rows = rowEnd - rowStart;
+    if(plan->threads <= 1 || rows <= 0){
+        plan->kernel->run(size, rowStart, rowEnd, (element (*)[size])matrixA, packedW, (element (*)[size])result,
+                          &plan->tiles);
+        return;
+    }
+    int rowsPerTask = taskRows(plan, rows);
+    struct multiplyTasks tasks = {size, rowStart, rowEnd, rowsPerTask, (element *)matrixA, packedW, result,
+                                  plan->kernel, &plan->tiles};
+    planTasks(plan, (rows + rowsPerTask - 1) / rowsPerTask, multiplyTask, &tasks);
+}
+
+/**
+ * What the threads of multiplySparse share: the sparse A, W (sparse or not), the rows of each task and the scratch
+ * rows of the threads.
+ */
+struct sparseTasks {
+    int size;
+    int rowsPerTask;
+    int depth;          //slices of the dot products, the tile depth of the plan
+    const struct sparseMatrix *a;
+    const wElement *w;
+    const struct sparseMatrix *sparseW;
+    rowFunction addRow;
+    element *result;
+    element *partial;   //size elements per thread
+};
+
+/**
+ * This function computes one task of multiplySparse, a block of rows of the result.
+ * Input parameters: context (struct sparseTasks), task, thread
+ * Returns: nothing, the rows of the task hold A*W
+**/
+static void sparseTask(void *context, int task, int thread){
+    const struct sparseTasks *tasks = context;
+    int size = tasks->size;
+    int rowStart = task * tasks->rowsPerTask;
+    int rowEnd = rowStart + tasks->rowsPerTask < size ? rowStart + tasks->rowsPerTask : size;
+    sparseMultiply(size, rowStart, rowEnd, tasks->depth, tasks->a, tasks->w, tasks->sparseW, tasks->addRow,
+                   tasks->result, tasks->partial + (size_t)thread * size);
+}
+
+/**
+ * This function computes result = A*W with the sparse kernels when A has at most the sparse percent of nonzeros of
+ * the plan: A is converted to CSR, and W too when it is as sparse (see matrix_sparse.h), in the arena of the plan.
+ * The work is the nonzeros of A times size (or times the nonzeros of a row of W) instead of size^3.
+ * Input parameters: plan, matrixA, matrixW, result
+ * Returns: true if result holds A*W, false if A is not sparse enough (nothing is computed)
+**/
+static bool multiplySparse(struct matmulPlan *plan, const element *matrixA, const wElement *matrixW,
+                           element *result){
+    int size = plan->size;
+    if(sparseFill(&plan->sparseA, size, matrixA, elementType, plan->sparseLimit) != 0){
+        return false;
+    }
+    bool sparseW = sparseFill(&plan->sparseW, size, matrixW, wElementType, plan->sparseLimit) == 0;
+
+    struct sparseTasks tasks = {size, size, plan->tiles.depth, &plan->sparseA, matrixW, sparseW ? &plan->sparseW : NULL,
+                                plan->kernel->addRow, result, plan->partial};
+    if(plan->threads > 1){
+        tasks.rowsPerTask = taskRows(plan, size);
+        planTasks(plan, (size + tasks.rowsPerTask - 1) / tasks.rowsPerTask, sparseTask, &tasks);
+    }else{
+        sparseTask(&tasks, 0, 0);
+    }
+    return true;
+}
+
+#if !narrowW
+/*
+ * The Strassen-Winograd recursion works on wrapElement values (unsigned for the integer types), which wrap exactly
+ * like the products of the kernel, so for integers the result is the same as the classical one. Floating point
+ * results are rounded differently. Narrow W types have no room for the sums and are not supported.
+ */
+
+/**
+ * This function computes Z = X + Y, or Z = X - Y, for n x n blocks stored with the given row strides.
+ * Input parameters: n, X, ldx, Y, ldy, Z, ldz, subtract
+ * Returns: nothing, Z holds the sum or the difference
+**/
+static void combineBlocks(int n, const wrapElement *X, int ldx, const wrapElement *Y, int ldy, wrapElement *Z,
+                          int ldz, bool subtract){
+    for(int i = 0; i < n; i++){
+        const wrapElement *x = X + (size_t)i * ldx;
+        const wrapElement *y = Y + (size_t)i * ldy;
+        wrapElement *z = Z + (size_t)i * ldz;
+        if(subtract){
+            for(int j = 0; j < n; j++){
+                z[j] = x[j] - y[j];
+            }
+        }else{
+            for(int j = 0; j < n; j++){
+                z[j] = x[j] + y[j];
+            }
+        }
+    }
+}
+
+
+/**
+ * This function multiplies two leaf blocks with the kernel: they are copied to contiguous matrices, W is packed, and
+ * the product is copied to C.
+ * Input parameters: A, lda, W, ldw, C, ldc, plan
+ * Returns: nothing, C holds A*W
+**/
+static void strassenLeaf(const wrapElement *A, int lda, const wrapElement *W, int ldw, wrapElement *C, int ldc,
+                         const struct matmulPlan *plan){
+    const struct strassenScratch *scratch = &plan->scratch;
+    int n = scratch->leaf;
+    for(int i = 0; i < n; i++){
+        memcpy(&scratch->leafA[i * n], A + (size_t)i * lda, n * sizeof(element));
+        memcpy(&scratch->leafW[i * n], W + (size_t)i * ldw, n * sizeof(element));
+    }
+    packMatrix(n, plan->kernel->width, scratch->leafW, scratch->leafPacked);
+    multiplyRows(plan, n, scratch->leafA, scratch->leafPacked, scratch->leafResult, 0, n);
+    for(int i = 0; i < n; i++){
+        memcpy(C + (size_t)i * ldc, &scratch->leafResult[i * n], n * sizeof(element));
+    }
+}
+
+/**
+ * This function computes C = A*W for n x n blocks with the Strassen-Winograd recursion (7 products of half size
+ * instead of 8), until the blocks are of the leaf size. The products and sums are scheduled so that only two
+ * temporaries X and Y of half size are needed per level, the quadrants of C hold the other intermediate values
+ * (Boyer, Dumas, Pernet and Zhou, "Memory efficient scheduling of Strassen-Winograd's matrix multiplication").
+ * Input parameters: n (the leaf size times a power of 2), A, lda, W, ldw, C, ldc, temporaries (of this level and
+ * the ones below), plan
+ * Returns: nothing, C holds A*W
+**/
+static void strassenLevel(int n, const wrapElement *A, int lda, const wrapElement *W, int ldw, wrapElement *C,
+                          int ldc, wrapElement *temporaries, const struct matmulPlan *plan){
+    if(n <= plan->scratch.leaf){
+        strassenLeaf(A, lda, W, ldw, C, ldc, plan);
+        return;
+    }
+    int h = n / 2;
+    wrapElement *X = temporaries;
+    wrapElement *Y = temporaries + (size_t)h * h;
+    wrapElement *below = Y + (size_t)h * h;
+    const wrapElement *A11 = A, *A12 = A + h, *A21 = A + (size_t)h * lda, *A22 = A21 + h;
+    const wrapElement *W11 = W, *W12 = W + h, *W21 = W + (size_t)h * ldw, *W22 = W21 + h;
+    wrapElement *C11 = C, *C12 = C + h, *C21 = C + (size_t)h * ldc, *C22 = C21 + h;
+
+    combineBlocks(h, A11, lda, A21, lda, X, h, true);                      //S3 = A11 - A21
+    combineBlocks(h, W22, ldw, W12, ldw, Y, h, true);                      //T3 = W22 - W12
+    strassenLevel(h, X, h, Y, h, C21, ldc, below, plan);                   //P7 = S3*T3
+    combineBlocks(h, A21, lda, A22, lda, X, h, false);                     //S1 = A21 + A22
+    combineBlocks(h, W12, ldw, W11, ldw, Y, h, true);                      //T1 = W12 - W11
+    strassenLevel(h, X, h, Y, h, C22, ldc, below, plan);                   //P5 = S1*T1
+    combineBlocks(h, X, h, A11, lda, X, h, true);                          //S2 = S1 - A11
+    combineBlocks(h, W22, ldw, Y, h, Y, h, true);                          //T2 = W22 - T1
+    strassenLevel(h, X, h, Y, h, C12, ldc, below, plan);                   //P6 = S2*T2
+    combineBlocks(h, A12, lda, X, h, X, h, true);                          //S4 = A12 - S2
+    strassenLevel(h, X, h, W22, ldw, C11, ldc, below, plan);               //P3 = S4*W22
+    strassenLevel(h, A11, lda, W11, ldw, X, h, below, plan);               //P1 = A11*W11
+    combineBlocks(h, X, h, C12, ldc, C12, ldc, false);                     //U2 = P1 + P6
+    combineBlocks(h, C12, ldc, C21, ldc, C21, ldc, false);                 //U3 = U2 + P7
+    combineBlocks(h, C12, ldc, C22, ldc, C12, ldc, false);                 //U4 = U2 + P5
+    combineBlocks(h, C21, ldc, C22, ldc, C22, ldc, false);                 //C22 = U3 + P5
+    combineBlocks(h, C12, ldc, C11, ldc, C12, ldc, false);                 //C12 = U4 + P3
+    combineBlocks(h, Y, h, W21, ldw, Y, h, true);                          //T4 = T2 - W21
+    strassenLevel(h, A22, lda, Y, h, C11, ldc, below, plan);               //P4 = A22*T4
+    combineBlocks(h, C21, ldc, C11, ldc, C21, ldc, true);                  //C21 = U3 - P4
+    strassenLevel(h, A12, lda, W21, ldw, C11, ldc, below, plan);           //P2 = A12*W21
+    combineBlocks(h, X, h, C11, ldc, C11, ldc, false);                     //C11 = P1 + P2
+}
+
+
+/**
+ * This function computes result = A*W with the Strassen-Winograd recursion, in the scratch of the plan. The
+ * operands are copied (padded with 0s) to the padded size of the recursion when it is bigger than size.
+ * Input parameters: plan, matrixA, matrixW, result
+ * Returns: nothing, result holds A*W
+**/
+static void strassenMultiply(const struct matmulPlan *plan, const element *matrixA, const element *matrixW,
+                             element *result){
+    const struct strassenScratch *scratch = &plan->scratch;
+    int size = plan->size;
+    int padded = scratch->padded;
+    const element *paddedA = matrixA, *paddedW = matrixW;
+    element *paddedResult = result;
+    if(padded != size){
+        memset(scratch->paddedA, 0, (size_t)padded * padded * sizeof(element));
+        memset(scratch->paddedW, 0, (size_t)padded * padded * sizeof(element));
+        for(int i = 0; i < size; i++){
+            memcpy(&scratch->paddedA[(size_t)i * padded], &matrixA[(size_t)i * size], size * sizeof(element));
+            memcpy(&scratch->paddedW[(size_t)i * padded], &matrixW[(size_t)i * size], size * sizeof(element));
+        }
+        paddedA = scratch->paddedA;
+        paddedW = scratch->paddedW;
+        paddedResult = scratch->paddedResult;
+    }
+    strassenLevel(padded, (const wrapElement *)paddedA, padded, (const wrapElement *)paddedW, padded,
+                  (wrapElement *)paddedResult, padded, scratch->temporaries, plan);
+    if(padded != size){
+        for(int i = 0; i < size; i++){
+            memcpy(&result[(size_t)i * size], &paddedResult[(size_t)i * padded], size * sizeof(element));
+        }
+    }
+}
+#endif
+
+/**
+ * This function fills in the defaults of the options of a plan: the element types of the build, the fastest kernel,
+ * one thread (with the default blocks of rows), no Strassen and the default sparse threshold.
+ * Input parameters: options (to fill in), size
+ * Returns: nothing
+**/
+void matmulDefaults(struct matmulOptions *options, int size){
+    memset(options, 0, sizeof(*options));
+    options->size = size;
+    options->dtype = elementType;
+    options->wDtype = wElementType;
+    options->threads = 1;
+    options->sparse = matmulSparseThreshold;
+}
+
+/**
+ * This function sets up a plan from its options, without its memory: the kernel, the threads, and whether the
+ * sparse kernels and the Strassen recursion (with its leaf and padded sizes) can be used.
+ * Input parameters: plan (to fill in), options
+ * Returns: 0 if successful, -1 if the options cannot be used (errno is EINVAL)
+**/
+static int planSetup(struct matmulPlan *plan, const struct matmulOptions *options){
+    memset(plan, 0, sizeof(*plan));
+    if(options->size < 1 || options->dtype != elementType || options->wDtype != wElementType ||
+       (options->kernel != NULL && !kernelSupported(options->kernel))){
+        errno = EINVAL;
+        return -1;
+    }
+    int size = options->size;
+    plan->size = size;
+    plan->kernel = options->kernel != NULL ? options->kernel : matmulFindKernel(NULL);
+    plan->threads = options->threads > 1 ? options->threads : 1;
+    plan->blockRows = options->blockRows > 0 ? options->blockRows : 0;
+    plan->tiles.rows = options->tiles.rows > 0 ? options->tiles.rows : matmulTileRows;
+    plan->tiles.cols = options->tiles.cols > 0 ? options->tiles.cols : matmulTileCols;
+    plan->tiles.depth = options->tiles.depth > 0 ? options->tiles.depth : matmulTileDepth;
+    plan->sparse = options->sparse > 0 ? options->sparse : 0;
+    plan->sparseLimit = (size_t)size * size * plan->sparse / 100;
+    plan->placement = options->placement;
+#if !narrowW
+    //the sums of the recursion do not fit in a narrow W, it is never used then
+    if(options->crossover > 0){
+        plan->crossover = options->crossover > matmulMinCrossover ? options->crossover : matmulMinCrossover;
+    }
+#endif
+    plan->strassen = plan->crossover > 0 && size > plan->crossover;
+    if(plan->strassen){
+        //the size is split in half until the blocks are at most the crossover
+        int levels = 0;
+        while((size + (1 << levels) - 1) >> levels > plan->crossover){
+            levels++;
+        }
+        plan->scratch.leaf = (size + (1 << levels) - 1) >> levels;
+        plan->scratch.padded = plan->scratch.leaf << levels;
+    }
+    return 0;
+}
+
+/**
+ * This function lays out the memory of a plan in an arena: W packed for the kernel, the CSR matrices and scratch rows
+ * of the sparse kernels, and the Strassen scratch.
+ * Input parameters: plan (set up by planSetup), arena
+ * Returns: nothing, the buffers of the plan point into the arena (NULL when it is only counted)
+**/
+static void planLayout(struct matmulPlan *plan, struct arena *arena){
+    int size = plan->size;
+    int width = plan->kernel->width;
+    plan->packedW = arenaTake(arena, (size_t)panelCount(size, width) * width * size * sizeof(wElement));
+    if(plan->sparse > 0){
+        //a matrix of 0s is sparse whatever the limit, there is always room for a nonzero
+        size_t capacity = plan->sparseLimit > 0 ? plan->sparseLimit : 1;
+        struct sparseMatrix *matrices[2] = {&plan->sparseA, &plan->sparseW};
+        size_t bytes[2] = {sizeof(element), sizeof(wElement)};
+        for(int m = 0; m < 2; m++){
+            matrices[m]->rowStart = arenaTake(arena, (size + 1) * sizeof(size_t));
+            matrices[m]->columns = arenaTake(arena, capacity * sizeof(int));
+            matrices[m]->values = arenaTake(arena, capacity * bytes[m]);
+        }
+        plan->partial = arenaTake(arena, (size_t)plan->threads * size * sizeof(element));
+    }
+    if(plan->strassen){
+        struct strassenScratch *scratch = &plan->scratch;
+        int leaf = scratch->leaf;
+        int padded = scratch->padded;
+        //the temporaries of all the levels: 2*(n/2)^2 + 2*(n/4)^2 + ... < padded^2
+        scratch->temporaries = arenaTake(arena, (size_t)padded * padded * sizeof(wrapElement));
+        scratch->leafA = arenaTake(arena, (size_t)leaf * leaf * sizeof(element));
+        scratch->leafW = arenaTake(arena, (size_t)leaf * leaf * sizeof(element));
+        scratch->leafPacked = arenaTake(arena, (size_t)panelCount(leaf, width) * width * leaf * sizeof(element));
+        scratch->leafResult = arenaTake(arena, (size_t)leaf * leaf * sizeof(element));
+        if(padded != size){
+            scratch->paddedA = arenaTake(arena, (size_t)padded * padded * sizeof(element));
+            scratch->paddedW = arenaTake(arena, (size_t)padded * padded * sizeof(element));
+            scratch->paddedResult = arenaTake(arena, (size_t)padded * padded * sizeof(element));
+        }
+    }
+}
+
+/**
+ * This function returns how much memory a plan for the given options allocates.
+ * Input parameters: options
+ * Returns: the bytes of the arena, 0 if the options cannot be used
+**/
+size_t matmulPlanBytes(const struct matmulOptions *options){
+    struct matmulPlan plan;
+    if(planSetup(&plan, options) == -1){
+        return 0;
+    }
+    struct arena arena = {NULL, 0};
+    planLayout(&plan, &arena);
+    return arena.used;
+}
+
+/**
+ * This function makes a plan: it picks the kernel and the way of computing, allocates all the memory the
+ * multiplies of this size will need, at once, and starts the threads that will compute them.
+ * Input parameters: plan (to fill in, free with matmulPlanFree), options
+ * Returns: 0 if successful, -1 if the options cannot be used (errno is EINVAL) or the memory cannot be allocated
+ * (ENOMEM)
+**/
+int matmulPlanInit(struct matmulPlan *plan, const struct matmulOptions *options){
+    if(planSetup(plan, options) == -1){
+        return -1;
+    }
+    struct arena arena = {NULL, 0};
+    planLayout(plan, &arena);
+    size_t bytes = (arena.used + arenaAlign - 1) / arenaAlign * arenaAlign;
+    arena.base = aligned_alloc(arenaAlign, bytes);
+    if(arena.base == NULL){
+        errno = ENOMEM;
+        return -1;
+    }
+    arena.used = 0;
+    planLayout(plan, &arena);
+    plan->arena = arena.base;
+    plan->arenaBytes = bytes;
+    //without them the threads are started for each multiply, which is only slower
+    plan->workers = plan->threads > 1 ? taskWorkersStart(plan->threads, plan->placement) : NULL;
+    return 0;
+}
+
+/**
+ * This function computes result = A*W as the plan says, without allocating anything.
+ * A sparse A is multiplied through its nonzeros (see matrix_sparse.h).
+ * Above the Strassen crossover the product is computed by the Strassen-Winograd recursion.
+ * Otherwise W is packed for the kernel and the rows are computed by the kernel, split between the threads of the
+ * plan if it has more than one.
+ * Input parameters: plan, matrixA, matrixW, result (size x size row-major matrices, result is not A or W)
+ * Returns: matmulSparse, matmulStrassen or matmulDense, the way the product was computed
+**/
+int matmulExecute(struct matmulPlan *plan, const element *matrixA, const wElement *matrixW, element *result){
+    if(matmulExecuteSparse(plan, matrixA, matrixW, result)){
+        return matmulSparse;
+    }
+#if !narrowW
+    if(plan->strassen){
+        strassenMultiply(plan, matrixA, matrixW, result);
+        return matmulStrassen;
+    }
+#endif
+    matmulPackW(plan, matrixW);
+    matmulExecuteRows(plan, matrixA, result, 0, plan->size);
+    return matmulDense;
+}
+
+/**
+ * This function computes result[m] = A[m]*W for a batch of left matrices multiplied by the same W, as one stacked
+ * multiply: W is packed once, and the rows of consecutive dense As are computed as the rows of one count*size x size
+ * matrix, split between the threads of the plan. Sparse As go through the sparse kernels one by one, and a plan above
+ * its Strassen crossover multiplies each A with the recursion.
+ * Input parameters: plan, count, matrixA (count size x size matrices, one after the other), matrixW, result (count
+ * matrices)
+ * Returns: how many of the products were computed with the sparse kernels
+**/
+int matmulExecuteBatch(struct matmulPlan *plan, int count, const element *matrixA, const wElement *matrixW,
+                       element *result){
+    size_t matrixElements = (size_t)plan->size * plan->size;
+    int sparse = 0;
+#if !narrowW
+    if(plan->strassen){
+        for(int m = 0; m < count; m++){
+            sparse += matmulExecute(plan, matrixA + m * matrixElements, matrixW, result + m * matrixElements) ==
+                      matmulSparse;
+        }
+        return sparse;
+    }
+#endif
+    //the dense As between two sparse ones are multiplied together
+    bool packed = false;
+    int denseStart = 0;
+    for(int m = 0; m <= count; m++){
+        if(m < count && !matmulExecuteSparse(plan, matrixA + m * matrixElements, matrixW, result + m * matrixElements)){
+            continue;
+        }
+        if(m > denseStart){
+            if(!packed){
+                matmulPackW(plan, matrixW);
+                packed = true;
+            }
+            multiplyRows(plan, plan->size, matrixA + denseStart * matrixElements, plan->packedW,
+                         result + denseStart * matrixElements, 0, (m - denseStart) * plan->size);
+        }
+        sparse += m < count;
+        denseStart = m + 1;
+    }
+    return sparse;
+}
+
+/**
+ * This function computes result = A*W with the sparse kernels if the plan uses them and A has at most its sparse
+ * percent of nonzeros, for a caller that splits the dense multiply itself.
+ * Input parameters: plan, matrixA, matrixW, result
+ * Returns: true if result holds A*W, false if nothing was computed
+**/
+bool matmulExecuteSparse(struct matmulPlan *plan, const element *matrixA, const wElement *matrixW, element *result){
+    return plan->sparse > 0 && multiplySparse(plan, matrixA, matrixW, result);
+}
+
+/**
+ * This function packs W into the plan for the kernel, for matmulExecuteRows.
+ * Input parameters: plan, matrixW (size x size)
+ * Returns: nothing
+**/
+void matmulPackW(struct matmulPlan *plan, const wElement *matrixW){
+    packMatrix(plan->size, plan->kernel->width, matrixW, plan->packedW);
+}
+
+/**
+ * This function computes rows rowStart..rowEnd-1 of result = A*W with the dense kernel and the W packed by
+ * matmulPackW, by the threads of the plan if it has more than one. A and the result are indexed by the row numbers,
+ * so a caller that only has a block of rows passes that block with rows 0..rowCount.
+ * Input parameters: plan, matrixA, result, rowStart, rowEnd (exclusive)
+ * Returns: nothing, the rows of result hold A*W
+**/
+void matmulExecuteRows(const struct matmulPlan *plan, const element *matrixA, element *result, int rowStart,
+                       int rowEnd){
+    multiplyRows(plan, plan->size, matrixA, plan->packedW, result, rowStart, rowEnd);
+}
+
+#if realElements
+/**
+ * This function returns the absolute value of a number, without libm.
+ * Input parameters: value
+ * Returns: |value|
+**/
+static double magnitude(double value){
+    return value < 0 ? -value : value;
+}
+#endif
+
+/**
+ * This function returns the next number of a xorshift64* generator, for the random vectors of matmulVerify.
+ * Input parameters: state (not 0)
+ * Returns: the number
+**/
+static uint64_t nextRandom(uint64_t *state){
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+/**
+ * This function checks a product with Freivalds' algorithm: for a random vector r of 0s and 1s, A*(W*r) must be R*r,
+ * which takes three matrix-vector products (O(n^2)) instead of a multiply. A wrong R passes a round with probability
+ * at most 1/2, so it passes all the rounds with probability at most 2^-rounds. The integer types are checked exactly,
+ * wrapping around like the kernels; float and double are compared within the rounding error of the multiply
+ * (4 * size * epsilon of |A|*(|W|*r) + |R|*r). A band of rows of the product can be checked on its own.
+ * Input parameters: size (W is size x size), rows (A and R are rows x size), matrixA, matrixW, result, rounds, seed
+ * (of the random vectors, different for every check)
+ * Returns: the number of rounds that failed (0 if R = A*W passed), -1 if the memory cannot be allocated
+**/
+int matmulVerify(int size, int rows, const element *matrixA, const wElement *matrixW, const element *result,
+                 int rounds, unsigned long long seed){
+    uint64_t state = seed != 0 ? seed : 1;
+    char *r = malloc(size);
+#if realElements
+    double *wr = malloc(2 * (size_t)size * sizeof(double));     //W*r, then |W|*r
+    double epsilon = 4.0 * size * (elementType == typeFloat ? FLT_EPSILON : DBL_EPSILON);
+#else
+    wrapElement *wr = malloc((size_t)size * sizeof(wrapElement));
+#endif
+    if(r == NULL || wr == NULL){
+        free(r);
+        free(wr);
+        return -1;
+    }
+    int failed = 0;
+    for(int round = 0; round < rounds; round++){
+        for(int j = 0; j < size; j++){
+            r[j] = nextRandom(&state) >> 63;
+        }
+        bool passed = true;
+#if realElements
+        for(int k = 0; k < size; k++){
+            const wElement *row = &matrixW[(size_t)k * size];
+            double sum = 0, bound = 0;
+            for(int j = 0; j < size; j++){
+                sum += r[j] ? (double)row[j] : 0;
+                bound += r[j] ? magnitude((double)row[j]) : 0;
+            }
+            wr[k] = sum;
+            wr[size + k] = bound;
+        }
+        for(int i = 0; i < rows && passed; i++){
+            const element *a = &matrixA[(size_t)i * size];
+            const element *rRow = &result[(size_t)i * size];
+            double left = 0, right = 0, bound = 0;
+            for(int k = 0; k < size; k++){
+                left += (double)a[k] * wr[k];
+                bound += magnitude((double)a[k]) * wr[size + k];
+            }
+            for(int j = 0; j < size; j++){
+                right += r[j] ? (double)rRow[j] : 0;
+                bound += r[j] ? magnitude((double)rRow[j]) : 0;
+            }
+            passed = magnitude(left - right) <= epsilon * bound;
+        }
+#else
+        for(int k = 0; k < size; k++){
+            const wElement *row = &matrixW[(size_t)k * size];
+            wrapElement sum = 0;
+            for(int j = 0; j < size; j++){
+                sum += r[j] ? (wrapElement)row[j] : 0;
+            }
+            wr[k] = sum;
+        }
+        for(int i = 0; i < rows && passed; i++){
+            const element *a = &matrixA[(size_t)i * size];
+            const element *rRow = &result[(size_t)i * size];
+            wrapElement left = 0, right = 0;
+            for(int k = 0; k < size; k++){
+                left += (wrapElement)a[k] * wr[k];
+            }
+            for(int j = 0; j < size; j++){
+                right += r[j] ? (wrapElement)rRow[j] : 0;
+            }
+            passed = left == right;
+        }
+#endif
+        failed += !passed;
+    }
+    free(r);
+    free(wr);
+    return failed;
+}
+
+/**
+ * This function stops the threads of a plan and frees its memory.
+ * Input parameters: plan
+ * Returns: nothing
+**/
+void matmulPlanFree(struct matmulPlan *plan){
+    taskWorkersStop(plan->workers);
+    free(plan->arena);
+    memset(plan, 0, sizeof(*plan));
+}
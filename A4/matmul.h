@@ -0,0 +1,149 @@
+/**
+ * Description: libmatmul, the multiply of matrixmult_parallel as a library, for matrixmult_parallel,
+ * matrixmult_multiw_deep --in-process and any program that wants A*W without starting a process.
+ * A plan is made once for a size and a way of computing (kernel, threads, Strassen crossover, sparse threshold): it
+ * allocates all the memory the multiply will need in one arena (W packed for the kernel, the CSR matrices and rows of
+ * the sparse kernels, the temporaries of the Strassen recursion) and starts its threads, kept until matmulPlanFree,
+ * so matmulExecute neither allocates anything nor starts a thread and can be called for every pair of operands of
+ * that size. The element types are the ones the library was built with (see
+ * matrix_types.h), a plan for other types is refused.
+ *
+ *     struct matmulOptions options;
+ *     struct matmulPlan plan;
+ *     matmulDefaults(&options, size);
+ *     options.threads = 4;
+ *     if(matmulPlanInit(&plan, &options) == 0){
+ *         matmulExecute(&plan, A, W, R);   //R = A*W, size x size row-major matrices
+ *         matmulPlanFree(&plan);
+ *     }
+ *
+ * matmulExecuteBatch multiplies a batch of As by the same W as one stacked multiply, packing W once.
+ * matmulVerify checks a product with Freivalds' randomized algorithm, in O(n^2) per round.
+ * Matrices bigger than the memory are multiplied by tiles from their files with streamLayer (see matrix_stream.h).
+ * A caller that splits the rows itself (forked children, row blocks of a worker server) checks for a sparse A with
+ * matmulExecuteSparse, packs W once with matmulPackW and computes bands of rows with matmulExecuteRows.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef MATMUL_H
+#define MATMUL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "matrix_sparse.h"
+#include "matrix_types.h"
+
+#define matmulCrossover 512         //default size up to which the Strassen recursion uses the kernel
+#define matmulMinCrossover 16       //smallest crossover accepted
+#define matmulSparseThreshold 15    //default percent of nonzeros of A up to which the sparse kernels are used
+#define matmulVerifyRounds 2        //default rounds of matmulVerify, a wrong product passes with probability <= 1/4
+#define matmulTileRows 32           //default rows of A (and R) per cache block
+#define matmulTileCols 32           //default columns of R per cache block (scalar kernel)
+#define matmulTileDepth 256         //default length of the dot product slice per cache block
+
+//how matmulExecute computed the product
+#define matmulDense 0
+#define matmulSparse 1
+#define matmulStrassen 2
+
+struct affinity;
+struct taskWorkers;
+
+/**
+ * The cache blocks of the kernels: rows of A, columns of R and length of the dot products per block. The vector
+ * kernels walk whole panels of W, so only the scalar kernel uses cols.
+ */
+struct matmulTiles {
+    int rows;
+    int cols;
+    int depth;
+};
+
+/**
+ * A multiply kernel: rows rowStart..rowEnd-1 of result = A*W, with W packed in panels of width columns, by blocks
+ * of tiles. addRow is its row function for the sparse kernels.
+ */
+typedef void (*kernelFunction)(int size, int rowStart, int rowEnd, element matrixA[size][size],
+                               const wElement *packedW, element result[size][size], const struct matmulTiles *tiles);
+
+struct matmulKernel {
+    const char *name;
+    const char *feature; //CPU feature needed, NULL if none
+    int width;
+    kernelFunction run;
+    rowFunction addRow;
+};
+
+/**
+ * What a plan is made for. matmulDefaults fills in the defaults, the caller changes what it wants.
+ */
+struct matmulOptions {
+    int size;           //the matrices are size x size
+    int dtype;          //type of A and R, must be elementType
+    int wDtype;         //type of W, must be wElementType
+    const struct matmulKernel *kernel;  //NULL for the fastest one this CPU supports
+    int threads;        //> 1: the rows are split between threads, the calling thread is one of them
+    int blockRows;      //rows of a task of the threads, 0 for the default (see matrix_tune.h)
+    struct matmulTiles tiles;   //cache blocks of the kernel, 0s for the defaults
+    int crossover;      //> 0: Strassen-Winograd for sizes above it, down to blocks of at most this size
+    int sparse;         //percent of nonzeros of A up to which the sparse kernels are used, 0 for never
+    const struct affinity *placement;   //where the threads run (thread t on slot t), or NULL
+};
+
+/**
+ * The Strassen-Winograd workspace of a plan: two temporaries for each level of the recursion, the contiguous
+ * operands the kernel needs at the leaves, and the operands padded to leaf * 2^levels.
+ */
+struct strassenScratch {
+    int leaf;                   //size of the blocks multiplied by the kernel
+    int padded;                 //size of the recursion, leaf * 2^levels
+    wrapElement *temporaries;   //2*(n/2)^2 for the first level, then 2*(n/4)^2, ...
+    element *leafA;
+    element *leafW;
+    element *leafPacked;
+    element *leafResult;
+    element *paddedA;           //NULL when padded is size
+    element *paddedW;
+    element *paddedResult;
+};
+
+struct matmulPlan {
+    int size;
+    const struct matmulKernel *kernel;
+    int threads;
+    int blockRows;
+    struct matmulTiles tiles;
+    int crossover;
+    int sparse;
+    const struct affinity *placement;
+    struct taskWorkers *workers; //the threads of the plan (see task_pool.h), NULL with one thread
+    void *arena;                //all the memory below
+    size_t arenaBytes;
+    wElement *packedW;          //W packed for the kernel
+    size_t sparseLimit;         //most nonzeros of a sparse A (and W), 0 without the sparse kernels
+    struct sparseMatrix sparseA;
+    struct sparseMatrix sparseW;
+    element *partial;           //one row of scratch per thread for the sparse kernels
+    bool strassen;
+    struct strassenScratch scratch;
+};
+
+const struct matmulKernel *matmulFindKernel(const char *name);
+void matmulDefaults(struct matmulOptions *options, int size);
+size_t matmulPlanBytes(const struct matmulOptions *options);
+int matmulPlanInit(struct matmulPlan *plan, const struct matmulOptions *options);
+int matmulExecute(struct matmulPlan *plan, const element *matrixA, const wElement *matrixW, element *result);
+int matmulExecuteBatch(struct matmulPlan *plan, int count, const element *matrixA, const wElement *matrixW,
+                       element *result);
+bool matmulExecuteSparse(struct matmulPlan *plan, const element *matrixA, const wElement *matrixW, element *result);
+void matmulPackW(struct matmulPlan *plan, const wElement *matrixW);
+void matmulExecuteRows(const struct matmulPlan *plan, const element *matrixA, element *result, int rowStart,
+                       int rowEnd);
+int matmulVerify(int size, int rows, const element *matrixA, const wElement *matrixW, const element *result,
+                 int rounds, unsigned long long seed);
+void matmulPlanFree(struct matmulPlan *plan);
+
+#endif
@@ -0,0 +1,401 @@
+/**
+ * Description: the CPU placement of the children, workers and threads (see matrix_affinity.h).
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <sched.h>
+
+#include "matrix_affinity.h"
+
+#ifndef affinitySysfs
+#define affinitySysfs "/sys/devices/system"  //can be pointed at a copy of another machine's topology when building
+#endif
+#define maxNodes 1024
+
+/**
+ * A CPU this process may use and where it is.
+ */
+struct cpuInfo {
+    int cpu;
+    int node;
+    int package;
+    int core;
+    int sibling;    //0 for the first CPU of its core, 1 for its first hyperthread, ...
+};
+
+/**
+ * This function reads the number in a sysfs file.
+ * Input parameters: path, fallback
+ * Returns: the number, or fallback if the file cannot be read
+**/
+static int readNumber(const char *path, int fallback){
+    FILE *file = fopen(path, "r");
+    if(file == NULL){
+        return fallback;
+    }
+    int value;
+    if(fscanf(file, "%d", &value) != 1){
+        value = fallback;
+    }
+    fclose(file);
+    return value;
+}
+
+/**
+ * This function parses a CPU list like 0,2,4-7 into a set, and the CPUs in the order of the list.
+ * Input parameters: list, set (to fill in), order (to fill in, CPU_SETSIZE entries, or NULL)
+ * Returns: the number of CPUs in the list, -1 if it is not a CPU list
+**/
+static int parseCpuList(const char *list, cpu_set_t *set, int *order){
+    CPU_ZERO(set);
+    int count = 0;
+    const char *next = list;
+    while(*next != '\0' && *next != '\n'){
+        if(!isdigit((unsigned char)*next)){
+            return -1;
+        }
+        char *end;
+        long first = strtol(next, &end, 10);
+        long last = first;
+        if(*end == '-'){
+            if(!isdigit((unsigned char)end[1])){
+                return -1;
+            }
+            last = strtol(end + 1, &end, 10);
+        }
+        if(first > last || last >= CPU_SETSIZE){
+            return -1;
+        }
+        for(long cpu = first; cpu <= last; cpu++){
+            if(!CPU_ISSET(cpu, set)){
+                CPU_SET(cpu, set);
+                if(order != NULL){
+                    order[count] = (int)cpu;
+                }
+                count++;
+            }
+        }
+        if(*end == ','){
+            end++;
+        }else if(*end != '\0' && *end != '\n'){
+            return -1;
+        }
+        next = end;
+    }
+    return count;
+}
+
+/**
+ * This function finds the NUMA node of every CPU from the cpulist of each online node in sysfs.
+ * Input parameters: nodeOf (CPU_SETSIZE entries, to fill in; 0 for a CPU of no node)
+ * Returns: nothing
+**/
+static void readNodes(int *nodeOf){
+    memset(nodeOf, 0, CPU_SETSIZE * sizeof(int));
+    char path[128];
+    char list[4096];
+    cpu_set_t nodes;
+    snprintf(path, sizeof(path), "%s/node/online", affinitySysfs);
+    FILE *file = fopen(path, "r");
+    if(file == NULL){
+        return;
+    }
+    //the online nodes are written like a CPU list
+    int nodeC = fgets(list, sizeof(list), file) != NULL ? parseCpuList(list, &nodes, NULL) : -1;
+    fclose(file);
+    for(int node = 0; nodeC > 0 && node < CPU_SETSIZE; node++){
+        if(!CPU_ISSET(node, &nodes)){
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/node/node%d/cpulist", affinitySysfs, node);
+        file = fopen(path, "r");
+        if(file == NULL){
+            continue;
+        }
+        cpu_set_t set;
+        if(fgets(list, sizeof(list), file) != NULL && parseCpuList(list, &set, NULL) > 0){
+            for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+                if(CPU_ISSET(cpu, &set)){
+                    nodeOf[cpu] = node;
+                }
+            }
+        }
+        fclose(file);
+    }
+}
+
+/**
+ * This function orders CPUs by node, package and core, the hyperthreads of a core next to each other (compact).
+ * Input parameters: a, b (struct cpuInfo)
+ * Returns: the order of a and b for qsort
+**/
+static int compactOrder(const void *a, const void *b){
+    const struct cpuInfo *x = a;
+    const struct cpuInfo *y = b;
+    if(x->node != y->node){
+        return x->node - y->node;
+    }
+    if(x->package != y->package){
+        return x->package - y->package;
+    }
+    if(x->core != y->core){
+        return x->core - y->core;
+    }
+    return x->cpu - y->cpu;
+}
+
+/**
+ * This function orders CPUs by node, then the first CPU of every core before the hyperthreads (scatter).
+ * Input parameters: a, b (struct cpuInfo)
+ * Returns: the order of a and b for qsort
+**/
+static int coresFirstOrder(const void *a, const void *b){
+    const struct cpuInfo *x = a;
+    const struct cpuInfo *y = b;
+    if(x->node != y->node){
+        return x->node - y->node;
+    }
+    if(x->sibling != y->sibling){
+        return x->sibling - y->sibling;
+    }
+    return compactOrder(a, b);
+}
+
+/**
+ * This function orders CPUs by number.
+ * Input parameters: a, b (struct cpuInfo)
+ * Returns: the order of a and b for qsort
+**/
+static int numberOrder(const void *a, const void *b){
+    return ((const struct cpuInfo *)a)->cpu - ((const struct cpuInfo *)b)->cpu;
+}
+
+/**
+ * This function gives slots a share of a run of CPUs: with fewer slots than CPUs, slot j of count gets the
+ * contiguous part j*n/count to (j+1)*n/count-1, otherwise CPU j mod n.
+ * Input parameters: j, count, n, start and end (to fill in, offsets in the run)
+ * Returns: nothing
+**/
+static void shareOf(int j, int count, int n, int *start, int *end){
+    if(count >= n){
+        *start = j % n;
+        *end = *start + 1;
+    }else{
+        *start = (int)((long)j * n / count);
+        *end = (int)((long)(j + 1) * n / count);
+    }
+}
+
+/**
+ * This function plans the placement of a number of slots over the CPUs this process may use.
+ * Input parameters: affinity (to fill in), policy (compact, scatter or a CPU list), slots
+ * Returns: 0 if successful (free it with affinityFree), -1 if the policy is unknown or lists a CPU this process
+ * cannot use (the reason is printed to stderr)
+**/
+int affinityInit(struct affinity *affinity, const char *policy, int slots){
+    memset(affinity, 0, sizeof(*affinity));
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) == -1){
+        perror("sched_getaffinity");
+        return -1;
+    }
+    bool compact = strcmp(policy, "compact") == 0;
+    bool scatter = strcmp(policy, "scatter") == 0;
+    int *listed = NULL;
+    int listC = 0;
+    if(!compact && !scatter){
+        cpu_set_t set;
+        listed = malloc(CPU_SETSIZE * sizeof(int));
+        if(listed == NULL){
+            perror("malloc");
+            return -1;
+        }
+        listC = parseCpuList(policy, &set, listed);
+        if(listC <= 0){
+            fprintf(stderr, "Error - affinity %s is not compact, scatter or a CPU list like 0,2,4-7.\n", policy);
+            free(listed);
+            return -1;
+        }
+        for(int i = 0; i < listC; i++){
+            if(!CPU_ISSET(listed[i], &allowed)){
+                fprintf(stderr, "Error - CPU %d of affinity %s cannot be used.\n", listed[i], policy);
+                free(listed);
+                return -1;
+            }
+        }
+    }
+
+    //where every CPU this process may use is
+    int *nodeOf = malloc(CPU_SETSIZE * sizeof(int));
+    struct cpuInfo *infos = malloc(CPU_SETSIZE * sizeof(struct cpuInfo));
+    if(nodeOf == NULL || infos == NULL){
+        perror("malloc");
+        free(nodeOf);
+        free(infos);
+        free(listed);
+        return -1;
+    }
+    readNodes(nodeOf);
+    int cpuC = 0;
+    char path[128];
+    for(int i = 0; listed != NULL ? i < listC : i < CPU_SETSIZE; i++){
+        int cpu = listed != NULL ? listed[i] : i;
+        if(listed == NULL && !CPU_ISSET(cpu, &allowed)){
+            continue;
+        }
+        struct cpuInfo *info = &infos[cpuC++];
+        info->cpu = cpu;
+        info->node = nodeOf[cpu];
+        snprintf(path, sizeof(path), "%s/cpu/cpu%d/topology/physical_package_id", affinitySysfs, cpu);
+        info->package = readNumber(path, 0);
+        snprintf(path, sizeof(path), "%s/cpu/cpu%d/topology/core_id", affinitySysfs, cpu);
+        info->core = readNumber(path, cpu);
+        info->sibling = 0;
+        for(int other = 0; other < cpuC - 1; other++){
+            struct cpuInfo *earlier = &infos[other];
+            info->sibling += earlier->package == info->package && earlier->core == info->core &&
+                             earlier->node == info->node;
+        }
+    }
+    free(nodeOf);
+    free(listed);
+    if(cpuC == 0){
+        fprintf(stderr, "Error - no CPU can be used.\n");
+        free(infos);
+        return -1;
+    }
+
+    //the order of the CPUs, in which the slots take their share
+    if(compact){
+        qsort(infos, cpuC, sizeof(struct cpuInfo), compactOrder);
+    }else if(scatter){
+        qsort(infos, cpuC, sizeof(struct cpuInfo), coresFirstOrder);
+    }
+    snprintf(affinity->policy, sizeof(affinity->policy), "%s", compact || scatter ? policy : "list");
+    affinity->slots = slots > 0 ? slots : 1;
+    slots = affinity->slots;
+    affinity->first = malloc((slots + 1) * sizeof(int));
+    affinity->cpus = malloc(((size_t)slots + cpuC) * sizeof(int));
+    affinity->nodes = malloc(((size_t)slots + cpuC) * sizeof(int));
+    if(affinity->first == NULL || affinity->cpus == NULL || affinity->nodes == NULL){
+        perror("malloc");
+        free(infos);
+        affinityFree(affinity);
+        return -1;
+    }
+
+    //the runs of CPUs the slots are spread over: every node for scatter when each node gets a slot, all of them
+    //otherwise
+    int runStart[maxNodes + 1];
+    int runC = 0;
+    runStart[runC++] = 0;
+    for(int i = 1; scatter && i < cpuC; i++){
+        if(infos[i].node != infos[i - 1].node && runC < maxNodes){
+            runStart[runC++] = i;
+        }
+    }
+    if(runC > slots){
+        runC = 1;
+    }
+    runStart[runC] = cpuC;
+    for(int run = 0; scatter && run < runC; run++){
+        //when the slots of a node share its CPUs they get whole cores: the node in compact order
+        int n = runStart[run + 1] - runStart[run];
+        if(slots / runC + (run < slots % runC ? 1 : 0) < n){
+            qsort(&infos[runStart[run]], n, sizeof(struct cpuInfo), compactOrder);
+        }
+    }
+
+    int next = 0;
+    for(int slot = 0; slot < slots; slot++){
+        int run = slot % runC;
+        int n = runStart[run + 1] - runStart[run];
+        int count = slots / runC + (run < slots % runC ? 1 : 0);
+        int start, end;
+        shareOf(slot / runC, count, n, &start, &end);
+        struct cpuInfo *share = &infos[runStart[run]];
+        //the order within a share does not matter (the shares of the slots do not overlap), sorted it reads as ranges
+        if(end - start > 1){
+            qsort(&share[start], end - start, sizeof(struct cpuInfo), numberOrder);
+        }
+        affinity->first[slot] = next;
+        for(int i = start; i < end; i++){
+            affinity->cpus[next] = share[i].cpu;
+            affinity->nodes[next++] = share[i].node;
+        }
+    }
+    affinity->first[slots] = next;
+    free(infos);
+    return 0;
+}
+
+/**
+ * This function pins the calling thread (a process right after fork, or a thread) to the CPUs of a slot. Slots
+ * past the last one wrap around.
+ * Input parameters: affinity, slot
+ * Returns: 0 if successful, -1 if the CPUs cannot be set
+**/
+int affinityPin(const struct affinity *affinity, int slot){
+    slot %= affinity->slots;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int i = affinity->first[slot]; i < affinity->first[slot + 1]; i++){
+        CPU_SET(affinity->cpus[i], &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/**
+ * This function describes the CPUs of a slot, like "cpus 0-3,8 (node 0)".
+ * Input parameters: affinity, slot, buffer, size
+ * Returns: nothing, buffer holds the description
+**/
+void affinityDescribe(const struct affinity *affinity, int slot, char *buffer, size_t size){
+    slot %= affinity->slots;
+    int first = affinity->first[slot];
+    int last = affinity->first[slot + 1];
+    size_t length = snprintf(buffer, size, "cpu%s ", last - first > 1 ? "s" : "");
+    for(int i = first; i < last && length < size; i++){
+        //consecutive CPUs are written as a range
+        int end = i;
+        while(end + 1 < last && affinity->cpus[end + 1] == affinity->cpus[end] + 1){
+            end++;
+        }
+        length += snprintf(buffer + length, size - length, i > first ? ",%d" : "%d", affinity->cpus[i]);
+        if(end > i && length < size){
+            length += snprintf(buffer + length, size - length, "-%d", affinity->cpus[end]);
+        }
+        i = end;
+    }
+    bool oneNode = true;
+    for(int i = first + 1; i < last; i++){
+        oneNode = oneNode && affinity->nodes[i] == affinity->nodes[first];
+    }
+    if(length < size){
+        if(oneNode){
+            snprintf(buffer + length, size - length, " (node %d)", affinity->nodes[first]);
+        }else{
+            snprintf(buffer + length, size - length, " (several nodes)");
+        }
+    }
+}
+
+/**
+ * This function frees a placement.
+ * Input parameters: affinity
+ * Returns: nothing
+**/
+void affinityFree(struct affinity *affinity){
+    free(affinity->first);
+    free(affinity->cpus);
+    free(affinity->nodes);
+    memset(affinity, 0, sizeof(*affinity));
+}
@@ -0,0 +1,37 @@
+/**
+ * Description: where the children, workers and threads of matrixmult_multiw_deep and matrixmult_parallel run. A
+ * placement gives each of a number of slots (a pool worker, a running child, a row child, a thread) a set of CPUs
+ * out of the ones this process may use, following a policy:
+ *  compact  fill the CPUs in topology order (node, package, core, then its hyperthreads), so neighbor slots share
+ *           caches and a node
+ *  scatter  spread the slots over the NUMA nodes (slot i on node i mod nodes) and over the physical cores of a node
+ *           before their hyperthreads
+ *  LIST     the CPUs of an explicit list such as 0,2,4-7, in that order
+ * With fewer slots than CPUs every slot gets a contiguous share of the order, otherwise one CPU (shared round-robin).
+ * The topology comes from sysfs; without it every CPU is its own core on node 0. A process pinned before it
+ * allocates its matrices gets them on its own node, as Linux places a page on the node of the first thread that
+ * touches it.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef MATRIX_AFFINITY_H
+#define MATRIX_AFFINITY_H
+
+#include <stddef.h>
+
+struct affinity {
+    char policy[16];    //compact, scatter or list
+    int slots;
+    int *first;         //slots + 1 offsets: the CPUs of slot i are cpus[first[i]] to cpus[first[i + 1] - 1]
+    int *cpus;
+    int *nodes;         //node of each entry of cpus
+};
+
+int affinityInit(struct affinity *affinity, const char *policy, int slots);
+int affinityPin(const struct affinity *affinity, int slot);
+void affinityDescribe(const struct affinity *affinity, int slot, char *buffer, size_t size);
+void affinityFree(struct affinity *affinity);
+
+#endif
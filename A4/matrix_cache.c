@@ -0,0 +1,311 @@
+/**
+ * Description: a cache of loaded matrix files with a memory budget and LRU eviction (see matrix_cache.h).
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "matrix_cache.h"
+#include "matrix_io.h"
+
+#define cacheBuckets 1024
+
+/**
+ * This function hashes a path (djb2).
+ * Input parameters: path
+ * Returns: the hash
+**/
+static unsigned long hashPath(const char *path){
+    unsigned long hash = 5381;
+    for(const unsigned char *c = (const unsigned char *)path; *c != '\0'; c++){
+        hash = hash * 33 + *c;
+    }
+    return hash;
+}
+
+/**
+ * This function initializes an empty cache.
+ * Input parameters: cache, budget (in bytes of matrix data)
+ * Returns: nothing, exit(1) if the allocation failed
+**/
+void cacheInit(struct matrixCache *cache, size_t budget){
+    memset(cache, 0, sizeof(*cache));
+    cache->bucketCount = cacheBuckets;
+    cache->buckets = calloc(cache->bucketCount, sizeof(struct cachedMatrix *));
+    if(cache->buckets == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    cache->budget = budget;
+    pthread_mutex_init(&cache->lock, NULL);
+}
+
+/**
+ * This function takes an entry out of the LRU list.
+ * Input parameters: cache, entry
+ * Returns: nothing
+**/
+static void unlinkEntry(struct matrixCache *cache, struct cachedMatrix *entry){
+    if(entry->newer != NULL){
+        entry->newer->older = entry->older;
+    }else{
+        cache->newest = entry->older;
+    }
+    if(entry->older != NULL){
+        entry->older->newer = entry->newer;
+    }else{
+        cache->oldest = entry->newer;
+    }
+    entry->newer = entry->older = NULL;
+}
+
+/**
+ * This function puts an entry at the front (most recently used) of the LRU list.
+ * Input parameters: cache, entry
+ * Returns: nothing
+**/
+static void linkNewest(struct matrixCache *cache, struct cachedMatrix *entry){
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if(cache->newest != NULL){
+        cache->newest->newer = entry;
+    }
+    cache->newest = entry;
+    if(cache->oldest == NULL){
+        cache->oldest = entry;
+    }
+}
+
+/**
+ * This function frees an entry.
+ * Input parameters: entry
+ * Returns: nothing
+**/
+static void freeEntry(struct cachedMatrix *entry){
+    free(entry->path);
+    free(entry->data);
+    free(entry);
+}
+
+/**
+ * This function removes an entry from the cache and frees it, or leaves it to its last cacheRelease if it is in use.
+ * Input parameters: cache, entry
+ * Returns: nothing
+**/
+static void removeEntry(struct matrixCache *cache, struct cachedMatrix *entry){
+    struct cachedMatrix **link = &cache->buckets[hashPath(entry->path) % cache->bucketCount];
+    while(*link != entry){
+        link = &(*link)->hashNext;
+    }
+    *link = entry->hashNext;
+    unlinkEntry(cache, entry);
+    cache->bytes -= entry->bytes;
+    entry->cached = false;
+    if(entry->users == 0){
+        freeEntry(entry);
+    }
+}
+
+/**
+ * This function looks for the entry of a path that is still valid for the file; an entry for an older version of
+ * the file is dropped. The lock must be held.
+ * Input parameters: cache, path, info (stat of the file)
+ * Returns: the entry, or NULL if there is none
+**/
+static struct cachedMatrix *findEntry(struct matrixCache *cache, const char *path, const struct stat *info){
+    struct cachedMatrix *entry = cache->buckets[hashPath(path) % cache->bucketCount];
+    while(entry != NULL && strcmp(entry->path, path) != 0){
+        entry = entry->hashNext;
+    }
+    if(entry == NULL){
+        return NULL;
+    }
+    if(entry->device == info->st_dev && entry->inode == info->st_ino && entry->fileSize == info->st_size &&
+       entry->modified.tv_sec == info->st_mtim.tv_sec && entry->modified.tv_nsec == info->st_mtim.tv_nsec){
+        unlinkEntry(cache, entry);
+        linkNewest(cache, entry);
+        return entry;
+    }
+    removeEntry(cache, entry);
+    return NULL;
+}
+
+/**
+ * This function adds a loaded entry to the cache if it fits in the budget, evicting the least recently used
+ * matrices that are not in use. The lock must be held.
+ * Input parameters: cache, entry
+ * Returns: nothing (entry->cached tells if it was kept)
+**/
+static void insertEntry(struct matrixCache *cache, struct cachedMatrix *entry){
+    if(entry->bytes > cache->budget){
+        return;
+    }
+    //make room, oldest first
+    struct cachedMatrix *victim = cache->oldest;
+    while(cache->bytes + entry->bytes > cache->budget && victim != NULL){
+        struct cachedMatrix *newer = victim->newer;
+        if(victim->users == 0){
+            removeEntry(cache, victim);
+            cache->evictions++;
+        }
+        victim = newer;
+    }
+    if(cache->bytes + entry->bytes > cache->budget){
+        return;
+    }
+    entry->cached = true;
+    unsigned long bucket = hashPath(entry->path) % cache->bucketCount;
+    entry->hashNext = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    linkNewest(cache, entry);
+    cache->bytes += entry->bytes;
+}
+
+/**
+ * This function loads a matrix file into a new entry.
+ * Input parameters: path, info (stat of the file)
+ * Returns: the entry, or NULL if the file cannot be read
+**/
+static struct cachedMatrix *loadEntry(const char *path, const struct stat *info){
+    int rows, cols;
+    if(matrixDimensions(path, &rows, &cols) == -1){
+        return NULL;
+    }
+    struct cachedMatrix *entry = calloc(1, sizeof(*entry));
+    if(entry == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    entry->size = rows > cols ? rows : cols;
+    if(entry->size < 1){
+        entry->size = 1;
+    }
+    entry->bytes = (size_t)entry->size * entry->size * sizeof(wElement);
+    entry->data = calloc((size_t)entry->size * entry->size, sizeof(wElement));
+    entry->path = strdup(path);
+    if(entry->data == NULL || entry->path == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    if(loadMatrix(path, entry->size, entry->data, wElementType) == -1){
+        freeEntry(entry);
+        return NULL;
+    }
+    entry->device = info->st_dev;
+    entry->inode = info->st_ino;
+    entry->fileSize = info->st_size;
+    entry->modified = info->st_mtim;
+    return entry;
+}
+
+/**
+ * This function returns the matrix of a file, from the cache if the file did not change since it was loaded,
+ * otherwise it is loaded (and cached if it fits in the budget, evicting the least recently used matrices).
+ * The file is read without the lock; if another thread cached it meanwhile, its entry is used.
+ * Input parameters: cache, path
+ * Returns: the matrix, to give back with cacheRelease, or NULL if the file cannot be read
+**/
+struct cachedMatrix *cacheGet(struct matrixCache *cache, const char *path){
+    struct stat info;
+    if(stat(path, &info) == -1){
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    struct cachedMatrix *entry = findEntry(cache, path, &info);
+    if(entry != NULL){
+        cache->hits++;
+        entry->users++;
+        pthread_mutex_unlock(&cache->lock);
+        return entry;
+    }
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    entry = loadEntry(path, &info);
+    if(entry == NULL){
+        return NULL;
+    }
+    pthread_mutex_lock(&cache->lock);
+    struct cachedMatrix *loaded = findEntry(cache, path, &info);
+    if(loaded != NULL){
+        freeEntry(entry);
+        entry = loaded;
+    }else{
+        //too big to keep, it is freed by cacheRelease
+        insertEntry(cache, entry);
+    }
+    entry->users++;
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+/**
+ * This function loads the matrix of a file into the cache, if it is not there yet, so a later cacheGet finds it.
+ * It is meant for a thread that reads ahead; errors are left to the cacheGet of the file.
+ * Input parameters: cache, path
+ * Returns: nothing
+**/
+void cachePrefetch(struct matrixCache *cache, const char *path){
+    struct stat info;
+    if(stat(path, &info) == -1){
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    bool present = findEntry(cache, path, &info) != NULL;
+    pthread_mutex_unlock(&cache->lock);
+    if(present){
+        return;
+    }
+
+    struct cachedMatrix *entry = loadEntry(path, &info);
+    if(entry == NULL){
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    if(findEntry(cache, path, &info) == NULL){
+        insertEntry(cache, entry);
+    }
+    if(entry->cached){
+        cache->prefetched++;
+    }else{
+        freeEntry(entry);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * This function gives back a matrix returned by cacheGet; it is freed if it is not kept in the cache.
+ * Input parameters: cache, entry
+ * Returns: nothing
+**/
+void cacheRelease(struct matrixCache *cache, struct cachedMatrix *entry){
+    if(entry == NULL){
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    entry->users--;
+    bool unused = !entry->cached && entry->users == 0;
+    pthread_mutex_unlock(&cache->lock);
+    if(unused){
+        freeEntry(entry);
+    }
+}
+
+/**
+ * This function frees the cache and all its matrices.
+ * Input parameters: cache
+ * Returns: nothing
+**/
+void cacheFree(struct matrixCache *cache){
+    while(cache->oldest != NULL){
+        removeEntry(cache, cache->oldest);
+    }
+    free(cache->buckets);
+    cache->buckets = NULL;
+    pthread_mutex_destroy(&cache->lock);
+}
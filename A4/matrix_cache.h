@@ -0,0 +1,62 @@
+/**
+ * Description: a cache of loaded matrix files for matrixmult_multiw_deep, so that W files used on many lines are
+ * read once. Entries are keyed by path and checked against the inode, size and modification time of the file, so a
+ * file that changed is read again. The cache has a memory budget and evicts the least recently used matrices.
+ * It can be shared with a thread that loads matrices ahead of time (cachePrefetch): the lookups are done under a
+ * lock, the files are read outside of it, and a matrix in use is not evicted until it is released.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef MATRIX_CACHE_H
+#define MATRIX_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "matrix_types.h"
+
+/**
+ * A loaded matrix, padded to a square size x size matrix (at least as big as the file's rows and columns) and
+ * converted to the W type.
+ */
+struct cachedMatrix {
+    char *path;
+    dev_t device;
+    ino_t inode;
+    off_t fileSize;
+    struct timespec modified;
+    int size;
+    wElement *data;
+    size_t bytes;
+    bool cached;                    //false if it is not (or no longer) in the cache, freed by its last release
+    int users;                      //cacheGet calls not released yet, it is not evicted while in use
+    struct cachedMatrix *hashNext;
+    struct cachedMatrix *newer;     //LRU list, most recently used first
+    struct cachedMatrix *older;
+};
+
+struct matrixCache {
+    pthread_mutex_t lock;
+    struct cachedMatrix **buckets;
+    int bucketCount;
+    struct cachedMatrix *newest;
+    struct cachedMatrix *oldest;
+    size_t bytes;
+    size_t budget;
+    long hits;
+    long misses;
+    long evictions;
+    long prefetched;    //matrices loaded by cachePrefetch
+};
+
+void cacheInit(struct matrixCache *cache, size_t budget);
+struct cachedMatrix *cacheGet(struct matrixCache *cache, const char *path);
+void cachePrefetch(struct matrixCache *cache, const char *path);
+void cacheRelease(struct matrixCache *cache, struct cachedMatrix *entry);
+void cacheFree(struct matrixCache *cache);
+
+#endif
@@ -0,0 +1,1101 @@
+/**
+ * Description: reading and writing matrix files in the text and binary formats (see matrix_io.h).
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matrix_io.h"
+#include "task_pool.h"
+
+_Static_assert(sizeof(int) == 4, "the binary format stores int as int32");
+_Static_assert(sizeof(float) == 4 && sizeof(double) == 8, "the binary format stores IEEE float and double");
+_Static_assert(sizeof(struct matrixFileHeader) == 64, "the binary header is 64 bytes");
+
+/**
+ * The names of the element types, indexed by dtype.
+ */
+static const char *typeNames[] = {NULL, "int32", "int8", "int16", "int64", "float", "double"};
+#define typeCount (int)(sizeof(typeNames) / sizeof(typeNames[0]))
+
+#define textChunkBytes (1 << 20)    //a text file is parsed by tasks of about this many bytes, split on line boundaries
+#define textBufferBytes (64 << 10)  //text output is formatted in a buffer of this size, written with one fwrite
+#define textElementLength 32        //most characters of an element in the text format, besides its width
+#define textBlockBytes (16 << 20)   //a text file counted or converted by blocks holds about this many bytes at a time
+
+/**
+ * The two digits of 0..99, so integers are formatted two digits at a time.
+ */
+static const char digitPairs[] = "00010203040506070809101112131415161718192021222324"
+                                 "25262728293031323334353637383940414243444546474849"
+                                 "50515253545556575859606162636465666768697071727374"
+                                 "75767778798081828384858687888990919293949596979899";
+
+/**
+ * This function returns the size of an element of a type.
+ * Input parameters: dtype
+ * Returns: the size in bytes, 0 for an unknown type
+**/
+size_t typeSize(int dtype){
+    switch(dtype){
+        case typeInt8: return 1;
+        case typeInt16: return 2;
+        case typeInt32: return 4;
+        case typeInt64: return 8;
+        case typeFloat: return 4;
+        case typeDouble: return 8;
+        default: return 0;
+    }
+}
+
+/**
+ * This function returns the name of a type.
+ * Input parameters: dtype
+ * Returns: the name, "unknown" for an unknown type
+**/
+const char *typeName(int dtype){
+    return dtype > 0 && dtype < typeCount ? typeNames[dtype] : "unknown";
+}
+
+/**
+ * This function finds a type by its name.
+ * Input parameters: name
+ * Returns: the dtype, -1 for an unknown name
+**/
+int typeFromName(const char *name){
+    for(int dtype = 1; dtype < typeCount; dtype++){
+        if(strcmp(typeNames[dtype], name) == 0){
+            return dtype;
+        }
+    }
+    return -1;
+}
+
+/**
+ * This function tells if a type holds real numbers.
+ * Input parameters: dtype
+ * Returns: true for float and double
+**/
+static bool isReal(int dtype){
+    return dtype == typeFloat || dtype == typeDouble;
+}
+
+/**
+ * This function reads element index of an integer matrix.
+ * Input parameters: matrix, dtype, index
+ * Returns: the value
+**/
+static int64_t getInteger(const void *matrix, int dtype, size_t index){
+    switch(dtype){
+        case typeInt8: return ((const int8_t *)matrix)[index];
+        case typeInt16: return ((const int16_t *)matrix)[index];
+        case typeInt64: return ((const int64_t *)matrix)[index];
+        case typeFloat: return (int64_t)((const float *)matrix)[index];
+        case typeDouble: return (int64_t)((const double *)matrix)[index];
+        default: return ((const int32_t *)matrix)[index];
+    }
+}
+
+/**
+ * This function reads element index of a matrix as a real number.
+ * Input parameters: matrix, dtype, index
+ * Returns: the value
+**/
+static double getReal(const void *matrix, int dtype, size_t index){
+    switch(dtype){
+        case typeFloat: return ((const float *)matrix)[index];
+        case typeDouble: return ((const double *)matrix)[index];
+        default: return (double)getInteger(matrix, dtype, index);
+    }
+}
+
+/**
+ * This function stores an integer in element index of a matrix, converted to its type (narrow integer types keep
+ * the low bits, like a cast).
+ * Input parameters: matrix, dtype, index, value
+ * Returns: nothing
+**/
+static void setInteger(void *matrix, int dtype, size_t index, int64_t value){
+    switch(dtype){
+        case typeInt8: ((int8_t *)matrix)[index] = (int8_t)value; break;
+        case typeInt16: ((int16_t *)matrix)[index] = (int16_t)value; break;
+        case typeInt64: ((int64_t *)matrix)[index] = value; break;
+        case typeFloat: ((float *)matrix)[index] = (float)value; break;
+        case typeDouble: ((double *)matrix)[index] = (double)value; break;
+        default: ((int32_t *)matrix)[index] = (int32_t)value; break;
+    }
+}
+
+/**
+ * This function stores a real number in element index of a matrix, converted to its type.
+ * Input parameters: matrix, dtype, index, value
+ * Returns: nothing
+**/
+static void setReal(void *matrix, int dtype, size_t index, double value){
+    switch(dtype){
+        case typeFloat: ((float *)matrix)[index] = (float)value; break;
+        case typeDouble: ((double *)matrix)[index] = value; break;
+        default: setInteger(matrix, dtype, index, (int64_t)value); break;
+    }
+}
+
+/**
+ * This function copies count elements from one matrix to another, converting them if the types differ.
+ * Input parameters: from, fromType, to, toType, count
+ * Returns: nothing
+**/
+static void convertElements(const void *from, int fromType, void *to, int toType, size_t count){
+    if(fromType == toType){
+        memcpy(to, from, count * typeSize(toType));
+    }else if(isReal(fromType) || isReal(toType)){
+        for(size_t i = 0; i < count; i++){
+            setReal(to, toType, i, getReal(from, fromType, i));
+        }
+    }else{
+        for(size_t i = 0; i < count; i++){
+            setInteger(to, toType, i, getInteger(from, fromType, i));
+        }
+    }
+}
+
+/**
+ * This function prints element index of a matrix, right-aligned in at least width characters. Real numbers are
+ * printed with enough digits to be read back exactly.
+ * Input parameters: file, width, matrix, dtype, index
+ * Returns: the number of characters printed, negative on error
+**/
+int printElement(FILE *file, int width, const void *matrix, int dtype, size_t index){
+    if(dtype == typeFloat){
+        return fprintf(file, "%*.9g", width, getReal(matrix, dtype, index));
+    }
+    if(dtype == typeDouble){
+        return fprintf(file, "%*.17g", width, getReal(matrix, dtype, index));
+    }
+    return fprintf(file, "%*" PRId64, width, getInteger(matrix, dtype, index));
+}
+
+/**
+ * This function formats an integer right-aligned in at least width characters, like printf "%*" PRId64, two digits
+ * at a time.
+ * Input parameters: out, width, value
+ * Returns: the end of the text (not terminated)
+**/
+static char *formatInteger(char *out, int width, int64_t value){
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *first = end;
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    while(magnitude >= 100){
+        const char *pair = &digitPairs[(magnitude % 100) * 2];
+        magnitude /= 100;
+        *--first = pair[1];
+        *--first = pair[0];
+    }
+    if(magnitude >= 10){
+        *--first = digitPairs[magnitude * 2 + 1];
+        *--first = digitPairs[magnitude * 2];
+    }else{
+        *--first = (char)('0' + magnitude);
+    }
+    if(value < 0){
+        *--first = '-';
+    }
+    int length = (int)(end - first);
+    for(int pad = width - length; pad > 0; pad--){
+        *out++ = ' ';
+    }
+    memcpy(out, first, length);
+    return out + length;
+}
+
+/**
+ * This function formats element index of a matrix exactly like printElement.
+ * Input parameters: out (room for width + textElementLength characters), width, matrix, dtype, index
+ * Returns: the end of the text (not terminated)
+**/
+static char *formatElement(char *out, int width, const void *matrix, int dtype, size_t index){
+    if(dtype == typeFloat){
+        return out + snprintf(out, width + textElementLength, "%*.9g", width, getReal(matrix, dtype, index));
+    }
+    if(dtype == typeDouble){
+        return out + snprintf(out, width + textElementLength, "%*.17g", width, getReal(matrix, dtype, index));
+    }
+    return formatInteger(out, width, getInteger(matrix, dtype, index));
+}
+
+/**
+ * This function writes the text formatted in a buffer once it holds more than limit characters.
+ * Input parameters: file, buffer, out (the end of the text, reset to buffer when written), limit
+ * Returns: 0 if successful, -1 if the text cannot be written
+**/
+static int flushText(FILE *file, char *buffer, char **out, size_t limit){
+    size_t length = (size_t)(*out - buffer);
+    if(length <= limit){
+        return 0;
+    }
+    *out = buffer;
+    return fwrite(buffer, 1, length, file) == length ? 0 : -1;
+}
+
+/**
+ * This function writes a matrix as text, one row per line, with no header. The rows are formatted in a buffer and
+ * written with one fwrite per buffer.
+ * Input parameters: file, rows, cols, matrix, stride (elements from one row to the next), dtype, width (of each
+ *                   element, see printElement), trailingSpace (every element is followed by a space, otherwise
+ *                   the elements are separated by one)
+ * Returns: 0 if successful, -1 if the text cannot be written
+**/
+int writeMatrixText(FILE *file, int rows, int cols, const void *matrix, int stride, int dtype, int width,
+                    bool trailingSpace){
+    size_t room = (size_t)width + textElementLength + 2;    //an element, its space and a newline
+    size_t capacity = room > textBufferBytes ? room : textBufferBytes;
+    char *buffer = malloc(capacity);
+    if(buffer == NULL){
+        return -1;
+    }
+    int status = 0;
+    char *out = buffer;
+    for(int i = 0; i < rows && status == 0; i++){
+        for(int j = 0; j < cols; j++){
+            status |= flushText(file, buffer, &out, capacity - room);
+            if(j > 0 && !trailingSpace){
+                *out++ = ' ';
+            }
+            out = formatElement(out, width, matrix, dtype, (size_t)i * stride + j);
+            if(trailingSpace){
+                *out++ = ' ';
+            }
+        }
+        status |= flushText(file, buffer, &out, capacity - room);
+        *out++ = '\n';
+    }
+    status |= flushText(file, buffer, &out, 0);
+    free(buffer);
+    return status;
+}
+
+/**
+ * This function reads and checks the header of a binary matrix file.
+ * Input parameters: fd, header (to fill in), fileSize
+ * Returns: 0 if the header is valid and the data fits in the file, -1 otherwise
+**/
+static int readHeader(int fd, struct matrixFileHeader *header, size_t fileSize){
+    if(pread(fd, header, sizeof(*header), 0) != sizeof(*header)){
+        return -1;
+    }
+    if(memcmp(header->magic, matrixMagic, sizeof(header->magic)) != 0 || header->version != matrixVersion ||
+       typeSize(header->dtype) == 0 || header->elementSize != typeSize(header->dtype)){
+        return -1;
+    }
+    size_t dataSize = (size_t)header->rows * header->cols * header->elementSize;
+    if(header->dataOffset < sizeof(*header) || header->dataOffset + dataSize > fileSize){
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * A piece of a text file parsed by one task: whole lines, from start to end.
+ */
+struct textChunk {
+    size_t start;
+    size_t end;
+    int rows;       //lines that are rows of the matrix
+    int cols;       //most numbers in one of its lines
+    int firstRow;   //row of its first line
+};
+
+/**
+ * What the tasks parsing a text file share.
+ */
+struct textParse {
+    const char *text;           //ends with a '\0', or a '\n' for a block of a file (see nextTextBlock)
+    struct textChunk *chunks;
+    bool countCols;             //the numbers of the rows are counted too (the dimensions)
+    int firstRow;
+    int rows;                   //rows firstRow..firstRow+rows-1 are parsed
+    int cols;                   //values kept per row, and elements from one row of matrix to the next
+    void *matrix;
+    int dtype;
+};
+
+/**
+ * This function reads a whole text file into memory.
+ * Input parameters: filename, length (to store in)
+ * Returns: the text, terminated by a '\0', to free; NULL if the file cannot be read
+**/
+static char *readText(const char *filename, size_t *length){
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1){
+        return NULL;
+    }
+    struct stat info;
+    size_t capacity = fstat(fd, &info) == 0 && info.st_size > 0 ? (size_t)info.st_size + 1 : 4096;
+    char *text = malloc(capacity);
+    ssize_t bytes = 1;
+    *length = 0;
+    while(text != NULL && bytes > 0){
+        if(*length + 1 == capacity){
+            //the file grew, or its size is not known
+            char *grown = realloc(text, capacity * 2);
+            if(grown == NULL){
+                free(text);
+                text = NULL;
+                break;
+            }
+            text = grown;
+            capacity *= 2;
+        }
+        bytes = read(fd, text + *length, capacity - 1 - *length);
+        if(bytes > 0){
+            *length += bytes;
+        }
+    }
+    close(fd);
+    if(text == NULL || bytes == -1){
+        free(text);
+        return NULL;
+    }
+    text[*length] = '\0';
+    return text;
+}
+
+/**
+ * A text file read by blocks of whole lines, so a file bigger than the memory can be counted and converted.
+ */
+struct textBlocks {
+    int fd;
+    char *text;         //the current block, then the start of the next one; capacity + 1 bytes for a '\0'
+    size_t capacity;
+    size_t length;      //bytes read into text
+    size_t used;        //bytes of the current block
+    bool end;           //the whole file was read
+};
+
+/**
+ * This function opens a text file to read it by blocks (see nextTextBlock).
+ * Input parameters: filename, blocks (to fill in, close with closeTextBlocks)
+ * Returns: 0 if successful, -1 if the file cannot be opened or the buffer allocated
+**/
+static int openTextBlocks(const char *filename, struct textBlocks *blocks){
+    memset(blocks, 0, sizeof(*blocks));
+    blocks->fd = open(filename, O_RDONLY);
+    if(blocks->fd == -1){
+        return -1;
+    }
+    blocks->capacity = textBlockBytes;
+    blocks->text = malloc(blocks->capacity + 1);
+    if(blocks->text == NULL){
+        close(blocks->fd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function reads the next block of a text file: as many whole lines as fit in the buffer (a line longer than
+ * it grows it), or the rest of the file, without its last newline, at the end.
+ * Input parameters: blocks
+ * Returns: the length of the block at blocks->text, 0 at the end of the file, -1 if the file cannot be read
+**/
+static ssize_t nextTextBlock(struct textBlocks *blocks){
+    //the partial line after the previous block moves to the front
+    memmove(blocks->text, blocks->text + blocks->used, blocks->length - blocks->used);
+    blocks->length -= blocks->used;
+    blocks->used = 0;
+    while(true){
+        while(!blocks->end && blocks->length < blocks->capacity){
+            ssize_t bytes = read(blocks->fd, blocks->text + blocks->length, blocks->capacity - blocks->length);
+            if(bytes == -1){
+                return -1;
+            }
+            blocks->end = bytes == 0;
+            blocks->length += bytes;
+        }
+        if(blocks->end){
+            blocks->text[blocks->length] = '\0';
+            blocks->used = blocks->length;
+            return blocks->length;
+        }
+        size_t last = blocks->length;
+        while(last > 0 && blocks->text[last - 1] != '\n'){
+            last--;
+        }
+        if(last > 0){
+            blocks->used = last;
+            return last;
+        }
+        char *grown = realloc(blocks->text, blocks->capacity * 2 + 1);
+        if(grown == NULL){
+            return -1;
+        }
+        blocks->text = grown;
+        blocks->capacity *= 2;
+    }
+}
+
+/**
+ * This function closes a text file read by blocks.
+ * Input parameters: blocks
+ * Returns: nothing
+**/
+static void closeTextBlocks(struct textBlocks *blocks){
+    close(blocks->fd);
+    free(blocks->text);
+    blocks->text = NULL;
+}
+
+/**
+ * This function splits a text into chunks of whole lines, about textChunkBytes each.
+ * Input parameters: text, start, length (the lines are text[start..length-1]), count (to store in)
+ * Returns: the chunks, to free; NULL if out of memory
+**/
+static struct textChunk *splitText(const char *text, size_t start, size_t length, int *count){
+    *count = (int)((length - start) / textChunkBytes) + 1;
+    struct textChunk *chunks = calloc(*count, sizeof(struct textChunk));
+    size_t from = start;
+    for(int c = 0; chunks != NULL && c < *count; c++){
+        size_t end = start + (length - start) * (c + 1) / *count;
+        end = end > from ? end : from;
+        const char *newline = memchr(text + end, '\n', length - end);
+        end = newline != NULL ? (size_t)(newline - text) + 1 : length;
+        chunks[c].start = from;
+        chunks[c].end = end;
+        from = end;
+    }
+    return chunks;
+}
+
+/**
+ * This function tells if a character separates the numbers of a line (the newline ends the line).
+ * Input parameters: c
+ * Returns: true for a space, a tab or a carriage return
+**/
+static inline bool isSeparator(char c){
+    return (c == ' ') | (c == '\t') | (c == '\r');
+}
+
+/**
+ * This function finds the end of the line starting at line.
+ * Input parameters: line, stop (end of the chunk)
+ * Returns: its newline, or stop for a last line without one
+**/
+static inline const char *lineEnd(const char *line, const char *stop){
+    const char *newline = memchr(line, '\n', stop - line);
+    return newline != NULL ? newline : stop;
+}
+
+/**
+ * This function reads a decimal integer like strtoll(text, NULL, 10) on a number of a line: an optional sign and
+ * digits, up to the first other character; no digits is 0 and a value out of range is clamped.
+ * Input parameters: text (a number of a text ending with a '\0', so the digits always end)
+ * Returns: the value
+**/
+static int64_t scanInteger(const char *text){
+    bool negative = *text == '-';
+    text += (*text == '-') | (*text == '+');
+    while(*text == '0'){
+        text++;
+    }
+    uint64_t value = 0;
+    int digits = 0;
+    for(unsigned digit = (unsigned)(*text - '0'); digit < 10; digit = (unsigned)(*++text - '0')){
+        value = value * 10 + digit;
+        digits++;
+    }
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    if(digits > 19 || value > limit){
+        value = limit;
+    }
+    return negative ? (int64_t)(0 - value) : (int64_t)value;
+}
+
+/**
+ * This function counts the lines of a chunk that are rows ('#' lines are not), and with countCols the most numbers
+ * in one of them (a task of runTasks, see task_pool.h).
+ * Input parameters: context (struct textParse), task (the chunk), thread
+ * Returns: nothing
+**/
+static void countChunk(void *context, int task, int thread){
+    struct textParse *parse = context;
+    struct textChunk *chunk = &parse->chunks[task];
+    const char *stop = parse->text + chunk->end;
+    for(const char *line = parse->text + chunk->start; line < stop; line = lineEnd(line, stop) + 1){
+        if(*line == '#'){
+            continue;
+        }
+        chunk->rows++;
+        if(!parse->countCols){
+            continue;
+        }
+        int count = 0;
+        for(const char *p = line, *end = lineEnd(line, stop); p < end; count++){
+            while(p < end && isSeparator(*p)){
+                p++;
+            }
+            if(p == end){
+                break;
+            }
+            while(p < end && !isSeparator(*p)){
+                p++;
+            }
+        }
+        chunk->cols = count > chunk->cols ? count : chunk->cols;
+    }
+}
+
+/**
+ * This function stores the numbers of one line in a row of the matrix; numbers past cols are ignored and missing
+ * ones are left as they are.
+ * Input parameters: parse, line, end (of the line), row (of the matrix)
+ * Returns: nothing
+**/
+static void parseLine(const struct textParse *parse, const char *line, const char *end, int row){
+    size_t index = (size_t)row * parse->cols;
+    bool real = isReal(parse->dtype);
+    for(int j = 0; j < parse->cols; j++){
+        while(line < end && isSeparator(*line)){
+            line++;
+        }
+        if(line == end){
+            return;
+        }
+        if(real){
+            setReal(parse->matrix, parse->dtype, index + j, strtod(line, NULL));
+        }else{
+            setInteger(parse->matrix, parse->dtype, index + j, scanInteger(line));
+        }
+        while(line < end && !isSeparator(*line)){
+            line++;
+        }
+    }
+}
+
+/**
+ * This function parses the rows of a chunk that are in rows firstRow..firstRow+rows-1 (a task of runTasks).
+ * Input parameters: context (struct textParse), task (the chunk), thread
+ * Returns: nothing
+**/
+static void parseChunk(void *context, int task, int thread){
+    struct textParse *parse = context;
+    const struct textChunk *chunk = &parse->chunks[task];
+    int row = chunk->firstRow;
+    int last = parse->firstRow + parse->rows;
+    if(row + chunk->rows <= parse->firstRow){
+        return;
+    }
+    const char *stop = parse->text + chunk->end;
+    for(const char *line = parse->text + chunk->start; line < stop && row < last; line = lineEnd(line, stop) + 1){
+        if(*line == '#'){
+            continue;
+        }
+        if(row >= parse->firstRow){
+            parseLine(parse, line, lineEnd(line, stop), row - parse->firstRow);
+        }
+        row++;
+    }
+}
+
+/**
+ * This function detects the format of a matrix file from its first bytes.
+ * Input parameters: filename
+ * Returns: formatBinary, formatText, or formatMissing if the file cannot be opened
+**/
+int matrixFormat(const char *filename){
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1){
+        return formatMissing;
+    }
+    char magic[8];
+    ssize_t bytes = read(fd, magic, sizeof(magic));
+    close(fd);
+    if(bytes == sizeof(magic) && memcmp(magic, matrixMagic, sizeof(magic)) == 0){
+        return formatBinary;
+    }
+    return formatText;
+}
+
+/**
+ * This function finds the dimensions of the matrix stored in a file.
+ * A binary file has them in its header. In a text file, if the first line is a header of the form "# rows cols"
+ * it is used, otherwise the number of rows is the number of lines that are not '#' lines (which loading skips) and
+ * the number of columns is the longest row (in numbers). A text file is read by blocks, so it does not have to fit
+ * in memory, and each block is counted by chunks in parallel.
+ * Input parameters: filename, rows and cols (to store in)
+ * Returns: 0 if successful, -1 if the file cannot be read (or is a broken binary file)
+**/
+int matrixDimensions(const char *filename, int *rows, int *cols){
+    if(matrixFormat(filename) == formatBinary){
+        struct mappedMatrix mapped;
+        if(mapMatrix(filename, &mapped) == -1){
+            return -1;
+        }
+        *rows = mapped.rows;
+        *cols = mapped.cols;
+        unmapMatrix(&mapped);
+        return 0;
+    }
+
+    struct textBlocks blocks;
+    if(openTextBlocks(filename, &blocks) == -1){
+        return -1;
+    }
+    *rows = 0;
+    *cols = 0;
+
+    //the file is counted by blocks, so it does not have to fit in memory
+    ssize_t length;
+    bool first = true;
+    while((length = nextTextBlock(&blocks)) > 0){
+        const char *text = blocks.text;
+        size_t start = 0;
+
+        //'#' lines before the first row: a header gives the dimensions directly, the others are skipped
+        while(first && start < (size_t)length && text[start] == '#'){
+            size_t end = (size_t)(lineEnd(text + start, text + length) - text);
+            char header[64];
+            size_t headerLength = end - start - 1 < sizeof(header) - 1 ? end - start - 1 : sizeof(header) - 1;
+            memcpy(header, text + start + 1, headerLength);
+            header[headerLength] = '\0';
+            if(sscanf(header, "%d %d", rows, cols) == 2){
+                closeTextBlocks(&blocks);
+                return 0;
+            }
+            *rows = 0;
+            start = end + 1;
+        }
+        first = false;
+
+        //count the lines and the numbers of the rest, by chunks in parallel
+        int count;
+        struct textParse parse = {text, splitText(text, start < (size_t)length ? start : length, length, &count), true};
+        if(parse.chunks == NULL){
+            closeTextBlocks(&blocks);
+            return -1;
+        }
+        runTasks(availableCores(), count, countChunk, &parse, NULL);
+        for(int c = 0; c < count; c++){
+            *rows += parse.chunks[c].rows;
+            *cols = parse.chunks[c].cols > *cols ? parse.chunks[c].cols : *cols;
+        }
+        free(parse.chunks);
+    }
+    closeTextBlocks(&blocks);
+    return length == -1 ? -1 : 0;
+}
+
+/**
+ * This function converts a text matrix file to a binary matrix file by blocks of lines, so neither has to fit in
+ * memory: the dimensions are counted first (see matrixDimensions), then the rows of each block are parsed by
+ * chunks in parallel, like loadMatrix does, and written with writeMatrixTile.
+ * Input parameters: textFile, binaryFile, dtype (of the binary file), rows and cols (to store in)
+ * Returns: 0 if successful, -1 if a file cannot be read or written
+**/
+int convertTextMatrix(const char *textFile, const char *binaryFile, int dtype, int *rows, int *cols){
+    struct tiledMatrix tiled;
+    struct textBlocks blocks;
+    if(matrixDimensions(textFile, rows, cols) == -1 || openTextBlocks(textFile, &blocks) == -1){
+        return -1;
+    }
+    if(createTiledMatrix(binaryFile, *rows, *cols, dtype, &tiled) == -1){
+        closeTextBlocks(&blocks);
+        return -1;
+    }
+
+    size_t rowBytes = (size_t)*cols * typeSize(dtype);
+    void *matrix = NULL;
+    int capacity = 0;
+    int done = 0;
+    int status = 0;
+    int threads = availableCores();
+    ssize_t length;
+    while(status == 0 && (length = nextTextBlock(&blocks)) > 0){
+        //the chunks count their rows, so each one knows where its first line goes in the block
+        int count;
+        struct textParse parse = {blocks.text, splitText(blocks.text, 0, length, &count), false, 0, 0, *cols, NULL,
+                                  dtype};
+        if(parse.chunks == NULL){
+            status = -1;
+            break;
+        }
+        runTasks(threads, count, countChunk, &parse, NULL);
+        for(int c = 0; c < count; c++){
+            parse.chunks[c].firstRow = parse.rows;
+            parse.rows += parse.chunks[c].rows;
+        }
+        if(parse.rows > capacity){
+            void *grown = realloc(matrix, parse.rows * rowBytes);
+            if(grown == NULL){
+                free(parse.chunks);
+                status = -1;
+                break;
+            }
+            matrix = grown;
+            capacity = parse.rows;
+        }
+        if(parse.rows > 0){
+            memset(matrix, 0, parse.rows * rowBytes);
+            parse.matrix = matrix;
+            runTasks(threads, count, parseChunk, &parse, NULL);
+            status = writeMatrixTile(&tiled, done, 0, parse.rows, *cols, matrix, *cols);
+            done += parse.rows;
+        }
+        free(parse.chunks);
+    }
+    if(status == 0 && length == -1){
+        status = -1;
+    }
+    free(matrix);
+    closeTextBlocks(&blocks);
+    return closeTiledMatrix(&tiled) == -1 ? -1 : status;
+}
+
+/**
+ * This function maps a binary matrix file in memory, so its data can be used without copying or parsing it.
+ * Input parameters: filename, mapped (to fill in)
+ * Returns: 0 if successful, -1 if the file cannot be opened or is not a valid binary matrix file
+**/
+int mapMatrix(const char *filename, struct mappedMatrix *mapped){
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1){
+        return -1;
+    }
+    struct stat info;
+    struct matrixFileHeader header;
+    if(fstat(fd, &info) == -1 || readHeader(fd, &header, info.st_size) == -1){
+        close(fd);
+        return -1;
+    }
+    mapped->length = info.st_size;
+    mapped->base = mmap(NULL, mapped->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped->base == MAP_FAILED){
+        mapped->base = NULL;
+        return -1;
+    }
+    mapped->rows = header.rows;
+    mapped->cols = header.cols;
+    mapped->dtype = header.dtype;
+    mapped->data = (const char *)mapped->base + header.dataOffset;
+    return 0;
+}
+
+/**
+ * This function unmaps a matrix mapped by mapMatrix.
+ * Input parameters: mapped
+ * Returns: nothing
+**/
+void unmapMatrix(struct mappedMatrix *mapped){
+    if(mapped->base != NULL){
+        munmap(mapped->base, mapped->length);
+        mapped->base = NULL;
+        mapped->data = NULL;
+    }
+}
+
+/**
+ * This function reads a matrix file (text or binary) into a size x size matrix of the given type.
+ * Rows may be of any length; values past size are ignored and missing values are left as they are (0 after
+ * initialization). A binary file of another type is converted; text values are read as integers, or as real
+ * numbers for float and double. A large text file is parsed by chunks of whole lines in parallel.
+ * Input parameters: filename, size, matrix (size*size elements, row after row), dtype
+ * Returns: 0 if successful, -1 if the file cannot be read
+**/
+int loadMatrix(const char *filename, int size, void *matrix, int dtype){
+    return loadMatrixRows(filename, 0, size, matrix, dtype);
+}
+
+/**
+ * This function reads rows firstRow..firstRow+size-1 of a matrix file into a size x size matrix, like loadMatrix,
+ * for files holding several matrices one under the other.
+ * Input parameters: filename, firstRow, size, matrix (size*size elements, row after row), dtype
+ * Returns: 0 if successful, -1 if the file cannot be read
+**/
+int loadMatrixRows(const char *filename, int firstRow, int size, void *matrix, int dtype){
+    return loadMatrixBlock(filename, firstRow, size, size, matrix, dtype);
+}
+
+/**
+ * This function reads rows firstRow..firstRow+rows-1 of a matrix file into a rows x cols matrix, like loadMatrix
+ * for a matrix that is not square: values past cols are ignored and missing ones are left as they are.
+ * Input parameters: filename, firstRow, rows, cols, matrix (rows*cols elements, row after row), dtype
+ * Returns: 0 if successful, -1 if the file cannot be read
+**/
+int loadMatrixBlock(const char *filename, int firstRow, int rows, int cols, void *matrix, int dtype){
+    size_t elementSize = typeSize(dtype);
+    if(matrixFormat(filename) == formatBinary){
+        struct mappedMatrix mapped;
+        if(mapMatrix(filename, &mapped) == -1){
+            return -1;
+        }
+        int copied = mapped.rows - firstRow < rows ? mapped.rows - firstRow : rows;
+        int width = mapped.cols < cols ? mapped.cols : cols;
+        size_t mappedSize = typeSize(mapped.dtype);
+        for(int i = 0; i < copied; i++){
+            convertElements((const char *)mapped.data + (size_t)(firstRow + i) * mapped.cols * mappedSize,
+                            mapped.dtype, (char *)matrix + (size_t)i * cols * elementSize, dtype, width);
+        }
+        unmapMatrix(&mapped);
+        return 0;
+    }
+
+    size_t length;
+    char *text = readText(filename, &length);
+    if(text == NULL){
+        return -1;
+    }
+
+    //the chunks count their rows first, so each one knows the row of its first line, then they are parsed in
+    //parallel; the dimensions header and the other '#' lines are skipped
+    int count;
+    struct textParse parse = {text, splitText(text, 0, length, &count), false, firstRow, rows, cols, matrix, dtype};
+    if(parse.chunks == NULL){
+        free(text);
+        return -1;
+    }
+    int threads = availableCores();
+    runTasks(threads, count, countChunk, &parse, NULL);
+    for(int c = 1; c < count; c++){
+        parse.chunks[c].firstRow = parse.chunks[c - 1].firstRow + parse.chunks[c - 1].rows;
+    }
+    runTasks(threads, count, parseChunk, &parse, NULL);
+    free(parse.chunks);
+    free(text);
+    return 0;
+}
+
+/**
+ * This function writes a matrix in the text format, with a "# rows cols" header line.
+ * Input parameters: filename, rows, cols, matrix, stride (elements from one row to the next), dtype
+ * Returns: 0 if successful, -1 if the file cannot be written
+**/
+int saveMatrixText(const char *filename, int rows, int cols, const void *matrix, int stride, int dtype){
+    FILE *file = fopen(filename, "w");
+    if(file == NULL){
+        return -1;
+    }
+    fprintf(file, "# %d %d\n", rows, cols);
+    int status = writeMatrixText(file, rows, cols, matrix, stride, dtype, 0, false);
+    return fclose(file) == 0 ? status : -1;
+}
+
+/**
+ * This function fills in the header of a binary matrix file.
+ * Input parameters: header, rows, cols, dtype
+ * Returns: nothing
+**/
+static void fillHeader(struct matrixFileHeader *header, int rows, int cols, int dtype){
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, matrixMagic, sizeof(header->magic));
+    header->version = matrixVersion;
+    header->dtype = dtype;
+    header->elementSize = typeSize(dtype);
+    header->rows = rows;
+    header->cols = cols;
+    header->alignment = matrixAlignment;
+    header->dataOffset = (sizeof(*header) + matrixAlignment - 1) / matrixAlignment * matrixAlignment;
+}
+
+/**
+ * This function writes a matrix in the binary format.
+ * Input parameters: filename, rows, cols, matrix, stride (elements from one row to the next), dtype
+ * Returns: 0 if successful, -1 if the file cannot be written
+**/
+int saveMatrixBinary(const char *filename, int rows, int cols, const void *matrix, int stride, int dtype){
+    FILE *file = fopen(filename, "wb");
+    if(file == NULL){
+        return -1;
+    }
+    struct matrixFileHeader header;
+    fillHeader(&header, rows, cols, dtype);
+
+    int status = fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -1;
+    for(size_t pad = sizeof(header); status == 0 && pad < header.dataOffset; pad++){
+        status = fputc(0, file) == EOF ? -1 : 0;
+    }
+    for(int i = 0; status == 0 && i < rows; i++){
+        const char *row = (const char *)matrix + (size_t)i * stride * header.elementSize;
+        if(fwrite(row, header.elementSize, cols, file) != (size_t)cols){
+            status = -1;
+        }
+    }
+    if(fclose(file) != 0){
+        status = -1;
+    }
+    return status;
+}
+
+/**
+ * This function reads or writes a whole buffer at an offset of a file, going on after short transfers.
+ * Input parameters: fd, buffer, bytes, offset, writing (false to read)
+ * Returns: 0 if successful, -1 on an error or at the end of the file
+**/
+static int transferFully(int fd, void *buffer, size_t bytes, off_t offset, bool writing){
+    char *next = buffer;
+    while(bytes > 0){
+        ssize_t done = writing ? pwrite(fd, next, bytes, offset) : pread(fd, next, bytes, offset);
+        if(done == -1 && errno == EINTR){
+            continue;
+        }
+        if(done <= 0){
+            return -1;
+        }
+        next += done;
+        bytes -= done;
+        offset += done;
+    }
+    return 0;
+}
+
+/**
+ * This function opens a binary matrix file to read it by tiles. Text files cannot be read by tiles.
+ * Input parameters: filename, tiled (to fill in, close with closeTiledMatrix)
+ * Returns: 0 if successful, -1 if the file cannot be opened or is not a valid binary matrix file
+**/
+int openTiledMatrix(const char *filename, struct tiledMatrix *tiled){
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1){
+        return -1;
+    }
+    struct stat info;
+    struct matrixFileHeader header;
+    if(fstat(fd, &info) == -1 || readHeader(fd, &header, info.st_size) == -1){
+        close(fd);
+        return -1;
+    }
+    tiled->fd = fd;
+    tiled->rows = header.rows;
+    tiled->cols = header.cols;
+    tiled->dtype = header.dtype;
+    tiled->dataOffset = header.dataOffset;
+    return 0;
+}
+
+/**
+ * This function creates a binary matrix file of rows x cols elements of 0 (a sparse file, the data takes no disk
+ * space until it is written), to write it by tiles.
+ * Input parameters: filename, rows, cols, dtype, tiled (to fill in, close with closeTiledMatrix)
+ * Returns: 0 if successful, -1 if the file cannot be written
+**/
+int createTiledMatrix(const char *filename, int rows, int cols, int dtype, struct tiledMatrix *tiled){
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if(fd == -1){
+        return -1;
+    }
+    struct matrixFileHeader header;
+    fillHeader(&header, rows, cols, dtype);
+    char start[(sizeof(header) + matrixAlignment - 1) / matrixAlignment * matrixAlignment] = {0};
+    memcpy(start, &header, sizeof(header));
+    size_t dataSize = (size_t)rows * cols * header.elementSize;
+    if(transferFully(fd, start, header.dataOffset, 0, true) == -1 ||
+       ftruncate(fd, header.dataOffset + dataSize) == -1){
+        close(fd);
+        return -1;
+    }
+    tiled->fd = fd;
+    tiled->rows = rows;
+    tiled->cols = cols;
+    tiled->dtype = dtype;
+    tiled->dataOffset = header.dataOffset;
+    return 0;
+}
+
+/**
+ * This function reads the rows x cols tile at (firstRow, firstCol) of a tiled matrix into a matrix of the given type,
+ * converting the values if the file has another type. The part of the tile past the end of the file is filled with
+ * 0s, like loadMatrix pads a matrix.
+ * Input parameters: tiled, firstRow, firstCol, rows, cols, tile, stride (elements from one row of the tile to the
+ * next), dtype
+ * Returns: 0 if successful, -1 if the file cannot be read
+**/
+int readMatrixTile(const struct tiledMatrix *tiled, int firstRow, int firstCol, int rows, int cols, void *tile,
+                   int stride, int dtype){
+    size_t fileSize = typeSize(tiled->dtype);
+    size_t elementSize = typeSize(dtype);
+    int inRows = tiled->rows - firstRow < rows ? tiled->rows - firstRow : rows;
+    int inCols = tiled->cols - firstCol < cols ? tiled->cols - firstCol : cols;
+    inRows = inRows > 0 && inCols > 0 ? inRows : 0;
+    off_t offset = tiled->dataOffset + ((off_t)firstRow * tiled->cols + firstCol) * fileSize;
+    //whole rows of the same type are read at once
+    int row = 0;
+    if(tiled->dtype == dtype && inCols == tiled->cols && stride == inCols && inRows > 0){
+        if(transferFully(tiled->fd, tile, (size_t)inRows * inCols * fileSize, offset, false) == -1){
+            return -1;
+        }
+        row = inRows;
+    }
+    int64_t chunk[512];     //the values of another type are read a chunk at a time and converted
+    int chunkElements = sizeof(chunk) / fileSize;
+    for(; row < inRows; row++){
+        char *to = (char *)tile + (size_t)row * stride * elementSize;
+        off_t rowOffset = offset + (off_t)row * tiled->cols * fileSize;
+        if(tiled->dtype == dtype){
+            if(transferFully(tiled->fd, to, inCols * fileSize, rowOffset, false) == -1){
+                return -1;
+            }
+            continue;
+        }
+        for(int j = 0; j < inCols; j += chunkElements){
+            int count = inCols - j < chunkElements ? inCols - j : chunkElements;
+            if(transferFully(tiled->fd, chunk, count * fileSize, rowOffset + (off_t)j * fileSize, false) == -1){
+                return -1;
+            }
+            convertElements(chunk, tiled->dtype, to + j * elementSize, dtype, count);
+        }
+    }
+    for(int i = 0; i < rows; i++){
+        int from = i < inRows ? inCols : 0;
+        memset((char *)tile + ((size_t)i * stride + from) * elementSize, 0, (cols - from) * elementSize);
+    }
+    return 0;
+}
+
+/**
+ * This function writes the rows x cols tile at (firstRow, firstCol) of a tiled matrix, from a matrix of the type of
+ * the file. The part of the tile past the end of the file is not written.
+ * Input parameters: tiled, firstRow, firstCol, rows, cols, tile, stride (elements from one row of the tile to the
+ * next)
+ * Returns: 0 if successful, -1 if the file cannot be written
+**/
+int writeMatrixTile(const struct tiledMatrix *tiled, int firstRow, int firstCol, int rows, int cols, const void *tile,
+                    int stride){
+    size_t elementSize = typeSize(tiled->dtype);
+    int inRows = tiled->rows - firstRow < rows ? tiled->rows - firstRow : rows;
+    int inCols = tiled->cols - firstCol < cols ? tiled->cols - firstCol : cols;
+    off_t offset = tiled->dataOffset + ((off_t)firstRow * tiled->cols + firstCol) * elementSize;
+    if(inRows <= 0 || inCols <= 0){
+        return 0;
+    }
+    if(inCols == tiled->cols && stride == inCols){
+        return transferFully(tiled->fd, (void *)tile, (size_t)inRows * inCols * elementSize, offset, true);
+    }
+    for(int i = 0; i < inRows; i++){
+        if(transferFully(tiled->fd, (char *)tile + (size_t)i * stride * elementSize, inCols * elementSize,
+                         offset + (off_t)i * tiled->cols * elementSize, true) == -1){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * This function closes a tiled matrix.
+ * Input parameters: tiled
+ * Returns: 0 if successful, -1 if the file could not be closed (a write that failed late)
+**/
+int closeTiledMatrix(struct tiledMatrix *tiled){
+    int status = close(tiled->fd);
+    tiled->fd = -1;
+    return status;
+}
@@ -0,0 +1,105 @@
+/**
+ * Description: reading and writing matrix files, shared by matrixmult_parallel, matrixmult_multiw_deep and
+ * matrixconvert. Two formats are supported and detected automatically when a file is loaded:
+ *  - text: one row per line, numbers separated by whitespace, with an optional "# rows cols" header line. Large
+ *    files are parsed by chunks of whole lines in parallel, and matrices are written through a buffer.
+ *  - binary: a 64-byte header (struct matrixFileHeader) followed by the rows of values in native byte order,
+ *    starting at an aligned offset so the file can be mapped and used in place. The values are int8, int16, int32,
+ *    int64, float or double (dtype); a file is converted when it is loaded as another type.
+ * A binary file can also be read and written by tiles (struct tiledMatrix), for matrices that do not fit in memory,
+ * and convertTextMatrix makes one from a text file without loading it.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef MATRIX_IO_H
+#define MATRIX_IO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define matrixMagic "MMATRIX"   //first 8 bytes of a binary matrix file (with the '\0')
+#define matrixVersion 1
+#define matrixAlignment 64      //the data of a binary file starts at a multiple of this
+
+//formats returned by matrixFormat
+#define formatMissing -1
+#define formatText 0
+#define formatBinary 1
+
+//element types of a binary file
+#define typeInt32 1
+#define typeInt8 2
+#define typeInt16 3
+#define typeInt64 4
+#define typeFloat 5
+#define typeDouble 6
+
+/**
+ * The header of a binary matrix file. The data is rows x cols elements, row after row, at dataOffset.
+ */
+struct matrixFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t elementSize;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t alignment;
+    uint64_t dataOffset;
+    uint8_t reserved[24];
+};
+
+/**
+ * A binary matrix file mapped in memory. data points into the mapping, row after row (cols values of type dtype per
+ * row).
+ */
+struct mappedMatrix {
+    int rows;
+    int cols;
+    int dtype;
+    const void *data;
+    void *base;
+    size_t length;
+};
+
+/**
+ * A binary matrix file open for reading or writing by tiles with pread and pwrite, so only the tiles in use are in
+ * memory.
+ */
+struct tiledMatrix {
+    int fd;
+    int rows;
+    int cols;
+    int dtype;
+    uint64_t dataOffset;
+};
+
+size_t typeSize(int dtype);
+const char *typeName(int dtype);
+int typeFromName(const char *name);
+int printElement(FILE *file, int width, const void *matrix, int dtype, size_t index);
+int matrixFormat(const char *filename);
+int matrixDimensions(const char *filename, int *rows, int *cols);
+int loadMatrix(const char *filename, int size, void *matrix, int dtype);
+int loadMatrixRows(const char *filename, int firstRow, int size, void *matrix, int dtype);
+int loadMatrixBlock(const char *filename, int firstRow, int rows, int cols, void *matrix, int dtype);
+int mapMatrix(const char *filename, struct mappedMatrix *mapped);
+void unmapMatrix(struct mappedMatrix *mapped);
+int saveMatrixText(const char *filename, int rows, int cols, const void *matrix, int stride, int dtype);
+int writeMatrixText(FILE *file, int rows, int cols, const void *matrix, int stride, int dtype, int width,
+                    bool trailingSpace);
+int saveMatrixBinary(const char *filename, int rows, int cols, const void *matrix, int stride, int dtype);
+int convertTextMatrix(const char *textFile, const char *binaryFile, int dtype, int *rows, int *cols);
+int openTiledMatrix(const char *filename, struct tiledMatrix *tiled);
+int createTiledMatrix(const char *filename, int rows, int cols, int dtype, struct tiledMatrix *tiled);
+int readMatrixTile(const struct tiledMatrix *tiled, int firstRow, int firstCol, int rows, int cols, void *tile,
+                   int stride, int dtype);
+int writeMatrixTile(const struct tiledMatrix *tiled, int firstRow, int firstCol, int rows, int cols, const void *tile,
+                    int stride);
+int closeTiledMatrix(struct tiledMatrix *tiled);
+
+#endif
@@ -0,0 +1,566 @@
+/**
+ * Description: the buffered logs (see matrix_log.h).
+ * The messages are records in a ring buffer: a header (total size, text length, destination file) followed by the
+ * text. Producers append records under a mutex, and the writer thread takes every record present, writes the ones
+ * for the same file with one writev, and frees their space. The thread is only started when a process logs enough
+ * (or long enough) to need it; the children of matrixmult_multiw_deep usually write all their logs at exit. A
+ * message too big for the buffer is written directly, once the buffer is empty, so the order of the messages is
+ * kept.
+ * A process forked from a logging process (a child before exec, a row child) writes its messages directly: the
+ * writer thread is not copied by fork, and the records still in the buffer belong to the parent.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "matrix_log.h"
+
+#define logBufferSize (256 * 1024)
+#define logNameLength 32        //<pid>.out fits easily
+#define logOpenFiles 4          //per-process files kept open by the writer
+#define logBatch 64             //records written by one writev
+#define wrapMarker UINT32_MAX   //text length of the padding before the ring wraps around
+#define logDelay 50             //milliseconds records may wait before they are written
+
+/**
+ * The header of a record in the ring. size is the header, the text and the padding to the next record.
+ */
+struct logRecord {
+    uint32_t size;
+    uint32_t length;
+    char name[logNameLength];
+};
+
+/**
+ * An open per-process log file of the writer.
+ */
+struct logFile {
+    char name[logNameLength];
+    int fd;
+    unsigned long used;     //when it was last written, to close the oldest
+};
+
+/**
+ * The state of the logs of this process. head and tail count the bytes appended and written since the start,
+ * the ring position is their remainder by logBufferSize.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;       //records to write, or stopping
+    pthread_cond_t drained;     //space freed, or the writer is idle
+    char *ring;
+    size_t head;
+    size_t tail;
+    bool writing;
+    bool stopping;
+    bool threadStarted;
+    long long pendingSince;     //when the oldest record waiting was appended
+    pid_t owner;                //the process the ring belongs to
+    pthread_t writer;
+    int level;
+    int command;
+    int logFd;                  //the single log, -1 for the per-process files
+    struct logFile files[logOpenFiles];
+    unsigned long writes;
+} logger = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, false, false,
+            false, 0, 0, 0, logMatrices, -1, -1};
+
+static const char *levelNames[] = {"none", "error", "info", "matrix"};
+
+/**
+ * This function returns the level named by a string.
+ * Input parameters: name (none, error, info or matrix)
+ * Returns: the level, or -1 if the name is unknown
+**/
+int logLevelFromName(const char *name){
+    for(int level = logNone; level <= logMatrices; level++){
+        if(strcmp(levelNames[level], name) == 0){
+            return level;
+        }
+    }
+    return -1;
+}
+
+/**
+ * This function tells if messages of a level are logged.
+ * Input parameters: level
+ * Returns: true if they are
+**/
+bool logEnabled(int level){
+    return level <= logger.level;
+}
+
+/**
+ * This function sets the command number the lines of the single log are tagged with.
+ * Input parameters: command (-1 for none)
+ * Returns: nothing
+**/
+void logSetCommand(int command){
+    logger.command = command;
+}
+
+/**
+ * This function tells if a log file name is the error stream (<pid>.err).
+ * Input parameters: file_name
+ * Returns: true for a .err file
+**/
+static bool isErrorFile(const char *file_name){
+    size_t length = strlen(file_name);
+    return length > 4 && strcmp(file_name + length - 4, ".err") == 0;
+}
+
+/**
+ * This function computes the length of the text logged for a message: the message and a newline, or, in the single
+ * log, every line of the message after its tag.
+ * Input parameters: message, tag (NULL for the per-process files)
+ * Returns: the length in bytes
+**/
+static size_t textLength(const char *message, const char *tag){
+    size_t length = strlen(message);
+    if(tag == NULL){
+        return length + 1;
+    }
+    //trailing newlines of a message are not tagged lines of their own
+    while(length > 0 && message[length - 1] == '\n'){
+        length--;
+    }
+    size_t lines = 1;
+    for(size_t i = 0; i < length; i++){
+        lines += message[i] == '\n';
+    }
+    //the newlines between the lines are kept, one more ends the last line
+    return length + 1 + lines * strlen(tag);
+}
+
+/**
+ * This function writes the text logged for a message (see textLength).
+ * Input parameters: text (to fill in), message, tag (NULL for the per-process files)
+ * Returns: nothing
+**/
+static void fillText(char *text, const char *message, const char *tag){
+    if(tag == NULL){
+        size_t length = strlen(message);
+        memcpy(text, message, length);
+        text[length] = '\n';
+        return;
+    }
+    size_t length = strlen(message);
+    while(length > 0 && message[length - 1] == '\n'){
+        length--;
+    }
+    size_t tagLength = strlen(tag);
+    const char *line = message;
+    const char *end = message + length;
+    while(1){
+        const char *next = memchr(line, '\n', end - line);
+        size_t lineLength = next != NULL ? (size_t)(next - line) : (size_t)(end - line);
+        memcpy(text, tag, tagLength);
+        memcpy(text + tagLength, line, lineLength);
+        text += tagLength + lineLength;
+        *text++ = '\n';
+        if(next == NULL){
+            break;
+        }
+        line = next + 1;
+    }
+}
+
+/**
+ * This function writes a whole buffer to a file descriptor, continuing after partial writes.
+ * Input parameters: fd, buffer, size (in bytes)
+ * Returns: 0 if successful, -1 if write failed
+**/
+static int writeText(int fd, const char *text, size_t size){
+    while(size > 0){
+        ssize_t written = write(fd, text, size);
+        if(written < 0){
+            return -1;
+        }
+        text += written;
+        size -= written;
+    }
+    return 0;
+}
+
+/**
+ * This function opens a per-process log file for appending.
+ * Input parameters: name
+ * Returns: the file descriptor, or -1 (reported with perror) if it cannot be opened
+**/
+static int openLogFile(const char *name){
+    int fd = open(name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd == -1){
+        perror("Failed to open log file");
+    }
+    return fd;
+}
+
+/**
+ * This function returns the file descriptor the writer thread writes a record to: the single log, or a per-process
+ * file, which is kept open (the least recently used one is closed to make room).
+ * Input parameters: name
+ * Returns: the file descriptor, or -1 if the file cannot be opened
+**/
+static int writerFile(const char *name){
+    if(logger.logFd >= 0){
+        return logger.logFd;
+    }
+    struct logFile *oldest = &logger.files[0];
+    for(int i = 0; i < logOpenFiles; i++){
+        struct logFile *file = &logger.files[i];
+        if(file->used > 0 && strcmp(file->name, name) == 0){
+            file->used = ++logger.writes;
+            return file->fd;
+        }
+        if(file->used < oldest->used){
+            oldest = file;
+        }
+    }
+    if(oldest->used > 0){
+        close(oldest->fd);
+        oldest->used = 0;
+    }
+    oldest->fd = openLogFile(name);
+    if(oldest->fd == -1){
+        return -1;
+    }
+    snprintf(oldest->name, sizeof(oldest->name), "%s", name);
+    oldest->used = ++logger.writes;
+    return oldest->fd;
+}
+
+/**
+ * This function writes the records between two positions of the ring, the ones for the same file by one writev.
+ * It runs in the writer thread, without the lock: producers only append after head.
+ * Input parameters: from, to (counters, see logger)
+ * Returns: nothing
+**/
+static void writeRecords(size_t from, size_t to){
+    struct iovec batch[logBatch];
+    int count = 0;
+    const char *batchName = NULL;
+    while(from < to || count > 0){
+        const struct logRecord *record = NULL;
+        if(from < to){
+            record = (const struct logRecord *)(logger.ring + from % logBufferSize);
+            if(record->length == wrapMarker){
+                from += record->size;
+                continue;
+            }
+        }
+        //write the batch when it is full, the file changes, or there is nothing more
+        if(count > 0 && (record == NULL || count == logBatch || strcmp(record->name, batchName) != 0)){
+            int fd = writerFile(batchName);
+            if(fd >= 0){
+                for(int i = 0; i < count; ){
+                    ssize_t written = writev(fd, batch + i, count - i);
+                    if(written < 0){
+                        break;
+                    }
+                    //skip what was written, a partial write resumes in the middle of a record
+                    while(i < count && (size_t)written >= batch[i].iov_len){
+                        written -= batch[i].iov_len;
+                        i++;
+                    }
+                    if(i < count){
+                        batch[i].iov_base = (char *)batch[i].iov_base + written;
+                        batch[i].iov_len -= written;
+                    }
+                }
+            }
+            count = 0;
+        }
+        if(record == NULL){
+            break;
+        }
+        batchName = record->name;
+        batch[count].iov_base = (void *)(record + 1);
+        batch[count++].iov_len = record->length;
+        from += record->size;
+    }
+}
+
+/**
+ * This function writes the records of the ring in the calling thread, when there is no writer thread.
+ * It is called with the lock held.
+ * Input parameters: none
+ * Returns: nothing
+**/
+static void writeInline(void){
+    writeRecords(logger.tail, logger.head);
+    logger.tail = logger.head;
+}
+
+/**
+ * This function is the writer thread: it writes the records as they are appended, until logClose stops it. While
+ * the ring is less than a quarter full it lets records gather for up to logDelay, so they are written in batches.
+ * Input parameters: unused
+ * Returns: NULL
+**/
+static void *logWriter(void *unused){
+    (void)unused;
+    pthread_mutex_lock(&logger.lock);
+    while(1){
+        while(logger.head == logger.tail && !logger.stopping){
+            pthread_cond_wait(&logger.ready, &logger.lock);
+        }
+        if(logger.head == logger.tail){
+            break;
+        }
+        if(!logger.stopping && logger.head - logger.tail < logBufferSize / 4){
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += logDelay * 1000000L;
+            if(until.tv_nsec >= 1000000000L){
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&logger.ready, &logger.lock, &until);
+        }
+        size_t from = logger.tail;
+        size_t to = logger.head;
+        logger.writing = true;
+        pthread_mutex_unlock(&logger.lock);
+
+        writeRecords(from, to);
+
+        pthread_mutex_lock(&logger.lock);
+        logger.tail = to;
+        logger.writing = false;
+        pthread_cond_broadcast(&logger.drained);
+    }
+    pthread_mutex_unlock(&logger.lock);
+    return NULL;
+}
+
+/**
+ * This function returns a time in milliseconds, to measure how long records have been waiting.
+ * Input parameters: none
+ * Returns: the time
+**/
+static long long milliseconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * This function writes a message directly, without the ring: in a forked process, or for a message too big for the
+ * ring.
+ * Input parameters: file_name, message, tag (NULL for the per-process files)
+ * Returns: 0 if successful, -1 if the log file cannot be opened
+**/
+static int writeDirect(const char *file_name, const char *message, const char *tag){
+    size_t length = textLength(message, tag);
+    char *text = malloc(length);
+    if(text == NULL){
+        perror("malloc");
+        exit(1);
+    }
+    fillText(text, message, tag);
+    int fd = logger.logFd >= 0 ? logger.logFd : openLogFile(file_name);
+    if(fd == -1){
+        free(text);
+        return -1;
+    }
+    writeText(fd, text, length);
+    if(fd != logger.logFd){
+        close(fd);
+    }
+    free(text);
+    return 0;
+}
+
+/**
+ * This function writes every record left at exit: it stops the writer thread once it is done, or writes them itself
+ * if no thread was started. Only the process that owns the ring does this, a forked process that exits leaves the
+ * records to its parent.
+ * Input parameters: none
+ * Returns: nothing
+**/
+static void logClose(void){
+    if(logger.ring == NULL || logger.owner != getpid()){
+        return;
+    }
+    pthread_mutex_lock(&logger.lock);
+    if(logger.threadStarted){
+        logger.stopping = true;
+        pthread_cond_signal(&logger.ready);
+        pthread_mutex_unlock(&logger.lock);
+        pthread_join(logger.writer, NULL);
+        pthread_mutex_lock(&logger.lock);
+        logger.threadStarted = false;
+    }else{
+        writeInline();
+    }
+    for(int i = 0; i < logOpenFiles; i++){
+        if(logger.files[i].used > 0){
+            close(logger.files[i].fd);
+            logger.files[i].used = 0;
+        }
+    }
+    //anything logged later (by another exit handler) is written directly
+    free(logger.ring);
+    logger.ring = NULL;
+    pthread_mutex_unlock(&logger.lock);
+}
+
+/**
+ * These functions keep the lock consistent across fork: it is held while forking, so the child does not get it
+ * in the middle of an append, and the child gets a fresh one.
+**/
+static void lockForFork(void){
+    pthread_mutex_lock(&logger.lock);
+}
+
+static void unlockAfterFork(void){
+    pthread_mutex_unlock(&logger.lock);
+}
+
+static void resetAfterFork(void){
+    pthread_mutex_init(&logger.lock, NULL);
+    pthread_cond_init(&logger.ready, NULL);
+    pthread_cond_init(&logger.drained, NULL);
+}
+
+/**
+ * This function starts the logs of this process: it reads MATRIXMULT_LOG_LEVEL, MATRIXMULT_LOG and
+ * MATRIXMULT_COMMAND (the command number of a child, for the tags), and allocates the ring. The writer thread is
+ * started later, when the ring fills up or records wait too long, so a short-lived process writes its logs once,
+ * at exit. Until it is called messages are written directly.
+ * Input parameters: none
+ * Returns: nothing
+**/
+void logInit(void){
+    const char *level = getenv("MATRIXMULT_LOG_LEVEL");
+    if(level != NULL && logLevelFromName(level) != -1){
+        logger.level = logLevelFromName(level);
+    }
+    const char *command = getenv("MATRIXMULT_COMMAND");
+    if(command != NULL){
+        logger.command = atoi(command);
+    }
+    const char *single = getenv("MATRIXMULT_LOG");
+    if(single != NULL && single[0] != '\0'){
+        logger.logFd = open(single, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(logger.logFd == -1){
+            perror("Failed to open the log, using the .out and .err files");
+        }
+    }
+
+    logger.ring = malloc(logBufferSize);
+    if(logger.ring == NULL){
+        return;
+    }
+    logger.owner = getpid();
+    pthread_atfork(lockForFork, unlockAfterFork, resetAfterFork);
+    atexit(logClose);
+}
+
+/**
+ * This function logs a message to a per-process log file, or to the single log, if its level is enabled.
+ * A newline is added at the end of the message.
+ * Input parameters: file_name (<pid>.out or <pid>.err), level, message
+ * Returns: nothing, exit(1) if a log file cannot be opened for a direct write
+**/
+void logWrite(const char *file_name, int level, const char *message){
+    if(!logEnabled(level)){
+        return;
+    }
+
+    //the tag of the lines of the single log
+    char tagBuffer[96];
+    const char *tag = NULL;
+    if(logger.logFd >= 0){
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        int length = snprintf(tagBuffer, sizeof(tagBuffer), "%ld.%06ld pid=%d cmd=", (long)now.tv_sec,
+                              now.tv_nsec / 1000, getpid());
+        if(logger.command >= 0){
+            length += snprintf(tagBuffer + length, sizeof(tagBuffer) - length, "%d", logger.command);
+        }else{
+            length += snprintf(tagBuffer + length, sizeof(tagBuffer) - length, "-");
+        }
+        snprintf(tagBuffer + length, sizeof(tagBuffer) - length, " %s ", isErrorFile(file_name) ? "err" : "out");
+        tag = tagBuffer;
+    }
+
+    size_t length = textLength(message, tag);
+    size_t size = (sizeof(struct logRecord) + length + 7) / 8 * 8;
+    pthread_mutex_lock(&logger.lock);
+    bool buffered = logger.ring != NULL && logger.owner == getpid();
+    if(!buffered || size > logBufferSize / 2){
+        //a big message waits for the ring to be written, to stay in order
+        if(buffered && !logger.threadStarted){
+            writeInline();
+        }
+        while(buffered && (logger.head != logger.tail || logger.writing)){
+            pthread_cond_wait(&logger.drained, &logger.lock);
+        }
+        int status = writeDirect(file_name, message, tag);
+        pthread_mutex_unlock(&logger.lock);
+        if(status == -1){
+            //like the unbuffered logs, a log file that cannot be opened stops the program
+            exit(1);
+        }
+        return;
+    }
+
+    //a record does not wrap around, the end of the ring is skipped when it is too short
+    size_t position = logger.head % logBufferSize;
+    size_t skip = logBufferSize - position < size ? logBufferSize - position : 0;
+    if(logBufferSize - (logger.head - logger.tail) < skip + size && !logger.threadStarted){
+        writeInline();
+    }
+    while(logBufferSize - (logger.head - logger.tail) < skip + size){
+        pthread_cond_wait(&logger.drained, &logger.lock);
+    }
+    bool wasEmpty = logger.head == logger.tail;
+    if(wasEmpty){
+        logger.pendingSince = milliseconds();
+    }
+    if(skip > 0){
+        struct logRecord *marker = (struct logRecord *)(logger.ring + position);
+        marker->size = skip;
+        marker->length = wrapMarker;
+        logger.head += skip;
+        position = 0;
+    }
+    struct logRecord *record = (struct logRecord *)(logger.ring + position);
+    record->size = size;
+    record->length = length;
+    snprintf(record->name, sizeof(record->name), "%s", file_name);
+    fillText((char *)(record + 1), message, tag);
+    logger.head += size;
+
+    //the writer thread is started once the ring fills up or the records have waited too long
+    bool filling = logger.head - logger.tail >= logBufferSize / 4;
+    if(!logger.threadStarted && (filling || milliseconds() - logger.pendingSince >= logDelay)){
+        logger.threadStarted = pthread_create(&logger.writer, NULL, logWriter, NULL) == 0;
+        if(!logger.threadStarted){
+            writeInline();
+        }
+    }else if(logger.threadStarted && (wasEmpty || filling)){
+        pthread_cond_signal(&logger.ready);
+    }
+    pthread_mutex_unlock(&logger.lock);
+}
+
+/**
+ * This function logs a message, at the error level for a .err file and the info level otherwise (see logWrite).
+ * Input parameters: file_name (<pid>.out or <pid>.err), message
+ * Returns: nothing
+**/
+void logMessage(const char *file_name, const char *message){
+    logWrite(file_name, isErrorFile(file_name) ? logError : logInfo, message);
+}
@@ -0,0 +1,32 @@
+/**
+ * Description: the logs of matrixmult_parallel and matrixmult_multiw_deep. A message is copied to a buffer in memory
+ * and written in batches (by a background thread once a process logs a lot), so logging does not open, write and
+ * close a file on every call.
+ * By default each process keeps its own <pid>.out and <pid>.err files (kept open while they are used). With
+ * MATRIXMULT_LOG=FILE every process appends to that one file instead, and each line is tagged with the time, the
+ * pid, the command number and the stream (out or err). MATRIXMULT_LOG_LEVEL (none, error, info or matrix, the
+ * default) sets what is logged: info drops the matrix dumps, error keeps only the .err messages.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef MATRIX_LOG_H
+#define MATRIX_LOG_H
+
+#include <stdbool.h>
+
+//log levels, each one includes the ones before it
+#define logNone 0
+#define logError 1
+#define logInfo 2
+#define logMatrices 3
+
+void logInit(void);
+void logSetCommand(int command);
+int logLevelFromName(const char *name);
+bool logEnabled(int level);
+void logWrite(const char *file_name, int level, const char *message);
+void logMessage(const char *file_name, const char *message);
+
+#endif
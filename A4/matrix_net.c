@@ -0,0 +1,199 @@
+/**
+ * Description: the sockets of the worker servers and their coordinator (see matrix_net.h).
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "matrix_net.h"
+
+#define unixPrefix "unix:"
+#define listenBacklog 16
+
+/**
+ * This function fills in the Unix-domain socket address of a unix:PATH address.
+ * Input parameters: address, unixAddress (to fill in)
+ * Returns: 1 if address is a unix: address, 0 if it is not, -1 if its path is empty or too long
+**/
+static int unixAddress(const char *address, struct sockaddr_un *unixAddress){
+    if(strncmp(address, unixPrefix, strlen(unixPrefix)) != 0){
+        return 0;
+    }
+    const char *path = address + strlen(unixPrefix);
+    memset(unixAddress, 0, sizeof(*unixAddress));
+    unixAddress->sun_family = AF_UNIX;
+    if(path[0] == '\0' || strlen(path) >= sizeof(unixAddress->sun_path)){
+        return -1;
+    }
+    strcpy(unixAddress->sun_path, path);
+    return 1;
+}
+
+/**
+ * This function resolves the TCP addresses of a HOST:PORT address.
+ * Input parameters: address, passive (true to listen), addresses (to fill in, free with freeaddrinfo)
+ * Returns: 0 if successful, -1 if the address has no port or cannot be resolved
+**/
+static int tcpAddresses(const char *address, bool passive, struct addrinfo **addresses){
+    const char *colon = strrchr(address, ':');
+    if(colon == NULL || colon[1] == '\0'){
+        fprintf(stderr, "Error - %s is not unix:PATH or HOST:PORT.\n", address);
+        return -1;
+    }
+    char *host = strndup(address, colon - address);
+    if(host == NULL){
+        perror("strndup");
+        return -1;
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    int status = getaddrinfo(host[0] != '\0' ? host : NULL, colon + 1, &hints, addresses);
+    free(host);
+    if(status != 0){
+        fprintf(stderr, "Error - cannot resolve %s: %s.\n", address, gai_strerror(status));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function turns off the Nagle delay of a TCP socket: a job header is small and is answered, it must not wait
+ * for more data. Unix-domain sockets ignore it.
+ * Input parameters: fd
+ * Returns: nothing
+**/
+static void noDelay(int fd){
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+/**
+ * This function opens a socket listening on an address. A Unix-domain socket left by an earlier server is removed.
+ * Input parameters: address (unix:PATH or [HOST]:PORT)
+ * Returns: the listening socket, or -1 if it failed (the reason is printed to stderr)
+**/
+int netListen(const char *address){
+    struct sockaddr_un local;
+    int isUnix = unixAddress(address, &local);
+    if(isUnix == 1){
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd == -1){
+            perror("socket");
+            return -1;
+        }
+        unlink(local.sun_path);
+        if(bind(fd, (struct sockaddr *)&local, sizeof(local)) == -1 || listen(fd, listenBacklog) == -1){
+            perror(address);
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    if(isUnix == -1){
+        fprintf(stderr, "Error - the socket path of %s is empty or too long.\n", address);
+        return -1;
+    }
+
+    struct addrinfo *addresses;
+    if(tcpAddresses(address, true, &addresses) == -1){
+        return -1;
+    }
+    int fd = -1;
+    for(struct addrinfo *entry = addresses; entry != NULL; entry = entry->ai_next){
+        fd = socket(entry->ai_family, entry->ai_socktype | SOCK_CLOEXEC, entry->ai_protocol);
+        if(fd == -1){
+            continue;
+        }
+        //a restarted server can take its port back right away
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if(bind(fd, entry->ai_addr, entry->ai_addrlen) == 0 && listen(fd, listenBacklog) == 0){
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    if(fd == -1){
+        perror(address);
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+/**
+ * This function accepts a connection on a listening socket.
+ * Input parameters: listenFd
+ * Returns: the connected socket, or -1 if accept failed (errno tells why)
+**/
+int netAccept(int listenFd){
+    int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if(fd != -1){
+        noDelay(fd);
+    }
+    return fd;
+}
+
+/**
+ * This function connects to a listening socket.
+ * Input parameters: address (unix:PATH or [HOST]:PORT)
+ * Returns: the connected socket, or -1 if the connection failed (errno tells why)
+**/
+int netConnect(const char *address){
+    struct sockaddr_un local;
+    int isUnix = unixAddress(address, &local);
+    if(isUnix == 1){
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd != -1 && connect(fd, (struct sockaddr *)&local, sizeof(local)) == -1){
+            int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        return fd;
+    }
+    if(isUnix == -1){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    struct addrinfo *addresses;
+    if(tcpAddresses(address, false, &addresses) == -1){
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = -1;
+    int error = ECONNREFUSED;
+    for(struct addrinfo *entry = addresses; entry != NULL; entry = entry->ai_next){
+        fd = socket(entry->ai_family, entry->ai_socktype | SOCK_CLOEXEC, entry->ai_protocol);
+        if(fd == -1){
+            error = errno;
+            continue;
+        }
+        if(connect(fd, entry->ai_addr, entry->ai_addrlen) == 0){
+            noDelay(fd);
+            break;
+        }
+        error = errno;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    errno = error;
+    return fd;
+}
@@ -0,0 +1,17 @@
+/**
+ * Description: the sockets between matrixmult_multiw_deep --workers and matrixmult_parallel --listen. An address is
+ * unix:PATH for a Unix-domain socket, or HOST:PORT for TCP (an empty HOST listens on every interface and connects to
+ * the local host). The jobs and results go over the socket like over the pipes of the worker pool.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef MATRIX_NET_H
+#define MATRIX_NET_H
+
+int netListen(const char *address);
+int netAccept(int listenFd);
+int netConnect(const char *address);
+
+#endif
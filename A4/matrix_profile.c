@@ -0,0 +1,440 @@
+/**
+ * Description: the per-phase timing (see matrix_profile.h).
+ * The first process that finds MATRIXMULT_PROFILE or MATRIXMULT_TRACE is the root of the run: it names a spans file
+ * (<pid>.spans) in MATRIXMULT_PROFILE_SPANS for its descendants. Every other process keeps its spans in memory and
+ * appends them to that file with one write when it exits; the root reads them back at its own exit (after its
+ * children), tells the layer of each span from its command number, and writes the summary and the trace.
+ * A forked child that does not exec (a row child) inherits the spans of its parent but never writes them.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "matrix_profile.h"
+
+#define profileNameLength 32
+
+/**
+ * A phase of one process: when it started on the monotonic clock and how long it took, in nanoseconds.
+ */
+struct span {
+    int pid;
+    int phase;
+    int command;        //-1 outside of a command
+    int layer;          //-1 until the root tells it from the command
+    long long start;
+    long long duration;
+    char program[profileNameLength];
+};
+
+/**
+ * The state of the timing of this process.
+ */
+static struct {
+    bool enabled;
+    bool root;
+    pid_t owner;                //the process the spans belong to
+    char program[profileNameLength];
+    int command;
+    int layer;
+    long long runStart;
+    struct span *spans;
+    int count;
+    int capacity;
+    int *firstCommands;         //root: the first command of every layer
+    int layers;
+    const char *spansFile;
+    const char *summaryFile;
+    const char *traceFile;
+} profiler = {false, false, 0, "", -1, 0};
+
+static const char *phaseNames[phaseCount] = {"parse", "spawn", "load", "compute", "transfer", "accumulate", "write",
+                                             "run"};
+
+/**
+ * This function returns the time of the monotonic clock.
+ * Input parameters: none
+ * Returns: the time in nanoseconds
+**/
+static long long nanoseconds(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * This function tells if the phases are timed in this process.
+ * Input parameters: none
+ * Returns: true if they are
+**/
+bool profileEnabled(void){
+    return profiler.enabled;
+}
+
+/**
+ * This function returns the start of a span, to pass to profileSpan once the phase is over.
+ * Input parameters: none
+ * Returns: the time in nanoseconds, 0 when the phases are not timed
+**/
+long long profileStart(void){
+    return profiler.enabled ? nanoseconds() : 0;
+}
+
+/**
+ * This function records a phase that started at start and ends now, for the current command and layer.
+ * Input parameters: phase, start (from profileStart)
+ * Returns: nothing
+**/
+void profileSpan(int phase, long long start){
+    if(!profiler.enabled){
+        return;
+    }
+    long long end = nanoseconds();
+    if(profiler.count == profiler.capacity){
+        int capacity = profiler.capacity > 0 ? profiler.capacity * 2 : 256;
+        struct span *spans = realloc(profiler.spans, capacity * sizeof(struct span));
+        if(spans == NULL){
+            return;
+        }
+        profiler.spans = spans;
+        profiler.capacity = capacity;
+    }
+    struct span *span = &profiler.spans[profiler.count++];
+    span->pid = getpid();
+    span->phase = phase;
+    span->command = profiler.command;
+    span->layer = profiler.root ? profiler.layer : -1;
+    span->start = start;
+    span->duration = end - start;
+    snprintf(span->program, profileNameLength, "%s", profiler.program);
+}
+
+/**
+ * This function sets the command number the next spans belong to.
+ * Input parameters: command (-1 for none)
+ * Returns: nothing
+**/
+void profileSetCommand(int command){
+    profiler.command = command;
+}
+
+/**
+ * This function starts a layer in the root: its own next spans belong to it, and so do the spans of the children
+ * from firstCommand on.
+ * Input parameters: layer (0 for the command line, then one per line of stdin), firstCommand
+ * Returns: nothing
+**/
+void profileSetLayer(int layer, int firstCommand){
+    if(!profiler.enabled || !profiler.root){
+        return;
+    }
+    profiler.layer = layer;
+    int *firstCommands = realloc(profiler.firstCommands, (layer + 1) * sizeof(int));
+    if(firstCommands == NULL){
+        return;
+    }
+    for(int i = profiler.layers; i <= layer; i++){
+        firstCommands[i] = firstCommand;
+    }
+    profiler.firstCommands = firstCommands;
+    profiler.layers = layer + 1;
+}
+
+/**
+ * This function passes the start of a spawn to the program a forked child is about to exec, which records the
+ * spawn span when its main starts. It is called in the child, between fork and exec.
+ * Input parameters: start (from profileStart, taken before fork)
+ * Returns: nothing
+**/
+void profileExportSpawn(long long start){
+    if(!profiler.enabled){
+        return;
+    }
+    char value[32];
+    snprintf(value, sizeof(value), "%lld", start);
+    setenv("MATRIXMULT_PROFILE_SPAWN", value, 1);
+}
+
+/**
+ * This function appends the spans of this process to the spans file, with one write.
+ * Input parameters: none
+ * Returns: nothing
+**/
+static void appendSpans(void){
+    size_t lineLength = profileNameLength + 96;
+    char *text = malloc((size_t)profiler.count * lineLength + 1);
+    int fd = open(profiler.spansFile, O_WRONLY | O_APPEND);
+    if(text == NULL || fd == -1){
+        free(text);
+        return;
+    }
+    size_t length = 0;
+    for(int i = 0; i < profiler.count; i++){
+        const struct span *span = &profiler.spans[i];
+        length += snprintf(text + length, lineLength, "%d %s %d %d %lld %lld\n", span->pid, span->program,
+                           span->phase, span->command, span->start, span->duration);
+    }
+    if(write(fd, text, length) != (ssize_t)length){
+        perror("Failed to write the spans");
+    }
+    close(fd);
+    free(text);
+}
+
+/**
+ * This function reads the spans the other processes appended to the spans file, adds them to the spans of this
+ * process, and removes the file.
+ * Input parameters: none
+ * Returns: nothing
+**/
+static void readSpans(void){
+    FILE *file = fopen(profiler.spansFile, "r");
+    if(file == NULL){
+        return;
+    }
+    struct span span;
+    while(fscanf(file, "%d %31s %d %d %lld %lld", &span.pid, span.program, &span.phase, &span.command, &span.start,
+                 &span.duration) == 6){
+        if(span.phase < 0 || span.phase >= phaseCount){
+            continue;
+        }
+        if(profiler.count == profiler.capacity){
+            int capacity = profiler.capacity > 0 ? profiler.capacity * 2 : 256;
+            struct span *spans = realloc(profiler.spans, capacity * sizeof(struct span));
+            if(spans == NULL){
+                break;
+            }
+            profiler.spans = spans;
+            profiler.capacity = capacity;
+        }
+        //the layer of a child is the last one started before its command
+        span.layer = 0;
+        for(int l = 0; l < profiler.layers && span.command >= 0; l++){
+            if(span.command >= profiler.firstCommands[l]){
+                span.layer = l;
+            }
+        }
+        profiler.spans[profiler.count++] = span;
+    }
+    fclose(file);
+    unlink(profiler.spansFile);
+}
+
+/**
+ * The totals of one phase.
+ */
+struct phaseTotal {
+    long count;
+    long long total;
+    long long max;
+};
+
+/**
+ * This function adds up the spans of a phase, of one layer or of all of them.
+ * Input parameters: phase, layer (-1 for all)
+ * Returns: the totals
+**/
+static struct phaseTotal totalOf(int phase, int layer){
+    struct phaseTotal total = {0, 0, 0};
+    for(int i = 0; i < profiler.count; i++){
+        const struct span *span = &profiler.spans[i];
+        if(span->phase != phase || (layer >= 0 && span->layer != layer)){
+            continue;
+        }
+        total.count++;
+        total.total += span->duration;
+        total.max = span->duration > total.max ? span->duration : total.max;
+    }
+    return total;
+}
+
+/**
+ * This function counts the processes that recorded spans.
+ * Input parameters: none
+ * Returns: the number of processes
+**/
+static int processCount(void){
+    int processes = 0;
+    for(int i = 0; i < profiler.count; i++){
+        bool seen = false;
+        for(int j = 0; j < i && !seen; j++){
+            seen = profiler.spans[j].pid == profiler.spans[i].pid;
+        }
+        processes += !seen;
+    }
+    return processes;
+}
+
+/**
+ * This function writes the summary as CSV: one line per phase for the whole run, then one per phase and layer
+ * (the run phase has no layer).
+ * Input parameters: file
+ * Returns: nothing
+**/
+static void writeSummaryCsv(FILE *file){
+    fprintf(file, "scope,layer,phase,count,total_ms,mean_ms,max_ms\n");
+    for(int layer = -1; layer < profiler.layers; layer++){
+        for(int phase = 0; phase < phaseCount; phase++){
+            struct phaseTotal total = totalOf(phase, layer);
+            if(total.count == 0 || (layer >= 0 && phase == phaseRun)){
+                continue;
+            }
+            fprintf(file, "%s,%d,%s,%ld,%.3f,%.3f,%.3f\n", layer < 0 ? "run" : "layer", layer, phaseNames[phase],
+                    total.count, total.total / 1e6, total.total / 1e6 / total.count, total.max / 1e6);
+        }
+    }
+}
+
+/**
+ * This function writes the summary as JSON: the wall time of the root, the totals of every phase, and the time of
+ * every phase in every layer.
+ * Input parameters: file, wall (runtime of the root, in nanoseconds)
+ * Returns: nothing
+**/
+static void writeSummaryJson(FILE *file, long long wall){
+    fprintf(file, "{\n  \"program\": \"%s\",\n  \"wall_ms\": %.3f,\n  \"processes\": %d,\n  \"phases\": {\n",
+            profiler.program, wall / 1e6, processCount());
+    for(int phase = 0; phase < phaseCount; phase++){
+        struct phaseTotal total = totalOf(phase, -1);
+        fprintf(file, "    \"%s\": {\"count\": %ld, \"total_ms\": %.3f, \"mean_ms\": %.3f, \"max_ms\": %.3f}%s\n",
+                phaseNames[phase], total.count, total.total / 1e6,
+                total.count > 0 ? total.total / 1e6 / total.count : 0.0, total.max / 1e6,
+                phase + 1 < phaseCount ? "," : "");
+    }
+    fprintf(file, "  },\n  \"layers\": [\n");
+    for(int layer = 0; layer < profiler.layers; layer++){
+        fprintf(file, "    {\"layer\": %d", layer);
+        for(int phase = 0; phase < phaseRun; phase++){
+            fprintf(file, ", \"%s_ms\": %.3f", phaseNames[phase], totalOf(phase, layer).total / 1e6);
+        }
+        fprintf(file, "}%s\n", layer + 1 < profiler.layers ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+/**
+ * This function writes every span as a complete event of the Chrome trace format, in microseconds from the start
+ * of the root, with one named track per process.
+ * Input parameters: file
+ * Returns: nothing
+**/
+static void writeTrace(FILE *file){
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for(int i = 0; i < profiler.count; i++){
+        const struct span *span = &profiler.spans[i];
+        if(span->phase == phaseRun){
+            fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                          "\"args\": {\"name\": \"%s\"}},\n", span->pid, span->pid, span->program);
+        }
+        fprintf(file, "{\"name\": \"%s\", \"cat\": \"matrixmult\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                      "\"pid\": %d, \"tid\": %d, \"args\": {\"command\": %d, \"layer\": %d}}%s\n",
+                phaseNames[span->phase], (span->start - profiler.runStart) / 1e3, span->duration / 1e3, span->pid,
+                span->pid, span->command, span->layer, i + 1 < profiler.count ? "," : "");
+    }
+    fprintf(file, "]}\n");
+}
+
+/**
+ * This function ends the timing at exit: the run span is recorded, then a child appends its spans to the spans
+ * file and the root writes the summary and the trace of the whole run.
+ * Input parameters: none
+ * Returns: nothing
+**/
+static void profileClose(void){
+    if(!profiler.enabled || profiler.owner != getpid()){
+        return;
+    }
+    profileSpan(phaseRun, profiler.runStart);
+    profiler.enabled = false;
+    if(!profiler.root){
+        appendSpans();
+        return;
+    }
+
+    long long wall = profiler.spans[profiler.count - 1].duration;
+    readSpans();
+    FILE *file;
+    if(profiler.summaryFile != NULL){
+        size_t length = strlen(profiler.summaryFile);
+        if((file = fopen(profiler.summaryFile, "w")) == NULL){
+            perror("Failed to write the profile");
+        }else{
+            if(length > 4 && strcmp(profiler.summaryFile + length - 4, ".csv") == 0){
+                writeSummaryCsv(file);
+            }else{
+                writeSummaryJson(file, wall);
+            }
+            fclose(file);
+        }
+    }
+    if(profiler.traceFile != NULL){
+        if((file = fopen(profiler.traceFile, "w")) == NULL){
+            perror("Failed to write the trace");
+        }else{
+            writeTrace(file);
+            fclose(file);
+        }
+    }
+    free(profiler.spans);
+    free(profiler.firstCommands);
+}
+
+/**
+ * This function starts the timing of this process: it reads MATRIXMULT_PROFILE and MATRIXMULT_TRACE (in the root)
+ * or MATRIXMULT_PROFILE_SPANS (in a child), MATRIXMULT_COMMAND, and MATRIXMULT_PROFILE_SPAWN, the start of the
+ * spawn of this process. The run span starts here.
+ * Input parameters: program (name of the process in the summary and the trace)
+ * Returns: nothing
+**/
+void profileInit(const char *program){
+    const char *spans = getenv("MATRIXMULT_PROFILE_SPANS");
+    const char *summary = getenv("MATRIXMULT_PROFILE");
+    const char *trace = getenv("MATRIXMULT_TRACE");
+    profiler.summaryFile = summary != NULL && summary[0] != '\0' ? summary : NULL;
+    profiler.traceFile = trace != NULL && trace[0] != '\0' ? trace : NULL;
+    if(spans == NULL && profiler.summaryFile == NULL && profiler.traceFile == NULL){
+        return;
+    }
+    profiler.enabled = true;
+    profiler.owner = getpid();
+    profiler.runStart = nanoseconds();
+    snprintf(profiler.program, profileNameLength, "%s", program);
+    const char *command = getenv("MATRIXMULT_COMMAND");
+    if(command != NULL){
+        profiler.command = atoi(command);
+    }
+
+    if(spans == NULL){
+        //the root: the children append their spans to a file of its own
+        static char spansFile[profileNameLength];
+        snprintf(spansFile, sizeof(spansFile), "%d.spans", getpid());
+        int fd = open(spansFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd == -1){
+            perror("Failed to create the spans file");
+            profiler.enabled = false;
+            return;
+        }
+        close(fd);
+        setenv("MATRIXMULT_PROFILE_SPANS", spansFile, 1);
+        profiler.spansFile = spansFile;
+        profiler.root = true;
+        profileSetLayer(0, 0);
+    }else{
+        profiler.spansFile = spans;
+    }
+
+    //the spawn started in the parent, before fork
+    const char *spawn = getenv("MATRIXMULT_PROFILE_SPAWN");
+    if(spawn != NULL){
+        profileSpan(phaseSpawn, atoll(spawn));
+        unsetenv("MATRIXMULT_PROFILE_SPAWN");
+    }
+    atexit(profileClose);
+}
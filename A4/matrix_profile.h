@@ -0,0 +1,37 @@
+/**
+ * Description: the per-phase timing of matrixmult_parallel and matrixmult_multiw_deep. Each process records spans
+ * (phase, command, start, duration) on a monotonic clock; the children append theirs to a spans file when they
+ * exit, and the first process (the one started by the user) adds them up per phase and per layer when it exits.
+ * MATRIXMULT_PROFILE=FILE writes the summary to FILE, as CSV if its name ends with .csv and as JSON otherwise.
+ * MATRIXMULT_TRACE=FILE writes every span in the Chrome trace format (chrome://tracing or ui.perfetto.dev), one
+ * track per process. Without either nothing is recorded.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef MATRIX_PROFILE_H
+#define MATRIX_PROFILE_H
+
+#include <stdbool.h>
+
+//phases of the hot path
+#define phaseParse 0        //splitting a line of stdin into file names
+#define phaseSpawn 1        //fork and exec of a child or a worker, until its main starts
+#define phaseLoad 2         //loading matrix files (and converting or padding them)
+#define phaseCompute 3      //the multiply, and the sum of the Ws of a fused layer
+#define phaseTransfer 4     //matrices going through the pipes: jobs and results
+#define phaseAccumulate 5   //adding the results of a layer into Rsum
+#define phaseWrite 6        //writing Rsum (Rsum.txt, Rsum.bin or the shared memory) and the sum of the Ws
+#define phaseRun 7          //a whole process
+#define phaseCount 8
+
+void profileInit(const char *program);
+bool profileEnabled(void);
+long long profileStart(void);
+void profileSpan(int phase, long long start);
+void profileSetCommand(int command);
+void profileSetLayer(int layer, int firstCommand);
+void profileExportSpawn(long long start);
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ * Description: the CSR format and the sparse multiply of libmatmul (see matrix_sparse.h).
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "matrix_sparse.h"
+
+/**
+ * This function checks if a value is 0, whatever its type: all its bytes are 0.
+ * Input parameters: value, bytes
+ * Returns: true if the value is 0 (a float -0 counts as a nonzero, which is still correct)
+**/
+static inline bool isZero(const char *value, size_t bytes){
+    if(bytes == sizeof(uint32_t)){
+        uint32_t bits;
+        memcpy(&bits, value, sizeof(bits));
+        return bits == 0;
+    }
+    if(bytes == sizeof(uint64_t)){
+        uint64_t bits;
+        memcpy(&bits, value, sizeof(bits));
+        return bits == 0;
+    }
+    for(size_t b = 0; b < bytes; b++){
+        if(value[b] != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * This function builds the CSR form of a dense size x size matrix, if it has at most limit nonzeros, in storage the
+ * caller allocated for limit nonzeros (the arena of a plan, see matmul.h). The fill stops as soon as the limit is
+ * passed, so a dense matrix is not scanned to the end.
+ * Input parameters: sparse (with rowStart for size + 1 offsets, columns and values for limit nonzeros, or 1 if limit
+ * is 0), size, matrix, dtype (of matrix), limit
+ * Returns: 0 if sparse holds the matrix, 1 if the matrix has more than limit nonzeros (sparse holds nothing then)
+**/
+int sparseFill(struct sparseMatrix *sparse, int size, const void *matrix, int dtype, size_t limit){
+    size_t bytes = typeSize(dtype);
+    const char *data = matrix;
+    size_t next = 0;
+    for(int i = 0; i < size; i++){
+        sparse->rowStart[i] = next;
+        for(int j = 0; j < size; j++){
+            const char *value = data + ((size_t)i * size + j) * bytes;
+            if(isZero(value, bytes)){
+                continue;
+            }
+            if(next == limit){
+                return 1;
+            }
+            sparse->columns[next] = j;
+            memcpy((char *)sparse->values + next * bytes, value, bytes);
+            next++;
+        }
+    }
+    sparse->rowStart[size] = next;
+    sparse->size = size;
+    sparse->nonzeros = next;
+    return 0;
+}
+
+/**
+ * This function computes rows rowStart..rowEnd-1 of result = A*W for a sparse A: every nonzero A[i][k] adds
+ * A[i][k] * (row k of W) to row i of the result, so the work is the number of nonzeros times size instead of size^3.
+ * With a sparse W only the nonzeros of row k of W are added.
+ * The products of the columns k of a slice of depth columns are summed from 0 and the sum is added to the row, like
+ * the dense kernels with their tiles of that depth; a row whose nonzeros are all in one slice is summed in place.
+ * The rows are added by addRow, the row function of the dense kernel in use, so they are vectorized and rounded
+ * like that kernel.
+ * Input parameters: size, rowStart, rowEnd (exclusive), depth (tile depth of the dense kernels), a (values of type
+ * element), w (dense size x size, used when sparseW is NULL), sparseW (values of type wElement, or NULL), addRow,
+ * result, partial (size elements of scratch)
+ * Returns: nothing, rows rowStart..rowEnd-1 of result hold A*W
+**/
+void sparseMultiply(int size, int rowStart, int rowEnd, int depth, const struct sparseMatrix *a, const wElement *w,
+                    const struct sparseMatrix *sparseW, rowFunction addRow, element *result, element *partial){
+    const element *aValues = a->values;
+    const wElement *wValues = sparseW != NULL ? sparseW->values : NULL;
+    for(int i = rowStart; i < rowEnd; i++){
+        element *row = result + (size_t)i * size;
+        memset(row, 0, size * sizeof(element));
+        size_t next = a->rowStart[i];
+        size_t end = a->rowStart[i + 1];
+        if(next == end){
+            continue;
+        }
+        bool oneSlice = a->columns[next] / depth == a->columns[end - 1] / depth;
+        element *sum = oneSlice ? row : partial;
+        while(next < end){
+            int slice = a->columns[next] / depth;
+            if(!oneSlice){
+                memset(sum, 0, size * sizeof(element));
+            }
+            for(; next < end && a->columns[next] / depth == slice; next++){
+                int k = a->columns[next];
+                if(sparseW == NULL){
+                    addRow(sum, aValues[next], w + (size_t)k * size, NULL, size);
+                }else{
+                    size_t first = sparseW->rowStart[k];
+                    addRow(sum, aValues[next], wValues + first, sparseW->columns + first,
+                           (int)(sparseW->rowStart[k + 1] - first));
+                }
+            }
+            if(!oneSlice){
+                for(int j = 0; j < size; j++){
+                    row[j] = (element)((wrapElement)row[j] + (wrapElement)sum[j]);
+                }
+            }
+        }
+    }
+}
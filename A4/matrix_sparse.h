@@ -0,0 +1,38 @@
+/**
+ * Description: sparse matrices in the compressed sparse row format (CSR) for libmatmul (see matmul.h): the nonzero
+ * values of each row and their columns. An A made of a few populated rows (like test/A1.txt) is multiplied by going
+ * over its nonzeros only, by a dense W or, when W is sparse too, by the nonzeros of W.
+ * The products of a slice of depth columns of A are summed apart and then added to the row of the result, like the
+ * dense kernels sum their tiles, and the rows are added by a function of the dense kernel in use (compiled for the
+ * same instruction set), so the result is the same as theirs for every element type.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef MATRIX_SPARSE_H
+#define MATRIX_SPARSE_H
+
+#include <stddef.h>
+
+#include "matrix_types.h"
+
+struct sparseMatrix {
+    int size;
+    size_t nonzeros;
+    size_t *rowStart;   //size + 1 offsets: the nonzeros of row i are rowStart[i] to rowStart[i + 1] - 1
+    int *columns;
+    void *values;       //of the element type of the matrix
+};
+
+/**
+ * A function of a dense kernel that adds value * (a row of W) to a row of the result: count elements of W added to
+ * sum[0..count-1], or, when columns is not NULL, count nonzeros of a sparse row added to sum[columns[q]].
+ */
+typedef void (*rowFunction)(element *sum, element value, const wElement *wRow, const int *columns, int count);
+
+int sparseFill(struct sparseMatrix *sparse, int size, const void *matrix, int dtype, size_t limit);
+void sparseMultiply(int size, int rowStart, int rowEnd, int depth, const struct sparseMatrix *a, const wElement *w,
+                    const struct sparseMatrix *sparseW, rowFunction addRow, element *result, element *partial);
+
+#endif
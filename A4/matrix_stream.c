@@ -0,0 +1,430 @@
+/**
+ * Description: the out-of-core multiply of libmatmul, a layer computed by tiles from binary matrix files with a
+ * memory budget (see matrix_stream.h).
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "matrix_io.h"
+#include "matrix_stream.h"
+
+#define bufferAlign 64  //every buffer starts on a cache line
+
+/**
+ * The tiles of one product, read by the thread while the other buffer is multiplied. The coordinates of the tiles
+ * it holds are kept, so a tile that is needed again by the next product of the buffer is not read again.
+ */
+struct streamBuffer {
+    element *a;
+    wElement *w;
+    int aRow, aCol;         //tile of A held, -1 if none
+    int wFile, wRow, wCol;  //tile of W held
+    bool full;              //read, waiting for its multiply
+};
+
+/**
+ * What the multiplying thread and the reading thread share. Step s multiplies tile (s / fileC / tiles) of the result
+ * (row major), by W number (s / tiles) % fileC, with K = s % tiles.
+ */
+struct streamState {
+    struct tiledMatrix left;
+    struct tiledMatrix *ws;
+    int fileC;
+    struct tiledMatrix result;
+    int tile;
+    int tiles;                  //tiles per row and per column
+    long steps;
+    struct streamBuffer buffers[2];
+    element *results[2];        //result tiles, one summed while the other is written
+    int resultTile[2];
+    bool pending[2];            //complete, waiting to be written
+    int written;
+    bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    size_t bytesRead;
+    size_t bytesWritten;
+};
+
+/**
+ * This function returns how many bytes a buffer of a tile takes, rounded up to keep the next one aligned.
+ * Input parameters: tile, elementSize
+ * Returns: the bytes
+**/
+static size_t bufferBytes(int tile, size_t elementSize){
+    size_t bytes = (size_t)tile * tile * elementSize;
+    return (bytes + bufferAlign - 1) / bufferAlign * bufferAlign;
+}
+
+/**
+ * This function returns the options of the plan of the tiles.
+ * Input parameters: options, tile
+ * Returns: the plan options
+**/
+static struct matmulOptions tileOptions(const struct streamOptions *options, int tile){
+    struct matmulOptions multiply = options->multiply;
+    multiply.size = tile;
+    multiply.crossover = 0;
+    return multiply;
+}
+
+/**
+ * This function returns how much memory the buffers of tiles of the given size take: two tiles of A and of W, two
+ * result tiles and the product of a tile.
+ * Input parameters: tile
+ * Returns: the bytes
+**/
+static size_t tileBuffersBytes(int tile){
+    return 5 * bufferBytes(tile, sizeof(element)) + 2 * bufferBytes(tile, sizeof(wElement));
+}
+
+/**
+ * This function returns how much memory a layer streamed by tiles of the given size takes, the buffers and the plan.
+ * Input parameters: options, tile
+ * Returns: the bytes, 0 if the plan options cannot be used
+**/
+static size_t streamBytes(const struct streamOptions *options, int tile){
+    struct matmulOptions multiply = tileOptions(options, tile);
+    size_t plan = matmulPlanBytes(&multiply);
+    return plan > 0 ? tileBuffersBytes(tile) + plan : 0;
+}
+
+/**
+ * This function fills in the defaults of the options of a streamed layer: the budget, and the defaults of the plan
+ * of the tiles (see matmulDefaults).
+ * Input parameters: options (to fill in), budget (bytes)
+ * Returns: nothing
+**/
+void streamDefaults(struct streamOptions *options, size_t budget){
+    memset(options, 0, sizeof(*options));
+    options->budget = budget;
+    matmulDefaults(&options->multiply, 0);
+}
+
+/**
+ * This function picks the tile size of a size x size layer: the whole matrix if it fits in the budget, otherwise the
+ * fewest tiles per row that fit, each a multiple of streamTileAlign, so the edge tiles are not mostly padding.
+ * Input parameters: options, size
+ * Returns: the tile size, 0 if even tiles of streamMinTile do not fit in the budget
+**/
+int streamTileSize(const struct streamOptions *options, int size){
+    size_t bytes = streamBytes(options, size);
+    if(bytes > 0 && bytes <= options->budget){
+        return size;
+    }
+    for(int tiles = 2; ; tiles++){
+        int tile = ((size + tiles - 1) / tiles + streamTileAlign - 1) / streamTileAlign * streamTileAlign;
+        bytes = streamBytes(options, tile);
+        if(bytes > 0 && bytes <= options->budget){
+            return tile;
+        }
+        if(tile <= streamMinTile){
+            return 0;
+        }
+    }
+}
+
+/**
+ * This function counts the bytes of a tile that are in a file.
+ * Input parameters: tiled, firstRow, firstCol, tile
+ * Returns: the bytes
+**/
+static size_t fileBytes(const struct tiledMatrix *tiled, int firstRow, int firstCol, int tile){
+    int rows = tiled->rows - firstRow < tile ? tiled->rows - firstRow : tile;
+    int cols = tiled->cols - firstCol < tile ? tiled->cols - firstCol : tile;
+    return rows > 0 && cols > 0 ? (size_t)rows * cols * typeSize(tiled->dtype) : 0;
+}
+
+/**
+ * This function reads the tiles of step s into a buffer, unless the buffer already holds them.
+ * Input parameters: state, buffer, s
+ * Returns: 0 if successful, -1 if a file cannot be read
+**/
+static int readStep(struct streamState *state, struct streamBuffer *buffer, long s){
+    int tiles = state->tiles;
+    int tile = state->tile;
+    int resultTile = s / state->fileC / tiles;
+    int file = (s / tiles) % state->fileC;
+    int row = resultTile / tiles * tile;
+    int col = resultTile % tiles * tile;
+    int depth = s % tiles * tile;
+    if(buffer->aRow != row || buffer->aCol != depth){
+        buffer->aRow = -1;
+        if(readMatrixTile(&state->left, row, depth, tile, tile, buffer->a, tile, elementType) == -1){
+            return -1;
+        }
+        buffer->aRow = row;
+        buffer->aCol = depth;
+        state->bytesRead += fileBytes(&state->left, row, depth, tile);
+    }
+    if(buffer->wFile != file || buffer->wRow != depth || buffer->wCol != col){
+        buffer->wFile = -1;
+        if(readMatrixTile(&state->ws[file], depth, col, tile, tile, buffer->w, tile, wElementType) == -1){
+            return -1;
+        }
+        buffer->wFile = file;
+        buffer->wRow = depth;
+        buffer->wCol = col;
+        state->bytesRead += fileBytes(&state->ws[file], depth, col, tile);
+    }
+    return 0;
+}
+
+/**
+ * This function writes a complete result tile if there is one, with the lock held (it is released during the
+ * write).
+ * Input parameters: state
+ * Returns: true if a tile was written (or failed), false if none was waiting
+**/
+static bool writePending(struct streamState *state){
+    for(int r = 0; r < 2; r++){
+        if(!state->pending[r]){
+            continue;
+        }
+        pthread_mutex_unlock(&state->lock);
+        int tiles = state->tiles;
+        int tile = state->tile;
+        int row = state->resultTile[r] / tiles * tile;
+        int col = state->resultTile[r] % tiles * tile;
+        int status = writeMatrixTile(&state->result, row, col, tile, tile, state->results[r], tile);
+        pthread_mutex_lock(&state->lock);
+        state->bytesWritten += fileBytes(&state->result, row, col, tile);
+        state->pending[r] = false;
+        state->written++;
+        state->failed = state->failed || status == -1;
+        pthread_cond_broadcast(&state->changed);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * This function is the thread of the reads and writes: it reads the tiles of every step into the buffer the
+ * multiplies are not using, and writes the result tiles as they are completed.
+ * Input parameters: context (struct streamState)
+ * Returns: NULL
+**/
+static void *streamThread(void *context){
+    struct streamState *state = context;
+    pthread_mutex_lock(&state->lock);
+    for(long s = 0; s < state->steps && !state->failed; s++){
+        struct streamBuffer *buffer = &state->buffers[s % 2];
+        //the complete result tiles go first, they hold back the multiplies
+        while(!state->failed){
+            if(writePending(state)){
+                continue;
+            }
+            if(!buffer->full){
+                break;
+            }
+            pthread_cond_wait(&state->changed, &state->lock);
+        }
+        if(state->failed){
+            break;
+        }
+        pthread_mutex_unlock(&state->lock);
+        int status = readStep(state, buffer, s);
+        pthread_mutex_lock(&state->lock);
+        buffer->full = true;
+        state->failed = status == -1;
+        pthread_cond_broadcast(&state->changed);
+    }
+    int resultTiles = state->fileC > 0 ? state->tiles * state->tiles : 0;
+    while(state->written < resultTiles && !state->failed){
+        if(!writePending(state)){
+            pthread_cond_wait(&state->changed, &state->lock);
+        }
+    }
+    pthread_mutex_unlock(&state->lock);
+    return NULL;
+}
+
+/**
+ * This function adds a product tile into a result tile, as wrapElement (unsigned for the integer types, so the sums
+ * wrap like the products of the kernels).
+ * Input parameters: sum, product, count
+ * Returns: nothing
+**/
+static void addTile(element *restrict sum, const element *restrict product, size_t count){
+    wrapElement *restrict to = (wrapElement *)sum;
+    const wrapElement *restrict from = (const wrapElement *)product;
+    for(size_t i = 0; i < count; i++){
+        to[i] += from[i];
+    }
+}
+
+/**
+ * This function returns the time of a monotonic clock.
+ * Input parameters: none
+ * Returns: the seconds
+**/
+static double now(void){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * This function multiplies the steps as their tiles are read, adding the products into the result tiles, and hands
+ * the complete result tiles to the thread to be written.
+ * Input parameters: state, plan, product (a tile of scratch), stats
+ * Returns: nothing, state->failed is set if the thread failed
+**/
+static void multiplySteps(struct streamState *state, struct matmulPlan *plan, element *product,
+                          struct streamStats *stats){
+    size_t tileElements = (size_t)state->tile * state->tile;
+    long stepsPerTile = (long)state->fileC * state->tiles;
+    int current = 0;
+    memset(state->results[current], 0, tileElements * sizeof(element));
+    for(long s = 0; s < state->steps; s++){
+        struct streamBuffer *buffer = &state->buffers[s % 2];
+        pthread_mutex_lock(&state->lock);
+        double start = now();
+        while(!buffer->full && !state->failed){
+            pthread_cond_wait(&state->changed, &state->lock);
+        }
+        stats->waitSeconds += now() - start;
+        bool failed = state->failed;
+        pthread_mutex_unlock(&state->lock);
+        if(failed){
+            return;
+        }
+
+        matmulExecute(plan, buffer->a, buffer->w, product);
+        addTile(state->results[current], product, tileElements);
+        stats->products++;
+
+        pthread_mutex_lock(&state->lock);
+        buffer->full = false;
+        if(s % stepsPerTile == stepsPerTile - 1){
+            //the tile is complete: it is written while the next one is summed in the other buffer
+            state->resultTile[current] = s / stepsPerTile;
+            state->pending[current] = true;
+            current = 1 - current;
+            while(state->pending[current] && !state->failed){
+                pthread_cond_broadcast(&state->changed);
+                pthread_cond_wait(&state->changed, &state->lock);
+            }
+        }
+        pthread_cond_broadcast(&state->changed);
+        pthread_mutex_unlock(&state->lock);
+        if(s % stepsPerTile == stepsPerTile - 1){
+            memset(state->results[current], 0, tileElements * sizeof(element));
+        }
+    }
+}
+
+/**
+ * This function closes the files of a streamed layer.
+ * Input parameters: state, opened (Ws opened)
+ * Returns: nothing
+**/
+static void closeFiles(struct streamState *state, int opened){
+    for(int f = 0; f < opened; f++){
+        closeTiledMatrix(&state->ws[f]);
+    }
+    free(state->ws);
+    closeTiledMatrix(&state->left);
+}
+
+/**
+ * This function computes the layer result = left*W1 + ... + left*Wk by tiles, with at most the memory of the budget
+ * for the tiles and the plan (see matrix_stream.h). The files are binary matrix files of any element type, converted
+ * as they are read; the result is a size x size binary file of the element type, where size is the largest dimension
+ * of the files (at least options->minSize), the smaller matrices being padded with 0s. With no W the result is 0s.
+ * Input parameters: options, left, files (of the Ws), fileC, result (file name), stats (to fill in)
+ * Returns: 0 if successful, -1 if a file cannot be read or written (errno is set), the budget is too small for the
+ * tiles (ENOMEM) or the options cannot be used (EINVAL)
+**/
+int streamLayer(const struct streamOptions *options, const char *left, char *const files[], int fileC,
+                const char *result, struct streamStats *stats){
+    memset(stats, 0, sizeof(*stats));
+    struct streamState state;
+    memset(&state, 0, sizeof(state));
+    state.fileC = fileC;
+    state.ws = malloc((fileC > 0 ? fileC : 1) * sizeof(struct tiledMatrix));
+    if(state.ws == NULL){
+        return -1;
+    }
+    if(openTiledMatrix(left, &state.left) == -1){
+        free(state.ws);
+        return -1;
+    }
+    int size = options->minSize;
+    size = state.left.rows > size ? state.left.rows : size;
+    size = state.left.cols > size ? state.left.cols : size;
+    for(int f = 0; f < fileC; f++){
+        if(openTiledMatrix(files[f], &state.ws[f]) == -1){
+            closeFiles(&state, f);
+            return -1;
+        }
+        size = state.ws[f].rows > size ? state.ws[f].rows : size;
+        size = state.ws[f].cols > size ? state.ws[f].cols : size;
+    }
+    stats->size = size;
+
+    //the buffers and the plan of the tiles
+    int tile = streamTileSize(options, size);
+    struct matmulOptions multiply = tileOptions(options, tile);
+    struct matmulPlan plan;
+    char *memory = NULL;
+    if(tile == 0){
+        errno = ENOMEM;
+    }else if(matmulPlanInit(&plan, &multiply) == 0){
+        memory = aligned_alloc(bufferAlign, tileBuffersBytes(tile));
+        if(memory == NULL){
+            matmulPlanFree(&plan);
+        }
+    }
+    if(memory == NULL){
+        closeFiles(&state, fileC);
+        return -1;
+    }
+    state.tile = stats->tile = tile;
+    state.tiles = (size + tile - 1) / tile;
+    state.steps = fileC > 0 ? (long)state.tiles * state.tiles * fileC * state.tiles : 0;
+    char *next = memory;
+    for(int b = 0; b < 2; b++){
+        element *a = (element *)next;
+        next += bufferBytes(tile, sizeof(element));
+        state.buffers[b] = (struct streamBuffer){a, (wElement *)next, -1, -1, -1, -1, -1, false};
+        next += bufferBytes(tile, sizeof(wElement));
+        state.results[b] = (element *)next;
+        next += bufferBytes(tile, sizeof(element));
+    }
+    element *product = (element *)next;
+
+    //the result is created full of 0s, the thread writes its tiles
+    int status = createTiledMatrix(result, size, size, elementType, &state.result);
+    pthread_t thread;
+    if(status == 0){
+        pthread_mutex_init(&state.lock, NULL);
+        pthread_cond_init(&state.changed, NULL);
+        status = pthread_create(&thread, NULL, streamThread, &state) == 0 ? 0 : -1;
+        if(status == 0){
+            multiplySteps(&state, &plan, product, stats);
+            pthread_join(thread, NULL);
+            status = state.failed ? -1 : 0;
+        }
+        pthread_cond_destroy(&state.changed);
+        pthread_mutex_destroy(&state.lock);
+        if(closeTiledMatrix(&state.result) == -1){
+            status = -1;
+        }
+    }
+    stats->bytesRead = state.bytesRead;
+    stats->bytesWritten = state.bytesWritten;
+    free(memory);
+    matmulPlanFree(&plan);
+    closeFiles(&state, fileC);
+    return status;
+}
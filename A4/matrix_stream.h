@@ -0,0 +1,57 @@
+/**
+ * Description: the out-of-core multiply of libmatmul (see matmul.h), for matrices bigger than the memory: a layer
+ * R = A*W1 + ... + A*Wk is computed from binary matrix files (see struct tiledMatrix) by square tiles, with a memory
+ * budget. Result tile (I, J) is the sum of the products of the tiles A(I, K) and Wk(K, J), computed by a libmatmul
+ * plan of the tile size; it is written to R as soon as it is complete. A thread reads the tiles of the next product
+ * while the current one is multiplied, and writes the finished result tiles, so the reads and writes overlap the
+ * multiplies (two buffers for the tiles of A and W, two for the result).
+ *
+ *     struct streamOptions options;
+ *     struct streamStats stats;
+ *     streamDefaults(&options, 256 << 20);     //256 MB for the tiles and the plan
+ *     options.multiply.threads = 4;
+ *     streamLayer(&options, "A.bin", files, fileC, "R.bin", &stats);
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef MATRIX_STREAM_H
+#define MATRIX_STREAM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "matmul.h"
+
+#define streamMinTile 64    //smallest tile, the budget must hold the buffers of this size
+#define streamTileAlign 64  //the tiles are a multiple of this, unless the matrix is smaller
+
+/**
+ * How a layer is streamed. multiply has the options of the plan of the tiles (its size is the tile size, set by
+ * streamLayer); the Strassen recursion is not used, its temporaries would take the memory of bigger tiles.
+ */
+struct streamOptions {
+    size_t budget;                  //bytes for the tile buffers and the plan
+    int minSize;                    //the result is at least minSize x minSize
+    struct matmulOptions multiply;
+};
+
+/**
+ * What streamLayer did.
+ */
+struct streamStats {
+    int size;           //R is size x size
+    int tile;
+    long products;      //tile products
+    size_t bytesRead;
+    size_t bytesWritten;
+    double waitSeconds; //time the multiplies waited for the reads
+};
+
+void streamDefaults(struct streamOptions *options, size_t budget);
+int streamTileSize(const struct streamOptions *options, int size);
+int streamLayer(const struct streamOptions *options, const char *left, char *const files[], int fileC,
+                const char *result, struct streamStats *stats);
+
+#endif
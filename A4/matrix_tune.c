@@ -0,0 +1,213 @@
+/**
+ * Description: reading, writing and using the per-host profile of matrixtune (see matrix_tune.h). The profile is a
+ * text file:
+ *     # matrixtune profile
+ *     host NAME
+ *     type int32
+ *     # size kernel threads blockRows crossover forkRows fused tileRows tileCols tileDepth seconds
+ *     size 512 avx512 4 32 0 0 1 64 32 256 0.012345678
+ * A line without the three tile sizes (a profile of an older matrixtune) gets the default tiles.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "matrix_io.h"
+#include "matrix_tune.h"
+#include "matrix_types.h"
+
+#define tuneDirectory ".matrixtune"    //in the home directory
+
+/**
+ * This function returns the name of the element type of this build, as written in a profile.
+ * Input parameters: none
+ * Returns: the name of the type
+**/
+static const char *buildType(void){
+    return typeName(narrowW ? wElementType : elementType);
+}
+
+/**
+ * This function finds the profile of this host: MATRIXMULT_TUNE, otherwise ~/.matrixtune/<host>-<type>.
+ * Input parameters: path (to fill in), length
+ * Returns: 0 if successful, -1 if there is no profile to use (MATRIXMULT_TUNE is none or empty, or no home)
+**/
+int tuneProfilePath(char *path, size_t length){
+    const char *chosen = getenv("MATRIXMULT_TUNE");
+    if(chosen != NULL){
+        if(chosen[0] == '\0' || strcmp(chosen, "none") == 0){
+            return -1;
+        }
+        snprintf(path, length, "%s", chosen);
+        return 0;
+    }
+    const char *home = getenv("HOME");
+    char host[tuneHostLength];
+    if(home == NULL || gethostname(host, sizeof(host)) == -1){
+        return -1;
+    }
+    host[sizeof(host) - 1] = '\0';
+    snprintf(path, length, "%s/%s/%s-%s", home, tuneDirectory, host, buildType());
+    return 0;
+}
+
+/**
+ * This function starts an empty profile for this host and element type.
+ * Input parameters: profile
+ * Returns: nothing
+**/
+void tuneStart(struct tuneProfile *profile){
+    memset(profile, 0, sizeof(*profile));
+    if(gethostname(profile->host, sizeof(profile->host)) == -1){
+        strcpy(profile->host, "unknown");
+    }
+    profile->host[sizeof(profile->host) - 1] = '\0';
+    snprintf(profile->type, sizeof(profile->type), "%s", buildType());
+}
+
+/**
+ * This function reads a profile. A profile written on another host or for another element type is not used.
+ * Input parameters: path, profile (to fill in)
+ * Returns: 0 if successful, -1 if the file cannot be read or is not for this host and type
+**/
+int tuneLoad(const char *path, struct tuneProfile *profile){
+    struct tuneProfile current;
+    tuneStart(&current);
+    tuneStart(profile);
+    profile->host[0] = profile->type[0] = '\0';
+    FILE *file = fopen(path, "r");
+    if(file == NULL){
+        return -1;
+    }
+    char line[256];
+    while(fgets(line, sizeof(line), file) != NULL){
+        struct tuneEntry entry = {0};
+        int forkRows, fused;
+        if(sscanf(line, "host %63s", profile->host) == 1 || sscanf(line, "type %15s", profile->type) == 1){
+            continue;
+        }
+        bool tiled = sscanf(line, "size %d %15s %d %d %d %d %d %d %d %d %lf", &entry.size, entry.kernel,
+                            &entry.threads, &entry.blockRows, &entry.crossover, &forkRows, &fused, &entry.tiles.rows,
+                            &entry.tiles.cols, &entry.tiles.depth, &entry.seconds) == 11;
+        if(!tiled){
+            memset(&entry.tiles, 0, sizeof(entry.tiles));
+        }
+        if((tiled || sscanf(line, "size %d %15s %d %d %d %d %d %lf", &entry.size, entry.kernel, &entry.threads,
+                            &entry.blockRows, &entry.crossover, &forkRows, &fused, &entry.seconds) == 8) &&
+           entry.size > 0){
+            entry.forkRows = forkRows != 0;
+            entry.fused = fused != 0;
+            tuneSet(profile, &entry);
+        }
+    }
+    fclose(file);
+    if(strcmp(profile->host, current.host) != 0 || strcmp(profile->type, current.type) != 0){
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function writes a profile, creating ~/.matrixtune if the path is in it.
+ * Input parameters: path, profile
+ * Returns: 0 if successful, -1 if the file cannot be written
+**/
+int tuneSave(const char *path, const struct tuneProfile *profile){
+    char directory[1024];
+    snprintf(directory, sizeof(directory), "%s", path);
+    char *slash = strrchr(directory, '/');
+    if(slash != NULL && strstr(directory, tuneDirectory) != NULL){
+        *slash = '\0';
+        if(mkdir(directory, 0755) == -1 && errno != EEXIST){
+            return -1;
+        }
+    }
+    FILE *file = fopen(path, "w");
+    if(file == NULL){
+        return -1;
+    }
+    fprintf(file, "# matrixtune profile\nhost %s\ntype %s\n", profile->host, profile->type);
+    fprintf(file, "# size kernel threads blockRows crossover forkRows fused tileRows tileCols tileDepth seconds\n");
+    for(int i = 0; i < profile->count; i++){
+        const struct tuneEntry *entry = &profile->entries[i];
+        fprintf(file, "size %d %s %d %d %d %d %d %d %d %d %.9f\n", entry->size, entry->kernel, entry->threads,
+                entry->blockRows, entry->crossover, entry->forkRows, entry->fused, entry->tiles.rows,
+                entry->tiles.cols, entry->tiles.depth, entry->seconds);
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+/**
+ * This function adds the entry of a size to a profile, replacing the one it had for that size. The entries are kept
+ * in the order of their sizes; when the profile is full the entry of the largest size is dropped.
+ * Input parameters: profile, entry
+ * Returns: nothing
+**/
+void tuneSet(struct tuneProfile *profile, const struct tuneEntry *entry){
+    int i = 0;
+    while(i < profile->count && profile->entries[i].size < entry->size){
+        i++;
+    }
+    if(i < profile->count && profile->entries[i].size == entry->size){
+        profile->entries[i] = *entry;
+        return;
+    }
+    if(i == tuneMaxEntries){
+        return;
+    }
+    int moved = profile->count < tuneMaxEntries ? profile->count - i : profile->count - i - 1;
+    memmove(&profile->entries[i + 1], &profile->entries[i], moved * sizeof(struct tuneEntry));
+    profile->entries[i] = *entry;
+    profile->count = i + 1 + moved;
+}
+
+/**
+ * This function finds the entry of the size nearest to the given one (on a log scale, the cost grows as size^3).
+ * Input parameters: profile (or NULL), size
+ * Returns: the entry, or NULL if the profile has none
+**/
+const struct tuneEntry *tuneFind(const struct tuneProfile *profile, int size){
+    const struct tuneEntry *nearest = NULL;
+    double distance = 0;
+    for(int i = 0; profile != NULL && i < profile->count; i++){
+        int tuned = profile->entries[i].size;
+        double ratio = tuned > size ? (double)tuned / size : (double)size / tuned;
+        if(nearest == NULL || ratio < distance){
+            nearest = &profile->entries[i];
+            distance = ratio;
+        }
+    }
+    return nearest;
+}
+
+/**
+ * This function changes the options of a plan to the configuration of a profile entry, except the settings chosen
+ * explicitly. A kernel this CPU does not support is not used.
+ * Input parameters: entry (or NULL for no change), options, chosen (tuneKernel, tuneThreads and tuneStrassen bits)
+ * Returns: nothing
+**/
+void tuneApply(const struct tuneEntry *entry, struct matmulOptions *options, int chosen){
+    if(entry == NULL){
+        return;
+    }
+    const struct matmulKernel *kernel = matmulFindKernel(entry->kernel);
+    if(!(chosen & tuneKernel) && kernel != NULL){
+        options->kernel = kernel;
+    }
+    if(!(chosen & tuneThreads)){
+        options->threads = entry->threads > 1 ? entry->threads : 1;
+    }
+    options->blockRows = entry->blockRows;
+    options->tiles = entry->tiles;
+    if(!(chosen & tuneStrassen) && !narrowW){
+        options->crossover = entry->crossover;
+    }
+}
@@ -0,0 +1,61 @@
+/**
+ * Description: the per-host profile written by matrixtune and read by matrixmult_parallel and
+ * matrixmult_multiw_deep at startup. For each matrix size that was tuned it holds the fastest way matrixtune found
+ * to multiply on this host with this element type: the kernel, its cache tiles, the threads and their blocks of rows,
+ * the Strassen crossover, whether matrixmult_parallel should fork its row children, and whether a layer is faster fused.
+ * A size without an entry uses the entry of the nearest size. A profile of another host or element type is ignored.
+ * The profile is MATRIXMULT_TUNE if it is set (none for no profile), otherwise ~/.matrixtune/<host>-<type>.
+ * Settings chosen explicitly (an option or a MATRIXMULT_ variable) are not overridden (see tuneApply).
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef MATRIX_TUNE_H
+#define MATRIX_TUNE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "matmul.h"
+
+#define tuneNameLength 16
+#define tuneHostLength 64
+#define tuneMaxEntries 32
+
+//settings chosen explicitly, which tuneApply keeps
+#define tuneKernel 1
+#define tuneThreads 2
+#define tuneStrassen 4
+
+/**
+ * The fastest configuration found for one size.
+ */
+struct tuneEntry {
+    int size;
+    char kernel[tuneNameLength];
+    int threads;        //threads of a multiply, 1 when it is computed by one thread or by the row children
+    int blockRows;      //rows of a task of the threads, 0 for the default
+    struct matmulTiles tiles;   //cache blocks of the kernel, 0s for the defaults
+    int crossover;      //Strassen crossover, 0 for the classical multiply
+    bool forkRows;      //matrixmult_parallel forks its row children instead of computing in process
+    bool fused;         //a layer of several Ws is faster with the Ws summed first
+    double seconds;     //time of one multiply with this configuration
+};
+
+struct tuneProfile {
+    char host[tuneHostLength];
+    char type[tuneNameLength];
+    int count;
+    struct tuneEntry entries[tuneMaxEntries];  //in the order of their sizes
+};
+
+int tuneProfilePath(char *path, size_t length);
+void tuneStart(struct tuneProfile *profile);
+int tuneLoad(const char *path, struct tuneProfile *profile);
+int tuneSave(const char *path, const struct tuneProfile *profile);
+void tuneSet(struct tuneProfile *profile, const struct tuneEntry *entry);
+const struct tuneEntry *tuneFind(const struct tuneProfile *profile, int size);
+void tuneApply(const struct tuneEntry *entry, struct matmulOptions *options, int chosen);
+
+#endif
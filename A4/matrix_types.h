@@ -0,0 +1,66 @@
+/**
+ * Description: the element types of the matrices, chosen when the programs are built (make TYPE=...). The two
+ * programs have to be built with the same type, they exchange matrices of these types through pipes and shared
+ * memory.
+ *  int8, int16  W is kept with 8 or 16 bits (in memory, in the cache, on the pipes and in the packed panels of the
+ *               kernels, which widen it as they load it); A, R and Rsum are int32 and the products are summed in int32
+ *  int32        every matrix is int (the default)
+ *  int64        every matrix is int64, for deep chains that overflow int32
+ *  float        every matrix is float
+ *  double       every matrix is double
+ * Matrix files of any type are converted when they are loaded (see loadMatrix).
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef MATRIX_TYPES_H
+#define MATRIX_TYPES_H
+
+#include <stdint.h>
+
+#include "matrix_io.h"
+
+//element: A, R and Rsum; wElement: W; wrapElement: element for sums that must wrap around instead of overflowing
+#if defined(matrixType_int8)
+typedef int32_t element;
+typedef int8_t wElement;
+typedef uint32_t wrapElement;
+#define elementType typeInt32
+#define wElementType typeInt8
+#elif defined(matrixType_int16)
+typedef int32_t element;
+typedef int16_t wElement;
+typedef uint32_t wrapElement;
+#define elementType typeInt32
+#define wElementType typeInt16
+#elif defined(matrixType_int64)
+typedef int64_t element;
+typedef int64_t wElement;
+typedef uint64_t wrapElement;
+#define elementType typeInt64
+#define wElementType typeInt64
+#elif defined(matrixType_float)
+typedef float element;
+typedef float wElement;
+typedef float wrapElement;
+#define elementType typeFloat
+#define wElementType typeFloat
+#elif defined(matrixType_double)
+typedef double element;
+typedef double wElement;
+typedef double wrapElement;
+#define elementType typeDouble
+#define wElementType typeDouble
+#else
+typedef int element;
+typedef int wElement;
+typedef unsigned wrapElement;
+#define elementType typeInt32
+#define wElementType typeInt32
+#endif
+
+//W is narrower than A: sums of Ws do not fit in a W
+#define narrowW (wElementType != elementType)
+
+#endif
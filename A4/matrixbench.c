@@ -0,0 +1,735 @@
+/**
+ * Description: a benchmark of matrixmult_parallel and matrixmult_multiw_deep. It generates synthetic A and W files
+ * over a grid of matrix sizes, Ws per line and layer depths, runs both programs in each of their execution modes
+ * (after warmup runs), and reports the median, p95 and best runtimes and the GFLOP/s of every case as CSV (and
+ * JSON). The data is generated from fixed seeds, so two builds run exactly the same cases; with --baseline the
+ * medians are compared to a previous CSV and slowdowns beyond the tolerance are reported.
+ * Usage: ./matrixbench [--sizes N,N,...] [--ws N,...] [--depths N,...] [--repeats N] [--warmup N] [--modes M,...]
+ *                      [--bin DIR] [--dir DIR] [--log-level LEVEL] [--csv FILE] [--json FILE]
+ *                      [--baseline FILE [--tolerance PERCENT]]
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "matrix_io.h"
+#include "matrix_types.h"
+
+#define maxGrid 16          //values per grid dimension
+#define maxArgs 32
+#define maxResults 1024
+#define defaultRepeats 5
+#define defaultWarmup 1
+#define defaultTolerance 10 //percent slower than the baseline reported as a regression
+#define cacheMegabytes "256"
+#define streamMegabytes "64"    //memory of the tiles of the out-of-core mode
+#define nameLength 64
+#define benchInputs 4       //A matrices of the inputs mode
+#define workerSocket "bench.sock" //socket of the worker server of the workers mode, in the data directory
+
+/**
+ * The values of one dimension of the grid, e.g. the matrix sizes.
+ */
+struct grid {
+    int values[maxGrid];
+    int count;
+};
+
+/**
+ * An execution mode of one of the programs: its name and its options. "%p" stands for the pool size and "%s" for
+ * the Strassen crossover.
+ */
+struct benchMode {
+    const char *name;
+    const char *options[8];
+    int inputs;         //A matrices run at once, from a list file after the options; 0 for A itself
+    bool binaryFiles;   //A and the Ws are given as binary matrix files
+};
+
+static const struct benchMode parallelModes[] = {
+    {"fork", {NULL}},
+    {"threads", {"--threads", NULL}},
+    {"strassen", {"--strassen=%s", NULL}},
+};
+
+static const struct benchMode deepModes[] = {
+    {"fork", {NULL}},
+    {"shm", {"--shm", NULL}},
+    {"binary", {"--binary", NULL}},
+    {"pool", {"--pool", "%p", NULL}},
+    {"pool-shm", {"--pool", "%p", "--shm", NULL}},
+    {"pool-cache", {"--pool", "%p", "--cache", cacheMegabytes, NULL}},
+    {"pool-prefetch", {"--pool", "%p", "--cache", cacheMegabytes, "--prefetch", "2", NULL}},
+    {"fused", {"--fused", NULL}},
+    {"batch", {"--batch", NULL}},
+    {"in-process", {"--in-process", "--max-children", "%p", NULL}},
+    {"workers", {"--workers", "unix:" workerSocket, NULL}},
+    {"inputs", {"--inputs", NULL}, benchInputs},
+    {"out-of-core", {"--out-of-core", streamMegabytes, NULL}, 0, true},
+};
+
+/**
+ * The measurements of one case.
+ */
+struct benchResult {
+    char program[nameLength];
+    char mode[nameLength];
+    int size;
+    int ws;
+    int depth;
+    int runs;
+    int failures;
+    double median;
+    double p95;
+    double best;
+    double gflops;      //of the median run, counting 2*size^3 per (Rsum, W) product
+    double baseline;    //median of the baseline, 0 if it has no such case
+};
+
+/**
+ * This function parses a comma separated list of positive numbers.
+ * Input parameters: text, grid (to fill in)
+ * Returns: 0 if successful, -1 if the list is empty, too long or not made of positive numbers
+**/
+int parseGrid(const char *text, struct grid *grid){
+    grid->count = 0;
+    while(*text != '\0'){
+        char *end;
+        long value = strtol(text, &end, 10);
+        if(end == text || value <= 0 || value > INT_MAX || grid->count == maxGrid || (*end != ',' && *end != '\0')){
+            return -1;
+        }
+        grid->values[grid->count++] = (int)value;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return grid->count > 0 ? 0 : -1;
+}
+
+/**
+ * This function tells if a mode is selected by the --modes list (all modes without it).
+ * Input parameters: modes (comma separated names, or NULL), name
+ * Returns: true if the mode is selected
+**/
+bool modeSelected(const char *modes, const char *name){
+    if(modes == NULL){
+        return true;
+    }
+    size_t length = strlen(name);
+    for(const char *mode = modes; mode != NULL; mode = strchr(mode, ',') != NULL ? strchr(mode, ',') + 1 : NULL){
+        if(strncmp(mode, name, length) == 0 && (mode[length] == ',' || mode[length] == '\0')){
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * This function returns the next number of a pseudo-random sequence (a 64-bit LCG), the same on every platform.
+ * Input parameters: state
+ * Returns: a number from 0 to 9
+**/
+int nextValue(uint64_t *state){
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (int)((*state >> 33) % 10);
+}
+
+/**
+ * This function returns the name of the binary copy of a generated matrix: its .txt replaced by .bin.
+ * Input parameters: binary (to fill in, nameLength bytes), filename
+ * Returns: nothing
+**/
+void binaryName(char *binary, const char *filename){
+    snprintf(binary, nameLength, "%.*s.bin", (int)(strlen(filename) - strlen(".txt")), filename);
+}
+
+/**
+ * This function writes a size x size text matrix of values from 0 to 9, generated from a seed, and with binary
+ * the same matrix as a binary file (see binaryName).
+ * Input parameters: filename, size, seed, binary
+ * Returns: 0 if successful, -1 if a file cannot be written
+**/
+int generateMatrix(const char *filename, int size, uint64_t seed, bool binary){
+    int *matrix = malloc((size_t)size * size * sizeof(int));
+    if(matrix == NULL){
+        perror("malloc");
+        exit(1);
+    }
+    for(size_t i = 0; i < (size_t)size * size; i++){
+        matrix[i] = nextValue(&seed);
+    }
+    int status = saveMatrixText(filename, size, size, matrix, size, typeInt32);
+    if(binary && status == 0){
+        char binaryFile[nameLength];
+        binaryName(binaryFile, filename);
+        status = saveMatrixBinary(binaryFile, size, size, matrix, size, typeInt32);
+    }
+    free(matrix);
+    return status;
+}
+
+/**
+ * This function writes the stdin of matrixmult_multiw_deep for a case: depth - 1 lines of the Ws.
+ * Input parameters: filename, wFiles, wCount, depth
+ * Returns: nothing
+**/
+void writeLines(const char *filename, char wFiles[][nameLength], int wCount, int depth){
+    FILE *lines = fopen(filename, "w");
+    if(lines == NULL){
+        perror("fopen");
+        exit(1);
+    }
+    for(int l = 1; l < depth; l++){
+        for(int w = 0; w < wCount; w++){
+            fprintf(lines, "%s%s", w > 0 ? " " : "", wFiles[w]);
+        }
+        fprintf(lines, "\n");
+    }
+    fclose(lines);
+}
+
+/**
+ * This function returns the time of a monotonic clock.
+ * Input parameters: none
+ * Returns: the time in seconds
+**/
+double now(void){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * This function runs a program once, with stdin from a file and its output thrown away, and times it.
+ * Input parameters: argv (of the program), input (file for stdin, or NULL for /dev/null)
+ * Returns: the runtime in seconds, or -1 if the program could not be run or did not exit with 0
+**/
+double runOnce(char *const argv[], const char *input){
+    double start = now();
+    pid_t pid = fork();
+    if(pid == -1){
+        perror("fork");
+        return -1;
+    }
+    if(pid == 0){
+        int in = open(input != NULL ? input : "/dev/null", O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if(in == -1 || out == -1){
+            _exit(127);
+        }
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        dup2(out, STDERR_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    if(waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        return -1;
+    }
+    return now() - start;
+}
+
+/**
+ * This function compares two runtimes, for qsort.
+ * Input parameters: a, b
+ * Returns: <0, 0 or >0
+**/
+int compareTimes(const void *a, const void *b){
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * This function runs one case: warmup runs, then repeats timed runs, and computes the statistics of the runs that
+ * succeeded (median, p95 by nearest rank, best).
+ * Input parameters: argv, input, warmup, repeats, products (number of size x size products of one run), result
+ * (to fill in, with the names and the grid values already set)
+ * Returns: nothing
+**/
+void runCase(char *const argv[], const char *input, int warmup, int repeats, double products,
+             struct benchResult *result){
+    for(int i = 0; i < warmup; i++){
+        runOnce(argv, input);
+    }
+    double times[repeats];
+    int runs = 0;
+    for(int i = 0; i < repeats; i++){
+        double time = runOnce(argv, input);
+        if(time >= 0){
+            times[runs++] = time;
+        }
+    }
+    result->runs = runs;
+    result->failures = repeats - runs;
+    result->median = result->p95 = result->best = result->gflops = 0;
+    if(runs == 0){
+        return;
+    }
+    qsort(times, runs, sizeof(double), compareTimes);
+    result->median = runs % 2 == 1 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    int rank = (95 * runs + 99) / 100;
+    result->p95 = times[rank - 1];
+    result->best = times[0];
+    result->gflops = 2.0 * result->size * result->size * result->size * products / result->median / 1e9;
+}
+
+/**
+ * This function starts the worker server of the workers mode (matrixmult_parallel --listen) on a Unix-domain socket
+ * of the data directory, and waits until it accepts connections.
+ * Input parameters: program (matrixmult_parallel)
+ * Returns: the pid of the server, or -1 if it could not be started
+**/
+pid_t startServer(const char *program){
+    unlink(workerSocket);
+    pid_t pid = fork();
+    if(pid == -1){
+        perror("fork");
+        return -1;
+    }
+    if(pid == 0){
+        int out = open("/dev/null", O_WRONLY);
+        if(out == -1){
+            _exit(127);
+        }
+        dup2(out, STDOUT_FILENO);
+        dup2(out, STDERR_FILENO);
+        execl(program, program, "--listen", "unix:" workerSocket, (char *)NULL);
+        _exit(127);
+    }
+
+    //a connection that succeeds means the server listens, it is closed at once
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", workerSocket);
+    for(int attempt = 0; attempt < 500; attempt++){
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool listening = fd != -1 && connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+        if(fd != -1){
+            close(fd);
+        }
+        if(listening){
+            return pid;
+        }
+        if(waitpid(pid, NULL, WNOHANG) == pid){
+            return -1;
+        }
+        usleep(10000);
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+/**
+ * This function stops the worker server started by startServer.
+ * Input parameters: pid
+ * Returns: nothing
+**/
+void stopServer(pid_t pid){
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(workerSocket);
+}
+
+/**
+ * This function builds the command line of a case: the program, the options of the mode (with %p and %s replaced)
+ * and the matrix files.
+ * Input parameters: argv (to fill in, maxArgs entries), storage (for the replaced options), program, mode,
+ * poolSize, crossover, files (NULL terminated)
+ * Returns: nothing
+**/
+void buildArgs(char *argv[], char storage[][nameLength], const char *program, const struct benchMode *mode,
+               int poolSize, int crossover, char *const files[]){
+    int count = 0;
+    argv[count++] = (char *)program;
+    for(int i = 0; mode->options[i] != NULL; i++){
+        const char *option = mode->options[i];
+        char *percent = strchr(option, '%');
+        if(percent == NULL){
+            argv[count++] = (char *)option;
+            continue;
+        }
+        snprintf(storage[i], nameLength, "%.*s%d", (int)(percent - option), option,
+                 percent[1] == 'p' ? poolSize : crossover);
+        argv[count++] = storage[i];
+    }
+    for(int i = 0; files[i] != NULL && count < maxArgs - 1; i++){
+        argv[count++] = files[i];
+    }
+    argv[count] = NULL;
+}
+
+/**
+ * This function reads the medians of a previous run from its CSV, and sets the baseline of the matching results.
+ * Input parameters: filename, results, count
+ * Returns: 0 if successful, -1 if the file cannot be read
+**/
+int readBaseline(const char *filename, struct benchResult *results, int count){
+    FILE *file = fopen(filename, "r");
+    if(file == NULL){
+        return -1;
+    }
+    char line[512];
+    while(fgets(line, sizeof(line), file) != NULL){
+        char program[nameLength], mode[nameLength];
+        int size, ws, depth;
+        double median;
+        //program,mode,size,ws,depth,runs,failures,median_s,...
+        if(sscanf(line, "%63[^,],%63[^,],%d,%d,%d,%*d,%*d,%lf", program, mode, &size, &ws, &depth, &median) != 6){
+            continue;
+        }
+        for(int i = 0; i < count; i++){
+            struct benchResult *result = &results[i];
+            if(strcmp(result->program, program) == 0 && strcmp(result->mode, mode) == 0 && result->size == size &&
+               result->ws == ws && result->depth == depth){
+                result->baseline = median;
+            }
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+/**
+ * This function writes the results as CSV, one line per case.
+ * Input parameters: file, results, count
+ * Returns: nothing
+**/
+void writeCsv(FILE *file, const struct benchResult *results, int count){
+    fprintf(file, "program,mode,size,ws,depth,runs,failures,median_s,p95_s,best_s,gflops,baseline_s,change_pct\n");
+    for(int i = 0; i < count; i++){
+        const struct benchResult *r = &results[i];
+        fprintf(file, "%s,%s,%d,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.3f,", r->program, r->mode, r->size, r->ws, r->depth,
+                r->runs, r->failures, r->median, r->p95, r->best, r->gflops);
+        if(r->baseline > 0 && r->runs > 0){
+            fprintf(file, "%.6f,%.1f\n", r->baseline, (r->median / r->baseline - 1) * 100);
+        }else{
+            fprintf(file, ",\n");
+        }
+    }
+}
+
+/**
+ * This function writes the results as JSON, with the settings of the run.
+ * Input parameters: file, results, count, repeats, warmup
+ * Returns: nothing
+**/
+void writeJson(FILE *file, const struct benchResult *results, int count, int repeats, int warmup){
+    fprintf(file, "{\n  \"type\": \"%s\",\n  \"cores\": %ld,\n  \"repeats\": %d,\n  \"warmup\": %d,\n",
+            typeName(narrowW ? wElementType : elementType), sysconf(_SC_NPROCESSORS_ONLN), repeats, warmup);
+    fprintf(file, "  \"results\": [\n");
+    for(int i = 0; i < count; i++){
+        const struct benchResult *r = &results[i];
+        fprintf(file, "    {\"program\": \"%s\", \"mode\": \"%s\", \"size\": %d, \"ws\": %d, \"depth\": %d, "
+                      "\"runs\": %d, \"failures\": %d, \"median\": %.6f, \"p95\": %.6f, \"best\": %.6f, "
+                      "\"gflops\": %.3f", r->program, r->mode, r->size, r->ws, r->depth, r->runs, r->failures,
+                r->median, r->p95, r->best, r->gflops);
+        if(r->baseline > 0){
+            fprintf(file, ", \"baseline\": %.6f", r->baseline);
+        }
+        fprintf(file, "}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+/**
+ * This function generates the data, runs every case of the grid in every selected mode and writes the results.
+ * Input parameters: argc and argv
+ * Returns: exit(0) if successful, exit(1) if there is an error, exit(2) if a case regressed against the baseline
+**/
+int main(int argc, char* argv[]) {
+    static struct option options[] = {
+        {"sizes", required_argument, NULL, 'n'},
+        {"ws", required_argument, NULL, 'w'},
+        {"depths", required_argument, NULL, 'd'},
+        {"repeats", required_argument, NULL, 'r'},
+        {"warmup", required_argument, NULL, 'u'},
+        {"modes", required_argument, NULL, 'm'},
+        {"bin", required_argument, NULL, 'b'},
+        {"dir", required_argument, NULL, 'D'},
+        {"log-level", required_argument, NULL, 'l'},
+        {"csv", required_argument, NULL, 'c'},
+        {"json", required_argument, NULL, 'j'},
+        {"baseline", required_argument, NULL, 'B'},
+        {"tolerance", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0}
+    };
+    struct grid sizes = {{64, 256, 512}, 3};
+    struct grid ws = {{1, 4}, 2};
+    struct grid depths = {{1, 4}, 2};
+    int repeats = defaultRepeats;
+    int warmup = defaultWarmup;
+    double tolerance = defaultTolerance;
+    const char *modes = NULL;
+    const char *binDir = ".";
+    const char *dataDir = "bench_data";
+    const char *logLevel = "none";
+    const char *csvFile = NULL;
+    const char *jsonFile = NULL;
+    const char *baselineFile = NULL;
+    int option;
+    bool valid = true;
+    while((option = getopt_long(argc, argv, "", options, NULL)) != -1){
+        if(option == 'n'){
+            valid = parseGrid(optarg, &sizes) == 0;
+        }else if(option == 'w'){
+            valid = parseGrid(optarg, &ws) == 0;
+        }else if(option == 'd'){
+            valid = parseGrid(optarg, &depths) == 0;
+        }else if(option == 'r'){
+            repeats = atoi(optarg);
+            valid = repeats > 0;
+        }else if(option == 'u'){
+            warmup = atoi(optarg);
+            valid = warmup >= 0;
+        }else if(option == 'm'){
+            modes = optarg;
+        }else if(option == 'b'){
+            binDir = optarg;
+        }else if(option == 'D'){
+            dataDir = optarg;
+        }else if(option == 'l'){
+            logLevel = optarg;
+        }else if(option == 'c'){
+            csvFile = optarg;
+        }else if(option == 'j'){
+            jsonFile = optarg;
+        }else if(option == 'B'){
+            baselineFile = optarg;
+        }else if(option == 't'){
+            tolerance = atof(optarg);
+        }else{
+            valid = false;
+        }
+        if(!valid){
+            fprintf(stderr, "Usage: %s [--sizes N,N,...] [--ws N,...] [--depths N,...] [--repeats N] [--warmup N]\n"
+                            "       [--modes M,...] [--bin DIR] [--dir DIR] [--log-level LEVEL] [--csv FILE]\n"
+                            "       [--json FILE] [--baseline FILE [--tolerance PERCENT]]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    //the programs are run from the data directory, where matrixmult_multiw_deep finds ./matrixmult_parallel
+    char binPath[PATH_MAX], parallelPath[PATH_MAX + nameLength], deepPath[PATH_MAX + nameLength];
+    if(realpath(binDir, binPath) == NULL){
+        fprintf(stderr, "Error - cannot find directory %s.\n", binDir);
+        exit(1);
+    }
+    snprintf(parallelPath, sizeof(parallelPath), "%s/matrixmult_parallel", binPath);
+    snprintf(deepPath, sizeof(deepPath), "%s/matrixmult_multiw_deep", binPath);
+    if(access(parallelPath, X_OK) == -1 || access(deepPath, X_OK) == -1){
+        fprintf(stderr, "Error - matrixmult_parallel and matrixmult_multiw_deep are not built in %s.\n", binPath);
+        exit(1);
+    }
+    //the baseline and the output files are relative to where the benchmark was started
+    int startDir = open(".", O_RDONLY | O_DIRECTORY);
+    if(startDir == -1){
+        perror("open");
+        exit(1);
+    }
+    if((mkdir(dataDir, 0755) == -1 && access(dataDir, W_OK) == -1) || chdir(dataDir) == -1){
+        fprintf(stderr, "Error - cannot use directory %s.\n", dataDir);
+        exit(1);
+    }
+    unlink("matrixmult_parallel");
+    if(symlink(parallelPath, "matrixmult_parallel") == -1){
+        perror("symlink");
+        exit(1);
+    }
+
+    //the modes choose the engine, not a profile of matrixtune; the logs are off unless asked for (their cost is
+    //measured separately)
+    unsetenv("MATRIXMULT_THREADS");
+    unsetenv("MATRIXMULT_STRASSEN");
+    setenv("MATRIXMULT_TUNE", "none", 1);
+    unsetenv("MATRIXMULT_LOG");
+    setenv("MATRIXMULT_LOG_LEVEL", logLevel, 1);
+    pid_t server = -1;
+    if(modeSelected(modes, "workers") && (server = startServer(parallelPath)) == -1){
+        fprintf(stderr, "Error - cannot start a worker server, the workers cases fail.\n");
+    }
+    int poolSize = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(poolSize < 1){
+        poolSize = 1;
+    }
+    int maxWs = 0;
+    for(int i = 0; i < ws.count; i++){
+        maxWs = ws.values[i] > maxWs ? ws.values[i] : maxWs;
+    }
+    if(maxWs > maxArgs - 12){
+        fprintf(stderr, "Error - at most %d Ws per line.\n", maxArgs - 12);
+        exit(1);
+    }
+
+    //binary copies of A and the Ws, for the modes that read them
+    bool binary = false;
+    for(size_t m = 0; m < sizeof(deepModes) / sizeof(deepModes[0]); m++){
+        binary = binary || (deepModes[m].binaryFiles && modeSelected(modes, deepModes[m].name));
+    }
+
+    static struct benchResult results[maxResults];
+    int count = 0;
+    for(int s = 0; s < sizes.count; s++){
+        int size = sizes.values[s];
+        char aFile[nameLength], aBinary[nameLength];
+        char wFiles[maxArgs][nameLength], wBinaries[maxArgs][nameLength];
+        snprintf(aFile, sizeof(aFile), "A_%d.txt", size);
+        binaryName(aBinary, aFile);
+        bool generated = generateMatrix(aFile, size, (uint64_t)size << 8, binary) == 0;
+        for(int w = 0; w < maxWs; w++){
+            snprintf(wFiles[w], nameLength, "W_%d_%d.txt", size, w);
+            binaryName(wBinaries[w], wFiles[w]);
+            generated = generated && generateMatrix(wFiles[w], size, ((uint64_t)size << 8) + w + 1, binary) == 0;
+        }
+        //the inputs mode runs A and benchInputs - 1 other matrices, listed in a file
+        char inputsFile[nameLength];
+        snprintf(inputsFile, sizeof(inputsFile), "inputs_%d.txt", size);
+        FILE *inputs = fopen(inputsFile, "w");
+        if(inputs == NULL){
+            generated = false;
+        }else{
+            fprintf(inputs, "%s\n", aFile);
+            for(int i = 1; i < benchInputs; i++){
+                char inputFile[nameLength];
+                snprintf(inputFile, sizeof(inputFile), "A_%d_%d.txt", size, i);
+                uint64_t seed = ((uint64_t)size << 8) + maxArgs + i;
+                generated = generated && generateMatrix(inputFile, size, seed, false) == 0;
+                fprintf(inputs, "%s\n", inputFile);
+            }
+            generated = fclose(inputs) == 0 && generated;
+        }
+        if(!generated){
+            fprintf(stderr, "Error - cannot write the matrices in %s.\n", dataDir);
+            exit(1);
+        }
+        int crossover = size / 4 > 16 ? size / 4 : 16;
+
+        //matrixmult_parallel: one product of A and W
+        for(size_t m = 0; m < sizeof(parallelModes) / sizeof(parallelModes[0]); m++){
+            const struct benchMode *mode = &parallelModes[m];
+            if(!modeSelected(modes, mode->name) || count == maxResults){
+                continue;
+            }
+            char *args[maxArgs];
+            char storage[8][nameLength];
+            char *files[] = {aFile, wFiles[0], NULL};
+            buildArgs(args, storage, "./matrixmult_parallel", mode, poolSize, crossover, files);
+            struct benchResult *result = &results[count++];
+            memset(result, 0, sizeof(*result));
+            snprintf(result->program, nameLength, "matrixmult_parallel");
+            snprintf(result->mode, nameLength, "%s", mode->name);
+            result->size = size;
+            result->ws = result->depth = 1;
+            fprintf(stderr, "matrixmult_parallel %s size %d\n", mode->name, size);
+            runCase(args, NULL, warmup, repeats, 1, result);
+        }
+
+        //matrixmult_multiw_deep: depth layers of k Ws, the first from the command line, the others from stdin
+        for(int k = 0; k < ws.count; k++){
+            for(int d = 0; d < depths.count; d++){
+                int wCount = ws.values[k];
+                int depth = depths.values[d];
+                char input[nameLength], binaryInput[nameLength];
+                snprintf(input, sizeof(input), "lines_%d_%d_%d.txt", size, wCount, depth);
+                writeLines(input, wFiles, wCount, depth);
+                snprintf(binaryInput, sizeof(binaryInput), "lines_%d_%d_%d_bin.txt", size, wCount, depth);
+                if(binary){
+                    writeLines(binaryInput, wBinaries, wCount, depth);
+                }
+
+                for(size_t m = 0; m < sizeof(deepModes) / sizeof(deepModes[0]); m++){
+                    const struct benchMode *mode = &deepModes[m];
+                    if(!modeSelected(modes, mode->name) || count == maxResults){
+                        continue;
+                    }
+                    char *args[maxArgs];
+                    char storage[8][nameLength];
+                    char *files[maxArgs];
+                    files[0] = mode->inputs > 0 ? inputsFile : mode->binaryFiles ? aBinary : aFile;
+                    for(int w = 0; w < wCount; w++){
+                        files[w + 1] = mode->binaryFiles ? wBinaries[w] : wFiles[w];
+                    }
+                    files[wCount + 1] = NULL;
+                    buildArgs(args, storage, deepPath, mode, poolSize, crossover, files);
+                    struct benchResult *result = &results[count++];
+                    memset(result, 0, sizeof(*result));
+                    snprintf(result->program, nameLength, "matrixmult_multiw_deep");
+                    snprintf(result->mode, nameLength, "%s", mode->name);
+                    result->size = size;
+                    result->ws = wCount;
+                    result->depth = depth;
+                    fprintf(stderr, "matrixmult_multiw_deep %s size %d ws %d depth %d\n", mode->name, size, wCount,
+                            depth);
+                    int as = mode->inputs > 0 ? mode->inputs : 1;
+                    runCase(args, mode->binaryFiles ? binaryInput : input, warmup, repeats, (double)wCount * depth * as,
+                            result);
+                }
+            }
+        }
+    }
+
+    if(server != -1){
+        stopServer(server);
+    }
+    if(fchdir(startDir) == -1){
+        perror("fchdir");
+        exit(1);
+    }
+    close(startDir);
+
+    //compare with the baseline: a median slower by more than the tolerance is a regression
+    int regressions = 0;
+    if(baselineFile != NULL){
+        if(readBaseline(baselineFile, results, count) == -1){
+            fprintf(stderr, "Error - cannot read the baseline %s.\n", baselineFile);
+            exit(1);
+        }
+        for(int i = 0; i < count; i++){
+            const struct benchResult *r = &results[i];
+            if(r->baseline > 0 && r->runs > 0 && r->median > r->baseline * (1 + tolerance / 100)){
+                fprintf(stderr, "Regression: %s %s size %d ws %d depth %d: %.6f s, baseline %.6f s (%+.1f%%)\n",
+                        r->program, r->mode, r->size, r->ws, r->depth, r->median, r->baseline,
+                        (r->median / r->baseline - 1) * 100);
+                regressions++;
+            }
+        }
+    }
+
+    writeCsv(stdout, results, count);
+    FILE *file;
+    if(csvFile != NULL){
+        if((file = fopen(csvFile, "w")) == NULL){
+            fprintf(stderr, "Error - cannot write file %s.\n", csvFile);
+            exit(1);
+        }
+        writeCsv(file, results, count);
+        fclose(file);
+    }
+    if(jsonFile != NULL){
+        if((file = fopen(jsonFile, "w")) == NULL){
+            fprintf(stderr, "Error - cannot write file %s.\n", jsonFile);
+            exit(1);
+        }
+        writeJson(file, results, count, repeats, warmup);
+        fclose(file);
+    }
+    exit(regressions > 0 ? 2 : 0);
+}
@@ -0,0 +1,105 @@
+/**
+ * Description: converts matrix files between the text format and the binary format read by matrixmult_parallel and
+ * matrixmult_multiw_deep (see matrix_io.h). The format of the input is detected; by default the output is in the
+ * other format. With --type the values are converted to an element type (int8, int16, int32, int64, float or
+ * double, see matrix_types.h); otherwise a binary output keeps the type of a binary input, and text is read as int32.
+ * A text file is converted to binary by blocks of lines, so it may be bigger than the memory (see --out-of-core).
+ * Usage: ./matrixconvert [--text | --binary] [--type NAME] input output
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "matrix_io.h"
+
+/**
+ * This function reads the input matrix (text or binary) and writes it in the requested format.
+ * Input parameters: argc and argv
+ * Returns: exit(0) if successful, or exit(1) if there is an error.
+**/
+int main(int argc, char* argv[]) {
+    static struct option options[] = {
+        {"text", no_argument, NULL, 't'},
+        {"binary", no_argument, NULL, 'b'},
+        {"type", required_argument, NULL, 'y'},
+        {NULL, 0, NULL, 0}
+    };
+    int output = -1;
+    int dtype = -1;
+    int option;
+    while((option = getopt_long(argc, argv, "tby:", options, NULL)) != -1){
+        if(option == 't'){
+            output = formatText;
+        }else if(option == 'b'){
+            output = formatBinary;
+        }else if(option == 'y' && typeFromName(optarg) != -1){
+            dtype = typeFromName(optarg);
+        }else{
+            fprintf(stderr, "Usage: %s [--text | --binary] [--type NAME] input output\n", argv[0]);
+            exit(1);
+        }
+    }
+    if(argc - optind != 2){
+        fprintf(stderr, "Usage: %s [--text | --binary] [--type NAME] input output\n", argv[0]);
+        exit(1);
+    }
+    const char *input = argv[optind];
+    const char *outputFile = argv[optind + 1];
+
+    //find the format and the dimensions of the input
+    int format = matrixFormat(input);
+    if(output == -1){
+        output = format == formatText ? formatBinary : formatText;
+    }
+    int rows, cols;
+    //text to binary goes by blocks, without loading the whole matrix
+    if(format == formatText && output == formatBinary){
+        int type = dtype == -1 ? typeInt32 : dtype;
+        if(convertTextMatrix(input, outputFile, type, &rows, &cols) == -1){
+            fprintf(stderr, "Error - cannot convert file %s to %s.\n", input, outputFile);
+            exit(1);
+        }
+        printf("%s: %d x %d binary %s matrix written to %s\n", input, rows, cols, typeName(type), outputFile);
+        exit(0);
+    }
+    if(format == formatMissing || matrixDimensions(input, &rows, &cols) == -1){
+        fprintf(stderr, "Error - cannot open file %s.\n", input);
+        exit(1);
+    }
+    //without --type the values keep the type of a binary input
+    struct mappedMatrix mapped;
+    if(dtype == -1 && format == formatBinary && mapMatrix(input, &mapped) == 0){
+        dtype = mapped.dtype;
+        unmapMatrix(&mapped);
+    }
+    if(dtype == -1){
+        dtype = typeInt32;
+    }
+
+    //read the matrix as it is, rows x cols (converted to dtype): a stack of --inputs matrices is not square
+    void *matrix = calloc(rows > 0 && cols > 0 ? (size_t)rows * cols : 1, typeSize(dtype));
+    if(matrix == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    if(loadMatrixBlock(input, 0, rows, cols, matrix, dtype) == -1){
+        fprintf(stderr, "Error - cannot read file %s.\n", input);
+        exit(1);
+    }
+
+    int status = output == formatBinary ? saveMatrixBinary(outputFile, rows, cols, matrix, cols, dtype)
+                                        : saveMatrixText(outputFile, rows, cols, matrix, cols, dtype);
+    if(status == -1){
+        fprintf(stderr, "Error - cannot write file %s.\n", outputFile);
+        exit(1);
+    }
+    printf("%s: %d x %d %s %s matrix written to %s\n", input, rows, cols,
+           output == formatBinary ? "binary" : "text", typeName(dtype), outputFile);
+    free(matrix);
+    exit(0);
+}
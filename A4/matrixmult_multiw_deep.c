@@ -2,6 +2,16 @@
  * Description: this program takes n number of files from the command line and stdin.
  * The program will pass each line of files to matrixmult_parallel.c and will return the result matrix.
  * Then the program will add all the result matrices and store it in R.txt.
+ * Rsum is square and grows (padded with 0s) to the size of the largest result returned by a child, starting at 8x8.
+ * The element type of the matrices is chosen when building (see matrix_types.h).
+ * With --profile or --trace the phases of every process are timed and summed up per layer (see matrix_profile.h).
+ * With --batch all the lines are read first and the chain A * M0 * M1 * ... is reduced as a tree (see runBatch).
+ * With --workers the row blocks of every product are computed by matrixmult_parallel --listen servers over sockets
+ * (see runLayerRemote).
+ * With --in-process the products are computed in this process with libmatmul (see runLayerLocal), no child is started.
+ * With --inputs many left matrices go through the same layers together (see runLayerStack).
+ * With --out-of-core the layers are streamed by tiles between binary files, for matrices bigger than the memory (see
+ * runLayerStream).
  *
  * Author names: Luisa Arias Barajas and Alicia Zhao
  * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
@@ -9,246 +19,3110 @@
  * Creation date: 10/25/2023
  **/
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
-#include <sys/time.h>
+#include <time.h>
 
-#define matrixSize 8
+#include "matmul.h"
+#include "matrix_affinity.h"
+#include "matrix_io.h"
+#include "matrix_cache.h"
+#include "matrix_log.h"
+#include "matrix_net.h"
+#include "matrix_profile.h"
+#include "matrix_stream.h"
+#include "matrix_tune.h"
+#include "matrix_types.h"
+
+#define minMatrixSize 8
 #define lineLength 1048576
 #define fileLength 256
+#define messageLen 100
+#define resultInSlot -2 //second dimension of a result written to the shared slot of the child
+#define wsumFilename "Wsum.bin"   //sum of the Ws of a layer in the fused mode
+#define chainPrefix "Rsum_chain_"   //matrices of the chain in the batch mode, chainPrefix<node>.bin
+#define chainOrderLimit 256         //longest chain ordered by cost in the batch mode, longer ones are split evenly
+#define remoteBlockRows 32  //fewest rows in a row block sent to a worker server
+#define remoteAttempts 3    //times a row block is sent before its W fails
+#define streamRsum "Rsum.bin"           //Rsum in the out-of-core mode
+#define streamPartial "Rsum_stream.bin" //the layer being streamed, renamed to streamRsum once it is complete
+//load into R into file (overwrite)
+/**
+ * This function replaces the result matrix in the file with the new matrix.
+ * A file name ending in .bin is written in the binary format (see matrix_io.h), anything else as text.
+ * @param filename
+ * @param size
+ * @param R_SUM
+ */
+void replaceMatrixInFile(char *filename, int size, element *R_SUM){
+    size_t length = strlen(filename);
+    if (length > 4 && strcmp(filename + length - 4, ".bin") == 0) {
+        if (saveMatrixBinary(filename, size, size, R_SUM, size, elementType) == -1) {
+            perror("Error writing the file");
+        }
+        return;
+    }
+
+    FILE *file = fopen(filename, "w");
+
+    if (file == NULL) {
+        perror("Error opening the file");
+        return;
+    }
+
+    // Write the new matrix content to the file, a row per line
+    if (writeMatrixText(file, size, size, R_SUM, size, elementType, 0, true) == -1) {
+        perror("Error writing the file");
+    }
+
+    // Close the file
+    fclose(file);
+}
+
+/**
+ * This function grows a square matrix to a new size, keeping its values and padding with 0s.
+ * @param matrix
+ * @param size current size, updated to newSize
+ * @param newSize
+ * returns: exit(1) if the allocation failed
+ */
+void growMatrix(element **matrix, int *size, int newSize){
+    if(newSize <= *size){
+        return;
+    }
+    element *grown = calloc((size_t)newSize * newSize, sizeof(element));
+    if(grown == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    for(int i = 0; i < *size; i++){
+        memcpy(&grown[i * newSize], &(*matrix)[i * *size], *size * sizeof(element));
+    }
+    free(*matrix);
+    *matrix = grown;
+    *size = newSize;
+}
+
+/**
+ * The state of one result matrix being received from a child or a worker. The result arrives as the dimensions
+ * of the matrix followed by its rows, possibly split over many reads.
+ */
+struct resultReader {
+    int header[2];
+    element *buffer;
+    size_t received;     //bytes received so far, header included
+    const element *slot; //shared result slot of the child, NULL without shared memory
+};
+
+/**
+ * This function reads what is available of a result from a non-blocking pipe.
+ * @param fd read end of the pipe
+ * @param reader state of the result, all 0s before the first call
+ * A result written to the shared slot of the child is complete once its header is read.
+ * @return 1 if the result is complete, 0 if more is needed, -1 if the child reported a failed job,
+ *         -2 if the pipe closed before a complete matrix
+ */
+int readResultStep(int fd, struct resultReader *reader){
+    while(1){
+        //first the dimensions, then the rows
+        char *target;
+        size_t expected;
+        if(reader->received < sizeof(reader->header)){
+            target = (char *)reader->header + reader->received;
+            expected = sizeof(reader->header) - reader->received;
+        }else{
+            int size = reader->header[0];
+            if(size > 0 && reader->header[1] == resultInSlot){
+                return reader->slot != NULL ? 1 : -1;
+            }
+            if(size <= 0 || size != reader->header[1]){
+                return -1;
+            }
+            size_t dataSize = (size_t)size * size * sizeof(element);
+            if(reader->buffer == NULL){
+                //create a buffer to read from pipe
+                reader->buffer = malloc(dataSize);
+                if(reader->buffer == NULL){
+                    perror("malloc");
+                    exit(1);
+                }
+            }
+            size_t dataReceived = reader->received - sizeof(reader->header);
+            if(dataReceived == dataSize){
+                return 1;
+            }
+            target = (char *)reader->buffer + dataReceived;
+            expected = dataSize - dataReceived;
+        }
+
+        ssize_t bytes = read(fd, target, expected);
+        if(bytes == -1 && (errno == EAGAIN || errno == EINTR)){
+            return 0;
+        }
+        if(bytes <= 0){
+            return -2;
+        }
+        reader->received += bytes;
+    }
+}
+
+/**
+ * This function adds a size x size matrix into the top left corner of a bigger square matrix. The rows are added
+ * as flat arrays of wrapElement (unsigned for the integer types, so they wrap like the products of the kernels), so the
+ * compiler vectorizes the loop.
+ * @param sum
+ * @param sumSize
+ * @param matrix
+ * @param size at most sumSize
+ */
+void addMatrix(element *restrict sum, int sumSize, const element *restrict matrix, int size){
+    for (int r = 0; r < size; r++) {
+        wrapElement *restrict row = (wrapElement *)&sum[(size_t)r * sumSize];
+        const wrapElement *restrict add = (const wrapElement *)&matrix[(size_t)r * size];
+        for (int j = 0; j < size; j++) {
+            row[j] += add[j];
+        }
+    }
+}
+
+/**
+ * This function adds a complete result (from the pipe or the shared slot) position-wise into Rsum and frees it. Rsum grows if the result is bigger.
+ * @param reader a complete result
+ * @param Rsum
+ * @param rsumSize
+ */
+void addResult(struct resultReader *reader, element **Rsum, int *rsumSize){
+    int size = reader->header[0];
+    const element *result = reader->buffer != NULL ? reader->buffer : reader->slot;
+    growMatrix(Rsum, rsumSize, size);
+    addMatrix(*Rsum, *rsumSize, result, size);
+    free(reader->buffer);  //free buffer
+    reader->buffer = NULL;
+}
+
+/**
+ * This function parses a line and stores it in an array of files, the array grows with the number of files.
+ * The names are not copied, they point into the line.
+ * @param line
+ * @param files array of file names (to free), valid as long as the line
+ * @return fileC
+ */
+int parse_line(char *line, char ***files) {
+    size_t input_length = strcspn(line, "\n");
+    if (line[input_length] == '\n') {
+        line[input_length] = '\0';  // Replace '\n' with '\0' to truncate the string
+    }
+    int fileC = 0;
+    int capacity = 0;
+    *files = NULL;
+    char *token;
+    char *saved;    //strtok_r: the prefetch thread parses lines too
+    token = strtok_r(line, " ", &saved);//tokenize
+
+    while(token != NULL){ //counts files per line
+        if(fileC == capacity){
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            *files = realloc(*files, capacity * sizeof(char *));
+            if(*files == NULL){
+                perror("realloc");
+                exit(1);
+            }
+        }
+        (*files)[fileC] = token;
+        fileC++;
+        token = strtok_r(NULL, " ", &saved);
+    }
+    return fileC;
+}
+
+/**
+ * This function writes a whole buffer to a file descriptor, continuing after partial writes.
+ * Input parameters: fd, buffer, size (in bytes)
+ * Returns: 0 if successful, -1 if write failed
+**/
+int writeFully(int fd, const void *buffer, size_t size){
+    const char *data = buffer;
+    while(size > 0){
+        ssize_t written = write(fd, data, size);
+        if(written < 0){
+            return -1;
+        }
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+/**
+ * This function reads a whole buffer from a file descriptor, continuing after partial reads.
+ * Input parameters: fd, buffer, size (in bytes)
+ * Returns: 0 if successful, -1 if read failed or the connection was closed early
+**/
+int readFully(int fd, void *buffer, size_t size){
+    char *data = buffer;
+    while(size > 0){
+        ssize_t bytes = read(fd, data, size);
+        if(bytes <= 0){
+            return -1;
+        }
+        data += bytes;
+        size -= bytes;
+    }
+    return 0;
+}
+
+/**
+ * This function logs how a child terminated to its .out file (or its .err file if it was killed).
+ * @param pid
+ * @param status status returned by waitpid
+ */
+void logChildStatus(pid_t pid, int status){
+    char output_file [fileLength];
+    sprintf(output_file, "%d.out", pid);
+    char err_file [fileLength];
+    sprintf(err_file, "%d.err", pid);
+
+    char output_msg[messageLen];
+    if(WIFEXITED(status)){  //normal termination
+        sprintf(output_msg, "Finished child %d pid of parent %d", pid, getpid());
+        logMessage(output_file, output_msg);
+        //exit signal code
+        int exit_signal = WEXITSTATUS(status);
+        sprintf(output_msg, "Exited with exit code = %d", exit_signal);
+        logMessage(output_file, output_msg);
+    } else if(WIFSIGNALED(status)){     //abnormal termination
+        int exit_signal = WTERMSIG(status);
+        sprintf(output_msg, "Killed with signal %d", exit_signal);
+        logMessage(err_file, output_msg);
+    }
+}
+
+/**
+ * The shared memory Rsum is published in with --shm. It starts with this header, followed by Rsum (size x size) and
+ * by one result slot (slotSize x slotSize) per child or worker running at the same time.
+ * It must match struct sharedHeader in matrixmult_parallel.c.
+ */
+struct sharedHeader {
+    int size;
+    int slotSize;
+    int slots;
+    int elementSize;    //sizeof(element), both programs must be built with the same type
+};
+
+/**
+ * The shared memory: a memfd inherited by the children and workers, and its mapping in the parent.
+ */
+struct sharedRegion {
+    int fd;
+    void *base;
+    size_t length;
+};
+
+/**
+ * This function creates the shared memory. The fd is inherited by every child and worker started afterwards.
+ * @param region to fill in
+ * @param slots number of result slots
+ */
+void createShared(struct sharedRegion *region, int slots){
+    region->fd = memfd_create("matrixmult_rsum", 0);
+    if(region->fd == -1){
+        perror("memfd_create");
+        exit(1);
+    }
+    region->base = NULL;
+    region->length = 0;
+    //slots is kept in the header until the first publish
+    struct sharedHeader header = {0, 0, slots, sizeof(element)};
+    if(ftruncate(region->fd, sizeof(header)) == -1 || pwrite(region->fd, &header, sizeof(header), 0) == -1){
+        perror("ftruncate");
+        exit(1);
+    }
+}
+
+/**
+ * This function returns the result slot of a child in the shared memory.
+ * @param region
+ * @param slot
+ * @return a pointer to the slot
+ */
+const element *sharedSlot(const struct sharedRegion *region, int slot){
+    const struct sharedHeader *header = region->base;
+    const element *rsum = (const element *)(header + 1);
+    return rsum + (size_t)header->size * header->size + (size_t)slot * header->slotSize * header->slotSize;
+}
+
+/**
+ * This function publishes Rsum in the shared memory for the next layer, growing it if needed. The result slots are
+ * as big as Rsum; a result that does not fit (a bigger W) comes through the pipe instead.
+ * @param region
+ * @param Rsum
+ * @param rsumSize
+ */
+void publishShared(struct sharedRegion *region, const element *Rsum, int rsumSize){
+    struct sharedHeader header;
+    if(pread(region->fd, &header, sizeof(header), 0) != sizeof(header)){
+        perror("pread");
+        exit(1);
+    }
+    size_t matrixBytes = (size_t)rsumSize * rsumSize * sizeof(element);
+    size_t length = sizeof(header) + matrixBytes * (1 + header.slots);
+    if(length != region->length){
+        if(region->base != NULL){
+            munmap(region->base, region->length);
+        }
+        if(ftruncate(region->fd, length) == -1){
+            perror("ftruncate");
+            exit(1);
+        }
+        region->base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, region->fd, 0);
+        if(region->base == MAP_FAILED){
+            perror("mmap");
+            exit(1);
+        }
+        region->length = length;
+    }
+    header.size = rsumSize;
+    header.slotSize = rsumSize;
+    memcpy(region->base, &header, sizeof(header));
+    memcpy((struct sharedHeader *)region->base + 1, Rsum, matrixBytes);
+}
+
+/**
+ * Where the children and workers run with --affinity: a pool worker on the slot of its index, a child on its slot
+ * among the children running at the same time. NULL to leave it to the scheduler.
+ */
+struct affinity *placement = NULL;
+
+/**
+ * The Freivalds check of the products with --verify: its rounds (0 for none), the layer being computed, for the
+ * messages, and the products this process checked. The children get the rounds and the layer in MATRIXMULT_VERIFY
+ * and MATRIXMULT_LAYER, the workers in their jobs.
+ */
+int verifyRounds = 0;
+int currentLayer = 0;
+long verifyChecked = 0;
+long verifyFailed = 0;
+
+/**
+ * This function starts a layer: its number goes to the profile and to the children and workers it starts.
+ * @param layer 0 for the command line, then one per line of stdin (or per depth with --batch)
+ * @param firstCommand first command of the layer
+ */
+void startLayer(int layer, int firstCommand){
+    profileSetLayer(layer, firstCommand);
+    currentLayer = layer;
+    char value[16];
+    snprintf(value, sizeof(value), "%d", layer);
+    setenv("MATRIXMULT_LAYER", value, 1);
+}
+
+/**
+ * This function logs a failure of this process to its .err file (or to the --log file), like the children and
+ * workers log theirs.
+ * @param format printf format of the message
+ */
+void logFailure(const char *format, ...){
+    char err_file[fileLength];
+    char output_msg[fileLength * 2 + messageLen];
+    sprintf(err_file, "%d.err", getpid());
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(output_msg, sizeof(output_msg), format, arguments);
+    va_end(arguments);
+    logMessage(err_file, output_msg);
+}
+
+/**
+ * This function checks a product computed in this process with Freivalds' algorithm (see matmulVerify) when --verify
+ * asks for it, and logs a product that fails to the .err file of this process with its layer and W.
+ * @param size
+ * @param matrixA
+ * @param matrixW
+ * @param result
+ * @param command of the product
+ * @param left name of the left matrix, for the message
+ * @param w name of W
+ * @return true if the product passed or was not checked
+ */
+bool verifyLocal(int size, const element *matrixA, const wElement *matrixW, const element *result, int command,
+                 const char *left, const char *w){
+    if(verifyRounds <= 0){
+        return true;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long long seed = ((unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec) ^ verifyChecked;
+    long long start = profileStart();
+    int failed = matmulVerify(size, size, matrixA, matrixW, result, verifyRounds, seed);
+    profileSpan(phaseCompute, start);
+    verifyChecked++;
+    if(failed == 0){
+        return true;
+    }
+    verifyFailed++;
+    if(failed == -1){
+        logFailure("Error - layer %d, command %d: cannot allocate the Freivalds check of %s*%s.", currentLayer, command,
+                   left, w);
+    }else{
+        logFailure("Error - layer %d, command %d: R = %s*%s failed the Freivalds check in %d of %d rounds.",
+                   currentLayer, command, left, w, failed, verifyRounds);
+    }
+    return false;
+}
+
+/**
+ * This function pins a child or worker right after fork, before it execs and allocates its matrices, so they are
+ * first touched (and placed) on its node, and logs where it runs.
+ * @param slot
+ * @param output_file log of the child
+ */
+void pinChild(int slot, const char *output_file){
+    if(placement == NULL){
+        return;
+    }
+    char where[messageLen];
+    char message[messageLen + 32];
+    affinityDescribe(placement, slot, where, sizeof(where));
+    if(affinityPin(placement, slot) == -1){
+        snprintf(message, sizeof(message), "Cannot pin to %s", where);
+    }else{
+        snprintf(message, sizeof(message), "Pinned to %s", where);
+    }
+    logMessage(output_file, message);
+}
+
+/**
+ * The write end of the pipe the SIGCHLD handler writes to, so that the event loops wake up when a child exits.
+ */
+int childSignalPipe[2] = {-1, -1};
+
+/**
+ * This function is the SIGCHLD handler: it only wakes up the event loop, the children are reaped there.
+ * @param signal
+ */
+void childSignalHandler(int signal){
+    (void)signal;
+    int saved_errno = errno;
+    char byte = 0;
+    ssize_t ignored = write(childSignalPipe[1], &byte, 1);
+    (void)ignored;
+    errno = saved_errno;
+}
+
+/**
+ * This function installs the SIGCHLD handler and its pipe.
+ */
+void setupChildSignal(void){
+    if(pipe(childSignalPipe) == -1){
+        perror("pipe");
+        exit(1);
+    }
+    for(int i = 0; i < 2; i++){
+        fcntl(childSignalPipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(childSignalPipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = childSignalHandler;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+}
+
+/**
+ * This function empties the SIGCHLD pipe after the event loop woke up on it.
+ */
+void drainChildSignal(void){
+    char bytes[64];
+    while(read(childSignalPipe[0], bytes, sizeof(bytes)) > 0){
+    }
+}
+
+/**
+ * One child of runLayerForked: the read end of its pipe, its result, and whether it was reaped yet.
+ */
+struct child {
+    pid_t pid;
+    int fd;             //read end of the pipe, -1 once the result is read
+    int resultRead;     //readResultStep status once the result is read
+    bool reaped;
+    int status;         //status returned by waitpid
+    int slot;           //shared result slot, -1 without shared memory
+    struct resultReader reader;
+};
+
+/**
+ * This function starts the child that multiplies left by one W file: it forks and execs matrixmult_parallel with
+ * stdout connected to a pipe.
+ * @param child to fill in
+ * With shared memory the child gets its fd and a result slot.
+ * @param left file name of the left matrix (A, Rsum.txt, or "-" for the shared Rsum)
+ * @param file W file name
+ * @param command command number, for the logs
+ * @param shared shared memory, or NULL
+ * @param slot shared result slot of the child
+ */
+void startChild(struct child *child, char *left, char *file, int command, const struct sharedRegion *shared,
+                int slot){
+    //create pipe
+    int pipes[2];
+    if(pipe(pipes) == -1){
+        perror("pipe");
+        exit(1);
+    }
+    //the parent end must not leak into the other children, or they would keep it open
+    fcntl(pipes[0], F_SETFD, FD_CLOEXEC);
+
+    //create child process, the child times its spawn from here
+    long long spawn = profileStart();
+    pid_t child_pid = fork();
+    if (child_pid == -1) {
+        perror("fork");
+        exit(1);
+    } else if (child_pid == 0) {
+        // Child process
+        dup2(pipes[1], STDOUT_FILENO); // Redirect stdout to the pipe write end
+        close(pipes[0]); // Close read end of the pipe
+        close(pipes[1]); // Close the original stdout
+
+        //creating output and error files named after their pid
+        char output_filen[fileLength];
+        sprintf(output_filen, "%d.out", getpid());
+        char message[messageLen];
+
+        sprintf(message, "Starting command %d: child PID %d of parent PPID %d\n", command, getpid(), getppid());
+        logSetCommand(command);
+        logMessage(output_filen, message);
+        pinChild(slot, output_filen);
+        //the child tags its logs with the command too
+        char command_arg[16];
+        sprintf(command_arg, "%d", command);
+        setenv("MATRIXMULT_COMMAND", command_arg, 1);
+        profileExportSpawn(spawn);
+
+        //matrix A and W will be printed in matrix_parallel
+
+        // Execute matrix multiplication with the appropriate files
+        if(shared != NULL){
+            char fd_arg[16];
+            char slot_arg[16];
+            sprintf(fd_arg, "%d", shared->fd);
+            sprintf(slot_arg, "%d", slot);
+            execl("./matrixmult_parallel", "./matrixmult_parallel", "--shm", fd_arg, "--slot", slot_arg, left, file,
+                  (char *)NULL);
+        }else{
+            execl("./matrixmult_parallel", "./matrixmult_parallel", left, file, (char *)NULL);
+        }
+        perror("execl");
+        exit(1);
+    }
+
+    // Parent process
+    close(pipes[1]); // Close write end of the pipe
+    fcntl(pipes[0], F_SETFL, O_NONBLOCK);
+    memset(child, 0, sizeof(*child));
+    child->pid = child_pid;
+    child->fd = pipes[0];
+    child->slot = slot;
+    if(shared != NULL){
+        child->reader.slot = sharedSlot(shared, slot);
+    }
+}
+
+/**
+ * This function runs one child per pair of files, each execs matrixmult_parallel on lefts[i] and files[i], and adds
+ * its result into sums[i] (which may all be the same matrix).
+ * Up to maxChildren children run at the same time. Their results are read as they become readable (poll), and they
+ * are reaped as they exit (SIGCHLD), in whatever order that happens.
+ * With shared memory each running child has its own result slot.
+ * @param lefts file names of the left matrices (A, Rsum.txt, "-" for the shared Rsum, ...)
+ * @param files W file names
+ * @param fileC number of children
+ * @param maxChildren limit of children running at the same time
+ * @param shared shared memory with maxChildren slots, or NULL
+ * @param command command counter, incremented for each child
+ * @param sums matrix each result is added to
+ * @param sumSizes
+ * @param finished set for each child that finished successfully, or NULL
+ * @return number of children that finished successfully
+ */
+int runChildren(char *lefts[], char *files[], int fileC, int maxChildren, const struct sharedRegion *shared,
+                int *command, element **sums[], int *sumSizes[], bool finished[]){
+    struct child *children = malloc((fileC > 0 ? fileC : 1) * sizeof(struct child));
+    struct pollfd *fds = malloc((fileC + 1) * sizeof(struct pollfd));
+    int *polled = malloc((fileC > 0 ? fileC : 1) * sizeof(int));
+    bool *slotBusy = calloc(maxChildren, sizeof(bool));
+    if(children == NULL || fds == NULL || polled == NULL || slotBusy == NULL){
+        perror("malloc");
+        exit(1);
+    }
+
+    //initialize variable to keep track of the number of children finished
+    int childFinished = 0;
+    if(finished != NULL){
+        memset(finished, 0, fileC * sizeof(bool));
+    }
+    int started = 0;
+    int done = 0;       //children reaped with their result read
+    int inFlight = 0;
+
+    while(done < fileC){
+        //start children up to the limit
+        while(started < fileC && inFlight < maxChildren){
+            //there is a free slot for every child in flight
+            int slot = 0;
+            while(slotBusy[slot]){
+                slot++;
+            }
+            slotBusy[slot] = true;
+            (*command)++;
+            startChild(&children[started], lefts[started], files[started], *command, shared, slot);
+            started++;
+            inFlight++;
+        }
+
+        //wait for a result or for a child to exit
+        int count = 0;
+        fds[count].fd = childSignalPipe[0];
+        fds[count++].events = POLLIN;
+        for(int i = 0; i < started; i++){
+            if(children[i].fd >= 0){
+                polled[count - 1] = i;
+                fds[count].fd = children[i].fd;
+                fds[count++].events = POLLIN;
+            }
+        }
+        if(poll(fds, count, -1) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("poll");
+            exit(1);
+        }
+
+        //read the results that arrived
+        for(int f = 1; f < count; f++){
+            if(fds[f].revents == 0){
+                continue;
+            }
+            int index = polled[f - 1];
+            struct child *child = &children[index];
+            long long start = profileStart();
+            int resultRead = readResultStep(child->fd, &child->reader);
+            profileSpan(phaseTransfer, start);
+            if(resultRead == 0){
+                continue;
+            }
+            if(resultRead == 1){
+                start = profileStart();
+                addResult(&child->reader, sums[index], sumSizes[index]);
+                profileSpan(phaseAccumulate, start);
+            }
+            free(child->reader.buffer);
+            child->resultRead = resultRead;
+            close(child->fd); // Close the read end of the pipe in the parent process
+            child->fd = -1;
+        }
+
+        //reap the children that exited
+        if(fds[0].revents != 0){
+            drainChildSignal();
+        }
+        for(int i = 0; i < started; i++){
+            struct child *child = &children[i];
+            if(child->reaped){
+                continue;
+            }
+            pid_t finished_pid = waitpid(child->pid, &child->status, WNOHANG);
+            //check if waitpid failed
+            if (finished_pid == -1) {
+                perror("waitpid");
+                exit(1);
+            }
+            if (finished_pid == 0) {
+                continue;
+            }
+            child->reaped = true;
+            logChildStatus(child->pid, child->status);
+        }
+
+        //a child is done once it is reaped and its result is read
+        for(int i = 0; i < started; i++){
+            struct child *child = &children[i];
+            if(child->reaped && child->fd == -1 && child->pid != 0){
+                //increment childFinished if child finished successfully
+                if (WIFEXITED(child->status) && WEXITSTATUS(child->status) == 0 && child->resultRead == 1) {
+                    childFinished++;
+                    if(finished != NULL){
+                        finished[i] = true;
+                    }
+                }
+                child->pid = 0;
+                slotBusy[child->slot] = false;
+                done++;
+                inFlight--;
+            }
+        }
+    }
+
+    free(children);
+    free(fds);
+    free(polled);
+    free(slotBusy);
+    return childFinished;
+}
+
+/**
+ * This function runs one layer the classic way: one child per W file, each execs matrixmult_parallel on left and Wi,
+ * and the results are added into Rsum (see runChildren).
+ * @param left file name of the left matrix (A, Rsum.txt, or "-" for the shared Rsum)
+ * @param files W file names
+ * @param fileC number of W files
+ * @param maxChildren limit of children running at the same time
+ * @param shared shared memory with maxChildren slots, or NULL
+ * @param command command counter, incremented for each child
+ * @param Rsum
+ * @param rsumSize
+ * @return number of children that finished successfully
+ */
+int runLayerForked(char *left, char *files[], int fileC, int maxChildren, const struct sharedRegion *shared,
+                   int *command, element **Rsum, int *rsumSize){
+    char **lefts = malloc((fileC > 0 ? fileC : 1) * sizeof(char *));
+    element ***sums = malloc((fileC > 0 ? fileC : 1) * sizeof(element **));
+    int **sumSizes = malloc((fileC > 0 ? fileC : 1) * sizeof(int *));
+    if(lefts == NULL || sums == NULL || sumSizes == NULL){
+        perror("malloc");
+        exit(1);
+    }
+    for(int i = 0; i < fileC; i++){
+        lefts[i] = left;
+        sums[i] = Rsum;
+        sumSizes[i] = rsumSize;
+    }
+    int childFinished = runChildren(lefts, files, fileC, maxChildren, shared, command, sums, sumSizes, NULL);
+    free(lefts);
+    free(sums);
+    free(sumSizes);
+    return childFinished;
+}
+
+/**
+ * A long-lived matrixmult_parallel --worker process and the pipes to talk to it.
+ */
+struct worker {
+    pid_t pid;
+    int toWorker;   //write end of the worker's stdin
+    int fromWorker; //read end of the worker's stdout
+};
+
+/**
+ * The header of a job sent to a worker, it must match struct jobHeader in matrixmult_parallel.c.
+ * When size > 0 the left matrix follows inline as size*size ints, when leftPathLength > 0 the path of its file
+ * follows, and otherwise it is Rsum in the shared memory. The path of the W file comes next, then W itself when
+ * wSize > 0 (from the W cache). The worker answers each job with one result (see readResultStep).
+ * A jobRows job sends a row block to a worker server instead (see sendRowsJob).
+ */
+struct jobHeader {
+    int op;             //jobMultiply, jobRows, or jobQuit to stop the worker
+    int command;        //command number, for the logs
+    int size;           //size of the inline left matrix, 0 if it is not inline
+    int leftPathLength; //0 if the left matrix is not read from a file
+    int wPathLength;
+    int slot;           //shared result slot of the worker, -1 for none
+    int wSize;          //size of the inline W matrix, 0 if the worker reads the W file (or keeps it, for jobRows)
+    int rowStart;       //jobRows: first row of the block
+    int rowCount;       //jobRows: rows of the block
+    int types;          //jobRows: jobTypes, checked by the worker server
+    int layer;          //for the messages of the Freivalds check
+    int verify;         //rounds of the Freivalds check of the product, 0 for none
+};
+#define jobQuit 0
+#define jobMultiply 1
+#define jobRows 2
+#define jobTypes (elementType * 16 + wElementType)
+
+/**
+ * This function starts one worker: it forks and execs matrixmult_parallel --worker with its stdin and stdout
+ * connected to pipes of the parent.
+ * @param worker to fill in
+ * @param index index of the worker in the pool, for the logs (and its shared result slot)
+ * @param shared shared memory, or NULL
+ */
+void startWorker(struct worker *worker, int index, const struct sharedRegion *shared){
+    int toWorker[2];
+    int fromWorker[2];
+    if(pipe(toWorker) == -1 || pipe(fromWorker) == -1){
+        perror("pipe");
+        exit(1);
+    }
+    //the parent ends must not leak into the other workers, or they would never see EOF
+    fcntl(toWorker[1], F_SETFD, FD_CLOEXEC);
+    fcntl(fromWorker[0], F_SETFD, FD_CLOEXEC);
+
+    long long spawn = profileStart();
+    pid_t pid = fork();
+    if(pid == -1){
+        perror("fork");
+        exit(1);
+    }
+    if(pid == 0){
+        profileExportSpawn(spawn);
+        dup2(toWorker[0], STDIN_FILENO);
+        dup2(fromWorker[1], STDOUT_FILENO);
+        close(toWorker[0]);
+        close(toWorker[1]);
+        close(fromWorker[0]);
+        close(fromWorker[1]);
+
+        char output_filen[fileLength];
+        sprintf(output_filen, "%d.out", getpid());
+        char message[messageLen];
+        sprintf(message, "Starting worker %d: child PID %d of parent PPID %d\n", index, getpid(), getppid());
+        logMessage(output_filen, message);
+        pinChild(index, output_filen);
+
+        if(shared != NULL){
+            char fd_arg[16];
+            sprintf(fd_arg, "%d", shared->fd);
+            execl("./matrixmult_parallel", "./matrixmult_parallel", "--worker", "--shm", fd_arg, (char *)NULL);
+        }else{
+            execl("./matrixmult_parallel", "./matrixmult_parallel", "--worker", (char *)NULL);
+        }
+        perror("execl");
+        exit(1);
+    }
+    close(toWorker[0]);
+    close(fromWorker[1]);
+    worker->pid = pid;
+    worker->toWorker = toWorker[1];
+    worker->fromWorker = fromWorker[0];
+}
+
+/**
+ * This function stops one worker: closing its stdin ends its job loop, then it is reaped and its status logged.
+ * @param worker
+ */
+void stopWorker(struct worker *worker){
+    close(worker->toWorker);
+    close(worker->fromWorker);
+    int status = 0;
+    if(waitpid(worker->pid, &status, 0) == -1){
+        perror("waitpid");
+        return;
+    }
+    logChildStatus(worker->pid, status);
+}
+
+/**
+ * This function replaces a worker that died during a job.
+ * @param worker
+ * @param index index of the worker in the pool
+ * @param command command the worker was running, for the logs
+ * @param shared shared memory, or NULL
+ */
+void restartWorker(struct worker *worker, int index, int command, const struct sharedRegion *shared){
+    char err_file[fileLength];
+    char output_msg[messageLen];
+    sprintf(err_file, "%d.err", worker->pid);
+    sprintf(output_msg, "Error - worker %d stopped during command %d, restarting it", index, command);
+    logMessage(err_file, output_msg);
+    stopWorker(worker);
+    startWorker(worker, index, shared);
+}
+
+/**
+ * This function sends one job to a worker.
+ * @param worker
+ * @param command command number, for the logs
+ * @param left file name of the left matrix, used if leftData is NULL; both NULL for the shared Rsum
+ * @param leftSize size of the inline left matrix
+ * @param leftData inline left matrix, or NULL
+ * @param wFile file name of W
+ * @param wData W from the cache, sent inline, or NULL to let the worker read wFile
+ * @param slot shared result slot of the worker, -1 for none
+ * @return 0 if successful, -1 if the worker is gone
+ */
+int sendJob(struct worker *worker, int command, const char *left, int leftSize, const element *leftData,
+            const char *wFile, const struct cachedMatrix *wData, int slot){
+    struct jobHeader header = {jobMultiply, command, 0, 0, (int)strlen(wFile), slot, 0};
+    header.layer = currentLayer;
+    header.verify = verifyRounds;
+    if(wData != NULL){
+        header.wSize = wData->size;
+    }
+    if(leftData != NULL){
+        header.size = leftSize;
+    }else if(left != NULL){
+        header.leftPathLength = (int)strlen(left);
+    }
+    if(writeFully(worker->toWorker, &header, sizeof(header)) == -1){
+        return -1;
+    }
+    if(leftData != NULL){
+        if(writeFully(worker->toWorker, leftData, (size_t)leftSize * leftSize * sizeof(element)) == -1){
+            return -1;
+        }
+    }else if(left != NULL && writeFully(worker->toWorker, left, header.leftPathLength) == -1){
+        return -1;
+    }
+    if(writeFully(worker->toWorker, wFile, header.wPathLength) == -1){
+        return -1;
+    }
+    if(wData != NULL){
+        return writeFully(worker->toWorker, wData->data, wData->bytes);
+    }
+    return 0;
+}
+
+/**
+ * This function runs one layer on the worker pool: a job is sent to every idle worker, and the results are read as
+ * they become readable (poll), so a worker gets its next job as soon as it answers. A worker that dies is replaced.
+ * @param pool
+ * @param poolSize
+ * @param left file name of the left matrix, used if leftData is NULL; both NULL for the shared Rsum
+ * @param leftSize size of the inline left matrix
+ * @param leftData inline left matrix (the previous Rsum), or NULL
+ * @param files W file names
+ * @param fileC number of W files
+ * @param shared shared memory with one slot per worker, or NULL
+ * @param cache W cache, or NULL to let the workers read the W files
+ * @param command command counter, incremented for each job
+ * @param Rsum
+ * @param rsumSize
+ * @return number of jobs that finished successfully
+ */
+int runLayerPool(struct worker *pool, int poolSize, char *left, int leftSize, const element *leftData,
+                 char *files[], int fileC, const struct sharedRegion *shared, struct matrixCache *cache, int *command,
+                 element **Rsum, int *rsumSize){
+    int jobsFinished = 0;
+    int next = 0;
+    int done = 0;
+    bool busy[poolSize];
+    struct resultReader readers[poolSize];
+    struct pollfd fds[poolSize];
+    int polled[poolSize];
+    memset(busy, 0, sizeof(busy));
+
+    while(done < fileC){
+        //one job per idle worker, so no worker blocks on a result while we are still writing to it
+        for(int w = 0; w < poolSize && next < fileC; w++){
+            if(busy[w]){
+                continue;
+            }
+            (*command)++;
+            //a W that cannot be loaded is sent by name, so the worker reports the error as usual
+            struct cachedMatrix *wData = NULL;
+            long long start = profileStart();
+            if(cache != NULL){
+                wData = cacheGet(cache, files[next]);
+                profileSpan(phaseLoad, start);
+                start = profileStart();
+            }
+            int sent = sendJob(&pool[w], *command, left, leftSize, leftData, files[next], wData,
+                               shared != NULL ? w : -1);
+            profileSpan(phaseTransfer, start);
+            cacheRelease(cache, wData);
+            if(sent == -1){
+                //the worker is gone, the job fails and the worker is replaced
+                restartWorker(&pool[w], w, *command, shared);
+                done++;
+            }else{
+                busy[w] = true;
+                memset(&readers[w], 0, sizeof(readers[w]));
+                if(shared != NULL){
+                    readers[w].slot = sharedSlot(shared, w);
+                }
+            }
+            next++;
+        }
+
+        //wait for results
+        int count = 0;
+        for(int w = 0; w < poolSize; w++){
+            if(busy[w]){
+                polled[count] = w;
+                fds[count].fd = pool[w].fromWorker;
+                fds[count++].events = POLLIN;
+            }
+        }
+        if(count == 0){
+            continue;
+        }
+        if(poll(fds, count, -1) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("poll");
+            exit(1);
+        }
+
+        for(int f = 0; f < count; f++){
+            if(fds[f].revents == 0){
+                continue;
+            }
+            int w = polled[f];
+            long long start = profileStart();
+            int resultRead = readResultStep(pool[w].fromWorker, &readers[w]);
+            profileSpan(phaseTransfer, start);
+            if(resultRead == 0){
+                continue;
+            }
+            if(resultRead == 1){
+                start = profileStart();
+                addResult(&readers[w], Rsum, rsumSize);
+                profileSpan(phaseAccumulate, start);
+                jobsFinished++;
+            }
+            free(readers[w].buffer);
+            if(resultRead == -2){
+                restartWorker(&pool[w], w, *command, shared);
+            }
+            busy[w] = false;
+            done++;
+        }
+    }
+    return jobsFinished;
+}
+
+/**
+ * A worker server of the --workers coordinator (matrixmult_parallel --listen) and the connection to it.
+ */
+struct remoteWorker {
+    const char *address;
+    int fd;             //-1 when not connected
+    int job;            //row block in flight, -1 when idle
+    int command;        //command of the block in flight
+    int wHeld;          //W of the layer the worker holds, -1 for none
+    bool unreachable;   //the last connection failed and was reported
+    long blocks;        //row blocks computed
+};
+
+/**
+ * A row block of a layer run on the worker servers: rows rowStart..rowStart+rowCount-1 of Rsum * W.
+ */
+struct rowBlock {
+    int file;
+    int rowStart;
+    int rowCount;
+    int attempts;   //times it was sent, a block that keeps failing fails its W
+    bool sent;      //in flight
+    bool done;
+};
+
+/**
+ * The Ws of a layer run on the worker servers, and their products as they come back.
+ */
+struct remoteW {
+    wElement *matrix;   //padded to size x size, NULL if the file cannot be loaded
+    int size;
+    element *result;    //size x size, added to Rsum once every block is back
+    int blocksLeft;
+    bool failed;
+};
+
+/**
+ * This function connects to the worker servers that are not connected: at the start, and at every layer for the
+ * ones that failed, which may have been restarted. A server that cannot be reached is reported once.
+ * @param workers
+ * @param workerC
+ * @return number of connected servers
+ */
+int connectWorkers(struct remoteWorker *workers, int workerC){
+    int connected = 0;
+    for(int w = 0; w < workerC; w++){
+        if(workers[w].fd == -1){
+            workers[w].fd = netConnect(workers[w].address);
+            if(workers[w].fd == -1 && !workers[w].unreachable){
+                logFailure("Error - cannot connect to worker %s: %s.", workers[w].address, strerror(errno));
+            }
+            workers[w].unreachable = workers[w].fd == -1;
+        }
+        connected += workers[w].fd != -1;
+    }
+    return connected;
+}
+
+/**
+ * This function drops the connection to a worker server that failed, its block goes back to the others.
+ * @param worker
+ */
+void dropWorker(struct remoteWorker *worker){
+    logFailure("Error - worker %s failed during command %d, its rows are sent to another worker.", worker->address,
+               worker->command);
+    close(worker->fd);
+    worker->fd = -1;
+    worker->wHeld = -1;
+    worker->job = -1;
+}
+
+/**
+ * This function loads a matrix file of the element type for the coordinator.
+ * @param file
+ * @param size set to the size of the matrix (its largest dimension)
+ * @return the matrix (to free), or NULL if it cannot be loaded
+ */
+element *loadLeftMatrix(const char *file, int *size){
+    int rows, cols;
+    if(matrixDimensions(file, &rows, &cols) == -1){
+        return NULL;
+    }
+    *size = rows > cols ? rows : cols;
+    *size = *size > minMatrixSize ? *size : minMatrixSize;
+    element *matrix = calloc((size_t)*size * *size, sizeof(element));
+    if(matrix == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    if(loadMatrix(file, *size, matrix, elementType) == -1){
+        free(matrix);
+        return NULL;
+    }
+    return matrix;
+}
+
+/**
+ * This function loads a W for the worker servers or the in-process multiply (from the cache if there is one),
+ * padded with 0s to the size of its product with a left matrix of leftSize.
+ * @param file
+ * @param cache W cache, or NULL
+ * @param leftSize
+ * @param size set to the size of the product
+ * @return W (to free), or NULL if it cannot be loaded
+ */
+wElement *loadRemoteW(const char *file, struct matrixCache *cache, int leftSize, int *size){
+    struct cachedMatrix *entry = NULL;
+    const wElement *matrix = NULL;
+    wElement *loaded = NULL;
+    int matrixSize = 0;
+    int rows, cols;
+    if(cache != NULL){
+        entry = cacheGet(cache, file);
+        if(entry != NULL){
+            matrix = entry->data;
+            matrixSize = entry->size;
+        }
+    }else if(matrixDimensions(file, &rows, &cols) == 0){
+        matrixSize = rows > cols ? rows : cols;
+        loaded = calloc((size_t)matrixSize * matrixSize, sizeof(wElement));
+        if(loaded == NULL){
+            perror("calloc");
+            exit(1);
+        }
+        if(loadMatrix(file, matrixSize, loaded, wElementType) == -1){
+            free(loaded);
+            loaded = NULL;
+        }
+        matrix = loaded;
+    }
+    if(matrix == NULL){
+        return NULL;
+    }
+
+    *size = matrixSize > leftSize ? matrixSize : leftSize;
+    *size = *size > minMatrixSize ? *size : minMatrixSize;
+    if(loaded != NULL && *size == matrixSize){
+        return loaded;
+    }
+    wElement *w = calloc((size_t)*size * *size, sizeof(wElement));
+    if(w == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    for(int i = 0; i < matrixSize; i++){
+        memcpy(&w[(size_t)i * *size], &matrix[(size_t)i * matrixSize], matrixSize * sizeof(wElement));
+    }
+    free(loaded);
+    cacheRelease(cache, entry);
+    return w;
+}
+
+/**
+ * This function sends a row block to a worker server: the rows of the left matrix, padded with 0s to the size of the
+ * product, and W unless the worker holds it from its previous block.
+ * @param worker
+ * @param command command number, for the logs
+ * @param left
+ * @param leftSize
+ * @param block
+ * @param wFile file name of W, for the logs
+ * @param w W of the block
+ * @return 0 if successful, -1 if the worker is gone
+ */
+int sendRowsJob(struct remoteWorker *worker, int command, const element *left, int leftSize,
+                const struct rowBlock *block, const char *wFile, const struct remoteW *w){
+    int size = w->size;
+    bool sendW = worker->wHeld != block->file;
+    struct jobHeader header = {jobRows, command, size, 0, (int)strlen(wFile), -1, sendW ? size : 0, block->rowStart,
+                               block->rowCount, jobTypes, currentLayer, verifyRounds};
+    if(writeFully(worker->fd, &header, sizeof(header)) == -1){
+        return -1;
+    }
+    const element *rows = &left[(size_t)block->rowStart * leftSize];
+    size_t rowsBytes = (size_t)block->rowCount * size * sizeof(element);
+    int status;
+    if(size == leftSize){
+        status = writeFully(worker->fd, rows, rowsBytes);
+    }else{
+        element *padded = calloc((size_t)block->rowCount * size, sizeof(element));
+        if(padded == NULL){
+            perror("calloc");
+            exit(1);
+        }
+        for(int r = 0; r < block->rowCount; r++){
+            memcpy(&padded[(size_t)r * size], &rows[(size_t)r * leftSize], leftSize * sizeof(element));
+        }
+        status = writeFully(worker->fd, padded, rowsBytes);
+        free(padded);
+    }
+    if(status == -1 || writeFully(worker->fd, wFile, header.wPathLength) == -1){
+        return -1;
+    }
+    if(sendW && writeFully(worker->fd, w->matrix, (size_t)size * size * sizeof(wElement)) == -1){
+        return -1;
+    }
+    worker->wHeld = block->file;
+    return 0;
+}
+
+/**
+ * This function reads the answer of a worker server to a row block and copies the rows to the product of its W.
+ * @param worker
+ * @param block
+ * @param w W of the block
+ * @return 1 if the rows were read, 0 if the worker could not compute them, -1 if the worker is gone (or answered
+ * something else)
+ */
+int readRowsResult(struct remoteWorker *worker, const struct rowBlock *block, struct remoteW *w){
+    int header[2];
+    if(readFully(worker->fd, header, sizeof(header)) == -1){
+        return -1;
+    }
+    if(header[0] == -1 && header[1] == -1){
+        return 0;
+    }
+    if(header[0] != block->rowCount || header[1] != w->size){
+        return -1;
+    }
+    return readFully(worker->fd, &w->result[(size_t)block->rowStart * w->size],
+                     (size_t)block->rowCount * w->size * sizeof(element)) == -1 ? -1 : 1;
+}
+
+/**
+ * This function picks the next block for an idle worker server: a block of the W it holds if one is left, so W is
+ * only sent again when the worker moves on to another W, otherwise the first block waiting.
+ * @param blocks
+ * @param blockC
+ * @param ws
+ * @param wHeld
+ * @return the block, or -1 if none is waiting
+ */
+int nextBlock(const struct rowBlock *blocks, int blockC, const struct remoteW *ws, int wHeld){
+    int first = -1;
+    for(int b = 0; b < blockC; b++){
+        if(blocks[b].sent || blocks[b].done || ws[blocks[b].file].failed){
+            continue;
+        }
+        if(blocks[b].file == wHeld){
+            return b;
+        }
+        if(first == -1){
+            first = b;
+        }
+    }
+    return first;
+}
+
+/**
+ * This function runs one layer on the worker servers: every W is loaded here, the rows of the left matrix are split
+ * into blocks (a few per server), and each idle server gets the next block as soon as it answers its previous one
+ * (poll), so a faster server computes more blocks. A server that fails is dropped and its block is sent to another
+ * one; a block that fails remoteAttempts times fails its W. The product of a W is added to Rsum once all its rows
+ * are back, so Rsum gets whole products like with the children.
+ * @param workers
+ * @param workerC
+ * @param left file name of the left matrix, used if leftData is NULL
+ * @param leftSize size of leftData
+ * @param leftData the previous Rsum, or NULL
+ * @param files W file names
+ * @param fileC number of W files
+ * @param cache W cache, or NULL
+ * @param command command counter, incremented for each block
+ * @param Rsum
+ * @param rsumSize
+ * @return number of Ws whose product was added to Rsum
+ */
+int runLayerRemote(struct remoteWorker *workers, int workerC, char *left, int leftSize, const element *leftData,
+                   char *files[], int fileC, struct matrixCache *cache, int *command, element **Rsum,
+                   int *rsumSize){
+    long long start = profileStart();
+    element *loadedLeft = NULL;
+    if(leftData == NULL){
+        loadedLeft = loadLeftMatrix(left, &leftSize);
+        if(loadedLeft == NULL){
+            logFailure("Error - cannot open file %s.", left);
+            return 0;
+        }
+        leftData = loadedLeft;
+    }
+    //the W a worker holds is an index in the Ws of a layer, it holds none of this one
+    for(int w = 0; w < workerC; w++){
+        workers[w].wHeld = -1;
+    }
+    int connected = connectWorkers(workers, workerC);
+    if(connected == 0){
+        logFailure("Error - no worker server can be reached, the layer is not computed.");
+        free(loadedLeft);
+        return 0;
+    }
+
+    //only the rows of the left matrix can be nonzero, the rows below them stay 0
+    int blockRows = (leftSize + connected * 4 - 1) / (connected * 4);
+    blockRows = blockRows > remoteBlockRows ? blockRows : remoteBlockRows;
+    int blocksPerW = (leftSize + blockRows - 1) / blockRows;
+    struct remoteW *ws = calloc(fileC, sizeof(struct remoteW));
+    struct rowBlock *blocks = calloc((size_t)fileC * blocksPerW, sizeof(struct rowBlock));
+    if(ws == NULL || blocks == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    int blockC = 0;
+    for(int f = 0; f < fileC; f++){
+        ws[f].matrix = loadRemoteW(files[f], cache, leftSize, &ws[f].size);
+        if(ws[f].matrix == NULL){
+            logFailure("Error - cannot open file %s.", files[f]);
+            ws[f].failed = true;
+            continue;
+        }
+        ws[f].result = calloc((size_t)ws[f].size * ws[f].size, sizeof(element));
+        if(ws[f].result == NULL){
+            perror("calloc");
+            exit(1);
+        }
+        for(int r = 0; r < leftSize; r += blockRows){
+            blocks[blockC].file = f;
+            blocks[blockC].rowStart = r;
+            blocks[blockC++].rowCount = r + blockRows < leftSize ? blockRows : leftSize - r;
+            ws[f].blocksLeft++;
+        }
+    }
+    profileSpan(phaseLoad, start);
+
+    int finished = 0;
+    struct pollfd fds[workerC];
+    int polled[workerC];
+    while(true){
+        //one block per idle server, so no server blocks on a result while we are still writing to it
+        for(int w = 0; w < workerC; w++){
+            struct remoteWorker *worker = &workers[w];
+            int b;
+            if(worker->fd == -1 || worker->job != -1 || (b = nextBlock(blocks, blockC, ws, worker->wHeld)) == -1){
+                continue;
+            }
+            worker->command = ++(*command);
+            start = profileStart();
+            int sent = sendRowsJob(worker, *command, leftData, leftSize, &blocks[b], files[blocks[b].file],
+                                   &ws[blocks[b].file]);
+            profileSpan(phaseTransfer, start);
+            if(sent == -1){
+                dropWorker(worker);
+                continue;
+            }
+            blocks[b].sent = true;
+            blocks[b].attempts++;
+            worker->job = b;
+        }
+
+        //wait for results, until no block is in flight
+        int count = 0;
+        for(int w = 0; w < workerC; w++){
+            if(workers[w].fd != -1 && workers[w].job != -1){
+                polled[count] = w;
+                fds[count].fd = workers[w].fd;
+                fds[count++].events = POLLIN;
+            }
+        }
+        if(count == 0){
+            break;
+        }
+        if(poll(fds, count, -1) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("poll");
+            exit(1);
+        }
+
+        for(int p = 0; p < count; p++){
+            if(fds[p].revents == 0){
+                continue;
+            }
+            struct remoteWorker *worker = &workers[polled[p]];
+            struct rowBlock *block = &blocks[worker->job];
+            struct remoteW *w = &ws[block->file];
+            start = profileStart();
+            int status = readRowsResult(worker, block, w);
+            profileSpan(phaseTransfer, start);
+            block->sent = false;
+            worker->job = -1;
+            if(status == 1){
+                block->done = true;
+                worker->blocks++;
+                if(--w->blocksLeft == 0){
+                    start = profileStart();
+                    growMatrix(Rsum, rsumSize, w->size);
+                    addMatrix(*Rsum, *rsumSize, w->result, w->size);
+                    profileSpan(phaseAccumulate, start);
+                    finished++;
+                }
+                continue;
+            }
+            if(status == -1){
+                dropWorker(worker);
+            }else{
+                //the worker may have lost W, it is sent with the next block
+                worker->wHeld = -1;
+            }
+            if(block->attempts >= remoteAttempts){
+                logFailure("Error - the rows of %s failed %d times.", files[block->file], block->attempts);
+                w->failed = true;
+            }
+        }
+    }
+
+    //blocks can only be left when every server is gone
+    if(nextBlock(blocks, blockC, ws, -1) != -1){
+        logFailure("Error - no worker server left, the layer is not computed.");
+    }
+    for(int f = 0; f < fileC; f++){
+        free(ws[f].matrix);
+        free(ws[f].result);
+    }
+    free(ws);
+    free(blocks);
+    free(loadedLeft);
+    return finished;
+}
+
+/**
+ * The multiply of the --in-process mode: a libmatmul plan (see matmul.h), kept from one product to the next while
+ * the size does not change, and the buffers of the padded left matrix and of the product. Nothing is allocated for
+ * a product of the same size as the previous one, apart from loading W. The profile of matrixtune, if there is one,
+ * changes the options for each size, except the ones chosen explicitly.
+ */
+struct localEngine {
+    struct matmulOptions options;   //size is set for every plan
+    const struct tuneProfile *tuning;
+    int chosen;                     //tuneKernel, tuneThreads and tuneStrassen
+    struct matmulPlan plan;         //plan.size is 0 before the first product
+    element *left;                  //the left matrix padded to plan.size
+    element *product;
+    long products;
+};
+
+/**
+ * This function sets up the in-process multiply: the kernel, the Strassen crossover and the sparse threshold are
+ * taken from MATRIXMULT_KERNEL, MATRIXMULT_STRASSEN and MATRIXMULT_SPARSE, like the children take them, the rest
+ * from the profile.
+ * @param local to fill in
+ * @param threads threads of a product
+ * @param threadsChosen true if threads was given explicitly
+ * @param placement where the threads run, or NULL
+ * @param tuning profile of matrixtune, or NULL
+ */
+void startLocal(struct localEngine *local, int threads, bool threadsChosen, const struct affinity *placement,
+                const struct tuneProfile *tuning){
+    memset(local, 0, sizeof(*local));
+    matmulDefaults(&local->options, 0);
+    local->options.threads = threads;
+    local->options.placement = placement;
+    local->tuning = tuning;
+    local->chosen = threadsChosen ? tuneThreads : 0;
+    const char *kernel = getenv("MATRIXMULT_KERNEL");
+    if(kernel != NULL && kernel[0] != '\0'){
+        local->chosen |= tuneKernel;
+        local->options.kernel = matmulFindKernel(kernel);
+        if(local->options.kernel == NULL){
+            fprintf(stderr, "Kernel %s is not available, choosing from the CPU.\n", kernel);
+        }
+    }
+    const char *strassen = getenv("MATRIXMULT_STRASSEN");
+    if(strassen != NULL && !narrowW){
+        local->chosen |= tuneStrassen;
+        local->options.crossover = atoi(strassen) > 0 ? atoi(strassen) : matmulCrossover;
+    }
+    const char *sparse = getenv("MATRIXMULT_SPARSE");
+    if(sparse != NULL){
+        local->options.sparse = atoi(sparse) > 0 ? atoi(sparse) : 0;
+    }
+}
+
+/**
+ * This function gets the in-process multiply ready for products of the given size: a new plan (with the
+ * configuration the profile has for the size) and new buffers are only made when the size changes.
+ * @param local
+ * @param size
+ */
+void planLocal(struct localEngine *local, int size){
+    if(local->plan.size == size){
+        return;
+    }
+    matmulPlanFree(&local->plan);
+    free(local->left);
+    free(local->product);
+    struct matmulOptions options = local->options;
+    options.size = size;
+    tuneApply(tuneFind(local->tuning, size), &options, local->chosen);
+    local->left = malloc((size_t)size * size * sizeof(element));
+    local->product = malloc((size_t)size * size * sizeof(element));
+    if(local->left == NULL || local->product == NULL || matmulPlanInit(&local->plan, &options) == -1){
+        perror("matmulPlanInit");
+        exit(1);
+    }
+}
+
+/**
+ * This function frees the plan and the buffers of the in-process multiply.
+ * @param local
+ */
+void stopLocal(struct localEngine *local){
+    matmulPlanFree(&local->plan);
+    free(local->left);
+    free(local->product);
+}
+
+/**
+ * This function runs one layer in this process: every W is loaded (from the cache if there is one), the left matrix
+ * is multiplied by it with the plan of the size of the product, by the threads of the plan, and the product is added
+ * to Rsum. No process is started, and the left matrix and the products never leave the memory of this process.
+ * @param local
+ * @param left file name of the left matrix, used if leftData is NULL
+ * @param leftSize size of leftData
+ * @param leftData the previous Rsum, or NULL
+ * @param files W file names
+ * @param fileC number of W files
+ * @param cache W cache, or NULL
+ * @param command command counter, incremented for each W
+ * @param Rsum
+ * @param rsumSize
+ * @return number of Ws whose product was added to Rsum
+ */
+int runLayerLocal(struct localEngine *local, char *left, int leftSize, const element *leftData, char *files[],
+                  int fileC, struct matrixCache *cache, int *command, element **Rsum, int *rsumSize){
+    long long start = profileStart();
+    element *loadedLeft = NULL;
+    if(leftData == NULL){
+        loadedLeft = loadLeftMatrix(left, &leftSize);
+        if(loadedLeft == NULL){
+            logFailure("Error - cannot open file %s.", left);
+            return 0;
+        }
+        leftData = loadedLeft;
+    }
+    profileSpan(phaseLoad, start);
+
+    char output_file[fileLength];
+    sprintf(output_file, "%d.out", getpid());
+    char message[messageLen];
+    int finished = 0;
+    for(int f = 0; f < fileC; f++){
+        ++(*command);
+        logSetCommand(*command);
+        start = profileStart();
+        int size;
+        wElement *w = loadRemoteW(files[f], cache, leftSize, &size);
+        profileSpan(phaseLoad, start);
+        if(w == NULL){
+            logFailure("Error - cannot open file %s.", files[f]);
+            continue;
+        }
+
+        //the left matrix is padded with 0s if W is bigger
+        start = profileStart();
+        planLocal(local, size);
+        const element *matrixA = leftData;
+        if(size != leftSize){
+            memset(local->left, 0, (size_t)size * size * sizeof(element));
+            for(int i = 0; i < leftSize; i++){
+                memcpy(&local->left[(size_t)i * size], &leftData[(size_t)i * leftSize], leftSize * sizeof(element));
+            }
+            matrixA = local->left;
+        }
+        int computed = matmulExecute(&local->plan, matrixA, w, local->product);
+        profileSpan(phaseCompute, start);
+        verifyLocal(size, matrixA, w, local->product, *command, left != NULL ? left : "Rsum", files[f]);
+        free(w);
+
+        start = profileStart();
+        growMatrix(Rsum, rsumSize, size);
+        addMatrix(*Rsum, *rsumSize, local->product, size);
+        profileSpan(phaseAccumulate, start);
+        snprintf(message, sizeof(message), "Command %d: %.40s in process, %d x %d, kernel = %s", *command, files[f],
+                 size, size, computed == matmulSparse ? "sparse" : local->plan.kernel->name);
+        logMessage(output_file, message);
+        local->products++;
+        finished++;
+    }
+    free(loadedLeft);
+    return finished;
+}
+
+/**
+ * The --out-of-core mode: the options of the in-process multiply, the memory budget of a layer, and what the layers
+ * streamed, summed up for the end of the run.
+ */
+struct streamRun {
+    struct localEngine *local;
+    size_t budget;
+    int size;           //of the last layer
+    int tile;
+    long layers;
+    long products;      //tile products
+    size_t bytesRead;
+    size_t bytesWritten;
+    double waitSeconds;
+};
+
+/**
+ * This function runs one layer out of core: the left matrix and the Ws are read by tiles from their binary files and
+ * the layer is written by tiles to streamPartial (see streamLayer), with at most the memory budget for the tiles and
+ * the plan. Nothing of the size of a matrix is held in memory. The plan has the threads and the MATRIXMULT_ settings
+ * of --in-process, and the configuration the profile has for the tile size. A W that is missing or is a text file
+ * (which cannot be read by tiles) is reported and left out of the layer.
+ * @param run
+ * @param left file name of the left matrix: A, or streamRsum
+ * @param files W file names
+ * @param fileC number of W files
+ * @param command command counter, incremented for each W
+ * @return number of Ws in the layer written to streamPartial, -1 if it could not be computed
+ */
+int runLayerStream(struct streamRun *run, const char *left, char *files[], int fileC, int *command){
+    struct localEngine *local = run->local;
+    char output_file[fileLength];
+    sprintf(output_file, "%d.out", getpid());
+    char message[messageLen];
+
+    //the layer is as big as its largest matrix, like Rsum
+    long long start = profileStart();
+    int rows, cols;
+    if(matrixFormat(left) != formatBinary || matrixDimensions(left, &rows, &cols) == -1){
+        logFailure("Error - cannot read file %s by tiles, it must be a binary matrix file (see matrixconvert).", left);
+        return -1;
+    }
+    int size = rows > cols ? rows : cols;
+    size = size > minMatrixSize ? size : minMatrixSize;
+    char **streamed = malloc((fileC > 0 ? fileC : 1) * sizeof(char *));
+    if(streamed == NULL){
+        perror("malloc");
+        exit(1);
+    }
+    int streamedC = 0;
+    for(int f = 0; f < fileC; f++){
+        ++(*command);
+        logSetCommand(*command);
+        int format = matrixFormat(files[f]);
+        if(format == formatMissing || (format == formatBinary && matrixDimensions(files[f], &rows, &cols) == -1)){
+            logFailure("Error - cannot open file %s.", files[f]);
+        }else if(format == formatText){
+            logFailure("Error - %s is a text file, it cannot be read by tiles (convert it with matrixconvert).",
+                       files[f]);
+        }else{
+            size = rows > size ? rows : size;
+            size = cols > size ? cols : size;
+            streamed[streamedC++] = files[f];
+            snprintf(message, sizeof(message), "Command %d: %.40s out of core", *command, files[f]);
+            logMessage(output_file, message);
+        }
+    }
+    profileSpan(phaseLoad, start);
+
+    //the plan of the tiles gets what the profile has for their size
+    start = profileStart();
+    struct streamOptions options;
+    streamDefaults(&options, run->budget);
+    options.minSize = minMatrixSize;
+    options.multiply = local->options;
+    int tile = streamTileSize(&options, size);
+    tuneApply(tuneFind(local->tuning, tile), &options.multiply, local->chosen);
+    struct streamStats stats;
+    int status = streamLayer(&options, left, streamed, streamedC, streamPartial, &stats);
+    profileSpan(phaseCompute, start);
+    free(streamed);
+    if(status == -1){
+        logFailure("Error - the layer of %d x %d could not be streamed with %zu MB: %s.", size, size, run->budget >> 20,
+                   strerror(errno));
+        unlink(streamPartial);
+        return -1;
+    }
+    run->size = stats.size;
+    run->tile = stats.tile;
+    run->layers++;
+    run->products += stats.products;
+    run->bytesRead += stats.bytesRead;
+    run->bytesWritten += stats.bytesWritten;
+    run->waitSeconds += stats.waitSeconds;
+    return streamedC;
+}
+
+/**
+ * This function publishes the layer streamed to streamPartial as the new Rsum, or drops it.
+ * @param publish true if the layer is complete
+ */
+void publishStream(bool publish){
+    long long start = profileStart();
+    if(publish && rename(streamPartial, streamRsum) == -1){
+        perror("rename");
+    }
+    unlink(streamPartial);
+    profileSpan(phaseWrite, start);
+}
+
+/**
+ * The inputs of the --inputs mode, carried through the layers together: the left matrices and their products are
+ * kept one after the other, so every W multiplies all of them as one stacked matrix (see matmulExecuteBatch), and
+ * every input has its own Rsum. The left matrices all have the size of the largest one, and the Rsums grow together.
+ */
+struct inputStack {
+    int count;
+    char **names;       //input of each matrix, for the output
+    int size;           //every left matrix is size x size
+    element *left;      //count left matrices, one after the other
+    element *product;   //count products of size x size
+    element **rsums;
+    int rsumSize;
+};
+
+/**
+ * This function orders file names for qsort.
+ * @param a
+ * @param b
+ * @return the order of the names
+ */
+int nameOrder(const void *a, const void *b){
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * This function adds the name of an input to a stack.
+ * @param stack
+ * @param name copied
+ */
+void addInputName(struct inputStack *stack, const char *name){
+    stack->names = realloc(stack->names, (stack->count + 1) * sizeof(char *));
+    if(stack->names == NULL || (stack->names[stack->count] = strdup(name)) == NULL){
+        perror("realloc");
+        exit(1);
+    }
+    stack->count++;
+}
+
+/**
+ * This function lists the inputs of a directory (its regular files, in the order of their names) or of a list file
+ * (one matrix file per line, empty lines and lines starting with # are skipped).
+ * @param source
+ * @param stack names are added to it
+ * @return 0 if successful, -1 if source cannot be read
+ */
+int listInputs(const char *source, struct inputStack *stack){
+    struct stat info;
+    if(stat(source, &info) == -1){
+        return -1;
+    }
+    if(S_ISDIR(info.st_mode)){
+        DIR *directory = opendir(source);
+        if(directory == NULL){
+            return -1;
+        }
+        char path[PATH_MAX];
+        for(struct dirent *entry = readdir(directory); entry != NULL; entry = readdir(directory)){
+            snprintf(path, sizeof(path), "%s/%s", source, entry->d_name);
+            if(entry->d_name[0] != '.' && stat(path, &info) == 0 && S_ISREG(info.st_mode)){
+                addInputName(stack, path);
+            }
+        }
+        closedir(directory);
+        qsort(stack->names, stack->count, sizeof(char *), nameOrder);
+        return 0;
+    }
+
+    FILE *list = fopen(source, "r");
+    if(list == NULL){
+        return -1;
+    }
+    char *line = NULL;
+    size_t lineSize = 0;
+    while(getline(&line, &lineSize, list) != -1){
+        char *saved;
+        char *name = strtok_r(line, " \t\r\n", &saved);
+        if(name != NULL && name[0] != '#'){
+            addInputName(stack, name);
+        }
+    }
+    free(line);
+    fclose(list);
+    return 0;
+}
+
+/**
+ * This function loads the inputs of the --inputs mode: the matrix files of a directory or of a list file, or the
+ * matrices of a stacked matrix file (a binary file of count*n rows of n columns, the matrices one under the other).
+ * Each input starts with an Rsum of 0s of the starting size.
+ * @param source
+ * @param stack to fill in
+ * @return 0 if successful, -1 if an input cannot be loaded (the error is printed)
+ */
+int loadInputStack(const char *source, struct inputStack *stack){
+    memset(stack, 0, sizeof(*stack));
+    int rows, cols;
+    bool stacked = matrixFormat(source) == formatBinary;
+    if(stacked){
+        if(matrixDimensions(source, &rows, &cols) == -1 || cols < 1 || rows % cols != 0){
+            fprintf(stderr, "Error - the rows of %s are not a multiple of its columns.\n", source);
+            return -1;
+        }
+        char name[fileLength];
+        for(int m = 0; m < rows / cols; m++){
+            snprintf(name, sizeof(name), "%.200s[%d]", source, m);
+            addInputName(stack, name);
+        }
+        stack->size = cols;
+    }else if(listInputs(source, stack) == -1){
+        fprintf(stderr, "Error - cannot open file %s.\n", source);
+        return -1;
+    }
+    if(stack->count == 0){
+        fprintf(stderr, "Error - %s has no input matrix.\n", source);
+        return -1;
+    }
+
+    //the matrices are padded with 0s to the largest one
+    for(int m = 0; m < stack->count && !stacked; m++){
+        if(matrixDimensions(stack->names[m], &rows, &cols) == -1){
+            fprintf(stderr, "Error - cannot open file %s.\n", stack->names[m]);
+            return -1;
+        }
+        stack->size = rows > stack->size ? rows : stack->size;
+        stack->size = cols > stack->size ? cols : stack->size;
+    }
+    stack->size = stacked || stack->size > minMatrixSize ? stack->size : minMatrixSize;
+    size_t matrixElements = (size_t)stack->size * stack->size;
+    stack->left = calloc(stack->count * matrixElements, sizeof(element));
+    stack->product = malloc(stack->count * matrixElements * sizeof(element));
+    stack->rsums = malloc(stack->count * sizeof(element *));
+    if(stack->left == NULL || stack->product == NULL || stack->rsums == NULL){
+        perror("malloc");
+        exit(1);
+    }
+    stack->rsumSize = minMatrixSize;
+    for(int m = 0; m < stack->count; m++){
+        element *matrix = stack->left + m * matrixElements;
+        if((stacked ? loadMatrixRows(source, m * stack->size, stack->size, matrix, elementType)
+                    : loadMatrix(stack->names[m], stack->size, matrix, elementType)) == -1){
+            fprintf(stderr, "Error - cannot open file %s.\n", stack->names[m]);
+            return -1;
+        }
+        stack->rsums[m] = calloc((size_t)stack->rsumSize * stack->rsumSize, sizeof(element));
+        if(stack->rsums[m] == NULL){
+            perror("calloc");
+            exit(1);
+        }
+    }
+    return 0;
+}
+
+/**
+ * This function resizes the left matrices of a stack (and the products), padding them with 0s or cutting them.
+ * @param stack
+ * @param size
+ * @param from the new left matrices are copied from these (count matrices of the size of the stack), or from the
+ * Rsums if NULL, which must have this size
+ */
+void resizeStack(struct inputStack *stack, int size, const element *from){
+    size_t matrixElements = (size_t)size * size;
+    if(size != stack->size){
+        free(stack->product);
+        stack->product = malloc(stack->count * matrixElements * sizeof(element));
+        element *left = calloc(stack->count * matrixElements, sizeof(element));
+        if(left == NULL || stack->product == NULL){
+            perror("calloc");
+            exit(1);
+        }
+        int copied = size < stack->size ? size : stack->size;
+        for(int m = 0; m < stack->count && from != NULL; m++){
+            for(int i = 0; i < copied; i++){
+                memcpy(&left[m * matrixElements + (size_t)i * size],
+                       &from[(m * (size_t)stack->size + i) * stack->size], copied * sizeof(element));
+            }
+        }
+        free(stack->left);
+        stack->left = left;
+        stack->size = size;
+    }
+    for(int m = 0; m < stack->count && from == NULL; m++){
+        memcpy(&stack->left[m * matrixElements], stack->rsums[m], matrixElements * sizeof(element));
+    }
+}
+
+/**
+ * This function runs one layer of the --inputs mode in this process: every W is loaded once (from the cache if there
+ * is one) and multiplies all the left matrices of the stack as one stacked matrix, and each product is added to the
+ * Rsum of its input.
+ * @param local
+ * @param stack
+ * @param files W file names
+ * @param fileC number of W files
+ * @param cache W cache, or NULL
+ * @param command command counter, incremented for each W
+ * @return number of Ws whose products were added to the Rsums
+ */
+int runLayerStack(struct localEngine *local, struct inputStack *stack, char *files[], int fileC,
+                  struct matrixCache *cache, int *command){
+    char output_file[fileLength];
+    sprintf(output_file, "%d.out", getpid());
+    char message[messageLen];
+    int finished = 0;
+    for(int f = 0; f < fileC; f++){
+        ++(*command);
+        logSetCommand(*command);
+        long long start = profileStart();
+        int size;
+        wElement *w = loadRemoteW(files[f], cache, stack->size, &size);
+        profileSpan(phaseLoad, start);
+        if(w == NULL){
+            logFailure("Error - cannot open file %s.", files[f]);
+            continue;
+        }
+
+        //the left matrices are padded with 0s if W is bigger
+        start = profileStart();
+        if(size != stack->size){
+            resizeStack(stack, size, stack->left);
+        }
+        planLocal(local, size);
+        int sparse = matmulExecuteBatch(&local->plan, stack->count, stack->left, w, stack->product);
+        profileSpan(phaseCompute, start);
+        size_t matrixElements = (size_t)size * size;
+        for(int m = 0; m < stack->count; m++){
+            verifyLocal(size, &stack->left[m * matrixElements], w, &stack->product[m * matrixElements], *command,
+                        stack->names[m], files[f]);
+        }
+        free(w);
+
+        start = profileStart();
+        for(int m = 0; m < stack->count; m++){
+            int rsumSize = stack->rsumSize;
+            growMatrix(&stack->rsums[m], &rsumSize, size);
+            addMatrix(stack->rsums[m], rsumSize, &stack->product[m * matrixElements], size);
+        }
+        stack->rsumSize = size > stack->rsumSize ? size : stack->rsumSize;
+        profileSpan(phaseAccumulate, start);
+        snprintf(message, sizeof(message), "Command %d: %.40s x %d inputs, %d x %d, kernel = %s, %d sparse", *command,
+                 files[f], stack->count, size, size, local->plan.kernel->name, sparse);
+        logMessage(output_file, message);
+        local->products += stack->count;
+        finished++;
+    }
+    return finished;
+}
+
+/**
+ * This function makes the Rsums of a layer the left matrices of the next one.
+ * @param stack
+ */
+void publishStack(struct inputStack *stack){
+    long long start = profileStart();
+    resizeStack(stack, stack->rsumSize, NULL);
+    profileSpan(phaseWrite, start);
+}
+
+/**
+ * This function writes the Rsum of every input to Rsum_<n>.txt (or Rsum_<n>.bin), n being its place in the stack,
+ * and prints them.
+ * @param stack
+ * @param binary
+ */
+void saveStack(struct inputStack *stack, bool binary){
+    char filename[fileLength];
+    for(int m = 0; m < stack->count; m++){
+        snprintf(filename, sizeof(filename), binary ? "Rsum_%d.bin" : "Rsum_%d.txt", m);
+        long long start = profileStart();
+        replaceMatrixInFile(filename, stack->rsumSize, stack->rsums[m]);
+        profileSpan(phaseWrite, start);
+
+        printf("Rsum %d (%s) = [ \n", m, stack->names[m]);
+        writeMatrixText(stdout, stack->rsumSize, stack->rsumSize, stack->rsums[m], stack->rsumSize, elementType, 4,
+                        true);
+        printf(" ]\n");
+    }
+}
+
+/**
+ * This function frees a stack.
+ * @param stack
+ */
+void freeStack(struct inputStack *stack){
+    for(int m = 0; m < stack->count; m++){
+        free(stack->names[m]);
+        free(stack->rsums[m]);
+    }
+    free(stack->names);
+    free(stack->rsums);
+    free(stack->left);
+    free(stack->product);
+}
+
+/**
+ * This function writes Rsum to its file and keeps a copy of it, which the pool sends to the workers as the left
+ * matrix of the next layer. With shared memory Rsum is only copied there, the file is written at the end.
+ * @param filename
+ * @param Rsum
+ * @param rsumSize
+ * @param published copy of the last Rsum written
+ * @param publishedSize
+ * @param shared shared memory, or NULL
+ */
+void publishRsum(char *filename, const element *Rsum, int rsumSize, element **published, int *publishedSize,
+                 struct sharedRegion *shared){
+    long long start = profileStart();
+    if(shared != NULL){
+        publishShared(shared, Rsum, rsumSize);
+        profileSpan(phaseWrite, start);
+        return;
+    }
+    replaceMatrixInFile(filename, rsumSize, (element *)Rsum);
+    profileSpan(phaseWrite, start);
+    if(*publishedSize != rsumSize){
+        free(*published);
+        *published = malloc((size_t)rsumSize * rsumSize * sizeof(element));
+        if(*published == NULL){
+            perror("malloc");
+            exit(1);
+        }
+        *publishedSize = rsumSize;
+    }
+    memcpy(*published, Rsum, (size_t)rsumSize * rsumSize * sizeof(element));
+}
+
+/**
+ * This function adds W files into a sum, for the fused mode: files first, first + step, ... are loaded (from the
+ * cache if there is one) and added, the sum grows to the biggest W. A file that cannot be loaded is reported.
+ * The sum is of the element type, so the cache is only used when W is not narrower (the fused mode needs that).
+ * @param files
+ * @param fileC
+ * @param first
+ * @param step
+ * @param cache W cache, or NULL
+ * @param Wsum
+ * @param wsumSize
+ * @return true if every file was loaded
+ */
+bool addWFiles(char *files[], int fileC, int first, int step, struct matrixCache *cache, element **Wsum,
+               int *wsumSize){
+    bool loaded = true;
+    for(int i = first; i < fileC; i += step){
+        struct cachedMatrix *entry = NULL;
+        element *matrix = NULL;
+        int rows, cols, size = 0;
+        long long start = profileStart();
+        if(cache != NULL && !narrowW){
+            entry = cacheGet(cache, files[i]);
+            if(entry != NULL){
+                matrix = (element *)entry->data;
+                size = entry->size;
+            }
+        }else if(matrixDimensions(files[i], &rows, &cols) == 0){
+            size = rows > cols ? rows : cols;
+            matrix = calloc((size_t)size * size, sizeof(element));
+            if(matrix == NULL){
+                perror("calloc");
+                exit(1);
+            }
+            if(loadMatrix(files[i], size, matrix, elementType) == -1){
+                free(matrix);
+                matrix = NULL;
+            }
+        }
+        if(matrix == NULL){
+            logFailure("Error - cannot open file %s.", files[i]);
+            loaded = false;
+            continue;
+        }
+        profileSpan(phaseLoad, start);
+        start = profileStart();
+        growMatrix(Wsum, wsumSize, size);
+        addMatrix(*Wsum, *wsumSize, matrix, size);
+        profileSpan(phaseCompute, start);
+        if(entry != NULL){
+            cacheRelease(cache, entry);
+        }else{
+            free(matrix);
+        }
+    }
+    return loaded;
+}
+
+/**
+ * This function sums the W files of a layer for the fused mode. Without a cache the files are split between up to
+ * maxChildren forked helpers, which load their share, add it up and send the partial sum back through a pipe, like
+ * a result; their exit status tells if one of their files could not be loaded. With a cache the matrices are
+ * already parsed and are added in this process.
+ * @param files
+ * @param fileC
+ * @param maxChildren
+ * @param cache W cache, or NULL
+ * @param Wsum sum of the loaded W files, set to 0s first
+ * @param wsumSize
+ * @return true if every file was loaded
+ */
+bool sumLayer(char *files[], int fileC, int maxChildren, struct matrixCache *cache, element **Wsum, int *wsumSize){
+    memset(*Wsum, 0, (size_t)*wsumSize * *wsumSize * sizeof(element));
+    if(cache != NULL || fileC < 2 || maxChildren < 2){
+        return addWFiles(files, fileC, 0, 1, cache, Wsum, wsumSize);
+    }
+
+    //the helpers are not timed on their own, their loads and sums count as loading
+    long long start = profileStart();
+    int helpers = fileC < maxChildren ? fileC : maxChildren;
+    pid_t pids[helpers];
+    int fds[helpers];
+    fflush(stderr);
+    for(int h = 0; h < helpers; h++){
+        int fd[2];
+        if(pipe(fd) == -1){
+            perror("pipe");
+            exit(1);
+        }
+        pids[h] = fork();
+        if(pids[h] == -1){
+            perror("fork");
+            exit(1);
+        }
+        if(pids[h] == 0){
+            //helper: add its share of the files and send the sum as a result
+            close(fd[0]);
+            if(placement != NULL){
+                affinityPin(placement, h);
+            }
+            element *partial = NULL;
+            int partialSize = 0;
+            bool loaded = addWFiles(files, fileC, h, helpers, NULL, &partial, &partialSize);
+            int header[2] = {partialSize, partialSize};
+            if(partialSize == 0){
+                header[0] = header[1] = -1;
+            }
+            if(writeFully(fd[1], header, sizeof(header)) == -1 ||
+               (partialSize > 0 &&
+                writeFully(fd[1], partial, (size_t)partialSize * partialSize * sizeof(element)) == -1)){
+                _exit(2);
+            }
+            _exit(loaded ? 0 : 1);
+        }
+        close(fd[1]);
+        fds[h] = fd[0];
+    }
+
+    //the pipes are blocking, so each partial sum is read in one go
+    bool loaded = true;
+    for(int h = 0; h < helpers; h++){
+        struct resultReader reader;
+        memset(&reader, 0, sizeof(reader));
+        int resultRead = readResultStep(fds[h], &reader);
+        if(resultRead == 1){
+            addResult(&reader, Wsum, wsumSize);
+        }
+        free(reader.buffer);
+        close(fds[h]);
+        int status;
+        waitpid(pids[h], &status, 0);
+        if(resultRead == -2 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            loaded = false;
+        }
+    }
+    drainChildSignal();
+    profileSpan(phaseLoad, start);
+    return loaded;
+}
+
 /**
- * @param file_name
- * @param message
- *
- * this function serves to make writing in logs a bit easier.
- * This function will open and close the files and write logs into the .err or .out file
- * Input parameters: file_name: file name that we will be writing to, message: message that we will write.
- * returns: return to main function if successful, otherwise returns exit(1)
+ * This function prepares a layer in the fused mode: Rsum*W1 + ... + Rsum*Wk is Rsum*(W1 + ... + Wk), so the Ws
+ * are summed (see sumLayer) and written to one file, and the layer becomes a single multiply by that file.
+ * A layer with one W is left as it is.
+ * @param files W file names of the layer, replaced by the name of the sum
+ * @param fileC number of W files, replaced by the number of multiplies left (0 if no W could be loaded)
+ * @param maxChildren
+ * @param cache W cache, or NULL
+ * @param Wsum buffer for the sum, reused from layer to layer
+ * @param wsumSize
+ * @return true if every W file of the layer was loaded
+ */
+bool fuseLayer(char ***files, int *fileC, int maxChildren, struct matrixCache *cache, element **Wsum,
+               int *wsumSize){
+    static char *fusedFiles[] = {wsumFilename};
+    if(*fileC < 2){
+        return true;
+    }
+    bool loaded = sumLayer(*files, *fileC, maxChildren, cache, Wsum, wsumSize);
+    *files = fusedFiles;
+    *fileC = 1;
+    long long start = profileStart();
+    if(saveMatrixBinary(wsumFilename, *wsumSize, *wsumSize, *Wsum, *wsumSize, elementType) == -1){
+        logFailure("Error - cannot write file %s.", wsumFilename);
+        *fileC = 0;
+    }
+    profileSpan(phaseWrite, start);
+    return loaded;
+}
+
+/**
+ * A node of the product tree of --batch: a matrix of the chain (A, or the sum of the Ws of a line), or the product
+ * of two nodes.
  */
-void logMessage(const char *file_name, char *message) {
-    FILE *file = fopen(file_name, "a");
-    if(file == NULL){
-        perror("Failed to open log file");
+struct chainNode {
+    int left;           //nodes multiplied, -1 for a matrix of the chain
+    int right;
+    int height;         //0 for a matrix of the chain; the products of the same height are computed at the same time
+    int size;           //square size of the matrix
+    char *path;         //file of the matrix, set once a product is computed
+    bool temporary;     //path was written for the batch, it is removed once it is used
+};
+
+/**
+ * This function gets the matrix of a line of the chain: the W file itself when there is only one, otherwise the
+ * sum of the Ws (see sumLayer) written to a temporary binary file.
+ * @param files W file names of the line
+ * @param fileC number of W files
+ * @param index of the line, for the name of the temporary file
+ * @param maxChildren
+ * @param partial keep the sum of the Ws that could be loaded when some could not
+ * @param node to fill in, its path is NULL if there is no matrix
+ * @return true if every W could be loaded
+ */
+bool chainMatrix(char *files[], int fileC, int index, int maxChildren, bool partial, struct chainNode *node){
+    memset(node, 0, sizeof(*node));
+    node->left = node->right = -1;
+    int rows, cols;
+    if(fileC == 1){
+        if(matrixDimensions(files[0], &rows, &cols) == -1){
+            logFailure("Error - cannot open file %s.", files[0]);
+            return false;
+        }
+        node->path = strdup(files[0]);
+        node->size = rows > cols ? rows : cols;
+    }else{
+        int wsumSize = minMatrixSize;
+        element *Wsum = calloc((size_t)wsumSize * wsumSize, sizeof(element));
+        char path[fileLength];
+        snprintf(path, sizeof(path), "%s%d.bin", chainPrefix, index);
+        if(Wsum == NULL){
+            perror("calloc");
+            exit(1);
+        }
+        bool loaded = sumLayer(files, fileC, maxChildren, NULL, &Wsum, &wsumSize);
+        if(saveMatrixBinary(path, wsumSize, wsumSize, Wsum, wsumSize, elementType) == -1){
+            logFailure("Error - cannot write file %s.", path);
+            loaded = false;
+        }
+        free(Wsum);
+        node->path = strdup(path);
+        node->size = wsumSize;
+        node->temporary = true;
+        if(!loaded && !partial){
+            unlink(path);
+            free(node->path);
+            node->path = NULL;
+            return false;
+        }
+        if(node->path == NULL){
+            perror("strdup");
+            exit(1);
+        }
+        return loaded;
+    }
+    if(node->path == NULL){
+        perror("strdup");
         exit(1);
     }
+    node->size = node->size > minMatrixSize ? node->size : minMatrixSize;
+    return true;
+}
 
-    fprintf(file, "%s\n", message);
-    fflush(file);
-    fclose(file);
+/**
+ * This function builds the product tree of chain[first..last] from the split points of orderChain.
+ * @param nodes the matrices of the chain, followed by the products (appended here)
+ * @param nodeC number of nodes
+ * @param chainC number of matrices in the chain
+ * @param split split[first * chainC + last]: the last matrix of the left part, or NULL to split in the middle
+ * @param first
+ * @param last
+ * @return the node of the product
+ */
+int buildChainTree(struct chainNode *nodes, int *nodeC, int chainC, const int *split, int first, int last){
+    if(first == last){
+        return first;
+    }
+    int middle = split != NULL ? split[first * chainC + last] : (first + last) / 2;
+    int left = buildChainTree(nodes, nodeC, chainC, split, first, middle);
+    int right = buildChainTree(nodes, nodeC, chainC, split, middle + 1, last);
+    struct chainNode *node = &nodes[(*nodeC)++];
+    memset(node, 0, sizeof(*node));
+    node->left = left;
+    node->right = right;
+    node->height = (nodes[left].height > nodes[right].height ? nodes[left].height : nodes[right].height) + 1;
+    node->size = nodes[left].size > nodes[right].size ? nodes[left].size : nodes[right].size;
+    return *nodeC - 1;
 }
+
 /**
- * This function reads a file line by line and stores it in a matrix.
- * @param R_SUM
- * @param row
- * @param result
+ * This function orders the products of a chain (matrix-chain ordering): the matrices are padded squares, so the
+ * product of a part of the chain costs (its largest size)^3 whatever the order, and the order only changes the cost
+ * of the products inside it. Among the orders of least cost the one of least height is kept, so a chain of equal
+ * sizes becomes a balanced tree. Chains longer than chainOrderLimit are split in the middle.
+ * @param nodes the matrices of the chain, with room for the products
+ * @param chainC number of matrices in the chain
+ * @return the root of the product tree
  */
-void readAddMatrix(int R_SUM[matrixSize][matrixSize], int row, char result[fileLength]){
-    char *token;
-    token = strtok(result, " ");
-    int j = 0;
+int orderChain(struct chainNode *nodes, int chainC){
+    int nodeC = chainC;
+    if(chainC > chainOrderLimit){
+        return buildChainTree(nodes, &nodeC, chainC, NULL, 0, chainC - 1);
+    }
+    double *cost = calloc((size_t)chainC * chainC, sizeof(double));
+    int *height = calloc((size_t)chainC * chainC, sizeof(int));
+    int *largest = calloc((size_t)chainC * chainC, sizeof(int));
+    int *split = calloc((size_t)chainC * chainC, sizeof(int));
+    if(cost == NULL || height == NULL || largest == NULL || split == NULL){
+        perror("calloc");
+        exit(1);
+    }
+    for(int i = 0; i < chainC; i++){
+        largest[i * chainC + i] = nodes[i].size;
+    }
+    for(int length = 2; length <= chainC; length++){
+        for(int first = 0; first + length - 1 < chainC; first++){
+            int last = first + length - 1;
+            int ij = first * chainC + last;
+            largest[ij] = largest[ij - 1] > nodes[last].size ? largest[ij - 1] : nodes[last].size;
+            double product = (double)largest[ij] * largest[ij] * largest[ij];
+            cost[ij] = -1;
+            for(int middle = first; middle < last; middle++){
+                double total = cost[first * chainC + middle] + cost[(middle + 1) * chainC + last] + product;
+                int h = height[first * chainC + middle] > height[(middle + 1) * chainC + last] ?
+                        height[first * chainC + middle] : height[(middle + 1) * chainC + last];
+                if(cost[ij] < 0 || total < cost[ij] || (total == cost[ij] && h + 1 < height[ij])){
+                    cost[ij] = total;
+                    height[ij] = h + 1;
+                    split[ij] = middle;
+                }
+            }
+        }
+    }
+    int root = buildChainTree(nodes, &nodeC, chainC, split, 0, chainC - 1);
+    free(cost);
+    free(height);
+    free(largest);
+    free(split);
+    return root;
+}
+
+/**
+ * This function runs the batch mode: all the lines of stdin are read first, and since every layer multiplies Rsum
+ * by the sum of its Ws, the final Rsum is the chain A * M0 * M1 * ... * ML (M0 for the Ws of the command line).
+ * The chain is ordered (see orderChain) and its products are computed by children, all the products of a height of
+ * the tree at the same time, instead of one layer after the other.
+ * A line with a W that cannot be loaded is left out, like a layer whose Rsum is not published; an empty line makes
+ * Rsum 0, as it does layer by layer.
+ * @param a file name of A
+ * @param wFiles W files of the command line
+ * @param wC number of W files of the command line
+ * @param maxChildren limit of children running at the same time
+ * @param command command counter, incremented for each child
+ * @param Rsum set to the product
+ * @param rsumSize
+ */
+void runBatch(char *a, char *wFiles[], int wC, int maxChildren, int *command, element **Rsum, int *rsumSize){
+    //the chain: A, then one matrix per layer
+    int capacity = 16;
+    struct chainNode *nodes = malloc(2 * capacity * sizeof(struct chainNode));
+    char *line = malloc(lineLength);
+    if(nodes == NULL || line == NULL){
+        perror("malloc");
+        exit(1);
+    }
+    int chainC = 0;
+    bool zero = false;
+    char *aFiles[] = {a};
+    if(!chainMatrix(aFiles, 1, chainC, maxChildren, false, &nodes[chainC])){
+        exit(1);
+    }
+    chainC++;
+    //the Ws of the command line that could be loaded are added up, like the results of the first layer
+    chainMatrix(wFiles, wC, chainC, maxChildren, true, &nodes[chainC]);
+    zero = nodes[chainC].path == NULL;
+    chainC += !zero;
+    //the size of Rsum is the largest of the chain, it still grows after an empty line
+    int size = minMatrixSize;
+    for(int i = 0; i < chainC; i++){
+        size = nodes[i].size > size ? nodes[i].size : size;
+    }
+    while(fgets(line, lineLength, stdin) != NULL){
+        long long start = profileStart();
+        line[strcspn(line, "\n")] = '\0';
+        char **files;
+        int fileC = parse_line(line, &files);
+        profileSpan(phaseParse, start);
+        if(chainC == capacity){
+            capacity *= 2;
+            nodes = realloc(nodes, 2 * capacity * sizeof(struct chainNode));
+            if(nodes == NULL){
+                perror("realloc");
+                exit(1);
+            }
+        }
+        if(fileC == 0){
+            zero = true;
+        }else if(zero){
+            int rows, cols;
+            for(int i = 0; i < fileC; i++){
+                if(matrixDimensions(files[i], &rows, &cols) == 0){
+                    size = rows > size ? rows : size;
+                    size = cols > size ? cols : size;
+                }
+            }
+        }else if(chainMatrix(files, fileC, chainC, maxChildren, false, &nodes[chainC])){
+            size = nodes[chainC].size > size ? nodes[chainC].size : size;
+            chainC++;
+        }
+        free(files);
+    }
+    free(line);
+
+    //a zero Rsum does not need any product
+    if(zero){
+        for(int i = 0; i < chainC; i++){
+            if(nodes[i].temporary){
+                unlink(nodes[i].path);
+            }
+            free(nodes[i].path);
+        }
+        chainC = 0;
+    }
+    int root = chainC > 0 ? orderChain(nodes, chainC) : -1;
+    int height = chainC > 0 ? nodes[root].height : 0;
+    int nodeC = chainC > 0 ? 2 * chainC - 1 : 0;
+
+    //the products of each height, the last one (the root) is Rsum
+    char **lefts = malloc((chainC + 1) * sizeof(char *));
+    char **rights = malloc((chainC + 1) * sizeof(char *));
+    int *indexes = malloc((chainC + 1) * sizeof(int));
+    element **products = malloc((chainC + 1) * sizeof(element *));
+    int *sizes = malloc((chainC + 1) * sizeof(int));
+    element ***sums = malloc((chainC + 1) * sizeof(element **));
+    int **sumSizes = malloc((chainC + 1) * sizeof(int *));
+    bool *finished = malloc((chainC + 1) * sizeof(bool));
+    if(lefts == NULL || rights == NULL || indexes == NULL || products == NULL || sizes == NULL || sums == NULL ||
+       sumSizes == NULL || finished == NULL){
+        perror("malloc");
+        exit(1);
+    }
+    element *result = NULL;
+    for(int h = 1; h <= height; h++){
+        startLayer(h, *command + 1);
+        int count = 0;
+        for(int n = chainC; n < nodeC; n++){
+            if(nodes[n].height != h){
+                continue;
+            }
+            indexes[count] = n;
+            lefts[count] = nodes[nodes[n].left].path;
+            rights[count] = nodes[nodes[n].right].path;
+            sizes[count] = minMatrixSize;
+            products[count] = calloc((size_t)minMatrixSize * minMatrixSize, sizeof(element));
+            if(products[count] == NULL){
+                perror("calloc");
+                exit(1);
+            }
+            sums[count] = &products[count];
+            sumSizes[count] = &sizes[count];
+            count++;
+        }
+        runChildren(lefts, rights, count, maxChildren, NULL, command, sums, sumSizes, finished);
+
+        for(int p = 0; p < count; p++){
+            struct chainNode *node = &nodes[indexes[p]];
+            if(!finished[p]){
+                logFailure("Error - the product of %s and %s failed.", lefts[p], rights[p]);
+                exit(1);
+            }
+            if(indexes[p] == root){
+                result = products[p];
+                node->size = sizes[p];
+                continue;
+            }
+            char path[fileLength];
+            snprintf(path, sizeof(path), "%s%d.bin", chainPrefix, indexes[p]);
+            long long start = profileStart();
+            if(saveMatrixBinary(path, sizes[p], sizes[p], products[p], sizes[p], elementType) == -1){
+                logFailure("Error - cannot write file %s.", path);
+                exit(1);
+            }
+            profileSpan(phaseWrite, start);
+            free(products[p]);
+            node->path = strdup(path);
+            node->temporary = true;
+        }
+        //the operands of this height are not needed anymore
+        for(int p = 0; p < count; p++){
+            struct chainNode *node = &nodes[indexes[p]];
+            for(int side = 0; side < 2; side++){
+                struct chainNode *operand = &nodes[side == 0 ? node->left : node->right];
+                if(operand->temporary){
+                    unlink(operand->path);
+                }
+                free(operand->path);
+                operand->path = NULL;
+            }
+        }
+    }
 
-    //store line in matrix
-    while (token != NULL) {
-        //convert string to int
-        R_SUM[row][j] += atoi(token);
-        token = strtok(NULL, " ");
-        j++;
+    memset(*Rsum, 0, (size_t)*rsumSize * *rsumSize * sizeof(element));
+    growMatrix(Rsum, rsumSize, size);
+    if(result != NULL){
+        addMatrix(*Rsum, *rsumSize, result, nodes[root].size);
+        free(result);
     }
 
+    free(nodes);
+    free(lefts);
+    free(rights);
+    free(indexes);
+    free(products);
+    free(sizes);
+    free(sums);
+    free(sumSizes);
+    free(finished);
 }
 
-//load into R into file (overwrite)
 /**
- * This function replaces the result matrix in the file with the new matrix.
- * @param filename
- * @param R_SUM
+ * The read-ahead stage of --prefetch N: a thread reads up to N lines of stdin ahead of the layer being computed and
+ * loads the W files of each line into the cache, or, without a cache, opens them and asks the kernel to read them
+ * into the page cache for the children. A line is handed to the main loop once its Ws are loaded; only Rsum
+ * depends on the previous layer, the Ws do not.
  */
-void replaceMatrixInFile(char *filename, int R_SUM[matrixSize][matrixSize]){
-    FILE *file = fopen(filename, "w");
+struct prefetcher {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     //a line was read or taken, or stdin ended
+    char **lines;               //ring of the lines read ahead
+    int depth;
+    int first;                  //next line for the main loop
+    int count;
+    bool ended;                 //stdin is at its end
+    struct matrixCache *cache;
+};
 
-    if (file == NULL) {
-        perror("Error opening the file");
+/**
+ * This function loads the W files of a line ahead of their layer.
+ * @param prefetcher
+ * @param line (not changed)
+ */
+void prefetchLine(struct prefetcher *prefetcher, const char *line){
+    char *copy = strdup(line);
+    if(copy == NULL){
+        perror("strdup");
+        exit(1);
     }
-
-    // Write the new matrix content to the file
-    for (int i = 0; i < matrixSize; i++) {
-        for (int j = 0; j < matrixSize; j++) {
-            fprintf(file, "%d ", R_SUM[i][j]);
+    char **files;
+    int fileC = parse_line(copy, &files);
+    for(int i = 0; i < fileC; i++){
+        if(prefetcher->cache != NULL){
+            cachePrefetch(prefetcher->cache, files[i]);
+        }else{
+            //a missing file is reported by its child, as without --prefetch
+            int fd = open(files[i], O_RDONLY);
+            if(fd >= 0){
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                close(fd);
+            }
         }
-        fprintf(file, "\n"); // Newline at the end of each row
     }
+    free(files);
+    free(copy);
+}
 
-    // Close the file
-    fclose(file);
+/**
+ * The thread of the read-ahead stage: it reads stdin while fewer than depth lines wait for the main loop.
+ * @param context the prefetcher
+ * @return NULL
+ */
+void *prefetchThread(void *context){
+    struct prefetcher *prefetcher = context;
+    char *line = malloc(lineLength);
+    if(line == NULL){
+        perror("malloc");
+        exit(1);
+    }
+    while(true){
+        pthread_mutex_lock(&prefetcher->lock);
+        while(prefetcher->count == prefetcher->depth){
+            pthread_cond_wait(&prefetcher->changed, &prefetcher->lock);
+        }
+        pthread_mutex_unlock(&prefetcher->lock);
+
+        if(fgets(line, lineLength, stdin) == NULL){
+            break;
+        }
+        prefetchLine(prefetcher, line);
+        char *ready = strdup(line);
+        if(ready == NULL){
+            perror("strdup");
+            exit(1);
+        }
+        pthread_mutex_lock(&prefetcher->lock);
+        prefetcher->lines[(prefetcher->first + prefetcher->count) % prefetcher->depth] = ready;
+        prefetcher->count++;
+        pthread_cond_signal(&prefetcher->changed);
+        pthread_mutex_unlock(&prefetcher->lock);
+    }
+    free(line);
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->ended = true;
+    pthread_cond_signal(&prefetcher->changed);
+    pthread_mutex_unlock(&prefetcher->lock);
+    return NULL;
 }
 
 /**
- * This function parses a line and stores it in an array of files.
- * @param line
- * @param files
- * @return fileC
+ * This function starts the read-ahead stage; from then on stdin belongs to its thread.
+ * @param prefetcher to fill in
+ * @param depth number of lines read ahead
+ * @param cache W cache, or NULL
  */
-int parse_line(char *line, char *files[]) {
-    size_t input_length = strcspn(line, "\n");
-    if (line[input_length] == '\n') {
-        line[input_length] = '\0';  // Replace '\n' with '\0' to truncate the string
+void startPrefetch(struct prefetcher *prefetcher, int depth, struct matrixCache *cache){
+    memset(prefetcher, 0, sizeof(*prefetcher));
+    prefetcher->lines = malloc(depth * sizeof(char *));
+    if(prefetcher->lines == NULL){
+        perror("malloc");
+        exit(1);
     }
-    int fileC = 0;
-    char *token;
-    token = strtok(line, " ");//tokenize
-    //files[fileC]=(char*)malloc(256*sizeof(char));
-    //strcpy(files[fileC],token );
+    prefetcher->depth = depth;
+    prefetcher->cache = cache;
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->changed, NULL);
+    if(pthread_create(&prefetcher->thread, NULL, prefetchThread, prefetcher) != 0){
+        perror("pthread_create");
+        exit(1);
+    }
+}
 
-    while(token != NULL){ //counts files per line
-        files[fileC]=(char*)malloc(fileLength*sizeof(char));
-        strcpy(files[fileC],token );
-        fileC++;
-        token = strtok(NULL, " ");
+/**
+ * This function takes the next line of stdin from the read-ahead stage, like fgets, once its Ws are loaded.
+ * @param prefetcher
+ * @param line buffer for the line
+ * @param size of the buffer
+ * @return line, or NULL at the end of stdin
+ */
+char *nextLine(struct prefetcher *prefetcher, char *line, size_t size){
+    pthread_mutex_lock(&prefetcher->lock);
+    while(prefetcher->count == 0 && !prefetcher->ended){
+        pthread_cond_wait(&prefetcher->changed, &prefetcher->lock);
     }
-    return fileC;
+    if(prefetcher->count == 0){
+        pthread_mutex_unlock(&prefetcher->lock);
+        return NULL;
+    }
+    char *ready = prefetcher->lines[prefetcher->first];
+    prefetcher->first = (prefetcher->first + 1) % prefetcher->depth;
+    prefetcher->count--;
+    pthread_cond_signal(&prefetcher->changed);
+    pthread_mutex_unlock(&prefetcher->lock);
+    snprintf(line, size, "%s", ready);
+    free(ready);
+    return line;
+}
+
+/**
+ * This function stops the read-ahead stage, once stdin is at its end.
+ * @param prefetcher
+ */
+void stopPrefetch(struct prefetcher *prefetcher){
+    pthread_join(prefetcher->thread, NULL);
+    pthread_mutex_destroy(&prefetcher->lock);
+    pthread_cond_destroy(&prefetcher->changed);
+    free(prefetcher->lines);
 }
 
 /**
  * This function executes multiple matrix multiplications in parallel.
  * It reads all matrices for all executions from files and writes the result matrix to a file.
+ * With --pool N (-p N) a pool of N matrixmult_parallel workers is started once and fed the jobs of every layer,
+ * instead of forking and exec'ing one child per W.
+ * Without a pool, --max-children N (-m N) limits how many children run at the same time (default: one per CPU).
+ * With --shm (-s) Rsum is published to the children in shared memory and they write their results to shared slots,
+ * instead of going through Rsum.txt and the pipes; Rsum.txt is only written at the end.
+ * With --binary (-b) Rsum is written to Rsum.bin in the binary format, which the children map instead of parsing.
+ * With --workers LIST (-w LIST) the layers run on worker servers (matrixmult_parallel --listen) at the comma
+ * separated addresses of LIST instead (unix:PATH or [HOST]:PORT): the rows of every product are split into blocks
+ * that are sent over the sockets and balanced between the servers, and the blocks of a server that fails are sent
+ * to the others (see runLayerRemote).
+ * With --in-process (-i) no child is started: the products are computed in this process by the threads of a libmatmul
+ * plan, as many as --max-children, with the kernel, Strassen and sparse settings of the MATRIXMULT_ environment
+ * variables (see runLayerLocal).
+ * With --inputs SOURCE (-I SOURCE) the command line only has Ws, and the left matrices are the files of the directory
+ * SOURCE, the files listed in SOURCE or the matrices stacked in the binary file SOURCE: they go through the layers
+ * together, in process, each W multiplying all of them as one stacked matrix (see runLayerStack), and the Rsum of
+ * input n is written to Rsum_<n>.txt.
+ * With --out-of-core MB (-o MB) A and the Ws are binary files that are read by tiles, and every layer is written by
+ * tiles to Rsum.bin, with at most MB megabytes for the tiles: the matrices can be bigger than the memory (see
+ * runLayerStream). The products are computed in process, like --in-process, and Rsum.bin is not printed.
+ * With --verify N (-V N) every product is checked with N rounds of Freivalds' randomized algorithm, A*(W*r) = R*r,
+ * by the process that computed it (see matmulVerify); a product that fails is reported with its layer and W in the
+ * .err log of that process.
+ * With --cache MB (-c MB) and a pool, worker servers or --in-process, the W files are loaded once by this process
+ * and kept in a cache of up to MB megabytes (least recently used first out), and sent to the workers with the jobs.
+ * With --fused (-f) the Ws of a layer are summed first and Rsum is multiplied once by the sum (see fuseLayer);
+ * without it every W is multiplied separately, which gives the same Rsum and can be used to check the fused mode.
+ * With --log FILE (-l FILE) every process logs to FILE instead of its own .out and .err files, and --log-level (-v)
+ * sets what is logged (see matrix_log.h); both are passed to the children in the environment.
+ * With --prefetch N (-a N) a thread reads up to N lines of stdin ahead and loads their W files while the current
+ * layer computes: into the W cache with --cache, otherwise into the page cache for the children (see prefetcher).
+ * With --affinity POLICY (-A POLICY) every pool worker, or every child running at the same time, is pinned to its
+ * own CPUs: compact (filling the cores in order), scatter (spreading them over the NUMA nodes) or an explicit CPU
+ * list; it is pinned before it allocates, so its matrices and result slot are on its node (see matrix_affinity.h).
+ * The placement is printed to stderr at the end.
+ * With --profile FILE (-P FILE) the parse, spawn, load, compute, transfer, accumulate and write phases of every
+ * process are timed and summed up per layer in FILE (CSV if it ends with .csv, JSON otherwise); --trace FILE (-T)
+ * writes every span of every process to FILE for chrome://tracing or Perfetto (see matrix_profile.h).
  * Input parameters: argc and argv, Files: matrixA, matrixW
  * returns: a matrix if successful, otherwise exit(1) if failed
 **/
 int main(int argc, char* argv[]) {
     //initialize variables
-    #define messageLen 100
-    int Rsum[matrixSize][matrixSize];
+    int rsumSize = minMatrixSize;
+    //set Rsum to 0s
+    element *Rsum = calloc(rsumSize * rsumSize, sizeof(element));
+    element *published = NULL;
+    int publishedSize = 0;
     char* rsum_filename;
     int command = -1;
+    int poolSize = 0;
+    int maxChildren = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    bool useShared = false;
+    bool binary = false;
+    long cacheMegabytes = 0;
+    bool fused = false;
+    bool batch = false;
+    int prefetchDepth = 0;
+    char *workerList = NULL;
+    bool inProcess = false;
+    bool childrenChosen = false;
+    const char *inputSource = NULL;
+    long streamMegabytes = 0;
+    const char *affinityPolicy = NULL;
+    int wsumSize = minMatrixSize;
+    element *Wsum = calloc(wsumSize * wsumSize, sizeof(element));
 
-    //set Rsum to 0s
-    for(int i = 0; i < matrixSize; i++){
-        for(int j = 0; j < matrixSize; j++){
-            Rsum[i][j] = 0;
-        }
+    if(Rsum == NULL || Wsum == NULL){
+        perror("calloc");
+        exit(1);
     }
 
     //record start time
-    struct timeval start, end;
-    gettimeofday(&start, NULL);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    //options come before the files
+    static struct option options[] = {
+        {"pool", required_argument, NULL, 'p'},
+        {"max-children", required_argument, NULL, 'm'},
+        {"shm", no_argument, NULL, 's'},
+        {"binary", no_argument, NULL, 'b'},
+        {"cache", required_argument, NULL, 'c'},
+        {"fused", no_argument, NULL, 'f'},
+        {"log", required_argument, NULL, 'l'},
+        {"log-level", required_argument, NULL, 'v'},
+        {"profile", required_argument, NULL, 'P'},
+        {"trace", required_argument, NULL, 'T'},
+        {"prefetch", required_argument, NULL, 'a'},
+        {"batch", no_argument, NULL, 'B'},
+        {"workers", required_argument, NULL, 'w'},
+        {"affinity", required_argument, NULL, 'A'},
+        {"in-process", no_argument, NULL, 'i'},
+        {"inputs", required_argument, NULL, 'I'},
+        {"out-of-core", required_argument, NULL, 'o'},
+        {"verify", required_argument, NULL, 'V'},
+        {NULL, 0, NULL, 0}
+    };
+    int option;
+    while((option = getopt_long(argc, argv, "+p:m:sbc:fl:v:P:T:a:Bw:A:iI:o:V:", options, NULL)) != -1){
+        if(option == 's'){
+            useShared = true;
+        }else if(option == 'b'){
+            binary = true;
+        }else if(option == 'f'){
+            fused = true;
+        }else if(option == 'B'){
+            batch = true;
+        }else if(option == 'w'){
+            workerList = optarg;
+        }else if(option == 'A'){
+            affinityPolicy = optarg;
+        }else if(option == 'i'){
+            inProcess = true;
+        }else if(option == 'I'){
+            //the stacked multiplies are done in process
+            inputSource = optarg;
+            inProcess = true;
+        }else if(option == 'V' && atoi(optarg) > 0){
+            //the children and the pool workers check their products too
+            verifyRounds = atoi(optarg);
+            setenv("MATRIXMULT_VERIFY", optarg, 1);
+        }else if(option == 'o' && atol(optarg) > 0){
+            streamMegabytes = atol(optarg);
+        }else if(option == 'p' && atoi(optarg) >= 0){
+            poolSize = atoi(optarg);
+        }else if(option == 'm' && atoi(optarg) > 0){
+            maxChildren = atoi(optarg);
+            childrenChosen = true;
+        }else if(option == 'a' && atoi(optarg) > 0){
+            prefetchDepth = atoi(optarg);
+        }else if(option == 'c' && atol(optarg) > 0){
+            cacheMegabytes = atol(optarg);
+        }else if(option == 'l'){
+            //the children inherit the log settings
+            setenv("MATRIXMULT_LOG", optarg, 1);
+        }else if(option == 'v' && logLevelFromName(optarg) != -1){
+            setenv("MATRIXMULT_LOG_LEVEL", optarg, 1);
+        }else if(option == 'P'){
+            setenv("MATRIXMULT_PROFILE", optarg, 1);
+        }else if(option == 'T'){
+            setenv("MATRIXMULT_TRACE", optarg, 1);
+        }else{
+            fprintf(stderr, "Usage: %s [--pool N] [--max-children N] [--shm] [--binary] [--cache MB] [--prefetch N]\n"
+                            "       [--fused] [--log FILE] [--log-level none|error|info|matrix] [--profile FILE]\n"
+                            "       [--trace FILE] [--batch] [--workers ADDRESS[,ADDRESS...]] [--verify ROUNDS]\n"
+                            "       [--affinity compact|scatter|CPU,CPU-CPU,...] [--in-process] A W1 [W2 ...]\n"
+                            "       [options] --inputs DIRECTORY|LIST|STACKED W1 [W2 ...]\n"
+                            "       [options] --out-of-core MB A.bin W1.bin [W2.bin ...]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+    //the logs are buffered and written by a thread (see matrix_log.h), the phases are timed if asked
+    logInit();
+    profileInit("matrixmult_multiw_deep");
+    int layer = 0;
+    startLayer(layer, 0);
+    if(cacheMegabytes > 0 && poolSize == 0 && workerList == NULL && !inProcess){
+        fprintf(stderr, "Error - --cache needs --pool, --workers or --in-process: only they take W from the parent.\n");
+        exit(1);
+    }
+    if(inProcess && (poolSize > 0 || useShared || batch || workerList != NULL)){
+        fprintf(stderr, "Error - %s starts no child, it cannot be used with --pool, --shm, --batch or --workers.\n",
+                inputSource != NULL ? "--inputs" : "--in-process");
+        exit(1);
+    }
+    if(streamMegabytes > 0 && (inProcess || poolSize > 0 || useShared || batch || workerList != NULL || fused ||
+                               cacheMegabytes > 0 || prefetchDepth > 0 || verifyRounds > 0)){
+        fprintf(stderr, "Error - --out-of-core streams every matrix by tiles, it cannot be used with --in-process, "
+                        "--inputs, --pool, --shm, --batch, --workers, --fused, --cache, --prefetch or --verify.\n");
+        exit(1);
+    }
+    if(workerList != NULL && (poolSize > 0 || useShared || batch)){
+        fprintf(stderr, "Error - --workers sends the rows over sockets, it cannot be used with --pool, --shm or "
+                        "--batch.\n");
+        exit(1);
+    }
+    if(fused && narrowW){
+        fprintf(stderr, "Error - --fused needs a W type as wide as Rsum: the sum of the Ws does not fit in a %s.\n",
+                typeName(wElementType));
+        exit(1);
+    }
+    if(batch && (poolSize > 0 || useShared || prefetchDepth > 0)){
+        fprintf(stderr, "Error - --batch runs a child per product, it cannot be used with --pool, --shm or --prefetch.\n");
+        exit(1);
+    }
+    if(batch && narrowW){
+        fprintf(stderr, "Error - --batch needs a W type as wide as Rsum: the products are used as Ws.\n");
+        exit(1);
+    }
+    if(batch && isatty(STDIN_FILENO)){
+        fprintf(stderr, "Error - --batch reads all of stdin first, stdin must be a file or a pipe.\n");
+        exit(1);
+    }
+    if(maxChildren < 1){
+        maxChildren = 1;
+    }
+    char **args = argv + optind - 1; //args[1] is A, like argv without options
+    int argCount = argc - optind + 1;
 
     //checking if there are more or equal to 2 files
-    if(argc < 3) {
+    //with --inputs there is no A on the command line, the Ws start at args[1]
+    int firstW = inputSource != NULL ? 1 : 2;
+    if(argCount < firstW + 1) {
         //if there are less than 2 files, then print to stderr error messages and terminate with code 1
 
-        fprintf(stderr, "Error - Command 0: \nReceived %d arguments, expecting more or equal to 2 files as input. \nTerminating with exit code 1\n", argc - 1);
+        fprintf(stderr, "Error - Command 0: \nReceived %d arguments, expecting more or equal to %d files as input. \nTerminating with exit code 1\n", argCount - 1, firstW);
         //exit failure
         exit(1);
     }
 
-    //entire A3 code from command line
-    //for loop to execute matrixmult_parallel.c
-    for(int i = 2; i  < argc; i++) {
+    //the profile of matrixtune (see matrix_tune.h) configures the in-process multiply and may fuse the layers
+    struct tuneProfile tuneProfile;
+    char profilePath[1024];
+    const struct tuneProfile *tuning = tuneProfilePath(profilePath, sizeof(profilePath)) == 0 &&
+                                       tuneLoad(profilePath, &tuneProfile) == 0 ? &tuneProfile : NULL;
 
-        //create pipe
-        int pipefd[2];
-        if(pipe(pipefd) == -1){
-            perror("pipe");
-            exit(1);
-        }
+    //the children are reaped as they exit
+    setupChildSignal();
 
-        //create child process
-        command++;
-        pid_t pid = fork();
-        //fork failed
-        if(pid == -1){
-            perror("fork");
+    //one slot per pool worker or per child running at the same time; inside its slot a child places its own row
+    //children or threads the same way (an explicit list has chosen the slots, they are filled compactly)
+    struct affinity affinity;
+    if(affinityPolicy != NULL){
+        if(affinityInit(&affinity, affinityPolicy, poolSize > 0 ? poolSize : maxChildren) == -1){
             exit(1);
         }
+        placement = &affinity;
+        setenv("MATRIXMULT_AFFINITY", strcmp(affinity.policy, "list") == 0 ? "compact" : affinity.policy, 1);
+    }
 
-        //child process
-        if(pid == 0){
-
-            dup2(pipefd[1], STDOUT_FILENO); // Redirect stdout to the pipe write end
-            close(pipefd[0]); // Close read end of the pipe
-            close(pipefd[1]); // Close the original stdout
-
-            //creating output and error files named after their pid
-            char output_filen[fileLength];
-            char error_filen[fileLength];
-            sprintf(output_filen, "%d.out", getpid());
-            sprintf(error_filen, "%d.err", getpid());
-            char message[messageLen];
-
-            sprintf(message, "Starting command %d: child PID %d of parent PPID %d\n", command, getpid(), getppid());
-            logMessage(output_filen, message);
+    //the shared memory is created before any child, so they all inherit it
+    struct sharedRegion sharedRegion;
+    struct sharedRegion *shared = NULL;
+    if(useShared){
+        shared = &sharedRegion;
+        createShared(shared, poolSize > 0 ? poolSize : maxChildren);
+        publishShared(shared, Rsum, rsumSize);
+    }
 
-            //matrix A and W will be printed in matrix_parallel
+    //W files used on several lines are only loaded once
+    struct matrixCache wCache;
+    struct matrixCache *cache = NULL;
+    if(cacheMegabytes > 0){
+        cache = &wCache;
+        cacheInit(cache, (size_t)cacheMegabytes * 1024 * 1024);
+    }
 
-            //the execution of matrixmult_parallel.c
-            execlp("./matrixmult_parallel", "./matrixmult_parallel", argv[1], argv[i], (char *)NULL);
-            perror("execlp failed");
+    //start the workers once, a dead worker must not kill us through SIGPIPE
+    struct worker *pool = NULL;
+    if(poolSize > 0){
+        signal(SIGPIPE, SIG_IGN);
+        pool = malloc(poolSize * sizeof(struct worker));
+        if(pool == NULL){
+            perror("malloc");
             exit(1);
-        }else{
-            //log file
-            char output_file [fileLength];
-            sprintf(output_file, "%d.out", pid);
-            char err_file [fileLength];
-            sprintf(err_file, "%d.err", pid);
-            //parent process
-            close(pipefd[1]);  //close read end of pipe
-
-            int status = 0; //status of child
-
-            //message
-            pid_t finished = waitpid(pid, &status, 0);
+        }
+        for(int i = 0; i < poolSize; i++){
+            startWorker(&pool[i], i, shared);
+        }
+    }
 
-            if (finished == -1) {
-                perror("waitpid");
+    //the worker servers are connected at the first layer, a failed server must not kill us through SIGPIPE
+    struct remoteWorker *workers = NULL;
+    int workerC = 0;
+    if(workerList != NULL){
+        signal(SIGPIPE, SIG_IGN);
+        char *saved;
+        for(char *address = strtok_r(workerList, ",", &saved); address != NULL;
+            address = strtok_r(NULL, ",", &saved)){
+            workers = realloc(workers, (workerC + 1) * sizeof(struct remoteWorker));
+            if(workers == NULL){
+                perror("realloc");
                 exit(1);
             }
+            workers[workerC++] = (struct remoteWorker){address, -1, -1, 0, -1, false, 0};
+        }
+        if(workerC == 0){
+            fprintf(stderr, "Error - --workers needs at least one address.\n");
+            exit(1);
+        }
+    }
 
-            char output_msg[messageLen];
-            if(WIFEXITED(status)){  //normal termination
-                sprintf(output_msg, "Finished child %d pid of parent %d", pid, getpid());
-                logMessage(output_file, output_msg);
-                //exit signal code
-                int exit_signal = WEXITSTATUS(status);
-                sprintf(output_msg, "Exited with exit code = %d", exit_signal);
-                logMessage(output_file, output_msg);
-            } else if(WIFSIGNALED(status)){     //abnormal termination
-                int exit_signal = WTERMSIG(status);
-                sprintf(output_msg, "Killed with signal %d", exit_signal);
-                logMessage(err_file, output_msg);
-            }
-
-            //create a buffer to read from pipe
-            ssize_t bytes_read;
-            int buffer_size = (matrixSize * matrixSize) * sizeof(int);
-            int* buffer = malloc(buffer_size);
-
-
-            // Read the data size (assuming it's an int)
-            int dataSize;
-            read(pipefd[0], &dataSize, sizeof (int));
-
-            //read from pipe
-            while((bytes_read = read(pipefd[0], buffer, dataSize)) > 0) {
-                //add the result matrix from the buffer to Rsum
-                for (int r = 0; r < matrixSize; r++) {
-                    for (int j = 0; j < matrixSize; j++) {
-                        Rsum[r][j] += buffer[r * matrixSize + j];
-                    }
-                }
+    //in process, the products are computed by the threads of a libmatmul plan instead of the children
+    struct localEngine local;
+    struct inputStack stack;
+    struct streamRun streamRun = {&local, (size_t)streamMegabytes << 20};
+    if(inProcess || streamMegabytes > 0){
+        startLocal(&local, maxChildren, childrenChosen, placement, tuning);
+    }
+    if(inputSource != NULL && loadInputStack(inputSource, &stack) == -1){
+        exit(1);
+    }
 
-            }
-            free(buffer);  //free buffer
-            close(pipefd[0]); // Close the read end of the pipe in the parent process
+    //the layers are fused if that was faster for the size of A; it does not change an integer Rsum
+    int leftRows, leftCols;
+    if(tuning != NULL && !fused && !batch && !narrowW && streamMegabytes == 0 &&
+       (inputSource != NULL || matrixDimensions(args[1], &leftRows, &leftCols) == 0)){
+        int leftSize = inputSource != NULL ? stack.size : leftRows > leftCols ? leftRows : leftCols;
+        const struct tuneEntry *tuned = tuneFind(tuning, leftSize);
+        fused = tuned != NULL && tuned->fused && elementType != typeFloat && elementType != typeDouble;
+    }
+
+    //the Ws of the next lines are loaded while the command line layer computes
+    struct prefetcher prefetcher;
+    if(prefetchDepth > 0){
+        startPrefetch(&prefetcher, prefetchDepth, cache);
+    }
 
+    //entire A3 code from command line
+    //multiply A with every W from the command line
+    char **layerFiles = args + firstW;
+    int layerC = argCount - firstW;
+    bool fusedLayer = fused && layerC > 1;
+    if(batch){
+        //the whole chain at once, stdin is read to the end so the loop below has no line left
+        runBatch(args[1], layerFiles, layerC, maxChildren, &command, &Rsum, &rsumSize);
+    }else{
+        if(fusedLayer){
+            fuseLayer(&layerFiles, &layerC, inProcess ? 1 : maxChildren, cache, &Wsum, &wsumSize);
+        }
+        if(streamMegabytes > 0){
+            //without the first Rsum the next layers have nothing to stream
+            if(runLayerStream(&streamRun, args[1], layerFiles, layerC, &command) == -1){
+                exit(1);
+            }
+        }else if(inputSource != NULL){
+            runLayerStack(&local, &stack, layerFiles, layerC, fusedLayer ? NULL : cache, &command);
+        }else if(inProcess){
+            runLayerLocal(&local, args[1], 0, NULL, layerFiles, layerC, fusedLayer ? NULL : cache, &command, &Rsum,
+                          &rsumSize);
+        }else if(workerC > 0){
+            runLayerRemote(workers, workerC, args[1], 0, NULL, layerFiles, layerC, fusedLayer ? NULL : cache,
+                           &command, &Rsum, &rsumSize);
+        }else if(poolSize > 0){
+            //the sum of the Ws is rewritten every layer, it must not come from the cache
+            runLayerPool(pool, poolSize, args[1], 0, NULL, layerFiles, layerC, shared, fusedLayer ? NULL : cache,
+                         &command, &Rsum, &rsumSize);
+        }else{
+            runLayerForked(args[1], layerFiles, layerC, maxChildren, shared, &command, &Rsum, &rsumSize);
         }
     }
 
     //add and initialize R.txt
-    rsum_filename = "Rsum.txt";
-    replaceMatrixInFile(rsum_filename, Rsum); //replace the matrix in R.txt
+    rsum_filename = binary ? "Rsum.bin" : "Rsum.txt";
+    if(streamMegabytes > 0){
+        publishStream(true);
+    }else if(inputSource != NULL){
+        //the Rsums of the inputs are only written at the end
+        publishStack(&stack);
+    }else{
+        publishRsum(rsum_filename, Rsum, rsumSize, &published, &publishedSize, shared); //replace the matrix in R.txt
+    }
 
     //command line done
 
@@ -264,12 +3138,16 @@ int main(int argc, char* argv[]) {
     }
 
     //currently in stdin
-    while (fgets(input_line, buffer_size2, stdin) != NULL) {   //reading a line
+    while ((prefetchDepth > 0 ? nextLine(&prefetcher, input_line, buffer_size2)
+                              : fgets(input_line, buffer_size2, stdin)) != NULL) {   //reading a line
+        //every line is a layer, its children start at the next command
+        startLayer(++layer, command + 1);
+        long long parseStart = profileStart();
+
         //make Rsum have all zeros
-        for(int i = 0; i < matrixSize; i++){
-            for(int j = 0; j < matrixSize; j++){
-                Rsum[i][j] = 0;
-            }
+        memset(Rsum, 0, (size_t)rsumSize * rsumSize * sizeof(element));
+        for(int m = 0; inputSource != NULL && m < stack.count; m++){
+            memset(stack.rsums[m], 0, (size_t)stack.rsumSize * stack.rsumSize * sizeof(element));
         }
 
         // Truncate input_line at the first newline character
@@ -278,141 +3156,154 @@ int main(int argc, char* argv[]) {
             input_line[input_length] = '\0';
         }
 
-        //initialize variable to keep track of the number of children finished
-        int childFinished = 0;
-
         //parse line and store in array of files
-        char *files[fileLength];
-        int fileC = parse_line(input_line, files);
-
-        for(int i = 0; i < fileC; i++){ //sending array of file to execl
-            //create pipe
-            int pipes[2];
-            if(pipe(pipes) == -1){
-                perror("pipe");
-                exit(1);
-            }
-
-            //create child process
-            command++;
-            pid_t child_pid = fork();
-            if (child_pid == -1) {
-                perror("fork");
-                return 1;
-            } else if (child_pid == 0) {
-                // Child process
-                dup2(pipes[1], STDOUT_FILENO); // Redirect stdout to the pipe write end
-                close(pipes[0]); // Close read end of the pipe
-                close(pipes[1]); // Close the original stdout
-
-                //creating output and error files named after their pid
-                char output_filen[fileLength];
-                char error_filen[fileLength];
-                sprintf(output_filen, "%d.out", getpid());
-                sprintf(error_filen, "%d.err", getpid());
-                char message[messageLen];
-
-                sprintf(message, "Starting command %d: child PID %d of parent PPID %d\n", command, getpid(), getppid());
-                logMessage(output_filen, message);
-
-                // Execute matrix multiplication with the appropriate files
-                execl("./matrixmult_parallel", "./matrixmult_parallel", "Rsum.txt", files[i], (char *)NULL);
-                perror("execl");
-                exit(1);
-            }else{
-                // Parent process
-                //log file
-                // Wait for the child to finish
-                close(pipes[1]); // Close write end of the pipe
-                int status = 0;
-                pid_t finished_pid = waitpid(child_pid, &status, 0);
-
-                char output_file [fileLength];
-                sprintf(output_file, "%d.out", child_pid);
-                char err_file [fileLength];
-                sprintf(err_file, "%d.err", child_pid);
-
-                //check if waitpid failed
-                if (finished_pid == -1) {
-                    perror("waitpid");
-                    exit(1);
-                }
-
-                //check if child finished successfully
-                if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-                    //message
-                    char output_msg[messageLen];
-                    if(WIFEXITED(status)){  //normal termination
-                        sprintf(output_msg, "Finished child %d pid of parent %d", child_pid, getpid());
-                        logMessage(output_file, output_msg);
-
-                        //exit signal code
-                        int exit_signal = WEXITSTATUS(status);
-                        sprintf(output_msg, "Exited with exit code = %d", exit_signal);
-                        logMessage(output_file, output_msg);
-                        //childFinished++;
-                    } else if(WIFSIGNALED(status)){     //abnormal termination
-                        int exit_signal = WTERMSIG(status);
-                        sprintf(output_msg, "Killed with signal %d", exit_signal);
-                        logMessage(err_file, output_msg);
-                    }
-
-                    //increment childFinished if child finished successfully
-                    childFinished++;
-
-                    //create a buffer to read from pipe
-                    ssize_t bytes_read;
-                    int buffer_size = (matrixSize * matrixSize) * sizeof(int);
-                    int* buffer = malloc(buffer_size);
+        char **files;
+        int fileC = parse_line(input_line, &files);
+        profileSpan(phaseParse, parseStart);
 
-                    // Read the data size (assuming it's an int)
-                    int dataSize;
-                    read(pipes[0], &dataSize, sizeof (int));
-
-                    //read from pipe
-                    while((bytes_read = read(pipes[0], buffer, dataSize)) > 0) {
-                        //add the result matrix from the buffer to Rsum
-                        for (int r = 0; r < matrixSize; r++) {
-                            for (int j = 0; j < matrixSize; j++) {
-                                Rsum[r][j] += buffer[r * matrixSize + j];
+        //multiply the last Rsum with every W of the line, or with their sum
+        layerFiles = files;
+        layerC = fileC;
+        fusedLayer = fused && fileC > 1;
+        bool loaded = true;
+        if(fusedLayer){
+            loaded = fuseLayer(&layerFiles, &layerC, inProcess ? 1 : maxChildren, cache, &Wsum, &wsumSize);
+        }
+        struct matrixCache *layerCache = fusedLayer ? NULL : cache;
+        int childFinished;
+        if(streamMegabytes > 0){
+            childFinished = runLayerStream(&streamRun, streamRsum, layerFiles, layerC, &command);
+        }else if(inputSource != NULL){
+            childFinished = runLayerStack(&local, &stack, layerFiles, layerC, layerCache, &command);
+        }else if(inProcess){
+            childFinished = runLayerLocal(&local, NULL, publishedSize, published, layerFiles, layerC, layerCache,
+                                          &command, &Rsum, &rsumSize);
+        }else if(workerC > 0){
+            childFinished = runLayerRemote(workers, workerC, NULL, publishedSize, published, layerFiles, layerC,
+                                           layerCache, &command, &Rsum, &rsumSize);
+        }else if(poolSize > 0 && shared != NULL){
+            childFinished = runLayerPool(pool, poolSize, NULL, 0, NULL, layerFiles, layerC, shared, layerCache,
+                                         &command, &Rsum, &rsumSize);
+        }else if(poolSize > 0){
+            childFinished = runLayerPool(pool, poolSize, rsum_filename, publishedSize, published, layerFiles, layerC,
+                                         NULL, layerCache, &command, &Rsum, &rsumSize);
+        }else{
+            childFinished = runLayerForked(shared != NULL ? "-" : rsum_filename, layerFiles, layerC, maxChildren,
+                                           shared, &command, &Rsum, &rsumSize);
+        }
+        if(fusedLayer){
+            //the fused multiply stands for all the Ws of the line
+            childFinished = childFinished == layerC && layerC == 1 && loaded ? fileC : 0;
+        }
 
-                            }
-                        }
-                    }
-                    free(buffer);
-                    close(pipes[0]); // Close the read end of the pipe in the parent process
-                }
-            }
-            //replace matrix in R.txt
-            if(childFinished == fileC){
-                replaceMatrixInFile(rsum_filename, Rsum);
-            }
+        //replace matrix in R.txt
+        if(streamMegabytes > 0){
+            publishStream(childFinished == fileC);
+        }else if(childFinished == fileC && inputSource != NULL){
+            publishStack(&stack);
+        }else if(childFinished == fileC){
+            publishRsum(rsum_filename, Rsum, rsumSize, &published, &publishedSize, shared);
         }
+
         //free files
-        for(int i = 0; i < fileC; i++){
-            free(files[i]);
-        }
+        free(files);
     }
 
     //free fgets
     free(input_line);
+    if(prefetchDepth > 0){
+        stopPrefetch(&prefetcher);
+    }
+    if(fused){
+        unlink(wsumFilename);
+    }
+
+    //the workers exit when their stdin is closed
+    for(int i = 0; i < poolSize; i++){
+        stopWorker(&pool[i]);
+    }
+    free(pool);
 
-    printf("Rsum = [ \n");
-    //print RSum
-    for (int i = 0; i < matrixSize; i++) {
-        for (int j = 0; j < matrixSize; j++) {
-            printf("%4d ", Rsum[i][j]); // Adjust the width (4) for formatting
+    //closing a connection ends its worker on the server
+    for(int w = 0; w < workerC; w++){
+        if(workers[w].fd != -1){
+            close(workers[w].fd);
         }
-        printf("\n"); // Move to the next row
+        fprintf(stderr, "Worker %s: %ld row blocks\n", workers[w].address, workers[w].blocks);
+    }
+    free(workers);
+
+    if(inProcess){
+        fprintf(stderr, "In process: %ld products, kernel = %s, threads = %d\n", local.products,
+                local.plan.kernel != NULL ? local.plan.kernel->name : "none",
+                local.plan.size > 0 ? local.plan.threads : local.options.threads);
+        stopLocal(&local);
+    }
+    if(verifyRounds > 0 && (inProcess || inputSource != NULL)){
+        fprintf(stderr, "Freivalds check: %ld products, %ld failed, %d rounds each\n", verifyChecked, verifyFailed,
+                verifyRounds);
+    }
+    if(streamMegabytes > 0){
+        fprintf(stderr, "Out of core: %ld layers, %ld products of %d x %d tiles, %.1f MB read, %.1f MB written, "
+                        "%.2f s waiting for reads\n", streamRun.layers, streamRun.products, streamRun.tile,
+                streamRun.tile, streamRun.bytesRead / (1024.0 * 1024.0), streamRun.bytesWritten / (1024.0 * 1024.0),
+                streamRun.waitSeconds);
+        stopLocal(&local);
+    }
+
+    //with shared memory Rsum.txt holds the last Rsum published
+    if(shared != NULL){
+        const struct sharedHeader *header = shared->base;
+        long long writeStart = profileStart();
+        replaceMatrixInFile(rsum_filename, header->size, (element *)(header + 1));
+        profileSpan(phaseWrite, writeStart);
+        munmap(shared->base, shared->length);
+        close(shared->fd);
+    }
+
+    if(streamMegabytes > 0){
+        //Rsum may not fit in memory, it stays in its file
+        printf("Rsum = %s (%d x %d)\n", streamRsum, streamRun.size, streamRun.size);
+    }else if(inputSource != NULL){
+        saveStack(&stack, binary);
+    }else{
+        printf("Rsum = [ \n");
+        //print RSum, each element 4 wide
+        writeMatrixText(stdout, rsumSize, rsumSize, Rsum, rsumSize, elementType, 4, true);
+        printf(" ]\n");
     }
-    printf(" ]\n");
     fflush(stdout);
 
     //record end time
-    gettimeofday(&end, NULL);
-    double runtime = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec) / 1000000.0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double runtime = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1000000000.0;
     fprintf(stdout, "Parent runtime = %.2f seconds\n", runtime);
+    if(cache != NULL){
+        fprintf(stderr, "W cache: %ld hits, %ld misses, %ld evictions, %.1f MB kept", cache->hits, cache->misses,
+                cache->evictions, cache->bytes / (1024.0 * 1024.0));
+        if(prefetchDepth > 0){
+            fprintf(stderr, ", %ld prefetched", cache->prefetched);
+        }
+        fprintf(stderr, "\n");
+        cacheFree(cache);
+    }
+    if(placement != NULL){
+        char where[messageLen];
+        for(int slot = 0; slot < placement->slots; slot++){
+            affinityDescribe(placement, slot, where, sizeof(where));
+            fprintf(stderr, "Affinity %s: %s %d on %s\n", placement->policy,
+                    poolSize > 0 ? "worker" : inProcess ? "thread" : "child slot", slot, where);
+        }
+        affinityFree(placement);
+    }
+
+    free(Rsum);
+    free(Wsum);
+    free(published);
+    if(inputSource != NULL){
+        freeStack(&stack);
+    }
 
     //exit success
     exit(0);
-}
\ No newline at end of file
+}
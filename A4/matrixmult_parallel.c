@@ -1,7 +1,22 @@
 /**
  * Description:Compute array multiplication in a parallel fashion using multiple processes.
+ * The matrix files can be text or binary (see matrix_io.h); binary files of the right size are used in place.
  * For example, the ith child process will compute dot products of the ith row of Ai against W to return the vector Ai * W .
- * Thus it will return the ith row of result R. We will assume they're square: 8x8 for A, and 8x8 for W.
+ * Thus it will return the ith row of result R. The matrices are treated as square n x n, where n is taken from the
+ * input files (an optional "# rows cols" header line, otherwise the number of rows and the longest row) and is never
+ * smaller than the classic 8x8. Smaller inputs are padded with 0s. When n is larger than the number of children,
+ * each child computes a band of consecutive rows.
+ * The multiply kernel is picked at startup from the CPU features (AVX-512, AVX2, SSE4.1, or the scalar reference);
+ * set MATRIXMULT_KERNEL=scalar|sse4.1|avx2|avx512 to force one.
+ * With --threads (or MATRIXMULT_THREADS) the rows are computed by threads of this process instead of children.
+ * With --affinity (or MATRIXMULT_AFFINITY) the row children or the threads are pinned to CPUs (see matrix_affinity.h).
+ * With --strassen (or MATRIXMULT_STRASSEN) large products use the Strassen-Winograd recursion over the kernel.
+ * A mostly zero A (at most --sparse or MATRIXMULT_SPARSE percent of nonzeros) is multiplied through its nonzeros
+ * (see matrix_sparse.h), with the same result.
+ * The element type of the matrices is chosen when building (see matrix_types.h).
+ * With --listen it is a worker server that computes row blocks of A*W for matrixmult_multiw_deep --workers over a
+ * Unix-domain or TCP socket.
+ * With MATRIXMULT_PROFILE or MATRIXMULT_TRACE the load, compute and transfer phases are timed (see matrix_profile.h).
  * We will compute A*W.
  *
  * Author names: Luisa Arias Barajas and Alicia Zhao
@@ -15,291 +30,1285 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
-#include <sys/time.h>
+#include <time.h>
 
+#include "matmul.h"
+#include "matrix_affinity.h"
+#include "matrix_io.h"
+#include "matrix_log.h"
+#include "matrix_net.h"
+#include "matrix_profile.h"
+#include "matrix_tune.h"
+#include "matrix_types.h"
+#include "task_pool.h"
 
-//defining values
-#define matrixSize 8
 
-/**
- * @param file_name
- * @param message
- *
- * this function serves to make writing in logs a bit easier.
- * This function will open and close the files and write logs into the .err or .out file
- */
-void logMessage(const char *file_name, char *message) {
-    FILE *file = fopen(file_name, "a");
-    if(file == NULL){
-        perror("Failed to open log file");
-        exit(1);
-    }
-
-    fprintf(file, "%s\n", message);
-    fflush(file);
-    fclose(file);
-}
+//defining values
+#define minMatrixSize 8 //matrices are never smaller than the classic 8x8
+#define rowChildren 8   //number of children that split the rows of R between them
 
 /**
  * This unction is a new function that adds on to send the matrix to the log file
+ * The matrix is formatted in memory and logged as one message after its label, at the matrix level (see
+ * matrix_log.h), so nothing is formatted when the matrix dumps are turned off.
  */
-void logMatrix(const char *file_name, int matrix[matrixSize][matrixSize]){
+void logMatrix(const char *file_name, const char *label, int size, const void *matrix, int dtype){
+    if(!logEnabled(logMatrices)){
+        return;
+    }
 
-    FILE *file  = fopen(file_name, "a");
+    char *text = NULL;
+    size_t length = 0;
+    FILE *file = open_memstream(&text, &length);
     if(file == NULL){
         perror("Failed to open file");
         exit(1); //exit with error
     }
 
-    for(int i = 0; i < matrixSize; i++){
-        for(int j = 0; j < matrixSize; j++){
-            fprintf(file, "%2d", matrix[i][j]);
-            fprintf(file, " ");
-        }
-        fprintf(file, "\n");
-    }
-    fprintf(file, "]\n");
+    fprintf(file, "%s\n", label);
+    writeMatrixText(file, size, size, matrix, size, dtype, 2, true);
+    fprintf(file, "]");
     fclose(file);
+    logWrite(file_name, logMatrices, text);
+    free(text);
 }
 
 /**
- * This function reads a file line by line and stores it in a matrix.
- * Assumption: there is a matrix inside the file and the file exists.
- * Input parameters: rows, cols, matrix(to store in), filename
+ * This function reads a matrix file (text or binary) and stores it in a matrix.
+ * Rows may be of any length, missing values are left as they are (0 after initialization).
+ * Assumption: there is a matrix inside the file, the file exists and fits in a size x size matrix.
+ * Input parameters: size, matrix(to store in), dtype (of matrix), filename
  * Returns: a matrix
 **/
-int readMatrix(int rows, int cols, int matrix[rows][cols], char* filename){
+int readMatrix(int size, void *matrix, int dtype, char* filename){
     //open file
     char output_file[50];
     sprintf(output_file, "%d.out", getpid());
 
-    FILE *fp = fopen(filename, "r");
-
-    //initialize variables
-    char line[100];
-    int i = 0, j = 0;
+    loadMatrix(filename, size, matrix, dtype);
 
-    //read file line by line
-    while (fgets(line, sizeof(line), fp)) {
-        char *token;
-        token = strtok(line, " ");
+    //NEW: call logMatrix to add the read matrix to log
+    logMatrix(output_file, strcat(filename, "=["), size, matrix, dtype);
+    return 0;
+}
 
-        //store line in matrix
-        while (token != NULL) {
-            //convert string to int
-            matrix[i][j] = atoi(token);
-            token = strtok(NULL, " ");
-            j++;
+/**
+ * This function gets a matrix file ready for a multiply of the given size and element type. A binary file of that
+ * type that is exactly size x size is mapped and used in place, anything else is read (padded with 0s, converted
+ * to the type) into a new matrix.
+ * Input parameters: size, filename, dtype, mapped (to fill in), output_file
+ * Returns: the matrix, to free with releaseOperand
+**/
+void *loadOperand(int size, char *filename, int dtype, struct mappedMatrix *mapped, const char *output_file){
+    mapped->base = NULL;
+    if(matrixFormat(filename) == formatBinary && mapMatrix(filename, mapped) == 0){
+        if(mapped->rows == size && mapped->cols == size && mapped->dtype == dtype){
+            logMatrix(output_file, strcat(filename, "=["), size, mapped->data, dtype);
+            return (void *)mapped->data;
         }
-        j = 0;
-        i++;
+        unmapMatrix(mapped);
     }
-    //NEW: call logMatrix to add the read matrix to log
-    logMessage( output_file,strcat(filename, "=["));
-    logMatrix(output_file, matrix);
 
-    //close file
-    fclose(fp);
-    return 0;
+    void *matrix = calloc((size_t)size * size, typeSize(dtype));
+    if (matrix == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    readMatrix(size, matrix, dtype, filename);
+    return matrix;
 }
 
 /**
- * This function performs an array multiplication in a parallel fashion.
- * Assumption: matrices have fixed size: A is 8x8, W is 8x8, are not empty, and are passed in the correct order.
- * Input parameters: matrixA, matrixW, result matrix
- * Returns: a matrix
+ * This function frees a matrix returned by loadOperand.
+ * Input parameters: matrix, mapped
+ * Returns: nothing
 **/
-void matrixCalculation(int row, int matrixA[matrixSize][matrixSize], int matrixW[matrixSize][matrixSize], int result[matrixSize]){
+void releaseOperand(void *matrix, struct mappedMatrix *mapped){
+    if(mapped->base != NULL){
+        unmapMatrix(mapped);
+    }else{
+        free(matrix);
+    }
+}
 
-    // Multiplying matrixA and matrixW and storing in array result.
-    for (int i = 0; i < matrixSize; i++) {
-        result[i] = 0;
-        for (int j = 0; j < matrixSize; j++) {
-            result[i] += matrixA[row][j] * matrixW[j][i];
+/**
+ * This function picks the multiply kernel: the one named by MATRIXMULT_KERNEL if it is set and supported, otherwise
+ * the fastest kernel this CPU supports.
+ * Input parameters: output_err (log for an unknown or unsupported kernel name)
+ * Returns: the kernel to use
+**/
+const struct matmulKernel *selectKernel(const char *output_err){
+    const char *requested = getenv("MATRIXMULT_KERNEL");
+    if(requested != NULL && requested[0] != '\0'){
+        const struct matmulKernel *kernel = matmulFindKernel(requested);
+        if(kernel != NULL){
+            return kernel;
         }
+        char message[100];
+        snprintf(message, sizeof(message), "Kernel %.40s is not available, choosing from the CPU.", requested);
+        logMessage(output_err, message);
     }
+    return matmulFindKernel(NULL);
 }
 
 /**
- * This function initializes the matrices, reads the files, and calls the matrixCalculation function. It also detects
- * any errors with the files.
- * Assumption: the files contain numbers only.
- * Input parameters: argc and argv, Files: matrixA, matrixW
- * Returns: a matrix, exit(0) if successful, or exit(1) if there is an error.
+ * This function writes a whole buffer to a file descriptor, continuing after partial writes.
+ * Input parameters: fd, buffer, size (in bytes)
+ * Returns: 0 if successful, -1 if write failed
 **/
-int main(int argc, char* argv[]) {
-
-    // Record start time
-    struct timeval start, end;
-    gettimeofday(&start, NULL);
-
-    if(argc < 3) {
-        //if there are less than 2 files, then print to stderr error messages and terminate with code 1
-        fprintf(stderr, "Error - Command 0: \nReceived %d arguments, expecting more or equal to 2 files as input. \nTerminating with exit code 1\n", argc - 1);
-        //exit failure
-        exit(1);
+int writeFully(int fd, const void *buffer, size_t size){
+    const char *data = buffer;
+    while(size > 0){
+        ssize_t written = write(fd, data, size);
+        if(written < 0){
+            return -1;
+        }
+        data += written;
+        size -= written;
     }
+    return 0;
+}
 
-    //logs for R matrix
-    char output_file[50];
-    sprintf(output_file, "%d.out", getpid());
-
-    //logs for error
-    char output_err[50];
-    sprintf(output_err, "%d.err", getpid());
-
-    //initialize matrices
-    int matrixA[matrixSize][matrixSize];
-    int matrixW[matrixSize][matrixSize];
-    int result[matrixSize][matrixSize];
-    //initialize matrixA with 0s
-    for(int i = 0; i < matrixSize; i++){
-        for(int j = 0; j < matrixSize; j++){
-            matrixA[i][j] = 0;
+/**
+ * This function reads a whole buffer from a file descriptor, continuing after partial reads.
+ * Input parameters: fd, buffer, size (in bytes)
+ * Returns: 0 if successful, -1 if read failed or the pipe was closed early
+**/
+int readFully(int fd, void *buffer, size_t size){
+    char *data = buffer;
+    while(size > 0){
+        ssize_t bytes = read(fd, data, size);
+        if(bytes <= 0){
+            return -1;
         }
+        data += bytes;
+        size -= bytes;
     }
-    //initialize matrixW with 0s
-    for(int i = 0; i < matrixSize; i++){
-        for(int j = 0; j < matrixSize; j++){
-            matrixW[i][j] = 0;
+    return 0;
+}
+
+/**
+ * This function returns the size of the square matrices needed to hold all the given dimensions.
+ * Input parameters: dims, count
+ * Returns: the largest dimension, at least minMatrixSize
+**/
+int squareSize(const int *dims, int count){
+    int size = minMatrixSize;
+    for(int i = 0; i < count; i++){
+        if(dims[i] > size){
+            size = dims[i];
         }
     }
+    return size;
+}
 
-    //matrix file names
-    char matrixAtxt[50];
-    char matrixWtxt[50];
-    char test_file[100];
+/**
+ * How a multiply is computed (see computeResult): the options of the plans (kernel, threads, Strassen crossover,
+ * sparse threshold, and the placement of the threads or of the row children), and how the work is split. The
+ * profile of matrixtune, if there is one, changes the options for each size, except the ones chosen explicitly.
+ */
+struct engine {
+    struct matmulOptions options;   //size is set for every multiply
+    bool forkRows;  //split the rows between rowChildren children, when the plan has a single thread
+    const struct tuneProfile *profile;  //NULL without a profile
+    int chosen;     //tuneKernel, tuneThreads and tuneStrassen, the settings the profile does not change
+    int verifyRounds;   //rounds of the Freivalds check of every product, 0 for none
+};
 
-    //copy file names to variables
-    strncpy(matrixAtxt, argv[1], 50);
-    strncpy(matrixWtxt, argv[2], 50);
+/**
+ * What a product is in the messages of the Freivalds check: the layer of matrixmult_multiw_deep (-1 when the program
+ * runs alone), the command and the W file.
+ */
+struct productName {
+    int layer;
+    int command;
+    const char *w;
+};
 
-    //open files
-    FILE* fpA = fopen(matrixAtxt, "r");
-    FILE* fpW = fopen(matrixWtxt, "r");
+/**
+ * A buffer kept from one job to the next, grown when a job needs more.
+ */
+struct buffer {
+    void *data;
+    size_t bytes;
+};
 
-    bool exitTrue = false;
-    //check if file matrixA exists
-    if (fpA == NULL ) {
-        //file matrixA does not exist
-        sprintf(test_file, "Error - cannot open file %s.", matrixAtxt);
-        logMessage(output_err, test_file);
+/**
+ * What a process keeps from one multiply to the next: the plan of the last size (its arena holds the packed W, which
+ * a worker server keeps between the row blocks of a W), and the buffers the jobs of a worker are read into and its
+ * results computed in. A worker only allocates when the size of the matrices changes.
+ */
+struct workspace {
+    struct matmulPlan plan;     //plan.size is 0 before the first multiply
+    bool heldW;                 //plan.packedW holds the W of the row blocks of the connection
+    struct buffer left;
+    struct buffer w;
+    struct buffer result;
+};
 
-        exitTrue = true;
+/**
+ * This function makes sure a buffer holds at least the given number of bytes.
+ * Input parameters: buffer, bytes
+ * Returns: the buffer, or NULL if it cannot be grown (the old one is kept)
+**/
+void *reserveBuffer(struct buffer *buffer, size_t bytes){
+    if(bytes > buffer->bytes){
+        void *data = realloc(buffer->data, bytes);
+        if(data == NULL){
+            perror("realloc");
+            return NULL;
+        }
+        buffer->data = data;
+        buffer->bytes = bytes;
     }
+    return buffer->data;
+}
 
-    //check if file matrixW exists
-    if(fpW == NULL){
-        //file matrixW does not exist
-        sprintf(test_file, "Error - cannot open file %s.", matrixWtxt);
-        logMessage(output_err, test_file);
-
-        exitTrue = true;
+/**
+ * This function tells if the rows of a multiply of the given size are forked: when the engine forks them and the
+ * profile of matrixtune, if there is one, did not find them faster in this process.
+ * Input parameters: engine, size
+ * Returns: true if the rows are split between rowChildren children
+**/
+bool forksRows(const struct engine *engine, int size){
+    const struct tuneEntry *tuned = tuneFind(engine->profile, size);
+    return engine->forkRows && (tuned == NULL || tuned->forkRows);
+}
 
+/**
+ * This function gets the plan of the workspace ready for matrices of the given size: the plan of the previous
+ * multiply is kept when it has that size, otherwise a new one is made, with the configuration the profile of
+ * matrixtune has for the size.
+ * Input parameters: workspace, engine, size
+ * Returns: the plan, or NULL if it cannot be made
+**/
+struct matmulPlan *planFor(struct workspace *workspace, const struct engine *engine, int size){
+    if(workspace->plan.size == size){
+        return &workspace->plan;
     }
-
-    //if any of the files do not exist, then terminate with code 1
-    if(exitTrue){
-        logMessage(output_err, "Terminating, exit code 1.");
-        exit(1);
+    matmulPlanFree(&workspace->plan);
+    workspace->heldW = false;
+    struct matmulOptions options = engine->options;
+    options.size = size;
+    //forked rows keep the single thread of the plan
+    tuneApply(tuneFind(engine->profile, size), &options, engine->chosen | (forksRows(engine, size) ? tuneThreads : 0));
+    if(matmulPlanInit(&workspace->plan, &options) == -1){
+        perror("matmulPlanInit");
+        return NULL;
     }
+    return &workspace->plan;
+}
 
-    //close files
-    fclose(fpA);
-    fclose(fpW);
+/**
+ * This function frees the plan and the buffers of a workspace.
+ * Input parameters: workspace
+ * Returns: nothing
+**/
+void freeWorkspace(struct workspace *workspace){
+    matmulPlanFree(&workspace->plan);
+    free(workspace->left.data);
+    free(workspace->w.data);
+    free(workspace->result.data);
+    memset(workspace, 0, sizeof(*workspace));
+}
 
-    //read matrixA from file
-    readMatrix(matrixSize, matrixSize, matrixA, matrixAtxt);
+/**
+ * This function checks rows of a product with Freivalds' algorithm (see matmulVerify), when the engine or the job
+ * asks for it. A product that fails is reported to the error log with its layer, command and W.
+ * Input parameters: rounds (0 for no check), size, rows, matrixA (rows x size), matrixW, result (rows x size), name,
+ * output_err
+ * Returns: true if the product passed or was not checked
+**/
+bool verifyProduct(int rounds, int size, int rows, const element *matrixA, const wElement *matrixW,
+                   const element *result, const struct productName *name, const char *output_err){
+    if(rounds <= 0){
+        return true;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long long seed = ((unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec) ^
+                              ((unsigned long long)getpid() << 32);
+    long long start = profileStart();
+    int failed = matmulVerify(size, rows, matrixA, matrixW, result, rounds, seed);
+    profileSpan(phaseCompute, start);
+    if(failed == 0){
+        return true;
+    }
+    char message[200];
+    if(failed == -1){
+        snprintf(message, sizeof(message), "Error - command %d: cannot allocate the Freivalds check of A*%.60s.",
+                 name->command, name->w);
+    }else if(name->layer >= 0){
+        snprintf(message, sizeof(message), "Error - layer %d, command %d: R = A*%.60s failed the Freivalds check in %d "
+                 "of %d rounds.", name->layer, name->command, name->w, failed, rounds);
+    }else{
+        snprintf(message, sizeof(message), "Error - R = A*%.60s failed the Freivalds check in %d of %d rounds.",
+                 name->w, failed, rounds);
+    }
+    logMessage(output_err, message);
+    return failed == -1;
+}
 
-    //read matrixW from file
-    readMatrix(matrixSize,matrixSize,matrixW, matrixWtxt);
+/**
+ * This function computes result = A*W as the engine says, with a plan made for the size (see matmul.h).
+ * A sparse A is multiplied through its nonzeros, in this process.
+ * Above the Strassen crossover the product is computed in this process by the Strassen-Winograd recursion.
+ * With threads > 1 the rows are split between threads of this process.
+ * Otherwise, with forkRows (see forksRows) the rows are split between rowChildren children that run at the same
+ * time and send their band back through a pipe (the classic behavior), or everything is computed in this process.
+ * When result is shared memory (sharedResult) the children write their band to it directly and the pipe only tells
+ * the parent they are done.
+ * Input parameters: plan (of size), size, matrixA, matrixW, result, engine, sharedResult
+ * Returns: matmulDense, matmulSparse or matmulStrassen if successful, -1 if a pipe or fork failed
+**/
+int computeResult(struct matmulPlan *plan, int size, element matrixA[size][size], wElement matrixW[size][size],
+                  element result[size][size], const struct engine *engine, bool sharedResult){
+    if(plan->threads > 1 || plan->strassen || !forksRows(engine, size)){
+        return matmulExecute(plan, &matrixA[0][0], &matrixW[0][0], &result[0][0]);
+    }
+    if(matmulExecuteSparse(plan, &matrixA[0][0], &matrixW[0][0], &result[0][0])){
+        return matmulSparse;
+    }
+
+    //pack W once in the parent, the children inherit it
+    matmulPackW(plan, &matrixW[0][0]);
 
     //compute array multiplication in a parallel fashion using multiple processes (fork)
-    for(int i = 0; i < matrixSize; i++){
+    //each child computes a band of rows, with 8x8 matrices this is one row per child
+    //all the children are started first, then their bands are read as they arrive
+    int band = (size + rowChildren - 1) / rowChildren;
+    pid_t pids[rowChildren];
+    struct pollfd fds[rowChildren];
+    size_t received[rowChildren];
+    size_t expected[rowChildren];
+    int children = 0;
+    int failed = 0;
+    for(int i = 0; i < rowChildren; i++){
+        int rowStart = i * band;
+        int rowEnd = rowStart + band < size ? rowStart + band : size;
+        if(rowStart >= rowEnd){
+            break;
+        }
         int pid;
         int pipefd[2];
 
         // Create a pipe
         if (pipe(pipefd) == -1) {
             perror("pipe");
-            return 1;
+            failed = -1;
+            break;
         }
 
         // Fork a child process
         if ((pid = fork()) == -1) {
             perror("fork");
-            return 1;
+            close(pipefd[0]);
+            close(pipefd[1]);
+            failed = -1;
+            break;
         }
 
         if (pid == 0) {  // Child process
             close(pipefd[0]);  // Close the read end of the pipe in the child process
+            //the read ends of the earlier children are not ours
+            for(int c = 0; c < children; c++){
+                close(fds[c].fd);
+            }
 
-            int row_result[matrixSize];
-            matrixCalculation(i, matrixA, matrixW, row_result);
+            //a pinned child touches its rows of the result first, so they are on its node
+            if (plan->placement != NULL) {
+                affinityPin(plan->placement, i);
+            }
+            matmulExecuteRows(plan, &matrixA[0][0], &result[0][0], rowStart, rowEnd);
 
-            // Write the result to the parent process through the pipe
-            write(pipefd[1], row_result, sizeof(row_result));
+            // Write the result to the parent process through the pipe, unless it is already in shared memory
+            if (!sharedResult) {
+                writeFully(pipefd[1], result[rowStart], (rowEnd - rowStart) * sizeof(*result));
+            }
             close(pipefd[1]);  // Close the write end of the pipe in the child process
 
             exit(0);
-        } else {  // Parent process
-            close(pipefd[1]);  // Close the write end of the pipe in the parent process
-            wait(NULL);
+        }
 
-            // Read the result from the child process through the pipe
-            read(pipefd[0], result[i], sizeof(result[i]));
+        // Parent process
+        close(pipefd[1]);  // Close the write end of the pipe in the parent process
+        fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+        pids[children] = pid;
+        fds[children].fd = pipefd[0];
+        fds[children].events = POLLIN;
+        received[children] = 0;
+        expected[children] = sharedResult ? 0 : (rowEnd - rowStart) * sizeof(*result);
+        children++;
+    }
 
-            close(pipefd[0]);  // Close the read end of the pipe in the parent process
+    // Read the results from the children through the pipes as they become readable,
+    // a band can be larger than the pipe buffer
+    int remaining = children;
+    while(remaining > 0){
+        if(poll(fds, children, -1) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("poll");
+            failed = -1;
+            break;
+        }
+        for(int c = 0; c < children; c++){
+            if(fds[c].fd < 0 || fds[c].revents == 0){
+                continue;
+            }
+            //with a shared result only the end of the pipe is expected
+            char end_of_pipe;
+            char *band_data = expected[c] == 0 ? &end_of_pipe : (char *)result[c * band] + received[c];
+            ssize_t bytes = read(fds[c].fd, band_data, expected[c] == 0 ? 1 : expected[c] - received[c]);
+            if(bytes == -1 && (errno == EAGAIN || errno == EINTR)){
+                continue;
+            }
+            if(bytes > 0){
+                received[c] += bytes;
+            }
+            if(bytes <= 0 || (expected[c] > 0 && received[c] == expected[c])){
+                //the band is complete (or the child is gone), reap the child right away
+                if(received[c] != expected[c]){
+                    perror("read");
+                    failed = -1;
+                }
+                close(fds[c].fd);
+                fds[c].fd = -1;
+                waitpid(pids[c], NULL, 0);
+                remaining--;
+            }
+        }
+    }
 
+    //children still running after a failure are reaped too
+    for(int c = 0; c < children; c++){
+        if(fds[c].fd >= 0){
+            close(fds[c].fd);
+            waitpid(pids[c], NULL, 0);
         }
+    }
+    return failed;
+}
+
+/**
+ * The second dimension of a result header when the result was written to the shared slot of the child instead of
+ * following on the pipe.
+ */
+#define resultInSlot -2
 
+/**
+ * This function sends a result matrix to the parent: its dimensions first, followed by the rows.
+ * A failed job is sent as dimensions -1 x -1 with no rows, and a result already in the shared slot of the child as
+ * size x resultInSlot with no rows.
+ * Input parameters: fd, size (-1 for a failed job), result (NULL if it is in the shared slot)
+ * Returns: 0 if successful, -1 if write failed
+**/
+int sendResult(int fd, int size, element *result){
+    int header[2] = {size, result == NULL && size > 0 ? resultInSlot : size};
+    if (writeFully(fd, header, sizeof(header)) < 0) {
+        return -1;
+    }
+    if (size <= 0 || result == NULL) {
+        return 0;
     }
 
-    // Serialize the result matrix into a buffer
-    int data_size = matrixSize * matrixSize;
-    int serialized_data_size = data_size * sizeof(int);
-    int* serialized_data = (int*)malloc(serialized_data_size);
+    // Write the result matrix to the pipe, it is already contiguous
+    return writeFully(fd, result, (size_t)size * size * sizeof(element));
+}
 
-    if (serialized_data == NULL) {
+/**
+ * The shared memory matrixmult_multiw_deep publishes Rsum in (--shm). It starts with this header, followed by Rsum
+ * (size x size) and by one result slot (slotSize x slotSize) per child or worker running at the same time.
+ * It must match struct sharedHeader in matrixmult_multiw_deep.c.
+ */
+struct sharedHeader {
+    int size;
+    int slotSize;
+    int slots;
+    int elementSize;    //sizeof(element) of matrixmult_multiw_deep, both programs must be built with the same type
+};
+
+/**
+ * A mapping of the shared memory.
+ */
+struct sharedRegion {
+    void *base;
+    size_t length;
+};
+
+/**
+ * This function maps the shared memory inherited from matrixmult_multiw_deep. It is mapped again for every job,
+ * because the parent grows it when Rsum grows.
+ * Input parameters: fd, region (to fill in)
+ * Returns: 0 if successful, -1 if the memory cannot be mapped or holds another element type
+**/
+int mapShared(int fd, struct sharedRegion *region){
+    struct stat info;
+    if(fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(struct sharedHeader)){
+        return -1;
+    }
+    region->length = info.st_size;
+    region->base = mmap(NULL, region->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(region->base == MAP_FAILED){
+        region->base = NULL;
+        return -1;
+    }
+    if(((struct sharedHeader *)region->base)->elementSize != sizeof(element)){
+        munmap(region->base, region->length);
+        region->base = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function returns where Rsum is in the shared memory.
+ * Input parameters: region
+ * Returns: a pointer to Rsum
+**/
+element *sharedRsum(const struct sharedRegion *region){
+    return (element *)((struct sharedHeader *)region->base + 1);
+}
+
+/**
+ * This function returns the result slot of a child in the shared memory, if it can hold a result of the given size.
+ * Input parameters: region, slot, size
+ * Returns: a pointer to the slot, or NULL if there is no such slot or it is not of that size
+**/
+element *sharedSlot(const struct sharedRegion *region, int slot, int size){
+    const struct sharedHeader *header = region->base;
+    if(region->base == NULL || slot < 0 || slot >= header->slots || size != header->slotSize){
+        return NULL;
+    }
+    return sharedRsum(region) + (size_t)header->size * header->size + (size_t)slot * size * size;
+}
+
+/**
+ * This function computes result = A*W, sends the result to stdout and logs it.
+ * When the shared slot of this process can hold the result it is computed directly in the slot and only its header
+ * is sent.
+ * The plan and the result buffer come from the workspace, so a worker allocates nothing for a job of the same size
+ * as the previous one.
+ * The product is checked with rounds of Freivalds' algorithm when they are asked for (see verifyProduct); a product
+ * that fails is still sent.
+ * Input parameters: size, matrixA, matrixW, engine (see computeResult), workspace, slotData (the shared slot, or
+ * NULL), rounds (of the check), name (of the product), output_file, output_err
+ * Returns: how the product was computed if successful (see computeResult), -1 if the result could not be computed
+ * or sent
+**/
+int multiplyAndSend(int size, element matrixA[size][size], wElement matrixW[size][size], const struct engine *engine,
+                    struct workspace *workspace, element *slotData, int rounds, const struct productName *name,
+                    const char *output_file, const char *output_err){
+    struct matmulPlan *plan = planFor(workspace, engine, size);
+    element (*result)[size] = slotData != NULL ? (element (*)[size])slotData
+                                               : reserveBuffer(&workspace->result, size * sizeof(*result));
+    if (plan == NULL || result == NULL) {
+        return -1;
+    }
+    //a multiply packs its own W over the one kept for row blocks
+    workspace->heldW = false;
+
+    long long start = profileStart();
+    int computed = computeResult(plan, size, matrixA, matrixW, result, engine, slotData != NULL);
+    profileSpan(phaseCompute, start);
+    int status = computed == -1 ? -1 : 0;
+    if (status == 0) {
+        verifyProduct(rounds, size, size, &matrixA[0][0], &matrixW[0][0], &result[0][0], name, output_err);
+    }
+    if (status == 0) {
+        // Write the dimensions of the result to the pipe, followed by the rows unless they are in the slot
+        start = profileStart();
+        status = sendResult(STDOUT_FILENO, size, slotData != NULL ? NULL : &result[0][0]);
+        profileSpan(phaseTransfer, start);
+        if (status == -1) {
+            perror("write");
+        }
+    }
+
+    if (status == 0) {
+        //writing logs to .out
+        logMatrix(output_file, "R = [", size, result, elementType);
+    }
+    return status == 0 ? computed : status;
+}
+
+/**
+ * This function gets a matrix sent by the parent ready for a multiply of the given size. It is used in place when
+ * it has the right size, otherwise it is copied (padded with 0s) into a new matrix.
+ * Input parameters: size, matrix, matrixSize, dtype (of matrix), label (for the logs), output_file
+ * Returns: the matrix, to free if it is not the one passed in
+**/
+void *padMatrix(int size, void *matrix, int matrixSize, int dtype, const char *label, const char *output_file){
+    if(matrixSize == size){
+        logMatrix(output_file, label, size, matrix, dtype);
+        return matrix;
+    }
+    size_t rowBytes = (size_t)size * typeSize(dtype);
+    size_t matrixRowBytes = (size_t)matrixSize * typeSize(dtype);
+    char *padded = calloc(size, rowBytes);
+    if (padded == NULL) {
         perror("malloc");
-        return 1;
+        exit(1);
+    }
+    for(int i = 0; i < matrixSize; i++){
+        memcpy(padded + i * rowBytes, (char *)matrix + i * matrixRowBytes, matrixRowBytes);
+    }
+    logMatrix(output_file, label, size, padded, dtype);
+    return padded;
+}
+
+/**
+ * This function gets the left matrix A ready for a multiply of the given size. Rsum from the shared memory is used
+ * in place when it has the right size, anything else is copied (padded with 0s) into a new matrix.
+ * Input parameters: size, left (inline or shared matrix, or NULL to read leftPath), leftSize, leftPath, mapped (for
+ * loadOperand), output_file
+ * Returns: the matrix, to free with releaseLeft
+**/
+element *loadLeft(int size, element *left, int leftSize, char *leftPath, struct mappedMatrix *mapped,
+                  const char *output_file){
+    mapped->base = NULL;
+    if(left == NULL){
+        return loadOperand(size, leftPath, elementType, mapped, output_file);
+    }
+    //the left matrix is padded with 0s if W is bigger
+    return padMatrix(size, left, leftSize, elementType, "Rsum=[", output_file);
+}
+
+/**
+ * This function frees the left matrix returned by loadLeft, unless it is the one from the parent.
+ * Input parameters: matrixA, left, mapped
+ * Returns: nothing
+**/
+void releaseLeft(element *matrixA, element *left, struct mappedMatrix *mapped){
+    if(matrixA != left){
+        releaseOperand(matrixA, mapped);
+    }
+}
+
+/**
+ * The header of a job sent by matrixmult_multiw_deep to a worker started with --worker (or --listen).
+ * When size > 0 the left matrix follows inline as size*size elements, when leftPathLength > 0 the path of its file
+ * follows (leftPathLength bytes), and otherwise it is Rsum in the shared memory. The path of the W file comes next
+ * (wPathLength bytes); when wSize > 0 W itself follows inline as wSize*wSize wElements (from the parent's cache) and
+ * the path is only used for the logs. The worker answers every job with sendResult, in the shared slot if slot >= 0 and
+ * it fits.
+ * A jobRows job of the --workers coordinator is a row block: rowCount rows of the left matrix follow inline (size
+ * elements each), then the path of W for the logs, then W (size x size) when wSize > 0; with wSize 0 the W of the
+ * previous job of the connection is used again. The worker answers with sendRows.
+ */
+struct jobHeader {
+    int op;             //jobMultiply, jobRows, or jobQuit to stop the worker
+    int command;        //command number, for the logs
+    int size;           //size of the inline left matrix, 0 if it is not inline
+    int leftPathLength; //0 if the left matrix is not read from a file
+    int wPathLength;
+    int slot;           //shared result slot of the worker, -1 for none
+    int wSize;          //size of the inline W matrix, 0 if the worker reads the W file (or keeps it, for jobRows)
+    int rowStart;       //jobRows: first row of the block in the whole product, for the logs
+    int rowCount;       //jobRows: rows of the block
+    int types;          //jobRows: jobTypes of the coordinator, both programs must be built with the same types
+    int layer;          //layer of the coordinator, for the messages of the Freivalds check
+    int verify;         //rounds of the Freivalds check of the product, 0 for the ones of the worker
+};
+#define jobQuit 0
+#define jobMultiply 1
+#define jobRows 2
+#define jobTypes (elementType * 16 + wElementType)
+
+/**
+ * This function reads a string of the given length from a file descriptor.
+ * Extra room is left at the end because readMatrix appends "=[" to the file name for the logs.
+ * Input parameters: fd, length
+ * Returns: the string (to free), or NULL if the read failed
+**/
+char *readString(int fd, int length){
+    char *string = malloc(length + 3);
+    if(string == NULL || readFully(fd, string, length) == -1){
+        free(string);
+        return NULL;
+    }
+    string[length] = '\0';
+    return string;
+}
+
+/**
+ * This function runs one job of the worker: it reads the operands of the job from stdin, multiplies them in
+ * this process and sends the result to stdout. Inline operands are read into the buffers of the workspace.
+ * Input parameters: header, engine (see computeResult), workspace, sharedFd (-1 without shared memory), output_file,
+ * output_err
+ * Returns: 0 if the job was answered (even when it failed), -1 if stdin or stdout is broken
+**/
+int runJob(const struct jobHeader *header, const struct engine *engine, struct workspace *workspace, int sharedFd,
+           const char *output_file, const char *output_err){
+    char message[100];
+    logSetCommand(header->command);
+    profileSetCommand(header->command);
+    sprintf(message, "Starting command %d: worker PID %d of parent PPID %d", header->command, getpid(), getppid());
+    logMessage(output_file, message);
+
+    //read the left matrix (inline, from a file or shared), the name of the W file and W if it is inline
+    int leftSize = header->size;
+    element *left = NULL;
+    char *leftPath = NULL;
+    struct sharedRegion shared = {NULL, 0};
+    long long start = profileStart();
+    if(leftSize > 0){
+        left = reserveBuffer(&workspace->left, (size_t)leftSize * leftSize * sizeof(element));
+        if(left == NULL || readFully(STDIN_FILENO, left, (size_t)leftSize * leftSize * sizeof(element)) == -1){
+            return -1;
+        }
+    }else if(header->leftPathLength > 0 && (leftPath = readString(STDIN_FILENO, header->leftPathLength)) == NULL){
+        return -1;
+    }
+    char *wPath = readString(STDIN_FILENO, header->wPathLength);
+    int wSize = header->wSize;
+    wElement *w = NULL;
+    if(wPath != NULL && wSize > 0){
+        w = reserveBuffer(&workspace->w, (size_t)wSize * wSize * sizeof(wElement));
+        if(w == NULL || readFully(STDIN_FILENO, w, (size_t)wSize * wSize * sizeof(wElement)) == -1){
+            free(wPath);
+            wPath = NULL;
+        }
+    }
+    if(wPath == NULL){
+        free(leftPath);
+        return -1;
+    }
+    profileSpan(phaseTransfer, start);
+    if(sharedFd >= 0 && (header->slot >= 0 || (leftSize == 0 && leftPath == NULL))){
+        mapShared(sharedFd, &shared);
+    }
+
+    //find the dimensions of the operands (this also checks that the files exist)
+    int dims[4] = {leftSize, leftSize, wSize, wSize};
+    bool failed = false;
+    if(leftSize == 0 && leftPath == NULL){
+        if(shared.base == NULL){
+            logMessage(output_err, "Error - cannot map the shared Rsum.");
+            failed = true;
+        }else{
+            dims[0] = dims[1] = ((struct sharedHeader *)shared.base)->size;
+        }
+    }
+    if(leftPath != NULL && matrixDimensions(leftPath, &dims[0], &dims[1]) == -1){
+        snprintf(message, sizeof(message), "Error - cannot open file %.60s.", leftPath);
+        logMessage(output_err, message);
+        failed = true;
+    }
+    if(w == NULL && matrixDimensions(wPath, &dims[2], &dims[3]) == -1){
+        snprintf(message, sizeof(message), "Error - cannot open file %.60s.", wPath);
+        logMessage(output_err, message);
+        failed = true;
+    }
+
+    int status = 0;
+    if(failed){
+        //answer with a failed result and wait for the next job
+        status = sendResult(STDOUT_FILENO, -1, NULL);
+    }else{
+        int size = squareSize(dims, 4);
+        if(leftSize == 0 && leftPath == NULL){
+            left = sharedRsum(&shared);
+            leftSize = dims[0];
+        }
+        struct mappedMatrix mappedA, mappedW = {0};
+        start = profileStart();
+        element *matrixA = loadLeft(size, left, leftSize, leftPath, &mappedA, output_file);
+        wElement *matrixW;
+        if(w != NULL){
+            strcat(wPath, "=[");
+            matrixW = padMatrix(size, w, wSize, wElementType, wPath, output_file);
+            wPath[strlen(wPath) - 2] = '\0';
+        }else{
+            matrixW = loadOperand(size, wPath, wElementType, &mappedW, output_file);
+        }
+        profileSpan(phaseLoad, start);
+
+        //the pool gives the parallelism, so the job is computed in this process (by threads if asked)
+        struct productName name = {header->layer, header->command, wPath};
+        int rounds = header->verify > 0 ? header->verify : engine->verifyRounds;
+        if(multiplyAndSend(size, (element (*)[size])matrixA, (wElement (*)[size])matrixW, engine, workspace,
+                           sharedSlot(&shared, header->slot, size), rounds, &name, output_file, output_err) == -1){
+            status = sendResult(STDOUT_FILENO, -1, NULL);
+        }
+        releaseLeft(matrixA, left, &mappedA);
+        if(matrixW != w){
+            releaseOperand(matrixW, &mappedW);
+        }
     }
 
-// Flatten the result matrix into a 1D array
-   int k = 0;
-    for (int i = 0; i < matrixSize; i++) {
-        for (int j = 0; j < matrixSize; j++) {
-            serialized_data[k] = result[i][j];
-            k++;
+    if(shared.base != NULL){
+        munmap(shared.base, shared.length);
+    }
+    free(leftPath);
+    free(wPath);
+    return status;
+}
+
+/**
+ * This function sends rows of a result to the coordinator: the number of rows and their size first, followed by the
+ * rows. A failed job is sent like by sendResult.
+ * Input parameters: fd, rows, size, result (rows x size)
+ * Returns: 0 if successful, -1 if write failed
+**/
+int sendRows(int fd, int rows, int size, const element *result){
+    int header[2] = {rows, size};
+    if(writeFully(fd, header, sizeof(header)) == -1){
+        return -1;
+    }
+    return writeFully(fd, result, (size_t)rows * size * sizeof(element));
+}
+
+/**
+ * This function runs one row block job of the --workers coordinator (jobRows): it reads the rows of the left matrix,
+ * and W unless the job uses the one this worker holds, and sends those rows of A*W to stdout. W is kept packed in
+ * the plan of the workspace, so the blocks of one W only send and pack it once, and the rows, W and the result are
+ * read and computed in its buffers. The rows are computed with the dense kernel, by threads if asked; they are not
+ * logged as a matrix, only the block is.
+ * Input parameters: header, engine, workspace (with the W kept between the jobs), output_file, output_err
+ * Returns: 0 if the job was answered (even when it failed), -1 if stdin or stdout is broken, or if the coordinator
+ * was built with other types (its matrices cannot be read)
+**/
+int runRowsJob(const struct jobHeader *header, const struct engine *engine, struct workspace *workspace,
+               const char *output_file, const char *output_err){
+    char message[100];
+    int size = header->size;
+    int rows = header->rowCount;
+    logSetCommand(header->command);
+    profileSetCommand(header->command);
+    if(header->types != jobTypes){
+        logMessage(output_err, "Error - the coordinator was built with other matrix types.");
+        return -1;
+    }
+    if(size <= 0 || rows <= 0 || rows > size || (header->wSize != 0 && header->wSize != size)){
+        logMessage(output_err, "Error - bad row block job.");
+        return -1;
+    }
+    sprintf(message, "Starting command %d: rows %d to %d on worker PID %d", header->command, header->rowStart,
+            header->rowStart + rows - 1, getpid());
+    logMessage(output_file, message);
+
+    //read the rows, the name of W and W if it is sent
+    long long start = profileStart();
+    element *left = reserveBuffer(&workspace->left, (size_t)rows * size * sizeof(element));
+    if(left == NULL || readFully(STDIN_FILENO, left, (size_t)rows * size * sizeof(element)) == -1){
+        return -1;
+    }
+    char *wPath = readString(STDIN_FILENO, header->wPathLength);
+    if(wPath == NULL){
+        return -1;
+    }
+    struct matmulPlan *plan = NULL;
+    if(header->wSize > 0){
+        wElement *w = reserveBuffer(&workspace->w, (size_t)size * size * sizeof(wElement));
+        if(w == NULL || readFully(STDIN_FILENO, w, (size_t)size * size * sizeof(wElement)) == -1){
+            free(wPath);
+            return -1;
         }
+        //the new W replaces the one of the previous jobs
+        plan = planFor(workspace, engine, size);
+        if(plan != NULL){
+            matmulPackW(plan, w);
+            workspace->heldW = true;
+        }
+    }else if(workspace->heldW && workspace->plan.size == size){
+        plan = &workspace->plan;
+    }
+    profileSpan(phaseTransfer, start);
+
+    int status;
+    element *result = NULL;
+    if(plan == NULL){
+        snprintf(message, sizeof(message), "Error - no W %.60s for command %d.", wPath, header->command);
+        logMessage(output_err, message);
+    }else{
+        result = reserveBuffer(&workspace->result, (size_t)rows * size * sizeof(element));
+    }
+    if(result == NULL){
+        //answer with a failed result and wait for the next job
+        status = sendResult(STDOUT_FILENO, -1, NULL);
+    }else{
+        start = profileStart();
+        matmulExecuteRows(plan, left, result, 0, rows);
+        profileSpan(phaseCompute, start);
+        //the rows of the block are checked against the W kept from its job
+        struct productName name = {header->layer, header->command, wPath};
+        verifyProduct(header->verify > 0 ? header->verify : engine->verifyRounds, size, rows, left, workspace->w.data,
+                      result, &name, output_err);
+        start = profileStart();
+        status = sendRows(STDOUT_FILENO, rows, size, result);
+        profileSpan(phaseTransfer, start);
+        if(status == 0){
+            snprintf(message, sizeof(message), "R rows %d to %d of %.40s: %d x %d", header->rowStart,
+                     header->rowStart + rows - 1, wPath, rows, size);
+            logMessage(output_file, message);
+        }
+    }
+    free(wPath);
+    return status;
+}
+
+/**
+ * This function runs matrixmult_parallel as a long-lived worker of matrixmult_multiw_deep: it answers jobs read from
+ * stdin until it gets jobQuit or stdin is closed. stdin and stdout are a socket for a worker server (--listen).
+ * Input parameters: engine (see computeResult), sharedFd (-1 without shared memory), output_file, output_err
+ * Returns: 0 when stdin is closed or the parent asks to quit, 1 if a job could not be read or answered
+**/
+int workerLoop(const struct engine *engine, int sharedFd, const char *output_file, const char *output_err){
+    struct jobHeader header;
+    struct workspace workspace = {0};
+    int jobs = 0;
+    while(readFully(STDIN_FILENO, &header, sizeof(header)) == 0 &&
+          (header.op == jobMultiply || header.op == jobRows)){
+        int status = header.op == jobRows ? runRowsJob(&header, engine, &workspace, output_file, output_err)
+                                          : runJob(&header, engine, &workspace, sharedFd, output_file, output_err);
+        if(status == -1){
+            logMessage(output_err, "Error - lost the connection to the parent, terminating with exit code 1.");
+            freeWorkspace(&workspace);
+            return 1;
+        }
+        jobs++;
     }
+    freeWorkspace(&workspace);
+
+    char message[100];
+    sprintf(message, "Worker %d finished %d jobs, kernel = %s", getpid(), jobs, engine->options.kernel->name);
+    logMessage(output_file, message);
+    return 0;
+}
 
-// Write the size of the serialized data to the pipe
-    if (write(STDOUT_FILENO, &serialized_data_size, sizeof(int)) < 0) {
-        perror("write");
+/**
+ * This function runs matrixmult_parallel as a worker server for matrixmult_multiw_deep --workers: it listens on an
+ * address and forks a worker for every connection, which answers the jobs of the connection (see workerLoop) until
+ * the coordinator closes it. The server runs until it is killed.
+ * Input parameters: address (unix:PATH or [HOST]:PORT, see matrix_net.h), engine, output_file
+ * Returns: 1 if the server cannot listen or accept
+**/
+int serveWorkers(const char *address, const struct engine *engine, const char *output_file){
+    int listenFd = netListen(address);
+    if(listenFd == -1){
         return 1;
     }
+    //the connection workers are reaped by the kernel, and a closed connection is an error of its job, not a signal
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    char message[100];
+    snprintf(message, sizeof(message), "Listening on %.60s, kernel = %s", address, engine->options.kernel->name);
+    logMessage(output_file, message);
+
+    while(true){
+        int connection = netAccept(listenFd);
+        if(connection == -1){
+            if(errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            perror("accept");
+            return 1;
+        }
+        pid_t pid = fork();
+        if(pid == 0){
+            //the worker answers on the connection like a pool worker on its pipes, and logs to its own files
+            close(listenFd);
+            dup2(connection, STDIN_FILENO);
+            dup2(connection, STDOUT_FILENO);
+            close(connection);
+            char worker_file[50];
+            char worker_err[50];
+            sprintf(worker_file, "%d.out", getpid());
+            sprintf(worker_err, "%d.err", getpid());
+            sprintf(message, "Starting worker PID %d of server PPID %d", getpid(), getppid());
+            logMessage(worker_file, message);
+            exit(workerLoop(engine, -1, worker_file, worker_err));
+        }
+        if(pid == -1){
+            perror("fork");
+        }
+        close(connection);
+    }
+}
 
-// Write the serialized data to the pipe
-    if (write(STDOUT_FILENO, serialized_data, serialized_data_size) < 0) {
-        perror("write");
+/**
+ * This function initializes the matrices, reads the files, and calls the selected multiply kernel. It also detects
+ * any errors with the files.
+ * Options (before the files):
+ *  --worker      run as a pool worker of matrixmult_multiw_deep (see workerLoop), no files
+ *  --listen ADDR run as a worker server for matrixmult_multiw_deep --workers on ADDR (unix:PATH or [HOST]:PORT), no
+ *                files (see serveWorkers)
+ *  --shm FD      use the shared memory of matrixmult_multiw_deep inherited as FD; a left file named "-" is Rsum
+ *  --slot N      write the result to shared slot N instead of the pipe when it fits
+ *  --threads[=N] compute with N threads in this process instead of forking children (default N: the cores);
+ *                MATRIXMULT_THREADS=N does the same for the children started by matrixmult_multiw_deep
+ *  --strassen[=N] use Strassen-Winograd for matrices bigger than N (default matmulCrossover), in this process;
+ *                MATRIXMULT_STRASSEN=N does the same for the children started by matrixmult_multiw_deep
+ *  --sparse=N    use the sparse kernels when at most N percent of A is nonzero (default matmulSparseThreshold, 0:
+ *                never);
+ *                MATRIXMULT_SPARSE=N does the same for the children started by matrixmult_multiw_deep
+ *  --affinity P  pin the row children, or the threads, to the CPUs of this process by policy P: compact, scatter or
+ *                a CPU list (see matrix_affinity.h); MATRIXMULT_AFFINITY=P does the same
+ *  --verify[=N]  check every product with N rounds of Freivalds' algorithm (default matmulVerifyRounds) and log the
+ *                ones that fail to the .err file; MATRIXMULT_VERIFY=N does the same for the children and workers
+ * Assumption: the files contain numbers only.
+ * Input parameters: argc and argv, Files: matrixA, matrixW
+ * Returns: a matrix, exit(0) if successful, or exit(1) if there is an error.
+**/
+int main(int argc, char* argv[]) {
+
+    //the run is timed from here, with the phases, when MATRIXMULT_PROFILE or MATRIXMULT_TRACE is set
+    profileInit("matrixmult_parallel");
+
+    //logs for R matrix
+    char output_file[50];
+    sprintf(output_file, "%d.out", getpid());
+
+    //logs for error
+    char output_err[50];
+    sprintf(output_err, "%d.err", getpid());
+
+    //the logs are buffered and written by a thread (see matrix_log.h)
+    logInit();
+
+    //options come before the files
+    static struct option options[] = {
+        {"worker", no_argument, NULL, 'w'},
+        {"listen", required_argument, NULL, 'l'},
+        {"shm", required_argument, NULL, 's'},
+        {"slot", required_argument, NULL, 'n'},
+        {"threads", optional_argument, NULL, 't'},
+        {"strassen", optional_argument, NULL, 'r'},
+        {"sparse", required_argument, NULL, 'z'},
+        {"affinity", required_argument, NULL, 'a'},
+        {"verify", optional_argument, NULL, 'v'},
+        {NULL, 0, NULL, 0}
+    };
+    bool worker = false;
+    const char *listenAddress = NULL;
+    int sharedFd = -1;
+    int slot = -1;
+    const char *threadOption = getenv("MATRIXMULT_THREADS");
+    const char *strassenOption = getenv("MATRIXMULT_STRASSEN");
+    const char *sparseOption = getenv("MATRIXMULT_SPARSE");
+    const char *affinityOption = getenv("MATRIXMULT_AFFINITY");
+    const char *verifyOption = getenv("MATRIXMULT_VERIFY");
+    int option;
+    while((option = getopt_long(argc, argv, "+", options, NULL)) != -1){
+        if(option == 'w'){
+            worker = true;
+        }else if(option == 'l'){
+            listenAddress = optarg;
+        }else if(option == 's'){
+            sharedFd = atoi(optarg);
+        }else if(option == 'n'){
+            slot = atoi(optarg);
+        }else if(option == 't'){
+            threadOption = optarg != NULL ? optarg : "0";
+        }else if(option == 'r'){
+            strassenOption = optarg != NULL ? optarg : "0";
+        }else if(option == 'z'){
+            sparseOption = optarg;
+        }else if(option == 'a'){
+            affinityOption = optarg;
+        }else if(option == 'v'){
+            verifyOption = optarg != NULL ? optarg : "0";
+        }else{
+            fprintf(stderr, "Usage: %s [--threads[=N]] [--strassen[=N]] [--sparse=N] [--affinity POLICY]\n"
+                            "           [--verify[=N]] [--shm FD [--slot N]] A W\n"
+                            "       %s --worker [--threads[=N]] [--strassen[=N]] [--sparse=N] [--verify[=N]]\n"
+                            "           [--shm FD]\n"
+                            "       %s --listen unix:PATH|[HOST]:PORT [--threads[=N]]\n",
+                    argv[0], argv[0], argv[0]);
+            exit(1);
+        }
+    }
+    //0 threads (or no number) means one per core, without the option the rows are forked
+    struct engine engine;
+    matmulDefaults(&engine.options, 0);
+    engine.forkRows = true;
+    //0 (or no number) is the default rounds of the Freivalds check
+    engine.verifyRounds = verifyOption == NULL ? 0 : atoi(verifyOption) > 0 ? atoi(verifyOption) : matmulVerifyRounds;
+    //the profile of matrixtune fills in what is not chosen here
+    struct tuneProfile profile;
+    char profilePath[1024];
+    const char *kernelOption = getenv("MATRIXMULT_KERNEL");
+    engine.profile = tuneProfilePath(profilePath, sizeof(profilePath)) == 0 && tuneLoad(profilePath, &profile) == 0
+                     ? &profile : NULL;
+    engine.chosen = (kernelOption != NULL && kernelOption[0] != '\0' ? tuneKernel : 0) |
+                    (threadOption != NULL ? tuneThreads : 0) | (strassenOption != NULL ? tuneStrassen : 0);
+    if(threadOption != NULL){
+        engine.options.threads = atoi(threadOption) > 0 ? atoi(threadOption) : availableCores();
+        engine.forkRows = false;
+    }
+    //0 (or no number) is the default crossover
+    if(strassenOption != NULL){
+        engine.options.crossover = atoi(strassenOption) > 0 ? atoi(strassenOption) : matmulCrossover;
+        if(engine.options.crossover < matmulMinCrossover){
+            engine.options.crossover = matmulMinCrossover;
+        }
+#if narrowW
+        //the sums of the recursion do not fit in a narrow W
+        logMessage(output_err, "Strassen is not available for narrow W types, using the classical multiply.");
+        engine.options.crossover = 0;
+#endif
+    }
+    //a percent of nonzeros, 0 turns the sparse kernels off
+    if(sparseOption != NULL){
+        engine.options.sparse = atoi(sparseOption) > 0 ? atoi(sparseOption) : 0;
+    }
+    //one slot per thread, or per row child, over the CPUs this process was given (by matrixmult_multiw_deep too)
+    struct affinity placement;
+    if(affinityOption != NULL){
+        if(affinityInit(&placement, affinityOption, engine.options.threads > 1 ? engine.options.threads : rowChildren)
+           == -1){
+            exit(1);
+        }
+        engine.options.placement = &placement;
+    }
+    char **args = argv + optind - 1; //args[1] is A, like argv without options
+    int argCount = argc - optind + 1;
+
+    //worker mode: the jobs come from the pool of matrixmult_multiw_deep, or from coordinators over sockets
+    if(listenAddress != NULL) {
+        engine.options.kernel = selectKernel(output_err);
+        engine.forkRows = false;
+        exit(serveWorkers(listenAddress, &engine, output_file));
+    }
+    if(worker) {
+        //the jobs are computed in the worker process, by threads if asked
+        engine.options.kernel = selectKernel(output_err);
+        engine.forkRows = false;
+        exit(workerLoop(&engine, sharedFd, output_file, output_err));
+    }
+
+    if(argCount < 3) {
+        //if there are less than 2 files, then print to stderr error messages and terminate with code 1
+        fprintf(stderr, "Error - Command 0: \nReceived %d arguments, expecting more or equal to 2 files as input. \nTerminating with exit code 1\n", argCount - 1);
+        //exit failure
+        exit(1);
+    }
+
+    //matrix file names, with room for the "=[" readMatrix adds for the logs
+    char *matrixAtxt = malloc(strlen(args[1]) + 3);
+    char *matrixWtxt = malloc(strlen(args[2]) + 3);
+    char test_file[100];
+    if (matrixAtxt == NULL || matrixWtxt == NULL) {
+        perror("malloc");
         return 1;
     }
 
-// Free dynamically allocated memory
-    free(serialized_data);
+    //copy file names to variables
+    strcpy(matrixAtxt, args[1]);
+    strcpy(matrixWtxt, args[2]);
 
-    // Record end time
-    gettimeofday(&end, NULL);
+    //the shared memory holds Rsum and the result slots
+    struct sharedRegion shared = {NULL, 0};
+    if(sharedFd >= 0 && mapShared(sharedFd, &shared) == -1){
+        logMessage(output_err, "Error - cannot map the shared Rsum.");
+    }
+    bool leftShared = strcmp(matrixAtxt, "-") == 0;
+
+    //find the dimensions of both files (this also checks that they exist)
+    int dims[4];
+    bool exitTrue = false;
+    //check if file matrixA exists
+    if (leftShared) {
+        if (shared.base == NULL) {
+            exitTrue = true;
+        } else {
+            dims[0] = dims[1] = ((struct sharedHeader *)shared.base)->size;
+        }
+    } else if (matrixDimensions(matrixAtxt, &dims[0], &dims[1]) == -1) {
+        //file matrixA does not exist
+        snprintf(test_file, sizeof(test_file), "Error - cannot open file %s.", matrixAtxt);
+        logMessage(output_err, test_file);
+
+        exitTrue = true;
+    }
+
+    //check if file matrixW exists
+    if(matrixDimensions(matrixWtxt, &dims[2], &dims[3]) == -1){
+        //file matrixW does not exist
+        snprintf(test_file, sizeof(test_file), "Error - cannot open file %s.", matrixWtxt);
+        logMessage(output_err, test_file);
+
+        exitTrue = true;
+
+    }
+
+    //if any of the files do not exist, then terminate with code 1
+    if(exitTrue){
+        logMessage(output_err, "Terminating, exit code 1.");
+        exit(1);
+    }
+
+    //the matrices are square and big enough to hold both inputs
+    int size = squareSize(dims, 4);
+
+    //pick the kernel for this CPU
+    engine.options.kernel = selectKernel(output_err);
+
+    //read matrixA from file (or use the shared Rsum)
+    long long start = profileStart();
+    struct mappedMatrix mappedA, mappedW;
+    element *left = leftShared ? sharedRsum(&shared) : NULL;
+    element *matrixA = loadLeft(size, left, dims[0], matrixAtxt, &mappedA, output_file);
+
+    //read matrixW from file
+    wElement *matrixW = loadOperand(size, matrixWtxt, wElementType, &mappedW, output_file);
+    profileSpan(phaseLoad, start);
+
+    //compute array multiplication in a parallel fashion using multiple processes (fork), or threads
+    //a child of matrixmult_multiw_deep is named by its layer and command in the messages of the check
+    const char *layerOption = getenv("MATRIXMULT_LAYER");
+    const char *commandOption = getenv("MATRIXMULT_COMMAND");
+    struct productName name = {layerOption != NULL ? atoi(layerOption) : -1,
+                               commandOption != NULL ? atoi(commandOption) : 0, matrixWtxt};
+    struct workspace workspace = {0};
+    int computed = multiplyAndSend(size, (element (*)[size])matrixA, (wElement (*)[size])matrixW, &engine,
+                                   &workspace, sharedSlot(&shared, slot, size), engine.verifyRounds, &name,
+                                   output_file, output_err);
+    if (computed == -1) {
+        return 1;
+    }
 
     //writing logs to .out
-    char mat[100];
-    sprintf(mat, "R = [");
+    char mat[160];
+    const struct matmulPlan *plan = &workspace.plan;
+    int length = sprintf(mat, "Kernel = %s", computed == matmulSparse ? "sparse" : plan->kernel->name);
+    if (plan->threads > 1) {
+        length += sprintf(mat + length, ", threads = %d", plan->threads);
+    }
+    if (computed == matmulStrassen) {
+        length += sprintf(mat + length, ", Strassen crossover = %d", plan->crossover);
+    }
+    if (tuneFind(engine.profile, size) != NULL) {
+        length += sprintf(mat + length, ", tuned for %d", tuneFind(engine.profile, size)->size);
+    }
+    if (elementType != typeInt32 || narrowW) {
+        length += sprintf(mat + length, ", type = %s", typeName(narrowW ? wElementType : elementType));
+    }
+    if (engine.options.placement != NULL) {
+        length += sprintf(mat + length, ", affinity = %s", engine.options.placement->policy);
+    }
+    if (engine.verifyRounds > 0) {
+        sprintf(mat + length, ", Freivalds rounds = %d", engine.verifyRounds);
+    }
     logMessage(output_file, mat);
 
-    logMatrix(output_file, result);
+    // Free dynamically allocated memory
+    releaseLeft(matrixA, left, &mappedA);
+    releaseOperand(matrixW, &mappedW);
+    freeWorkspace(&workspace);
+    free(matrixAtxt);
+    free(matrixWtxt);
 
     //exit success
     exit(0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,649 @@
+/**
+ * Description: the autotuner of matrixmult_parallel and matrixmult_multiw_deep. For each matrix size it runs short
+ * benchmarks of the multiply with libmatmul (see matmul.h): every kernel this CPU supports, with every thread count
+ * and every block of rows of the threads, then the cache tiles of the fastest kernel, then the Strassen crossovers
+ * and the forked row children of matrixmult_parallel with the fastest of them, and a layer of several Ws fused and
+ * unfused. The fastest configuration of every size is saved in the profile of this host (see matrix_tune.h), which both programs load at
+ * startup. The Strassen recursion and the fused layers are only tried for the integer types, whose results they do
+ * not change.
+ * With --check (make check) nothing is tuned: every kernel, with odd tiles, threads, the sparse kernels and the
+ * Strassen recursion, multiplies random operands of sizes that are not multiples of the tiles, and every result is
+ * compared element by element with the scalar kernel (see checkKernels).
+ * Usage: ./matrixtune [--sizes N,N,...] [--threads N,N,...] [--blocks N,N,...] [--repeats N] [--profile FILE]
+ *                     [--dry-run] [--check]
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "matmul.h"
+#include "matrix_io.h"
+#include "matrix_tune.h"
+#include "matrix_types.h"
+
+#define maxGrid 16          //values per list of candidates
+#define defaultRepeats 3
+#define rowChildren 8       //children of the forked rows, like matrixmult_parallel
+#define layerWs 4           //Ws of the layer timed fused and unfused
+#define pathLength 1024
+
+static const char *kernelNames[] = {"scalar", "sse4.1", "avx2", "avx512"};
+static const int crossovers[] = {64, 128, 256, 512, 1024};
+static const int tileRowSizes[] = {16, 32, 64, 128};
+static const int tileDepths[] = {64, 128, 256, 512};
+static const int tileColSizes[] = {16, 32, 64, 128};    //only the scalar kernel blocks the columns
+#define countOf(array) (int)(sizeof(array) / sizeof(array[0]))
+
+/**
+ * A list of candidates, e.g. the thread counts.
+ */
+struct grid {
+    int values[maxGrid];
+    int count;
+};
+
+/**
+ * The operands of the benchmarks of one size, and the number of timed runs.
+ */
+struct tuneCase {
+    int size;
+    int repeats;
+    element *a;
+    wElement *w[layerWs];
+    element *result;
+    element *rsum;
+    element *wsum;
+};
+
+typedef void (*trialFunction)(struct tuneCase *tuneCase, struct matmulPlan *plan);
+
+/**
+ * This function parses a comma separated list of positive numbers.
+ * Input parameters: text, grid (to fill in)
+ * Returns: 0 if successful, -1 if the list is empty, too long or not made of positive numbers
+**/
+int parseGrid(const char *text, struct grid *grid){
+    grid->count = 0;
+    while(*text != '\0'){
+        char *end;
+        long value = strtol(text, &end, 10);
+        if(end == text || value <= 0 || value > INT_MAX || grid->count == maxGrid || (*end != ',' && *end != '\0')){
+            return -1;
+        }
+        grid->values[grid->count++] = (int)value;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return grid->count > 0 ? 0 : -1;
+}
+
+/**
+ * This function returns the next number of a pseudo-random sequence (a 64-bit LCG).
+ * Input parameters: state
+ * Returns: a number from 0 to 9
+**/
+int nextValue(uint64_t *state){
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (int)((*state >> 33) % 10);
+}
+
+/**
+ * This function returns the time of a monotonic clock.
+ * Input parameters: none
+ * Returns: the time in seconds
+**/
+double now(void){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * This function compares two runtimes, for qsort.
+ * Input parameters: a, b
+ * Returns: <0, 0 or >0
+**/
+int compareTimes(const void *a, const void *b){
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * This function writes a whole buffer to a file descriptor, continuing after partial writes.
+ * Input parameters: fd, buffer, size (in bytes)
+ * Returns: 0 if successful, -1 if write failed
+**/
+int writeFully(int fd, const void *buffer, size_t size){
+    const char *data = buffer;
+    while(size > 0){
+        ssize_t written = write(fd, data, size);
+        if(written < 0){
+            return -1;
+        }
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+/**
+ * This function reads a whole buffer from a file descriptor, continuing after partial reads.
+ * Input parameters: fd, buffer, size (in bytes)
+ * Returns: 0 if successful, -1 if read failed or the pipe was closed early
+**/
+int readFully(int fd, void *buffer, size_t size){
+    char *data = buffer;
+    while(size > 0){
+        ssize_t bytes = read(fd, data, size);
+        if(bytes <= 0){
+            return -1;
+        }
+        data += bytes;
+        size -= bytes;
+    }
+    return 0;
+}
+
+/**
+ * This function multiplies A by the first W with the plan.
+ * Input parameters: tuneCase, plan
+ * Returns: nothing
+**/
+void trialMultiply(struct tuneCase *tuneCase, struct matmulPlan *plan){
+    matmulExecute(plan, tuneCase->a, tuneCase->w[0], tuneCase->result);
+}
+
+/**
+ * This function multiplies A by the first W the way matrixmult_parallel does without threads: W is packed once and
+ * rowChildren children compute a band of rows each and send it back through a pipe.
+ * Input parameters: tuneCase, plan (of one thread)
+ * Returns: nothing
+**/
+void trialForked(struct tuneCase *tuneCase, struct matmulPlan *plan){
+    int size = tuneCase->size;
+    int band = (size + rowChildren - 1) / rowChildren;
+    int fds[rowChildren];
+    int children = 0;
+    matmulPackW(plan, tuneCase->w[0]);
+    for(int i = 0; i < rowChildren && i * band < size; i++){
+        int rowStart = i * band;
+        int rowEnd = rowStart + band < size ? rowStart + band : size;
+        int pipefd[2];
+        if(pipe(pipefd) == -1){
+            perror("pipe");
+            exit(1);
+        }
+        pid_t pid = fork();
+        if(pid == -1){
+            perror("fork");
+            exit(1);
+        }
+        if(pid == 0){
+            close(pipefd[0]);
+            matmulExecuteRows(plan, tuneCase->a, tuneCase->result, rowStart, rowEnd);
+            writeFully(pipefd[1], &tuneCase->result[(size_t)rowStart * size],
+                       (size_t)(rowEnd - rowStart) * size * sizeof(element));
+            _exit(0);
+        }
+        close(pipefd[1]);
+        fds[children++] = pipefd[0];
+    }
+    for(int c = 0; c < children; c++){
+        int rowStart = c * band;
+        int rowEnd = rowStart + band < size ? rowStart + band : size;
+        readFully(fds[c], &tuneCase->result[(size_t)rowStart * size],
+                  (size_t)(rowEnd - rowStart) * size * sizeof(element));
+        close(fds[c]);
+    }
+    while(wait(NULL) > 0){
+    }
+}
+
+/**
+ * This function adds a matrix of the element type into another one.
+ * Input parameters: sum, matrix, count (elements)
+ * Returns: nothing
+**/
+void addInto(element *restrict sum, const element *restrict matrix, size_t count){
+    wrapElement *restrict to = (wrapElement *)sum;
+    const wrapElement *restrict from = (const wrapElement *)matrix;
+    for(size_t i = 0; i < count; i++){
+        to[i] += from[i];
+    }
+}
+
+/**
+ * This function computes a layer of layerWs Ws like matrixmult_multiw_deep without --fused: A times every W, each
+ * product added to Rsum.
+ * Input parameters: tuneCase, plan
+ * Returns: nothing
+**/
+void trialUnfused(struct tuneCase *tuneCase, struct matmulPlan *plan){
+    size_t count = (size_t)tuneCase->size * tuneCase->size;
+    memset(tuneCase->rsum, 0, count * sizeof(element));
+    for(int i = 0; i < layerWs; i++){
+        matmulExecute(plan, tuneCase->a, tuneCase->w[i], tuneCase->result);
+        addInto(tuneCase->rsum, tuneCase->result, count);
+    }
+}
+
+/**
+ * This function computes the same layer with --fused: the Ws are summed first and A is multiplied once by the sum
+ * (only used when W is of the element type).
+ * Input parameters: tuneCase, plan
+ * Returns: nothing
+**/
+void trialFused(struct tuneCase *tuneCase, struct matmulPlan *plan){
+    size_t count = (size_t)tuneCase->size * tuneCase->size;
+    memset(tuneCase->wsum, 0, count * sizeof(element));
+    for(int i = 0; i < layerWs; i++){
+        addInto(tuneCase->wsum, (const element *)tuneCase->w[i], count);
+    }
+    memset(tuneCase->rsum, 0, count * sizeof(element));
+    matmulExecute(plan, tuneCase->a, (const wElement *)tuneCase->wsum, tuneCase->result);
+    addInto(tuneCase->rsum, tuneCase->result, count);
+}
+
+/**
+ * This function times a trial with a plan made from the options: one warmup run, then the timed runs.
+ * Input parameters: tuneCase, options, trial
+ * Returns: the median time in seconds, or -1 if the plan cannot be made
+**/
+double timeTrial(struct tuneCase *tuneCase, const struct matmulOptions *options, trialFunction trial){
+    struct matmulPlan plan;
+    if(matmulPlanInit(&plan, options) == -1){
+        return -1;
+    }
+    double times[tuneCase->repeats];
+    trial(tuneCase, &plan);
+    for(int r = 0; r < tuneCase->repeats; r++){
+        double start = now();
+        trial(tuneCase, &plan);
+        times[r] = now() - start;
+    }
+    matmulPlanFree(&plan);
+    qsort(times, tuneCase->repeats, sizeof(double), compareTimes);
+    return times[tuneCase->repeats / 2];
+}
+
+/**
+ * This function times the cache tiles of the fastest configuration so far: the rows and depths together, then the
+ * columns for the scalar kernel.
+ * Input parameters: tuneCase, best (changed to the fastest tiles), bestTime (likewise)
+ * Returns: nothing
+**/
+void tuneTiles(struct tuneCase *tuneCase, struct matmulOptions *best, double *bestTime){
+    struct matmulOptions options = *best;
+    for(int r = 0; r < countOf(tileRowSizes); r++){
+        for(int d = 0; d < countOf(tileDepths); d++){
+            options.tiles.rows = tileRowSizes[r];
+            options.tiles.depth = tileDepths[d];
+            double time = timeTrial(tuneCase, &options, trialMultiply);
+            if(time >= 0 && time < *bestTime){
+                *bestTime = time;
+                *best = options;
+            }
+        }
+    }
+    options = *best;
+    for(int c = 0; best->kernel->width == 1 && c < countOf(tileColSizes); c++){
+        options.tiles.cols = tileColSizes[c];
+        double time = timeTrial(tuneCase, &options, trialMultiply);
+        if(time >= 0 && time < *bestTime){
+            *bestTime = time;
+            *best = options;
+        }
+    }
+}
+
+/**
+ * This function tunes one size: the kernels, thread counts and blocks of rows, then the cache tiles, the Strassen
+ * crossovers, the forked rows and the fused layer with the fastest of them.
+ * Input parameters: tuneCase, threads, blocks, entry (to fill in)
+ * Returns: nothing
+**/
+void tuneSize(struct tuneCase *tuneCase, const struct grid *threads, const struct grid *blocks,
+              struct tuneEntry *entry){
+    int size = tuneCase->size;
+    struct matmulOptions options, best;
+    matmulDefaults(&options, size);
+    //dense operands, the sparse kernels are not what is tuned
+    options.sparse = 0;
+    options.tiles = (struct matmulTiles){matmulTileRows, matmulTileCols, matmulTileDepth};
+    best = options;
+    double bestTime = -1;
+    for(int k = 0; k < countOf(kernelNames); k++){
+        options.kernel = matmulFindKernel(kernelNames[k]);
+        if(options.kernel == NULL){
+            continue;
+        }
+        for(int t = 0; t < threads->count; t++){
+            options.threads = threads->values[t];
+            //the blocks of rows only matter to several threads, 0 is the default
+            for(int b = -1; b < (options.threads > 1 ? blocks->count : 0); b++){
+                options.blockRows = b < 0 ? 0 : blocks->values[b];
+                double time = timeTrial(tuneCase, &options, trialMultiply);
+                if(time >= 0 && (bestTime < 0 || time < bestTime)){
+                    bestTime = time;
+                    best = options;
+                }
+            }
+        }
+    }
+
+    tuneTiles(tuneCase, &best, &bestTime);
+
+    //the sums of the recursion wrap like the kernel only for integers, and do not fit in a narrow W
+    bool exact = !narrowW && elementType != typeFloat && elementType != typeDouble;
+    for(int c = 0; exact && c < countOf(crossovers) && crossovers[c] < size; c++){
+        options = best;
+        options.crossover = crossovers[c];
+        double time = timeTrial(tuneCase, &options, trialMultiply);
+        if(time >= 0 && time < bestTime){
+            bestTime = time;
+            best = options;
+        }
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->size = size;
+    snprintf(entry->kernel, sizeof(entry->kernel), "%s", best.kernel->name);
+    entry->threads = best.threads;
+    entry->blockRows = best.blockRows;
+    entry->tiles = best.tiles;
+    entry->crossover = best.crossover;
+    entry->seconds = bestTime;
+
+    //matrixmult_parallel computes Strassen in process, otherwise it may fork its rows
+    if(best.crossover == 0){
+        options = best;
+        options.threads = 1;
+        options.blockRows = 0;
+        double time = timeTrial(tuneCase, &options, trialForked);
+        entry->forkRows = time >= 0 && time < bestTime;
+    }
+    if(exact){
+        double unfused = timeTrial(tuneCase, &best, trialUnfused);
+        double fused = timeTrial(tuneCase, &best, trialFused);
+        entry->fused = fused >= 0 && fused < unfused;
+    }
+}
+
+/**
+ * This function makes the operands of one size, of values from 0 to 9.
+ * Input parameters: tuneCase (to fill in), size, repeats
+ * Returns: nothing
+**/
+void makeCase(struct tuneCase *tuneCase, int size, int repeats){
+    size_t count = (size_t)size * size;
+    uint64_t seed = 149 + size;
+    tuneCase->size = size;
+    tuneCase->repeats = repeats;
+    tuneCase->a = malloc(count * sizeof(element));
+    tuneCase->result = malloc(count * sizeof(element));
+    tuneCase->rsum = malloc(count * sizeof(element));
+    tuneCase->wsum = malloc(count * sizeof(element));
+    for(int i = 0; i < layerWs; i++){
+        tuneCase->w[i] = malloc(count * sizeof(wElement));
+        if(tuneCase->w[i] == NULL){
+            perror("malloc");
+            exit(1);
+        }
+        for(size_t j = 0; j < count; j++){
+            tuneCase->w[i][j] = (wElement)nextValue(&seed);
+        }
+    }
+    if(tuneCase->a == NULL || tuneCase->result == NULL || tuneCase->rsum == NULL || tuneCase->wsum == NULL){
+        perror("malloc");
+        exit(1);
+    }
+    for(size_t j = 0; j < count; j++){
+        tuneCase->a[j] = (element)nextValue(&seed);
+    }
+}
+
+/**
+ * This function frees the operands of one size.
+ * Input parameters: tuneCase
+ * Returns: nothing
+**/
+void freeCase(struct tuneCase *tuneCase){
+    free(tuneCase->a);
+    free(tuneCase->result);
+    free(tuneCase->rsum);
+    free(tuneCase->wsum);
+    for(int i = 0; i < layerWs; i++){
+        free(tuneCase->w[i]);
+    }
+}
+
+/**
+ * The shapes of the operands of --check: A is rows x inner and W inner x cols, padded with 0s to the largest of them
+ * like matrixmult_multiw_deep pads its matrices.
+ */
+static const int checkShapes[][3] = {{1, 1, 1}, {3, 5, 7}, {17, 33, 9}, {70, 45, 101}, {129, 257, 63}, {200, 150, 211}};
+static const struct matmulTiles checkTiles[] = {{0, 0, 0}, {7, 5, 13}, {64, 16, 40}};
+static const int checkThreads[] = {1, 3};
+
+/**
+ * This function returns a random value that uses the whole range of a type for the integers (so the sums wrap), and
+ * a small integer for float and double (so every sum is exact whatever its order).
+ * Input parameters: state, bits (of the type)
+ * Returns: the value
+**/
+long long checkValue(uint64_t *state, int bits){
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    if(elementType == typeFloat || elementType == typeDouble){
+        return (long long)(*state >> 33) % 19 - 9;
+    }
+    return (long long)(*state >> (64 - bits)) - (bits == 64 ? 0 : 1LL << (bits - 1));
+}
+
+/**
+ * This function multiplies with the options and compares the result with the reference.
+ * Input parameters: options, a, w, reference, result, label (of the case, for the report)
+ * Returns: true if every element is the same
+**/
+bool checkCase(const struct matmulOptions *options, const element *a, const wElement *w, const element *reference,
+               element *result, const char *label){
+    struct matmulPlan plan;
+    if(matmulPlanInit(&plan, options) == -1){
+        printf("FAIL %s: the plan cannot be made\n", label);
+        return false;
+    }
+    int size = options->size;
+    memset(result, 0x5a, (size_t)size * size * sizeof(element));
+    matmulExecute(&plan, a, w, result);
+    matmulPlanFree(&plan);
+    for(size_t i = 0; i < (size_t)size * size; i++){
+        if(memcmp(&result[i], &reference[i], sizeof(element)) != 0){
+            printf("FAIL %s: R[%zu][%zu] differs from the scalar kernel\n", label, i / size, i % size);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * This function checks every kernel this CPU supports against the scalar kernel: for every shape, with every tile
+ * size and thread count, dense and with the sparse kernels, classical and with the Strassen recursion at the lowest
+ * crossover.
+ * Input parameters: none
+ * Returns: the number of cases that failed
+**/
+int checkKernels(void){
+    int cases = 0, failed = 0;
+    uint64_t seed = 2024;
+    for(int s = 0; s < countOf(checkShapes); s++){
+        int rows = checkShapes[s][0], inner = checkShapes[s][1], cols = checkShapes[s][2];
+        int size = rows > inner ? rows : inner;
+        size = size > cols ? size : cols;
+        size_t count = (size_t)size * size;
+        element *a = calloc(count, sizeof(element));
+        wElement *w = calloc(count, sizeof(wElement));
+        element *reference = malloc(count * sizeof(element));
+        element *result = malloc(count * sizeof(element));
+        if(a == NULL || w == NULL || reference == NULL || result == NULL){
+            perror("malloc");
+            exit(1);
+        }
+        //every third row of A is 0s, so the sparse kernels skip rows too
+        for(int i = 0; i < rows; i++){
+            for(int k = 0; i % 3 != 2 && k < inner; k++){
+                a[(size_t)i * size + k] = (element)checkValue(&seed, 8 * sizeof(element));
+            }
+        }
+        for(int k = 0; k < inner; k++){
+            for(int j = 0; j < cols; j++){
+                w[(size_t)k * size + j] = (wElement)checkValue(&seed, 8 * sizeof(wElement));
+            }
+        }
+
+        struct matmulOptions options;
+        matmulDefaults(&options, size);
+        options.kernel = matmulFindKernel("scalar");
+        options.sparse = 0;
+        struct matmulPlan plan;
+        if(matmulPlanInit(&plan, &options) == -1){
+            perror("matmulPlanInit");
+            exit(1);
+        }
+        matmulExecute(&plan, a, w, reference);
+        matmulPlanFree(&plan);
+
+        for(int k = 0; k < countOf(kernelNames); k++){
+            options.kernel = matmulFindKernel(kernelNames[k]);
+            for(int c = 0; options.kernel != NULL && c < countOf(checkTiles) * countOf(checkThreads) * 4; c++){
+                options.tiles = checkTiles[c % countOf(checkTiles)];
+                options.threads = checkThreads[c / countOf(checkTiles) % countOf(checkThreads)];
+                options.sparse = c / (countOf(checkTiles) * countOf(checkThreads)) % 2 ? 100 : 0;
+                options.crossover = c / (countOf(checkTiles) * countOf(checkThreads) * 2) ? matmulMinCrossover : 0;
+                char label[128];
+                snprintf(label, sizeof(label), "%dx%d * %dx%d, %s, tiles %dx%dx%d, %d thread%s, %s, %s", rows, inner,
+                         inner, cols, kernelNames[k], options.tiles.rows, options.tiles.cols, options.tiles.depth,
+                         options.threads, options.threads > 1 ? "s" : "", options.sparse ? "sparse" : "dense",
+                         options.crossover ? "Strassen" : "classical");
+                cases++;
+                failed += !checkCase(&options, a, w, reference, result, label);
+            }
+        }
+        free(a);
+        free(w);
+        free(reference);
+        free(result);
+    }
+    printf("check (%s): %d cases, %d failed\n", typeName(narrowW ? wElementType : elementType), cases, failed);
+    return failed;
+}
+
+/**
+ * This function tunes every size and saves the fastest configurations in the profile of this host, keeping the
+ * entries of the sizes it did not tune.
+ * Input parameters: argc, argv
+ * Returns: 0 if successful, 1 if the options are wrong, the profile cannot be written or a check failed
+**/
+int main(int argc, char* argv[]) {
+    static struct option options[] = {
+        {"sizes", required_argument, NULL, 'n'},
+        {"threads", required_argument, NULL, 't'},
+        {"blocks", required_argument, NULL, 'b'},
+        {"repeats", required_argument, NULL, 'r'},
+        {"profile", required_argument, NULL, 'p'},
+        {"dry-run", no_argument, NULL, 'd'},
+        {"check", no_argument, NULL, 'c'},
+        {NULL, 0, NULL, 0}
+    };
+    struct grid sizes = {{256, 512}, 2};
+    struct grid blocks = {{8, 16, 32, 64}, 4};
+    struct grid threads = {{1}, 1};
+    //1, 2, 4, ... and every core
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for(int t = 2; t < cores && threads.count < maxGrid - 1; t *= 2){
+        threads.values[threads.count++] = t;
+    }
+    if(cores > 1){
+        threads.values[threads.count++] = cores;
+    }
+    int repeats = defaultRepeats;
+    char path[pathLength] = "";
+    bool dryRun = false;
+    int option;
+    bool valid = true;
+    while((option = getopt_long(argc, argv, "", options, NULL)) != -1){
+        if(option == 'n'){
+            valid = parseGrid(optarg, &sizes) == 0;
+        }else if(option == 't'){
+            valid = parseGrid(optarg, &threads) == 0;
+        }else if(option == 'b'){
+            valid = parseGrid(optarg, &blocks) == 0;
+        }else if(option == 'r'){
+            repeats = atoi(optarg);
+            valid = repeats > 0;
+        }else if(option == 'p'){
+            snprintf(path, sizeof(path), "%s", optarg);
+        }else if(option == 'd'){
+            dryRun = true;
+        }else if(option == 'c'){
+            return checkKernels() == 0 ? 0 : 1;
+        }else{
+            valid = false;
+        }
+        if(!valid){
+            fprintf(stderr, "Usage: %s [--sizes N,N,...] [--threads N,N,...] [--blocks N,N,...] [--repeats N]\n"
+                            "       [--profile FILE] [--dry-run] [--check]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if(path[0] == '\0' && !dryRun && tuneProfilePath(path, sizeof(path)) == -1){
+        fprintf(stderr, "Error - no profile to write: set HOME, MATRIXMULT_TUNE or --profile.\n");
+        exit(1);
+    }
+
+    //the entries of the other sizes are kept
+    struct tuneProfile profile;
+    if(dryRun || tuneLoad(path, &profile) == -1){
+        tuneStart(&profile);
+    }
+    for(int s = 0; s < sizes.count; s++){
+        struct tuneCase tuneCase;
+        struct tuneEntry entry;
+        makeCase(&tuneCase, sizes.values[s], repeats);
+        tuneSize(&tuneCase, &threads, &blocks, &entry);
+        freeCase(&tuneCase);
+        tuneSet(&profile, &entry);
+
+        char block[32] = "default blocks";
+        if(entry.blockRows > 0){
+            snprintf(block, sizeof(block), "blocks of %d rows", entry.blockRows);
+        }
+        char strassen[32] = "classical";
+        if(entry.crossover > 0){
+            snprintf(strassen, sizeof(strassen), "Strassen crossover %d", entry.crossover);
+        }
+        double gflops = 2.0 * entry.size * entry.size * entry.size / entry.seconds / 1e9;
+        printf("size %d: kernel %s, tiles %dx%dx%d, %d thread%s, %s, %s, %s rows, %s: %.6f s (%.2f GFLOP/s)\n",
+               entry.size, entry.kernel, entry.tiles.rows, entry.tiles.cols, entry.tiles.depth, entry.threads,
+               entry.threads > 1 ? "s" : "", block, strassen, entry.forkRows ? "forked" : "in-process",
+               entry.fused ? "fused" : "unfused", entry.seconds, gflops);
+        fflush(stdout);
+    }
+    if(!dryRun){
+        if(tuneSave(path, &profile) == -1){
+            perror(path);
+            exit(1);
+        }
+        printf("Profile of %s (%s) written to %s\n", profile.host, profile.type, path);
+    }
+    return 0;
+}
@@ -0,0 +1,361 @@
+/**
+ * Description: a small work-stealing thread engine (see task_pool.h).
+ * The tasks are coarse (a band of rows of a multiply), so each deque is protected by its own mutex: the owner and
+ * a thief only contend on the same deque when one is nearly empty.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "matrix_affinity.h"
+#include "task_pool.h"
+
+/**
+ * The tasks of one thread: front..back-1 are left. The owner takes from the back, thieves from the front.
+ */
+struct taskDeque {
+    pthread_mutex_t lock;
+    int front;
+    int back;
+};
+
+/**
+ * What the threads of one runTasks call share.
+ */
+struct taskPool {
+    struct taskDeque *deques;
+    int threads;
+    taskFunction run;
+    void *context;
+    const struct affinity *placement;   //where the threads run, NULL to leave it to the scheduler
+};
+
+/**
+ * One thread: its pool and its deque, and the threads it belongs to if they are kept between jobs.
+ */
+struct taskThread {
+    struct taskPool *pool;
+    int index;
+    struct taskWorkers *workers;
+};
+
+/**
+ * Threads kept from job to job (see taskWorkersStart). A job is announced by a new generation; the threads run it
+ * like the threads of runTasks and the last one to finish wakes the caller.
+ */
+struct taskWorkers {
+    struct taskPool pool;
+    struct taskThread *members;
+    pthread_t *ids;
+    int started;                //threads created, besides the caller
+    pid_t owner;                //process that created them, a forked child has none
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        //a new job or stop
+    pthread_cond_t done;        //busy reached 0
+    long generation;
+    int busy;                   //threads still running the current job
+    bool stop;
+};
+
+/**
+ * This function returns the number of cores available to this process.
+ * Input parameters: none
+ * Returns: the number of CPUs this process may run on (a pinned worker gets its own), or of online CPUs if that is
+ * not known, at least 1
+**/
+int availableCores(void){
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0){
+        return CPU_COUNT(&allowed);
+    }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+/**
+ * This function takes the last task of the thread's own deque.
+ * Input parameters: deque
+ * Returns: the task, or -1 if the deque is empty
+**/
+static int popTask(struct taskDeque *deque){
+    int task = -1;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->front < deque->back){
+        task = --deque->back;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/**
+ * This function steals the first task of another thread's deque.
+ * Input parameters: deque
+ * Returns: the task, or -1 if the deque is empty
+**/
+static int stealTask(struct taskDeque *deque){
+    int task = -1;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->front < deque->back){
+        task = deque->front++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/**
+ * This function runs the tasks of one thread, then steals from the others (starting with its neighbor) until every
+ * deque is empty. No task creates new tasks, so a thread that finds all deques empty is done.
+ * Input parameters: pool, index (of the thread)
+ * Returns: nothing
+**/
+static void runThreadTasks(struct taskPool *pool, int index){
+    int task;
+    while((task = popTask(&pool->deques[index])) != -1){
+        pool->run(pool->context, task, index);
+    }
+    for(int offset = 1; offset < pool->threads; offset++){
+        struct taskDeque *victim = &pool->deques[(index + offset) % pool->threads];
+        while((task = stealTask(victim)) != -1){
+            pool->run(pool->context, task, index);
+        }
+    }
+}
+
+/**
+ * This function is a thread of runTasks: it is pinned to its slot, then runs its tasks (see runThreadTasks).
+ * Input parameters: argument (struct taskThread)
+ * Returns: NULL
+**/
+static void *taskThreadMain(void *argument){
+    struct taskThread *self = argument;
+    if(self->pool->placement != NULL){
+        affinityPin(self->pool->placement, self->index);
+    }
+    runThreadTasks(self->pool, self->index);
+    return NULL;
+}
+
+/**
+ * This function is a thread kept by taskWorkersStart: it is pinned to its slot once, then runs the tasks of each job
+ * until the threads are stopped.
+ * Input parameters: argument (struct taskThread)
+ * Returns: NULL
+**/
+static void *taskWorkerMain(void *argument){
+    struct taskThread *self = argument;
+    struct taskWorkers *workers = self->workers;
+    if(workers->pool.placement != NULL){
+        affinityPin(workers->pool.placement, self->index);
+    }
+    long seen = 0;
+    pthread_mutex_lock(&workers->lock);
+    while(true){
+        while(!workers->stop && workers->generation == seen){
+            pthread_cond_wait(&workers->wake, &workers->lock);
+        }
+        if(workers->stop){
+            break;
+        }
+        seen = workers->generation;
+        pthread_mutex_unlock(&workers->lock);
+        runThreadTasks(&workers->pool, self->index);
+        pthread_mutex_lock(&workers->lock);
+        if(--workers->busy == 0){
+            pthread_cond_signal(&workers->done);
+        }
+    }
+    pthread_mutex_unlock(&workers->lock);
+    return NULL;
+}
+
+/**
+ * This function splits tasks 0..taskCount-1 between the deques of a pool, a contiguous share per thread.
+ * Input parameters: pool, taskCount
+ * Returns: nothing
+**/
+static void shareTasks(struct taskPool *pool, int taskCount){
+    for(int t = 0; t < pool->threads; t++){
+        pool->deques[t].front = (int)((long)taskCount * t / pool->threads);
+        pool->deques[t].back = (int)((long)taskCount * (t + 1) / pool->threads);
+    }
+}
+
+/**
+ * This function runs tasks 0..taskCount-1 on up to the given number of threads (the calling thread is one of them)
+ * and returns when all of them are done. Each thread starts with a contiguous share of the tasks. With a placement
+ * thread t is pinned to slot t of it (the calling thread is thread 0, and gets back its own CPUs before returning),
+ * so the rows a thread computes first are also first touched on its node.
+ * Input parameters: threads, taskCount, run (called with context, a task number and the thread), context, placement
+ * (or NULL)
+ * Returns: 0 if successful, -1 if some threads could not be created (their tasks were run by the others)
+**/
+int runTasks(int threads, int taskCount, taskFunction run, void *context, const struct affinity *placement){
+    if(threads > taskCount){
+        threads = taskCount;
+    }
+    if(threads < 1){
+        threads = 1;
+    }
+
+    struct taskDeque deques[threads];
+    struct taskThread members[threads];
+    pthread_t ids[threads];
+    struct taskPool pool = {deques, threads, run, context, placement};
+    for(int t = 0; t < threads; t++){
+        pthread_mutex_init(&deques[t].lock, NULL);
+        members[t].pool = &pool;
+        members[t].index = t;
+        members[t].workers = NULL;
+    }
+    shareTasks(&pool, taskCount);
+
+    //thread 0 is this thread; it steals from every deque before returning, so the tasks of a thread that could not
+    //be started are still run
+    int status = 0;
+    int started = 1;
+    for(; started < threads; started++){
+        if(pthread_create(&ids[started], NULL, taskThreadMain, &members[started]) != 0){
+            perror("pthread_create");
+            status = -1;
+            break;
+        }
+    }
+    //the calling thread is pinned only while it is thread 0, its own CPUs are restored after
+    cpu_set_t callerMask;
+    bool restore = placement != NULL && pthread_getaffinity_np(pthread_self(), sizeof(callerMask), &callerMask) == 0;
+    taskThreadMain(&members[0]);
+    for(int t = 1; t < started; t++){
+        pthread_join(ids[t], NULL);
+    }
+    if(restore){
+        pthread_setaffinity_np(pthread_self(), sizeof(callerMask), &callerMask);
+    }
+    for(int t = 0; t < threads; t++){
+        pthread_mutex_destroy(&deques[t].lock);
+    }
+    return status;
+}
+
+/**
+ * This function starts threads that are kept to run many jobs (see runTasksOn), so a job does not create and join
+ * its threads. The calling thread of a job is thread 0, so threads - 1 threads are started; with a placement thread
+ * t is pinned to slot t once, when it starts.
+ * Input parameters: threads, placement (or NULL)
+ * Returns: the threads, to stop with taskWorkersStop; NULL if they cannot be allocated
+**/
+struct taskWorkers *taskWorkersStart(int threads, const struct affinity *placement){
+    threads = threads > 1 ? threads : 1;
+    struct taskWorkers *workers = calloc(1, sizeof(struct taskWorkers));
+    if(workers == NULL){
+        return NULL;
+    }
+    workers->pool.deques = calloc(threads, sizeof(struct taskDeque));
+    workers->members = calloc(threads, sizeof(struct taskThread));
+    workers->ids = calloc(threads, sizeof(pthread_t));
+    if(workers->pool.deques == NULL || workers->members == NULL || workers->ids == NULL){
+        free(workers->pool.deques);
+        free(workers->members);
+        free(workers->ids);
+        free(workers);
+        return NULL;
+    }
+    workers->pool.threads = threads;
+    workers->pool.placement = placement;
+    workers->owner = getpid();
+    pthread_mutex_init(&workers->lock, NULL);
+    pthread_cond_init(&workers->wake, NULL);
+    pthread_cond_init(&workers->done, NULL);
+    for(int t = 0; t < threads; t++){
+        pthread_mutex_init(&workers->pool.deques[t].lock, NULL);
+        workers->members[t].pool = &workers->pool;
+        workers->members[t].index = t;
+        workers->members[t].workers = workers;
+    }
+    //a thread that cannot be started leaves its deque to the others, like in runTasks
+    for(int t = 1; t < threads; t++){
+        if(pthread_create(&workers->ids[t], NULL, taskWorkerMain, &workers->members[t]) != 0){
+            perror("pthread_create");
+            break;
+        }
+        workers->started++;
+    }
+    return workers;
+}
+
+/**
+ * This function runs tasks 0..taskCount-1 on threads started by taskWorkersStart, the calling thread being thread
+ * 0, and returns when all of them are done. Only one job runs on the threads at a time. In a child forked after
+ * the threads were started (it has none of them), the job is run by runTasks.
+ * Input parameters: workers, taskCount, run (called with context, a task number and the thread), context
+ * Returns: 0 if successful, -1 if some threads could not be created (their tasks were run by the others)
+**/
+int runTasksOn(struct taskWorkers *workers, int taskCount, taskFunction run, void *context){
+    struct taskPool *pool = &workers->pool;
+    if(workers->owner != getpid()){
+        return runTasks(pool->threads, taskCount, run, context, pool->placement);
+    }
+    pool->run = run;
+    pool->context = context;
+    shareTasks(pool, taskCount);
+    pthread_mutex_lock(&workers->lock);
+    workers->generation++;
+    workers->busy = workers->started;
+    pthread_cond_broadcast(&workers->wake);
+    pthread_mutex_unlock(&workers->lock);
+
+    //the calling thread is pinned only while it is thread 0, its own CPUs are restored after
+    cpu_set_t callerMask;
+    bool restore = pool->placement != NULL &&
+                   pthread_getaffinity_np(pthread_self(), sizeof(callerMask), &callerMask) == 0;
+    if(pool->placement != NULL){
+        affinityPin(pool->placement, 0);
+    }
+    runThreadTasks(pool, 0);
+    pthread_mutex_lock(&workers->lock);
+    while(workers->busy > 0){
+        pthread_cond_wait(&workers->done, &workers->lock);
+    }
+    pthread_mutex_unlock(&workers->lock);
+    if(restore){
+        pthread_setaffinity_np(pthread_self(), sizeof(callerMask), &callerMask);
+    }
+    return workers->started == pool->threads - 1 ? 0 : -1;
+}
+
+/**
+ * This function stops and frees the threads started by taskWorkersStart. A forked child only frees the memory.
+ * Input parameters: workers (or NULL)
+ * Returns: nothing
+**/
+void taskWorkersStop(struct taskWorkers *workers){
+    if(workers == NULL){
+        return;
+    }
+    if(workers->owner == getpid()){
+        pthread_mutex_lock(&workers->lock);
+        workers->stop = true;
+        pthread_cond_broadcast(&workers->wake);
+        pthread_mutex_unlock(&workers->lock);
+        for(int t = 1; t <= workers->started; t++){
+            pthread_join(workers->ids[t], NULL);
+        }
+        for(int t = 0; t < workers->pool.threads; t++){
+            pthread_mutex_destroy(&workers->pool.deques[t].lock);
+        }
+        pthread_mutex_destroy(&workers->lock);
+        pthread_cond_destroy(&workers->wake);
+        pthread_cond_destroy(&workers->done);
+    }
+    free(workers->pool.deques);
+    free(workers->members);
+    free(workers->ids);
+    free(workers);
+}
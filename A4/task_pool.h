@@ -0,0 +1,28 @@
+/**
+ * Description: a small work-stealing thread engine for libmatmul (see matmul.h). A job is split into numbered tasks
+ * (bands of rows); every thread starts with its own share of the tasks in a deque, takes them from the back, and
+ * steals from the front of the other deques when it runs out, so threads that finish early help the slow ones.
+ * With a placement (see matrix_affinity.h) thread t is pinned to slot t before it takes a task.
+ * runTasks starts and joins its threads for one job; threads started once with taskWorkersStart run many jobs with
+ * runTasksOn, without creating a thread per job.
+ *
+ * Author names: Luisa Arias Barajas and Alicia Zhao
+ * Author emails:luisa.ariasbarajas@sjsu.edu and alicia.zhao@sjsu.edu
+ **/
+
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+//thread is the index of the thread running the task, 0 to threads - 1 (0 is the calling thread)
+typedef void (*taskFunction)(void *context, int task, int thread);
+
+struct affinity;
+struct taskWorkers;
+
+int availableCores(void);
+int runTasks(int threads, int taskCount, taskFunction run, void *context, const struct affinity *placement);
+struct taskWorkers *taskWorkersStart(int threads, const struct affinity *placement);
+int runTasksOn(struct taskWorkers *workers, int taskCount, taskFunction run, void *context);
+void taskWorkersStop(struct taskWorkers *workers);
+
+#endif